@@ -1,14 +1,17 @@
 ﻿#include "DiskClient.h"
 #include "UdTool.h"
+#include "BatchTool.h"
 #include "TProgress.h"
 #include "UserInfoWidget.h"
 #include "Login.h"
 #include "DownTool.h"
+#include "MultiDownTool.h"
 #include "Serializer.h"
 #include "BufferPool.h"
 #include <QThread>
 #include <QFileDialog>
 #include <QDebug>
+#include <QDateTime>
 
 DiskClient::DiskClient(QWidget *parent)
     : QWidget(parent)
@@ -22,6 +25,10 @@ DiskClient::DiskClient(QWidget *parent)
 }
 
 DiskClient::~DiskClient() {
+    // 之后创建的传输工具不再使用短任务连接
+    if (mux_) {
+        MuxSession::unbind(cur_server_ip_.toStdString(), cur_l_port_);
+    }
     // 停止异步操作
     if (sr_tool_) {
         sr_tool_->SR_stop();
@@ -215,6 +222,16 @@ void DiskClient::initSignals() {
     // 删除文件成功信号
     connect(task_manager_.get(), &ShortTaskManager::delFileOK,
             this, &DiskClient::requestCD);
+    // 批量删除、移动完成后刷新文件列表（批量创建的文件夹通过 createDirOK 逐个加入视图），有条目失败时提示
+    connect(task_manager_.get(), &ShortTaskManager::batchOpOK,
+            this, [this](quint32 code, quint32 succeeded, quint32 failed) {
+        if (code != Code::BATCH_MAKEDIR && succeeded > 0) {
+            requestCD();
+        }
+        if (failed > 0) {
+            handleError(QString("%1 个文件操作失败").arg(failed));
+        }
+    });
     // 错误信号
     connect(task_manager_.get(), &ShortTaskManager::error,
             this, &DiskClient::handleError);
@@ -242,8 +259,11 @@ void DiskClient::initSignals() {
     connect(file_view_, &FileSystem::createDir,
             this, &DiskClient::handleCreateDir);
     // 删除文件信号
-    connect(file_view_, &FileSystem::deleteFile,
-            this, &DiskClient::handleDeleteFile);
+    connect(file_view_, &FileSystem::deleteFiles,
+            this, &DiskClient::handleDeleteFiles);
+    // 移动文件信号
+    connect(file_view_, &FileSystem::moveFiles,
+            this, &DiskClient::handleMoveFiles);
 }
 
 // 初始化客户端
@@ -306,6 +326,11 @@ bool DiskClient::connectMainServer() {
 
 void DiskClient::startRecvProtocol() {
     if (sr_tool_) {
+#if UseMuxTransfer
+        // 登录后，传输任务作为流在短任务连接上收发，上传下载工具按长任务端口创建 SR_Tool 时自动使用该会话
+        mux_ = std::make_shared<MuxSession>(sr_tool_);
+        MuxSession::bind(cur_server_ip_.toStdString(), cur_l_port_, mux_);
+#endif
         sr_tool_->asyncRecvProtocol(true);
         sr_tool_->SR_run();
         qDebug() << "start async loop";
@@ -339,6 +364,15 @@ void DiskClient::handleWidgetChaned() {
 void DiskClient::handleGetsClicked(ItemDate item) {
     uint64_t file_id = item.id;
 
+    // 文件夹使用多文件下载，在一个连接上下载文件夹中的所有文件，保存到所选目录下的同名文件夹中
+    if (item.file_type == "d") {
+        QString dir_path = QFileDialog::getExistingDirectory(this, "选择保存的目录", QDir::homePath());
+        if (!dir_path.isEmpty()) {
+            startMultiDownload({ file_id }, dir_path, item.file_name);
+        }
+        return;
+    }
+
     // 用于QFileDialog的过滤：filter = "文件类型(*.${拓展名})"
     QString filter ="文件类型(*"+ item.file_name.right(item.file_name.size() - item.file_name.lastIndexOf("."))+")";
 
@@ -353,12 +387,12 @@ void DiskClient::handleGetsClicked(ItemDate item) {
     TranPdu pdu;
     pdu.header.type = ProtocolType::TRANPDU_TYPE;
     pdu.header.body_len = TRANPDU_BODY_LEN;
+    pdu.header.version = PROTOCOL_VERSION_V2;
     pdu.tran_pdu_code = Code::GETS;
     // 这里用parent_dir_id字段保存file_id，注意在服务端识别
     pdu.parent_dir_id = file_id;
-    memcpy(pdu.user, user_info_->user, sizeof(pdu.user));
-    memcpy(pdu.pwd, user_info_->pwd, sizeof(pdu.pwd));
-    QByteArray file_name = QFileInfo(file_path).fileName().toUtf8();
+    setTranAuth(pdu);
+    QByteArray file_name = QFileInfo(file_path).fileName().toUtf8().left(sizeof(pdu.file_name) - 1);
     memcpy(pdu.file_name, file_name.data(), file_name.size());
     pdu.file_name[file_name.size()] = '\0';
 
@@ -374,6 +408,10 @@ void DiskClient::handleGetsClicked(ItemDate item) {
     // !!!!!!!!!!!!!!!!!!!!!!!! 疑问：能确保thread和worker的资源什么情况下都会被销毁吗 !!!!!!!!!!!!!!!!!!
     QThread* thread = new QThread();
     DownTool* worker = new DownTool(cur_server_ip_, cur_l_port_, pdu, file_path, nullptr);  // 创建下载工具
+    // 会话令牌被服务端拒绝时改用密码重新请求，之后的传输不再使用该令牌（重新登录时获得新的令牌）
+    worker->setAuthPwd(user_info_->pwd);
+    QObject::connect(worker, &DownTool::tokenRejected,
+                     this, [this]() { user_info_->token_expire = 0; });
 
     // 连接信号
     // worker完成时，删除worker，并关闭线程
@@ -422,38 +460,68 @@ void DiskClient::handleGetsClicked(ItemDate item) {
 void DiskClient::handlePutsClicked() {
     // 获取当前目录id（上传文件到当前目录）
     uint64_t parent_id = file_view_->getCurDirId();
-    // 创建一个对话框打开文件，获取要上传文件的路径
-    QString file_path = QFileDialog::getOpenFileName(this, "选择文件", QDir::homePath(), "所有文件(*.*)");
-    if (file_path.isEmpty()) {
+    // 创建一个对话框打开文件，获取要上传文件的路径（可以多选）
+    QStringList file_paths = QFileDialog::getOpenFileNames(this, "选择文件", QDir::homePath(), "所有文件(*.*)");
+    if (file_paths.isEmpty()) {
         return;
     }
 
-    // 判断所选文件是否合法
-    // 对文件长度进行判断，服务端不接受太长的文件名
-    QFileInfo file_info(file_path);
-    // !!!!!!!!!!!!!!!!!!!!!!! 这里直接使用 100，不利于维护和更新，后续可使用宏 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-    if (file_info.fileName().toUtf8().size() >= 100) {
-        QMessageBox::warning(this, "警告", "文件名过长");
-        return;
+    // 小文件合并为一个批量上传任务，在一个连接上完成，其余文件每个单独上传
+    QStringList small_paths;
+    for (const QString& file_path : file_paths) {
+        // 判断所选文件是否合法
+        // 对文件长度进行判断，服务端不接受太长的文件名
+        QFileInfo file_info(file_path);
+        if (file_info.fileName().toUtf8().size() >= MAX_FILE_NAME_LEN) {
+            QMessageBox::warning(this, "警告", "文件名过长：" + file_info.fileName());
+            continue;
+        }
+
+        // 以 d 结尾的服务端默认为文件夹，所有不接受
+        QString suffix = file_info.suffix();
+        if (suffix == "d") {
+            QMessageBox::warning(this, "提示", "后缀名不能为d：" + file_info.fileName());
+            continue;
+        }
+
+        if (file_info.size() <= MAX_BATCH_FILE_SIZE) {
+            small_paths.append(file_path);
+        }
+        else {
+            startUpload(parent_id, file_path);
+        }
     }
 
-    // 以 d 结尾的服务端默认为文件夹，所有不接受
-    QString suffix = file_info.suffix();
-    if (suffix == "d") {
-        QMessageBox::warning(this, "提示", "后缀名不能为d");
-        return;
+    // 只有一个小文件时按普通上传处理（可以断点续传）
+    if (small_paths.size() == 1) {
+        startUpload(parent_id, small_paths.front());
     }
+    else {
+        for (qsizetype i = 0; i < small_paths.size(); i += MAX_BATCH_FILES) {
+            startBatchUpload(parent_id, small_paths.mid(i, MAX_BATCH_FILES));
+        }
+    }
+    show_widget_sw_->setCurrentIndex(1);  // 切换到文件传输页面
+}
 
+// 上传一个文件
+void DiskClient::startUpload(uint64_t parent_id, const QString& file_path) {
     QByteArray file_path_bytes = file_path.toUtf8();
+    // pdu.file_name 先保存文件路径，由 UdTool 打开文件后换成文件名
+    if (file_path_bytes.size() >= MAX_FILE_NAME_LEN) {
+        QMessageBox::warning(this, "警告", "文件路径过长：" + file_path);
+        return;
+    }
 
     // 构建通信pdu
     TranPdu pdu;
     pdu.header.type = ProtocolType::TRANPDU_TYPE;
     pdu.header.body_len = TRANPDU_BODY_LEN;
-    pdu.tran_pdu_code = Code::PUTS;
+    pdu.header.version = PROTOCOL_VERSION_V2;
+    // 总是请求断点续传，服务端没有上传记录时会回复 PUT_CONTINUE_FAILED，客户端从头上传
+    pdu.tran_pdu_code = Code::PUTSCONTINUE;
     pdu.parent_dir_id = parent_id;
-    memcpy(pdu.user, user_info_->user, sizeof(pdu.user));
-    memcpy(pdu.pwd, user_info_->pwd, sizeof(pdu.pwd));
+    setTranAuth(pdu);
     memcpy(pdu.file_name, file_path_bytes.data(), file_path_bytes.size());
 
     // 构建进度条
@@ -466,6 +534,10 @@ void DiskClient::handlePutsClicked() {
     QThread* thread = new QThread();
     UdTool* worker = new UdTool(cur_server_ip_, cur_l_port_, nullptr);  // 创建上传工具
     worker->setTranPdu(pdu);    // 设置要上传文件的信息
+    // 会话令牌被服务端拒绝时改用密码重新请求，之后的传输不再使用该令牌（重新登录时获得新的令牌）
+    worker->setAuthPwd(user_info_->pwd);
+    QObject::connect(worker, &UdTool::tokenRejected,
+                     this, [this]() { user_info_->token_expire = 0; });
 
     // 连接信号
     // worker完成时，删除worker，并关闭线程
@@ -507,7 +579,129 @@ void DiskClient::handlePutsClicked() {
     // 启动线程
     worker->moveToThread(thread);
     thread->start();
-    show_widget_sw_->setCurrentIndex(1);  // 切换到文件传输页面
+}
+
+// 填写传输请求的认证信息：会话令牌未过期时使用令牌（服务端不查询数据库），否则使用密码
+// 在令牌到期前留出一段时间，避免请求在路上过期
+void DiskClient::setTranAuth(TranPdu& pdu) const {
+    memcpy(pdu.user, user_info_->user, sizeof(pdu.user));
+    if (user_info_->token_expire - 60 > QDateTime::currentSecsSinceEpoch()) {
+        memcpy(pdu.pwd, user_info_->token, sizeof(pdu.pwd));
+        pdu.header.reserved = AUTH_SESSION_TOKEN;
+    }
+    else {
+        memcpy(pdu.pwd, user_info_->pwd, sizeof(pdu.pwd));
+        pdu.header.reserved = 0;
+    }
+}
+
+// 批量上传多个小文件，所有文件共用一个连接和一个进度条
+void DiskClient::startBatchUpload(uint64_t parent_id, const QStringList& file_paths) {
+    TranPdu pdu;
+    pdu.header.type = ProtocolType::TRANPDU_TYPE;
+    pdu.header.body_len = TRANPDU_BODY_LEN;
+    pdu.header.version = PROTOCOL_VERSION_V2;
+    pdu.parent_dir_id = parent_id;
+    setTranAuth(pdu);
+
+    // 构建进度条
+    TProgress* progress = new TProgress(this);
+    progress->setFileName(1, QString("%1 等 %2 个文件").arg(QFileInfo(file_paths.front()).fileName()).arg(file_paths.size()));
+    file_trans_wd_->layout()->addWidget(progress);
+
+    QThread* thread = new QThread();
+    BatchTool* worker = new BatchTool(cur_server_ip_, cur_l_port_, nullptr);  // 创建批量上传工具
+    worker->setFiles(pdu, file_paths);
+    // 会话令牌被服务端拒绝时改用密码重新请求，之后的传输不再使用该令牌（重新登录时获得新的令牌）
+    worker->setAuthPwd(user_info_->pwd);
+    QObject::connect(worker, &BatchTool::tokenRejected,
+                     this, [this]() { user_info_->token_expire = 0; });
+
+    // 连接信号，与单个文件上传相同
+    QObject::connect(worker, &BatchTool::workFinished,
+                     thread, &QThread::quit);
+    QObject::connect(worker, &BatchTool::workFinished,
+                     worker, &BatchTool::deleteLater);
+    QObject::connect(worker, &BatchTool::error,
+                     thread, &QThread::quit);
+    QObject::connect(worker, &BatchTool::error,
+                     worker, &BatchTool::deleteLater);
+    QObject::connect(thread, &QThread::finished,
+                     thread, &QThread::deleteLater);
+    QObject::connect(thread, &QThread::started,
+                     worker, &BatchTool::doingUp);
+
+    QObject::connect(worker, &BatchTool::sendProgress,
+                     progress, &TProgress::handleUpdateProgress);
+    QObject::connect(worker, &BatchTool::workFinished,
+                     progress, &TProgress::handleFinished);
+    QObject::connect(progress, &TProgress::cancel,
+                     worker, &BatchTool::sendCancelRequest);
+    // 每个文件入库后添加文件项
+    QObject::connect(worker, &BatchTool::sendItemData,
+                     file_view_, &FileSystem::addNewFileItem);
+    QObject::connect(worker, &BatchTool::error,
+                     this, &DiskClient::handleError);
+
+    worker->setControlAtomic(progress->getAtomic(), progress->getCv(), progress->getMutex());
+
+    // 启动线程
+    worker->moveToThread(thread);
+    thread->start();
+}
+
+void DiskClient::startMultiDownload(const std::vector<uint64_t>& ids, const QString& dir_path, const QString& name) {
+    TranPdu pdu;
+    pdu.header.type = ProtocolType::TRANPDU_TYPE;
+    pdu.header.body_len = TRANPDU_BODY_LEN;
+    pdu.header.version = PROTOCOL_VERSION_V2;
+    setTranAuth(pdu);
+    QByteArray file_name = name.toUtf8().left(sizeof(pdu.file_name) - 1);
+    memcpy(pdu.file_name, file_name.data(), file_name.size());
+
+    // 构建进度条
+    TProgress* progress = new TProgress(this);
+    progress->setFileName(2, QDir(dir_path).filePath(name));    // 2 表示下载
+    file_trans_wd_->layout()->addWidget(progress);
+
+    QThread* thread = new QThread();
+    MultiDownTool* worker = new MultiDownTool(cur_server_ip_, cur_l_port_, pdu, ids, dir_path, nullptr);  // 创建多文件下载工具
+    // 会话令牌被服务端拒绝时改用密码重新请求，之后的传输不再使用该令牌（重新登录时获得新的令牌）
+    worker->setAuthPwd(user_info_->pwd);
+    QObject::connect(worker, &MultiDownTool::tokenRejected,
+                     this, [this]() { user_info_->token_expire = 0; });
+
+    // 连接信号，与单个文件下载相同
+    QObject::connect(worker, &MultiDownTool::workFinished,
+                     thread, &QThread::quit);
+    QObject::connect(worker, &MultiDownTool::workFinished,
+                     worker, &MultiDownTool::deleteLater);
+    QObject::connect(worker, &MultiDownTool::error,
+                     thread, &QThread::quit);
+    QObject::connect(worker, &MultiDownTool::error,
+                     worker, &MultiDownTool::deleteLater);
+    QObject::connect(thread, &QThread::finished,
+                     thread, &QThread::deleteLater);
+    QObject::connect(thread, &QThread::started,
+                     worker, &MultiDownTool::doingDown);
+
+    QObject::connect(worker, &MultiDownTool::sendProgress,
+                     progress, &TProgress::handleUpdateProgress);
+    QObject::connect(worker, &MultiDownTool::workFinished,
+                     progress, &TProgress::handleFinished);
+    QObject::connect(progress, &TProgress::pause,
+                     worker, &MultiDownTool::sendPauseRequest);
+    QObject::connect(progress, &TProgress::resume,
+                     worker, &MultiDownTool::sendResumeRequest);
+    QObject::connect(progress, &TProgress::cancel,
+                     worker, &MultiDownTool::sendCancelRequest);
+    QObject::connect(worker, &MultiDownTool::error,
+                     this, &DiskClient::handleError);
+
+    // 启动线程
+    worker->moveToThread(thread);
+    thread->start();
+    show_widget_sw_->setCurrentIndex(1);    // 设置当前页面为传输页面
 }
 
 // 处理 file_view_ 的 FileViewSystem::createDir 信号的槽函数
@@ -515,9 +709,14 @@ void DiskClient::handleCreateDir(uint64_t parent_id, QString new_dir_name) {
     task_manager_->makeDir(parent_id, new_dir_name);
 }
 
-// 处理 file_view_ 的 FileViewSystem::deleteFile 信号的槽函数
-void DiskClient::handleDeleteFile(uint64_t file_id, QString file_name) {
-    task_manager_->delFile(file_id, file_name);
+// 处理 file_view_ 的 FileViewSystem::deleteFiles 信号的槽函数，多选时按 MAX_BATCH_OP_ITEMS 分成多个批量请求
+void DiskClient::handleDeleteFiles(std::vector<uint64_t> file_ids) {
+    task_manager_->batchDelete(std::vector<quint64>(file_ids.begin(), file_ids.end()));
+}
+
+// 处理 file_view_ 的 FileViewSystem::moveFiles 信号的槽函数
+void DiskClient::handleMoveFiles(std::vector<uint64_t> file_ids, uint64_t target_dir_id) {
+    task_manager_->batchMove(std::vector<quint64>(file_ids.begin(), file_ids.end()), target_dir_id);
 }
 
 // 处理 user_info_pb_ 的 QPushButton::clicked 信号的槽函数
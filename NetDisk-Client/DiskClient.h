@@ -8,9 +8,11 @@
 #include <QLabel>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
+#include <vector>
 #include "SR_Tool.h"
 #include "TaskQue.h"
 #include "ShortTaskManager.h"
+#include "MuxSession.h"
 // #include "FileViewSystem.h"
 #include "FileSystem.h"
 #include "protocol.h"
@@ -30,6 +32,10 @@ private:
     void initClient();
     bool connectMainServer();
     void startRecvProtocol();   // 开始接收消息
+    void startUpload(std::uint64_t parent_id, const QString& file_path);             // 上传一个文件
+    void startBatchUpload(std::uint64_t parent_id, const QStringList& file_paths);    // 批量上传多个小文件
+    void startMultiDownload(const std::vector<std::uint64_t>& ids, const QString& dir_path, const QString& name);  // 多文件下载（文件夹下载）
+    void setTranAuth(TranPdu& pdu) const;    // 填写传输请求的用户名和认证信息（会话令牌或密码）
 
 private slots:
     // task_manager_信号的槽函数函数
@@ -41,7 +47,8 @@ private slots:
     void handleGetsClicked(ItemDate item);
     void handlePutsClicked();
     void handleCreateDir(std::uint64_t parent_id, QString new_dir_name);
-    void handleDeleteFile(std::uint64_t file_id, QString file_name);
+    void handleDeleteFiles(std::vector<std::uint64_t> file_ids);
+    void handleMoveFiles(std::vector<std::uint64_t> file_ids, std::uint64_t target_dir_id);
 
     void handleInfoPBClicked();
     void requestCD();
@@ -53,6 +60,7 @@ private:
     // 因此先声明task_manager_（析构顺序与声明顺序相反）
     std::shared_ptr<ShortTaskManager> task_manager_;// 短任务管理器
     std::shared_ptr<SR_Tool> sr_tool_;              // 发送和接受数据工具
+    std::shared_ptr<MuxSession> mux_;               // 传输任务的多路复用会话（UseMuxTransfer 为1时使用）
     std::shared_ptr<TaskQue> task_queue_;           // 任务队列
 
 
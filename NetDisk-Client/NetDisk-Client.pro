@@ -1,4 +1,4 @@
-QT       += core gui
+﻿QT       += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -28,11 +28,20 @@ CONFIG += c++20
 INCLUDEPATH += ToolClass
 INCLUDEPATH += WidgetClass
 INCLUDEPATH += BufferPool
+# 与服务端、负载均衡器共用的协议编解码
+INCLUDEPATH += ../NetDisk-Common
 
 SOURCES += \
     BufferPool/BufferPool.cpp \
     DiskClient.cpp \
+    ToolClass/BatchTool.cpp \
+    ToolClass/Chunker.cpp \
+    ToolClass/Compressor.cpp \
+    ToolClass/Crc32c.cpp \
+    ToolClass/Delta.cpp \
     ToolClass/DownTool.cpp \
+    ToolClass/MultiDownTool.cpp \
+    ToolClass/MuxSession.cpp \
     ToolClass/SR_Tool.cpp \
     ToolClass/Serializer.cpp \
     ToolClass/ShortTaskManager.cpp \
@@ -45,10 +54,19 @@ SOURCES += \
     main.cpp
 
 HEADERS += \
+    ../NetDisk-Common/FairMutex.h \
+    ../NetDisk-Common/WireFormat.h \
     BufferPool/BufferPool.h \
     DisallowCopyAndMove.h \
     DiskClient.h \
+    ToolClass/BatchTool.h \
+    ToolClass/Chunker.h \
+    ToolClass/Compressor.h \
+    ToolClass/Crc32c.h \
+    ToolClass/Delta.h \
     ToolClass/DownTool.h \
+    ToolClass/MultiDownTool.h \
+    ToolClass/MuxSession.h \
     ToolClass/SR_Tool.h \
     ToolClass/Serializer.h \
     ToolClass/ShortTaskManager.h \
@@ -0,0 +1,360 @@
+﻿#include "BatchTool.h"
+#include "SR_Tool.h"
+#include "Compressor.h"
+#include <openssl/sha.h>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+#include <algorithm>
+
+BatchTool::BatchTool(const QString& ip, const std::uint32_t& port, QObject *parent)
+    : QObject{parent}, sr_tool_(std::make_shared<SR_Tool>(ip.toStdString(), port, nullptr))
+{
+    initSignals();
+}
+
+BatchTool::~BatchTool() {
+    sr_tool_->SR_stop();    // 关闭异步任务
+
+    // 关闭连接
+    boost::system::error_code ec;
+    sr_tool_->getSSL()->shutdown(ec);
+    if (ec && ec != boost::asio::ssl::error::stream_truncated) {
+        qWarning() << "SSL 关闭错误：" << QString::fromLocal8Bit(ec.message());
+    }
+    // 无论SSL是否关闭，都关闭底层socket
+    sr_tool_->getSSL()->lowest_layer().close(ec);
+}
+
+void BatchTool::initSignals() {
+    connect(sr_tool_.get(), &SR_Tool::recvPDURespondOK,
+            this, &BatchTool::handleRecvPDURespond);
+}
+
+// 设置上传的文件
+void BatchTool::setFiles(const TranPdu& tran_pdu, const QStringList& file_paths) {
+    tran_pdu_ = tran_pdu;
+    tran_pdu_.tran_pdu_code = Code::PUTS_BATCH;
+    tran_pdu_.compress = Compressor::makeOffer();  // 请求压缩传输，由服务端决定是否开启
+    tran_pdu_.compress |= UPLOAD_CAP_CRC32C;       // 发送的清单和文件都带有校验和
+    memset(tran_pdu_.file_name, 0, sizeof(tran_pdu_.file_name));
+    memset(tran_pdu_.file_md5, 0, sizeof(tran_pdu_.file_md5));
+
+    files_.clear();
+    total_bytes_ = 0;
+    for (const QString& path : file_paths) {
+        QFileInfo file_info(path);
+        BatchFile file;
+        file.path = path;
+        file.name = file_info.fileName().toUtf8();
+        file.size = file_info.size();
+        total_bytes_ += file.size;
+        files_.push_back(std::move(file));
+    }
+    // file_size 为所有文件的总长度（服务端一次检查空间），sended_size 为文件数
+    tran_pdu_.file_size = total_bytes_;
+    tran_pdu_.sended_size = files_.size();
+}
+
+// 设置令牌被拒绝时使用的密码
+void BatchTool::setAuthPwd(const char *pwd) {
+    auth_pwd_.assign(pwd, strnlen(pwd, sizeof(TranPdu::pwd)));
+}
+
+// 设置传输控制对象
+void BatchTool::setControlAtomic(std::shared_ptr<std::atomic<std::uint32_t>> control,
+                                 std::shared_ptr<std::condition_variable> cv, std::shared_ptr<std::mutex> mutex)
+{
+    ctrl_ = control;
+    cv_ = cv;
+    mtx_ = mutex;
+}
+
+// 计算所有文件的哈希值，文件都不超过 MAX_BATCH_FILE_SIZE，一次读入
+bool BatchTool::calculateSHA256() {
+    unsigned char result[SHA256_DIGEST_LENGTH];
+    for (BatchFile& file : files_) {
+        QFile reader(file.path);
+        if (!reader.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        QByteArray data = reader.readAll();
+        if (static_cast<uint64_t>(data.size()) != file.size) {
+            return false;
+        }
+        SHA256(reinterpret_cast<const unsigned char*>(data.constData()), data.size(), result);
+        file.hash = QByteArray(reinterpret_cast<char*>(result), SHA256_DIGEST_LENGTH).toHex();
+    }
+    return true;
+}
+
+// 发送批量上传请求到服务端
+bool BatchTool::sendTranPdu() {
+    auto buf = Serializer::serialize(tran_pdu_);
+
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), Serializer::encodedLen(tran_pdu_), ec);
+    if (ec) {
+        emit error("BatchTool::sendTranPdu(): " + QString::fromStdString(ec.what()));
+        return false;
+    }
+    return true;
+}
+
+// 发送文件清单：每条为[文件长度(uint64), 文件哈希(64字节十六进制), 文件名长度(uint16), 文件名]
+bool BatchTool::sendList() {
+    size_t pages = (files_.size() + MAX_BATCH_LIST_PER_PAGE - 1) / MAX_BATCH_LIST_PER_PAGE;
+    for (size_t page = 0; page < pages; ++page) {
+        size_t begin = page * MAX_BATCH_LIST_PER_PAGE;
+        size_t end = std::min(files_.size(), begin + MAX_BATCH_LIST_PER_PAGE);
+
+        TranDataPdu pdu;
+        pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+        pdu.code = Code::PUTS_BATCH_LIST;
+        pdu.file_offset = begin;
+        pdu.total_chunks = pages;
+        pdu.chunk_index = page;
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t size = htonll(files_[i].size);
+            uint16_t name_len = htons(static_cast<uint16_t>(files_[i].name.size()));
+            pdu.data.append((char*)&size, sizeof(size));
+            pdu.data.append(files_[i].hash.constData(), BATCH_HASH_LEN);
+            pdu.data.append((char*)&name_len, sizeof(name_len));
+            pdu.data.append(files_[i].name.constData(), files_[i].name.size());
+        }
+        pdu.chunk_size = pdu.data.size();
+        pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+
+        auto buf = Serializer::serialize(pdu);
+        boost::system::error_code ec;
+        sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+        if (ec) {
+            emit error("batch upload: send file list error: " + QString::fromLocal8Bit(ec.message()));
+            return false;
+        }
+    }
+    qDebug() << "batch upload: files:" << files_.size() << "pages:" << pages;
+    return true;
+}
+
+// 发送服务端需要的文件，每个文件一个数据包，按协商的压缩方式压缩
+void BatchTool::sendFiles(const std::vector<uint32_t>& indexes) {
+    Compressor compressor(compress_);
+    std::string packed;
+    for (uint32_t index : indexes) {
+        if (!waitControl()) {
+            return;
+        }
+        BatchFile& file = files_[index];
+        QFile reader(file.path);
+        QByteArray data;
+        if (reader.open(QIODevice::ReadOnly)) {
+            data = reader.readAll();
+        }
+        if (static_cast<uint64_t>(data.size()) != file.size) {
+            // 文件在上传过程中被修改或删除，发送空数据，服务端校验失败后回复该文件失败
+            qDebug() << "batch upload: read file failed:" << file.path;
+            data.clear();
+        }
+
+        TranDataPdu pdu;
+        pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+        pdu.code = Code::PUTS_BATCH_DATA;
+        pdu.total_chunks = files_.size();
+        pdu.chunk_index = index;
+        pdu.status = compressor.compress(data.constData(), data.size(), packed);
+        // 直接引用读取的文件或压缩缓冲区，序列化时只复制一次
+        if (pdu.status != Compression::COMPRESS_NONE) {
+            pdu.view = packed;
+        }
+        else {
+            pdu.view = std::string_view(data.constData(), data.size());
+        }
+        pdu.chunk_size = pdu.view.size();
+        pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+
+        auto buf = Serializer::serialize(pdu);
+        boost::system::error_code ec;
+        sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+        if (ec) {
+            emit error("batch upload: send file error: " + QString::fromLocal8Bit(ec.message()));
+            return;
+        }
+    }
+    if (compressor.getCompressedChunks() > 0) {
+        qDebug() << "batch upload: sent" << compressor.getRawBytes() << "bytes," << compressor.getWireBytes() << "bytes on wire";
+    }
+}
+
+// 传输控制：为 1 则暂停等待，为 2 则结束传输
+bool BatchTool::waitControl() {
+    if (ctrl_ == nullptr) {
+        return true;
+    }
+    if (ctrl_->load() == 1) {
+        std::unique_lock<std::mutex> lock(*mtx_.get());
+        cv_->wait(lock, [ctrl = ctrl_] { return ctrl->load() != 1; });
+    }
+    return ctrl_->load() != 2;
+}
+
+void BatchTool::handleRecvPDURespond(std::shared_ptr<PDURespond> pdu) {
+    if (finished_) {
+        return;
+    }
+    switch (pdu->code) {
+        case Code::PUTS_BATCH: handlePutsBatchRespond(pdu); break;
+        case Code::PUTS_BATCH_LIST: handleBatchListRespond(pdu); break;
+        case Code::PUTS_BATCH_DATA: handleBatchDataRespond(pdu); break;
+    }
+}
+
+void BatchTool::handlePutsBatchRespond(std::shared_ptr<PDURespond> pdu) {
+    compress_ = pdu->header.reserved;  // 协商的压缩方式，0为不压缩
+    switch (pdu->status) {
+        case Status::SUCCESS: {
+            sendList();
+            break;
+        }
+        case Status::NOT_VERIFY: {
+            // 会话令牌被拒绝，在同一个连接上改用密码重新请求
+            if (!useTranPwd(tran_pdu_, auth_pwd_)) {
+                emit error("batch upload request error: not verify");
+            }
+            else if (sendTranPdu()) {
+                emit tokenRejected();
+            }
+            break;
+        }
+        case Status::NO_CAPACITY: {
+            emit error("batch upload request error: no capacity");
+            break;
+        }
+        default: {
+            emit error("batch upload request error");
+            break;
+        }
+    }
+}
+
+// 清单的回复：页序号(uint32) + 需要发送数据的文件序号(uint32)...，其余文件已经秒传，等待入库结果
+void BatchTool::handleBatchListRespond(std::shared_ptr<PDURespond> pdu) {
+    if (pdu->msg.size() < sizeof(uint32_t)) {
+        return;
+    }
+    uint32_t page = 0;
+    memcpy((char*)&page, pdu->msg.data(), sizeof(page));
+    page = ntohl(page);
+    if (Status::SUCCESS != pdu->status) {
+        // 整页清单被拒绝，服务端不会回复这一页文件的结果
+        size_t begin = (size_t)page * MAX_BATCH_LIST_PER_PAGE;
+        size_t end = std::min(files_.size(), begin + MAX_BATCH_LIST_PER_PAGE);
+        for (size_t i = begin; i < end; ++i) {
+            resolveFile(i, 0);
+        }
+        checkFinished();
+        return;
+    }
+
+    std::vector<uint32_t> indexes;
+    size_t count = (pdu->msg.size() - sizeof(uint32_t)) / sizeof(uint32_t);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t index = 0;
+        memcpy((char*)&index, pdu->msg.data() + sizeof(uint32_t) * (i + 1), sizeof(index));
+        index = ntohl(index);
+        if (index < files_.size() && !files_[index].resolved) {
+            indexes.push_back(index);
+        }
+    }
+    sendFiles(indexes);
+    checkFinished();
+}
+
+// 文件结果的回复：若干条[文件序号(uint32), 文件ID(uint64)]
+void BatchTool::handleBatchDataRespond(std::shared_ptr<PDURespond> pdu) {
+    const char* ptr = pdu->msg.data();
+    for (size_t left = pdu->msg.size(); left >= BATCH_RESULT_LEN; left -= BATCH_RESULT_LEN) {
+        uint32_t index = 0;
+        uint64_t file_id = 0;
+        memcpy((char*)&index, ptr, sizeof(index));
+        memcpy((char*)&file_id, ptr + sizeof(index), sizeof(file_id));
+        ptr += BATCH_RESULT_LEN;
+        resolveFile(ntohl(index), ntohll(file_id));
+    }
+    checkFinished();
+}
+
+void BatchTool::resolveFile(uint32_t index, uint64_t file_id) {
+    if (index >= files_.size() || files_[index].resolved) {
+        return;
+    }
+    BatchFile& file = files_[index];
+    file.resolved = true;
+    ++resolved_count_;
+    resolved_bytes_ += file.size;
+    if (file_id == 0) {
+        ++failed_count_;
+        qDebug() << "batch upload: file failed:" << file.path;
+    }
+    else {
+        // 在文件视图系统中添加文件项
+        TranPdu item = tran_pdu_;
+        memset(item.file_name, 0, sizeof(item.file_name));
+        memcpy(item.file_name, file.name.constData(), file.name.size());
+        item.file_size = file.size;
+        emit sendItemData(item, file_id);
+    }
+
+    // 如果达到更新条件在更新，避免一直更新卡顿UI
+    double cur_progress = total_bytes_ == 0 ? 1 : static_cast<double>(resolved_bytes_) / total_bytes_;
+    if (cur_progress - last_progress_ >= progress_step_) {
+        last_progress_ = cur_progress;
+        emit sendProgress(resolved_bytes_, total_bytes_);
+    }
+}
+
+void BatchTool::checkFinished() {
+    if (finished_ || resolved_count_ < files_.size()) {
+        return;
+    }
+    finished_ = true;
+    qDebug() << "batch upload: finished, files:" << files_.size() << "failed:" << failed_count_;
+    if (failed_count_ > 0) {
+        emit error(QString("batch upload: %1 of %2 files failed").arg(failed_count_).arg(files_.size()));
+        return;
+    }
+    emit sendProgress(1, 1);    // 更新进度条
+    emit workFinished();        // 完成任务
+}
+
+// 开始执行任务槽函数，连接QThread的started信号
+void BatchTool::doingUp() {
+    if (files_.empty()) {
+        emit workFinished();
+        return;
+    }
+    // 连接服务器
+    boost::system::error_code ec;
+    sr_tool_->connect(ec);
+    if (ec) {
+        emit error("BatchTool::doingUp(): connect error" + QString::fromLocal8Bit(ec.message()));
+        return;
+    }
+    // 计算所有文件的哈希值
+    if (!calculateSHA256()) {
+        emit error("BatchTool::doingUp(): create hash error");
+        return;
+    }
+    // 发送批量上传请求
+    if (!sendTranPdu()) {
+        return;
+    }
+    qDebug() << "batch upload: start upload";
+    // 发送请求成功后，接收回复
+    sr_tool_->asyncRecvProtocol(true);  // 持续注册接收回复的异步事件
+    sr_tool_->SR_run(); // 在其它线程启动异步事件
+}
+
+void BatchTool::sendCancelRequest() {
+    emit workFinished();    // 发送完成信号，关闭连接和线程
+}
@@ -0,0 +1,98 @@
+﻿#ifndef BATCHTOOL_H
+#define BATCHTOOL_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "protocol.h"
+
+class SR_Tool;
+
+// 批量上传的一个小文件
+struct BatchFile {
+    QString path;           // 文件路径
+    QByteArray name;        // 文件名（不带路径，UTF-8）
+    uint64_t size{ 0 };     // 文件长度
+    QByteArray hash;        // 文件内容的 SHA-256（十六进制）
+    bool resolved{ false }; // 是否已经有结果
+};
+
+// 批量上传小文件（长任务）的类
+// 大量小文件每个单独上传时，连接、TLS握手和认证的开销远大于数据本身。批量上传在一个连接上认证一次，
+// 先发送所有文件的清单，服务端已有内容的文件直接秒传，其余文件每个作为一个数据包连续发送，服务端分组入库后回复每个文件的结果
+class BatchTool : public QObject {
+    Q_OBJECT
+
+public:
+    BatchTool(const QString& ip, const std::uint32_t& port, QObject *parent = nullptr);
+    ~BatchTool();
+
+private:
+    void initSignals();
+
+public:
+    // 设置要上传的文件，tran_pdu 提供用户名、密码和上传到的目录
+    void setFiles(const TranPdu& tran_pdu, const QStringList& file_paths);
+    // 设置密码，请求使用的会话令牌被服务端拒绝时改用密码重新请求
+    void setAuthPwd(const char *pwd);
+    // 设置传输控制变量
+    void setControlAtomic(std::shared_ptr<std::atomic<std::uint32_t>> control,
+                          std::shared_ptr<std::condition_variable> cv, std::shared_ptr<std::mutex> mutex);
+
+signals:
+    void sendProgress(qint64 bytes, qint64 total);      // 发送进度信号
+    void workFinished();                                // 任务完成信号
+    void sendItemData(TranPdu data, uint64_t file_id);  // 发送添加文件视图信号
+    void error(QString message);                        // 错误信号
+    void tokenRejected();                               // 会话令牌被服务端拒绝，已改用密码重新请求
+
+public slots:
+    void doingUp();     // 执行上传操作
+
+    void sendCancelRequest();
+
+private:
+    bool calculateSHA256();     // 计算所有文件的哈希值
+    bool sendTranPdu();         // 发送批量上传请求
+    bool sendList();            // 发送文件清单：每页最多 MAX_BATCH_LIST_PER_PAGE 个文件
+    void sendFiles(const std::vector<uint32_t>& indexes);   // 发送服务端需要的文件
+    bool waitControl();         // 传输控制，暂停时等待，取消时返回false
+
+private slots:
+    void handleRecvPDURespond(std::shared_ptr<PDURespond> pdu);
+
+private:
+    void handlePutsBatchRespond(std::shared_ptr<PDURespond> pdu);
+    void handleBatchListRespond(std::shared_ptr<PDURespond> pdu);
+    void handleBatchDataRespond(std::shared_ptr<PDURespond> pdu);
+    void resolveFile(uint32_t index, uint64_t file_id);     // 记录一个文件的结果，file_id 为0表示失败
+    void checkFinished();       // 所有文件都有结果时结束任务
+
+private:
+    std::shared_ptr<SR_Tool> sr_tool_;  // 发送接收工具
+    TranPdu tran_pdu_{ {0} };           // 批量上传请求
+    std::string auth_pwd_;              // 令牌被拒绝时使用的密码
+    std::vector<BatchFile> files_;
+    uint64_t total_bytes_{ 0 };         // 所有文件的总长度
+    uint32_t compress_{ 0 };            // 与服务端协商的压缩方式（Compression）
+
+    size_t resolved_count_{ 0 };        // 已经有结果的文件数
+    size_t failed_count_{ 0 };          // 失败的文件数
+    uint64_t resolved_bytes_{ 0 };      // 已经有结果的文件的总长度
+    bool finished_{ false };
+
+    // 工作控制，0为继续，1为暂停，2为结束
+    std::shared_ptr<std::atomic<std::uint32_t>> ctrl_{ nullptr };
+    std::shared_ptr<std::condition_variable> cv_{ nullptr };
+    std::shared_ptr<std::mutex> mtx_{ nullptr };
+
+    double last_progress_{ 0 };  // 最后一次进度
+    const double progress_step_{ 0.003 };   // 更新进度条的最小进度
+};
+
+#endif // BATCHTOOL_H
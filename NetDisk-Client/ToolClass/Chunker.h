@@ -0,0 +1,36 @@
+﻿#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// 文件清单中的一个块
+struct ChunkEntry {
+    uint64_t offset{ 0 };           // 在文件中的偏移
+    uint32_t size{ 0 };             // 块长度
+    unsigned char hash[32]{ 0 };    // 块内容的 SHA-256
+};
+
+// 基于内容的分块（FastCDC），与服务端使用完全相同的参数和 Gear 表，同样的数据在两端切出同样的块
+// 分块边界由数据内容决定，文件中间插入或删除少量数据只影响附近的块，修改过的大文件只需要上传变化的块
+// 跳过最小块长度之前的数据；期望长度前后使用不同的掩码（归一化分块）；每次循环处理两个字节
+class Chunker {
+public:
+    static const uint32_t kMinSize = 16 * 1024;     // 最小块长度
+    static const uint32_t kAvgSize = 64 * 1024;     // 期望块长度
+    static const uint32_t kMaxSize = 256 * 1024;    // 最大块长度
+
+    // 返回从 data 开始的下一个块的长度，len 为剩余数据长度（不足 kMaxSize 时只有文件末尾才允许）
+    static uint32_t nextChunk(const unsigned char* data, uint64_t len);
+
+private:
+    static void initGear();
+
+private:
+    static const uint64_t kMaskS;     // 期望长度之前的掩码（18位）
+    static const uint64_t kMaskL;     // 期望长度之后的掩码（14位）
+    static uint64_t gear_[256];
+    static uint64_t gear_ls_[256];    // gear_ 左移一位
+};
+
+#endif // CHUNKER_H
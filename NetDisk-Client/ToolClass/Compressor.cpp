@@ -0,0 +1,83 @@
+﻿#include "Compressor.h"
+#include "protocol.h"
+#include <algorithm>
+#include <cmath>
+#include <QByteArray>
+#include <QtEndian>
+
+uint32_t Compressor::makeOffer(int level) {
+    return (static_cast<uint32_t>(std::min(std::max(level, 0), 9)) << 8) | (1u << Compression::COMPRESS_DEFLATE);
+}
+
+bool Compressor::decompress(uint32_t codec, const char* data, size_t len, size_t max_len, std::string& out) {
+    if (codec != Compression::COMPRESS_DEFLATE || len <= sizeof(uint32_t)) {
+        return false;
+    }
+    // qUncompress 按头部声明的原始长度分配内存，先检查长度，防止异常数据申请过大的内存
+    uint32_t raw_len = qFromBigEndian<uint32_t>(data);
+    if (raw_len == 0 || raw_len > std::min(max_len, kMaxRawSize)) {
+        return false;
+    }
+    QByteArray raw = qUncompress(reinterpret_cast<const uchar*>(data), static_cast<qsizetype>(len));
+    if (raw.size() != static_cast<qsizetype>(raw_len)) {
+        return false;
+    }
+    out.assign(raw.constData(), raw.size());
+    return true;
+}
+
+Compressor::Compressor(uint32_t negotiated, int level)
+    : codec_(negotiated & 0xff)
+    , level_(std::min(std::max(level, 1), 9)) {
+    if (codec_ != Compression::COMPRESS_DEFLATE) {
+        codec_ = Compression::COMPRESS_NONE;   // 不认识的压缩方式按不压缩处理
+    }
+}
+
+uint32_t Compressor::compress(const char* data, size_t len, std::string& out) {
+    raw_bytes_ += len;
+    bool tried = false;
+    if (codec_ != Compression::COMPRESS_NONE && len > kSampleSize / 4) {
+        if (skip_left_ > 0) {
+            --skip_left_;
+        }
+        else if (entropy(data, std::min(len, kSampleSize)) <= kMaxEntropy) {
+            tried = true;
+            // qCompress 的格式：原始长度(uint32，网络字节序) + zlib 数据，与服务端相同
+            QByteArray packed = qCompress(reinterpret_cast<const uchar*>(data), static_cast<qsizetype>(len), level_);
+            if (!packed.isEmpty() && static_cast<size_t>(packed.size()) <= len - len / 8) {  // 至少节省 1/8 才发送压缩数据
+                out.assign(packed.constData(), packed.size());
+                fail_count_ = 0;
+                wire_bytes_ += out.size();
+                ++compressed_chunks_;
+                return codec_;
+            }
+        }
+    }
+    // 压缩不划算，连续失败时跳过的分片数成倍增加
+    if (tried) {
+        fail_count_ = std::min<uint32_t>(fail_count_ + 1, 31);
+        skip_left_ = std::min<uint32_t>(kMaxSkip, (1u << fail_count_) - 1);
+    }
+    wire_bytes_ += len;
+    ++stored_chunks_;
+    return Compression::COMPRESS_NONE;
+}
+
+double Compressor::entropy(const char* data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    uint32_t count[256] = { 0 };
+    for (size_t i = 0; i < len; ++i) {
+        ++count[static_cast<unsigned char>(data[i])];
+    }
+    double result = 0;
+    for (uint32_t c : count) {
+        if (c > 0) {
+            double p = static_cast<double>(c) / len;
+            result -= p * std::log2(p);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+﻿#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 传输数据的分片压缩
+// 上传/下载请求（TranPdu 的 compress 字段）携带支持的压缩方式和希望的级别，服务端在回复的头部（reserved）中返回协商结果。
+// 发送时每个分片单独决定是否压缩：先抽样估计字节熵，熵很高的数据（已经压缩过的图片、视频、压缩包）直接原样发送；
+// 压缩后节省不到 1/8 也原样发送，并且连续失败时成倍地跳过后面的分片，避免在不可压缩的数据上浪费 CPU
+class Compressor {
+public:
+    // 请求中携带的压缩能力，级别为0表示使用服务端配置的级别
+    static uint32_t makeOffer(int level = 0);
+    // 解压一个分片，原始长度超过 max_len 或者数据格式错误返回false
+    static bool decompress(uint32_t codec, const char* data, size_t len, size_t max_len, std::string& out);
+
+    // negotiated 为协商的压缩方式（服务端回复头部的 reserved），level 为压缩级别
+    explicit Compressor(uint32_t negotiated, int level = 1);
+
+    // 尝试压缩一个分片，返回本分片的压缩方式：COMPRESS_NONE 时按原样发送 data，否则发送 out
+    uint32_t compress(const char* data, size_t len, std::string& out);
+    // 本次传输的统计：原始字节数、实际发送的字节数、压缩的分片数、原样发送的分片数
+    uint64_t getRawBytes() const { return raw_bytes_; }
+    uint64_t getWireBytes() const { return wire_bytes_; }
+    uint64_t getCompressedChunks() const { return compressed_chunks_; }
+    uint64_t getStoredChunks() const { return stored_chunks_; }
+
+private:
+    static double entropy(const char* data, size_t len);   // 估计字节熵（位/字节）
+
+private:
+    static constexpr size_t kSampleSize = 512;  // 估计熵的抽样长度
+    static constexpr double kMaxEntropy = 7.2;  // 超过该熵的分片不尝试压缩
+    static constexpr uint32_t kMaxSkip = 64;    // 连续压缩失败后最多跳过的分片数
+    static constexpr size_t kMaxRawSize = 16 * 1024 * 1024;    // 解压后单个分片的最大长度
+
+    uint32_t codec_{ 0 };
+    int level_{ 1 };
+
+    uint32_t fail_count_{ 0 };    // 连续压缩失败次数
+    uint32_t skip_left_{ 0 };     // 还需要跳过的分片数
+
+    uint64_t raw_bytes_{ 0 };
+    uint64_t wire_bytes_{ 0 };
+    uint64_t compressed_chunks_{ 0 };
+    uint64_t stored_chunks_{ 0 };
+};
+
+#endif // COMPRESSOR_H
@@ -0,0 +1,101 @@
+﻿#include "Crc32c.h"
+#include <cstring>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_X64_MSVC
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_X64_GCC
+#endif
+
+namespace {
+
+// slicing-by-8 查找表，多项式为 0x1EDC6F41 的反射形式
+struct CrcTable {
+    uint32_t table[8][256];
+    CrcTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const CrcTable kTable;
+
+bool detectHardware() {
+#if defined(CRC32C_X64_MSVC)
+    int info[4] = { 0 };
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;     // ECX 第20位：SSE4.2
+#elif defined(CRC32C_X64_GCC)
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+const bool kUseHardware = detectHardware();
+
+}
+
+uint32_t Crc32c::compute(const char* data, size_t len, uint32_t crc) {
+    const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+    crc = kUseHardware ? extendHardware(crc, ptr, len) : extendTable(crc, ptr, len);
+    return ~crc;
+}
+
+bool Crc32c::isHardware() {
+    return kUseHardware;
+}
+
+uint32_t Crc32c::extendTable(uint32_t crc, const unsigned char* data, size_t len) {
+    const auto& t = kTable.table;
+    // 每次处理8字节，按字节组合，与机器字节序无关
+    while (len >= 8) {
+        uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(CRC32C_X64_MSVC) || defined(CRC32C_X64_GCC)
+#if defined(CRC32C_X64_GCC)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t Crc32c::extendHardware(uint32_t crc, const unsigned char* data, size_t len) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#else
+uint32_t Crc32c::extendHardware(uint32_t crc, const unsigned char* data, size_t len) {
+    return extendTable(crc, data, len);
+}
+#endif
@@ -0,0 +1,21 @@
+﻿#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstdint>
+#include <cstddef>
+
+// 传输数据分片的校验和（CRC32C，Castagnoli 多项式），与服务端相同
+// 发送方在序列化 TranDataPdu 时计算 data 的校验和填入 check_sum，接收方在使用数据（解压、写入）之前校验，
+// 校验失败的分片单独重新传输。CPU 支持 SSE4.2 时使用 crc32 指令（每次处理8字节），否则使用 slicing-by-8 查找表
+class Crc32c {
+public:
+    // 计算 data 的校验和，crc 为前一段数据的校验和（分段计算时使用）
+    static uint32_t compute(const char* data, size_t len, uint32_t crc = 0);
+    static bool isHardware();   // 是否使用了硬件指令
+
+private:
+    static uint32_t extendTable(uint32_t crc, const unsigned char* data, size_t len);
+    static uint32_t extendHardware(uint32_t crc, const unsigned char* data, size_t len);
+};
+
+#endif // CRC32C_H
@@ -0,0 +1,133 @@
+﻿#include "Delta.h"
+#include "protocol.h"
+#include <openssl/sha.h>
+#include <algorithm>
+#include <cstring>
+#include <QtEndian>
+
+uint32_t Delta::weakSum(const unsigned char* data, size_t len) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += data[i];
+        b += (len - i) * data[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+bool Delta::compute(QFile& file, uint64_t file_size, const char* sig, size_t sig_len, std::vector<DeltaCopy>& copies) {
+    copies.clear();
+    if (sig_len < 2 * sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t block_size = qFromBigEndian<uint32_t>(sig);
+    uint32_t count = qFromBigEndian<uint32_t>(sig + sizeof(uint32_t));
+    sig += 2 * sizeof(uint32_t);
+    if (block_size == 0 || block_size > kMaxCopySize || sig_len != 2 * sizeof(uint32_t) + (uint64_t)count * DELTA_SIG_ENTRY_LEN) {
+        return false;
+    }
+    if (count == 0 || file_size < block_size) {
+        return true;
+    }
+
+    // 按弱校验和排序，命中时二分查找；tag 为16位的快速过滤表，大部分位置不需要查找
+    std::vector<std::pair<uint32_t, uint32_t>> blocks(count);  // 弱校验和，块序号
+    std::vector<bool> tag(1 << 16, false);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t weak = qFromBigEndian<uint32_t>(sig + (uint64_t)i * DELTA_SIG_ENTRY_LEN);
+        blocks[i] = { weak, i };
+        tag[(weak ^ (weak >> 16)) & 0xffff] = true;
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    // 缓冲区中 [start, end) 为还没有处理的数据，滚动时需要窗口后面的一个字节，因此至少保留 block_size+1 字节（文件末尾除外）
+    std::vector<unsigned char> buffer(4 * 1024 * 1024 + block_size + 1);
+    size_t start = 0, end = 0;
+    uint64_t buffer_pos = 0;    // buffer[0] 在文件中的偏移
+    bool is_eof = false;
+    bool need_init = true;
+    uint32_t a = 0, b = 0;      // 当前窗口的字节和与加权和（只使用低16位）
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+
+    if (!file.seek(0)) {
+        return false;
+    }
+    while (true) {
+        if (!is_eof && end - start <= block_size) {
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            buffer_pos += start;
+            start = 0;
+            qint64 read_bytes = file.read(reinterpret_cast<char*>(buffer.data()) + end, buffer.size() - end);
+            if (read_bytes < 0) {
+                return false;
+            }
+            is_eof = (read_bytes == 0);
+            end += read_bytes;
+            continue;
+        }
+        if (end - start < block_size) {
+            break;
+        }
+
+        const unsigned char* window = buffer.data() + start;
+        if (need_init) {
+            a = 0;
+            b = 0;
+            for (uint32_t i = 0; i < block_size; ++i) {
+                a += window[i];
+                b += (block_size - i) * window[i];
+            }
+            need_init = false;
+        }
+        uint32_t weak = (a & 0xffff) | (b << 16);
+
+        // 弱校验和命中后再比较强哈希，多个候选时优先选择紧接上一条复制指令的块，使复制指令可以合并
+        int64_t match = -1;
+        if (tag[(weak ^ (weak >> 16)) & 0xffff]) {
+            auto it = std::lower_bound(blocks.begin(), blocks.end(), std::make_pair(weak, 0u));
+            bool hashed = false;
+            uint64_t expect = copies.empty() ? UINT64_MAX : (copies.back().base_offset + copies.back().size) / block_size;
+            for (; it != blocks.end() && it->first == weak; ++it) {
+                if (!hashed) {
+                    SHA256(window, block_size, digest);
+                    hashed = true;
+                }
+                if (memcmp(digest, sig + (uint64_t)it->second * DELTA_SIG_ENTRY_LEN + sizeof(uint32_t), DELTA_STRONG_LEN) == 0) {
+                    if (match == -1 || it->second == expect) {
+                        match = it->second;
+                    }
+                    if (it->second == expect) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (match >= 0) {
+            uint64_t offset = buffer_pos + start;
+            uint64_t base_offset = (uint64_t)match * block_size;
+            DeltaCopy* last = copies.empty() ? nullptr : &copies.back();
+            if (last != nullptr && last->offset + last->size == offset && last->base_offset + last->size == base_offset
+                && last->size <= kMaxCopySize - block_size) {
+                last->size += block_size;
+            }
+            else {
+                copies.push_back({ offset, base_offset, block_size });
+            }
+            start += block_size;
+            need_init = true;
+            continue;
+        }
+
+        // 窗口向后滑动一个字节
+        if (end - start == block_size) {
+            break;
+        }
+        unsigned char out = window[0];
+        unsigned char in = window[block_size];
+        a = a - out + in;
+        b = b - block_size * out + a;
+        ++start;
+    }
+    return true;
+}
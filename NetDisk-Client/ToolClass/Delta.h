@@ -0,0 +1,30 @@
+﻿#ifndef DELTA_H
+#define DELTA_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <QFile>
+
+// 差量上传的一条复制指令：新文件的 [offset, offset+size) 与旧版本的 [base_offset, base_offset+size) 相同
+struct DeltaCopy {
+    uint64_t offset{ 0 };           // 新文件中的偏移
+    uint64_t base_offset{ 0 };      // 旧版本中的偏移
+    uint32_t size{ 0 };             // 长度
+};
+
+// rsync 风格的差量计算
+// 服务端发送旧版本每个块的签名（弱校验和 + 强哈希），客户端在新文件上逐字节滚动弱校验和，
+// 命中后再比较强哈希，相同的块变成复制指令，其余数据仍按普通上传发送
+class Delta {
+public:
+    // 解析签名（块长度(uint32) + 块数(uint32) + 块签名...），查找新文件中与旧版本相同的块，相邻的复制合并为一条
+    static bool compute(QFile& file, uint64_t file_size, const char* sig, size_t sig_len, std::vector<DeltaCopy>& copies);
+    // 弱校验和，与服务端的计算方法相同：低16位为字节和，高16位为加权和
+    static uint32_t weakSum(const unsigned char* data, size_t len);
+
+private:
+    static const uint32_t kMaxCopySize = 64 * 1024 * 1024;  // 合并后单条复制指令的最大长度
+};
+
+#endif // DELTA_H
@@ -1,7 +1,10 @@
 ﻿#include "DownTool.h"
+#include "Compressor.h"
+#include "Crc32c.h"
+#include <algorithm>
 
 DownTool::DownTool(const QString &ip, const uint32_t port, const TranPdu &pdu, const QString &file_path, QObject *parent)
-    : QObject{parent}, sr_tool_(std::make_shared<SR_Tool>(ip.toStdString(), port, nullptr))
+    : QObject{parent}, sr_tool_(std::make_shared<SR_Tool>(ip.toStdString(), port, nullptr)), ip_(ip), port_(port)
 {
     initSignals();  // 初始化信号
 
@@ -11,11 +14,24 @@ DownTool::DownTool(const QString &ip, const uint32_t port, const TranPdu &pdu, c
     }
 
     file_ctx_.pdu = pdu;
+    file_ctx_.pdu.compress = Compressor::makeOffer();   // 请求压缩传输，由服务端决定是否开启
     file_ctx_.file.setFileName(file_path);
 }
 
 DownTool::~DownTool() {
     sr_tool_->SR_stop();    // 关闭异步任务
+    // 关闭并行下载的连接，先关闭套接字，使等待接收的异步任务结束
+    for (auto& range : ranges_) {
+        retired_tools_.push_back(range.tool);
+    }
+    for (auto& tool : retired_tools_) {
+        if (tool == nullptr) {
+            continue;
+        }
+        boost::system::error_code ec;
+        tool->getSSL()->lowest_layer().close(ec);
+        tool->SR_stop();
+    }
 
     // 关闭文件
     if (file_ctx_.file.exists()) {
@@ -43,7 +59,17 @@ DownTool::~DownTool() {
     sr_tool_->getSSL()->lowest_layer().close();
 }
 
+// 设置令牌被拒绝时使用的密码
+void DownTool::setAuthPwd(const char *pwd) {
+    auth_pwd_.assign(pwd, strnlen(pwd, sizeof(TranPdu::pwd)));
+}
+
 void DownTool::doingDown() {
+    // 文件较大时使用多个连接并行下载
+    if (startRanges()) {
+        return;
+    }
+
     // 连接到服务器
     sr_tool_->connect(ec_);
     if (ec_) {
@@ -63,16 +89,7 @@ void DownTool::doingDown() {
 }
 
 void DownTool::sendPauseRequest() {
-    TranControlPdu pdu;
-    pdu.header.type = ProtocolType::TRANCONTROLPDU_TYPE;
-    pdu.header.body_len = TRANCONTROL_BODY_BASE_LEN;
-    pdu.code = Code::GETS_CONTROL;
-    pdu.action = ControlAction::PAUSE;
-
-    auto buf = Serializer::serialize(pdu);
-
-    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec_);
-    if (ec_) {
+    if (!sendControlPdu(ControlAction::PAUSE)) {
         emit error("download file error: send control pause failed");
     }
     qDebug() << "download file: send pause request";
@@ -80,41 +97,72 @@ void DownTool::sendPauseRequest() {
 }
 
 void DownTool::sendResumeRequest() {
-    TranControlPdu pdu;
-    pdu.header.type = ProtocolType::TRANCONTROLPDU_TYPE;
-    pdu.header.body_len = TRANCONTROL_BODY_BASE_LEN;
-    pdu.code = Code::GETS_CONTROL;
-    pdu.action = ControlAction::RESUME;
-
-    auto buf = Serializer::serialize(pdu);
-
-    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec_);
-    if (ec_) {
+    if (!sendControlPdu(ControlAction::RESUME)) {
         emit error("download file error: send control resume failed");
     }
     qDebug() << "download file: send resume request";
 }
 
 void DownTool::sendCancelRequest() {
+    // 如果文件未下载完，删除文件
+    if (file_ctx_.recv_bytes != file_ctx_.pdu.file_size) {
+        removeFile();
+    }
+
+    if (!sendControlPdu(ControlAction::CANCEL)) {
+        emit error("download file error: send cancel failed");
+    }
+    emit workFinished();    // 取消后，发送完成信号，关闭连接和线程
+    qDebug() << "download file: send cancel request";
+}
+
+// 发送传输控制，多连接下载时发送给所有未完成的连接
+bool DownTool::sendControlPdu(uint32_t action) {
     TranControlPdu pdu;
     pdu.header.type = ProtocolType::TRANCONTROLPDU_TYPE;
     pdu.header.body_len = TRANCONTROL_BODY_BASE_LEN;
     pdu.code = Code::GETS_CONTROL;
-    pdu.action = ControlAction::CANCEL;
+    pdu.action = action;
 
     auto buf = Serializer::serialize(pdu);
 
-    // 如果文件未下载完，删除文件
-    if (file_ctx_.recv_bytes != file_ctx_.pdu.file_size) {
-        removeFile();
+    if (ranges_.empty()) {
+        sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec_);
+        return !ec_;
     }
+    bool ok = true;
+    for (auto& range : ranges_) {
+        if (range.finished || range.tool == nullptr) {
+            continue;
+        }
+        boost::system::error_code ec;
+        range.tool->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+        ok = ok && !ec;
+    }
+    return ok;
+}
 
-    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec_);
-    if (ec_) {
-        emit error("download file error: send cancel failed");
+bool DownTool::unpackData(std::shared_ptr<TranDataPdu> pdu, uint64_t max_len) {
+    file_ctx_.wire_bytes += pdu->chunk_size;
+    if (pdu->status != Compression::COMPRESS_NONE) {
+        std::string raw;
+        if (pdu->chunk_size > pdu->data.size() ||
+            !Compressor::decompress(pdu->status, pdu->data.data(), pdu->chunk_size, max_len, raw)) {
+            return false;
+        }
+        pdu->data.swap(raw);
+        pdu->chunk_size = pdu->data.size();
+        pdu->status = Compression::COMPRESS_NONE;
+    }
+    file_ctx_.raw_bytes += pdu->chunk_size;
+    return true;
+}
+
+void DownTool::reportCompression() {
+    if (file_ctx_.raw_bytes > 0 && file_ctx_.wire_bytes < file_ctx_.raw_bytes) {
+        qDebug() << "download file: recv" << file_ctx_.raw_bytes << "bytes," << file_ctx_.wire_bytes << "bytes on wire"
+                 << QString("(%1%)").arg(100.0 * file_ctx_.wire_bytes / file_ctx_.raw_bytes, 0, 'f', 1);
     }
-    emit workFinished();    // 取消后，发送完成信号，关闭连接和线程
-    qDebug() << "download file: send cancel request";
 }
 
 // 发送TranPdu到服务端
@@ -122,7 +170,7 @@ bool DownTool::sendTranPdu() {
     // 序列化
     auto buf = Serializer::serialize(file_ctx_.pdu);
 
-    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + file_ctx_.pdu.header.body_len, ec_);
+    sr_tool_->send(buf.get(), Serializer::encodedLen(file_ctx_.pdu), ec_);
 
     if (ec_) {
         emit error("DwonTool::sendTranPdu(): " + QString::fromStdString(ec_.what()));
@@ -223,20 +271,53 @@ void DownTool::handleRecvTranDataPdu(std::shared_ptr<TranDataPdu> pdu) {
             return;
         }
         // 写入数据不需要加锁保护，因为DownTool是在单线程工作的
+        // 上一个分片校验和错误：它的原始数据到这个分片的偏移为止
+        if (file_ctx_.bad_pending) {
+            if (pdu->file_offset <= file_ctx_.recv_bytes || pdu->file_offset > file_ctx_.pdu.file_size) {
+                removeFile();
+                emit error("download file: recv data error: missing data");
+                return;
+            }
+            file_ctx_.bad_ranges.emplace_back(file_ctx_.recv_bytes, pdu->file_offset - file_ctx_.recv_bytes);
+            file_ctx_.recv_bytes = pdu->file_offset;
+            file_ctx_.bad_pending = false;
+        }
         if (file_ctx_.recv_bytes != pdu->file_offset) { // 检查是否漏了数据
             removeFile();
             emit error("download file: recv data error: missing data");
             return;
         }
-        file.seek(pdu->file_offset);                    // 定位
-        file.write(pdu->data.data(), pdu->chunk_size);  // 写入数据
-        file_ctx_.recv_bytes += pdu->chunk_size;        // 更新已接收字节数
+        if (pdu->chunk_size > pdu->data.size() || Crc32c::compute(pdu->data.data(), pdu->chunk_size) != pdu->check_sum) {
+            qDebug() << "download file: chunk checksum mismatch, offset:" << pdu->file_offset;
+            if (pdu->chunk_index + 1 < pdu->total_chunks) {
+                file_ctx_.bad_pending = true;
+                return;
+            }
+            // 最后一个分片，数据到文件末尾
+            file_ctx_.bad_ranges.emplace_back(pdu->file_offset, file_ctx_.pdu.file_size - pdu->file_offset);
+            file_ctx_.recv_bytes = file_ctx_.pdu.file_size;
+        }
+        else {
+            if (!unpackData(pdu, file_ctx_.pdu.file_size - file_ctx_.recv_bytes)) {
+                removeFile();
+                emit error("download file: recv data error: decompress failed");
+                return;
+            }
+            file.seek(pdu->file_offset);                    // 定位
+            file.write(pdu->data.data(), pdu->chunk_size);  // 写入数据
+            file_ctx_.recv_bytes += pdu->chunk_size;        // 更新已接收字节数
+        }
 
         // 更新进度条
         emit sendProgress(file_ctx_.recv_bytes, file_ctx_.pdu.file_size);
         // !!!!!!!!!!!!!!!!!!!!!! 可以增加回复确认的功能，用于服务端重传 !!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
         qDebug() << "recv bytes:" << file_ctx_.recv_bytes << "total bytes:" << file_ctx_.pdu.file_size;
+        // 有校验和错误的分片，单独重新下载这些区间，主连接不再使用（析构时关闭）
+        if (file_ctx_.recv_bytes == file_ctx_.pdu.file_size && !file_ctx_.bad_ranges.empty()) {
+            startRepair();
+            return;
+        }
         // 下载完成
         if (file_ctx_.recv_bytes == file_ctx_.pdu.file_size) {
             // 验证哈希,发送TranFinishPdu回复
@@ -247,6 +328,7 @@ void DownTool::handleRecvTranDataPdu(std::shared_ptr<TranDataPdu> pdu) {
 
             if (verifySHA256()) {   // 验证成功
                 qDebug() << "download file verify success";
+                reportCompression();
                 pdu.file_size = 1;  // 1 表示验证成功
             }
             else {  // 验证失败
@@ -313,6 +395,16 @@ void DownTool::handleGetsRespond(std::shared_ptr<PDURespond> pdu) {
             emit error("download file error: get continue failed");
             break;
         }
+        case Status::NOT_VERIFY: {
+            // 会话令牌被拒绝（例如服务器重启后更换了密钥），在同一个连接上改用密码重新请求
+            if (!useTranPwd(file_ctx_.pdu, auth_pwd_)) {
+                emit error("download file error: not verify");
+            }
+            else if (sendTranPdu()) {
+                emit tokenRejected();
+            }
+            break;
+        }
         case Status::FAILED: {
             emit error("download file error: request error");
             break;
@@ -337,6 +429,239 @@ void DownTool::handleGetsFinishRespond(std::shared_ptr<PDURespond> pdu) {
     }
 }
 
+bool DownTool::startRanges() {
+    uint64_t file_size = file_ctx_.pdu.file_size;
+    size_t count = std::min<uint64_t>(max_connections_, file_size / bytes_per_connection_);
+    if (count < 2) {    // 文件较小，单连接下载
+        return false;
+    }
+
+    // 预先设置文件大小，各个连接把数据写入各自区间的位置
+    if (!file_ctx_.file.open(QIODevice::ReadWrite) || !file_ctx_.file.resize(file_size)) {
+        emit error("DownTool::startRanges(): Error opening file for writing");
+        return true;
+    }
+
+    // 按连接数均分文件，区间边界按chunk对齐
+    const uint64_t chunk_size = 2048;
+    uint64_t range_size = (file_size / count + chunk_size - 1) / chunk_size * chunk_size;
+    ranges_.resize(count);
+    for (size_t i=0; i<count; ++i) {
+        ranges_[i].offset = range_size * i;
+        ranges_[i].length = (i == count-1) ? file_size - ranges_[i].offset : range_size;
+    }
+    qDebug() << "download file: parallel ranges:" << count;
+
+    for (size_t i=0; i<count; ++i) {
+        if (!openRange(i)) {
+            return true;
+        }
+    }
+    return true;
+}
+
+void DownTool::startRepair() {
+    if (file_ctx_.bad_ranges.size() > max_repair_ranges_) {
+        removeFile();
+        emit error("download file error: too many corrupted chunks");
+        return;
+    }
+    qDebug() << "download file: repair ranges:" << file_ctx_.bad_ranges.size();
+    ranges_.resize(file_ctx_.bad_ranges.size());
+    for (size_t i=0; i<ranges_.size(); ++i) {
+        ranges_[i].offset = file_ctx_.bad_ranges[i].first;
+        ranges_[i].length = file_ctx_.bad_ranges[i].second;
+        file_ctx_.recv_bytes -= ranges_[i].length;  // 这些区间重新计入进度
+    }
+    for (size_t i=0; i<ranges_.size(); ++i) {
+        if (!openRange(i)) {
+            removeFile();
+            return;
+        }
+    }
+}
+
+bool DownTool::retryRange(size_t index) {
+    RangeContext& range = ranges_[index];
+    qDebug() << "download file: range verify failed, offset:" << range.offset;
+    if (range.retry >= max_range_retry_) {
+        removeFile();
+        emit error("download file error: range verify failed");
+        return false;
+    }
+    ++range.retry;
+    if (!openRange(index)) {
+        removeFile();
+        return false;
+    }
+    return true;
+}
+
+bool DownTool::openRange(size_t index) {
+    RangeContext& range = ranges_[index];
+    if (range.tool != nullptr) {    // 重新下载，替换原来的连接
+        retired_tools_.push_back(range.tool);
+    }
+    // 已经写入的数据会被覆盖，重新计数
+    file_ctx_.recv_bytes -= range.recv_bytes;
+    range.recv_bytes = 0;
+    range.hash.reset(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (range.hash == nullptr || EVP_DigestInit_ex(range.hash.get(), EVP_sha256(), nullptr) != 1) {
+        emit error("DownTool::openRange(): create hash error");
+        return false;
+    }
+
+    range.tool = std::make_shared<SR_Tool>(ip_.toStdString(), port_, nullptr);
+    SR_Tool* tool = range.tool.get();
+    connect(tool, &SR_Tool::recvPDURespondOK, this, [this, index, tool](std::shared_ptr<PDURespond> pdu) {
+        handleRangeRespond(index, tool, pdu);
+    });
+    connect(tool, &SR_Tool::recvTranDataPduOK, this, [this, index, tool](std::shared_ptr<TranDataPdu> pdu) {
+        handleRangeData(index, tool, pdu);
+    });
+    connect(tool, &SR_Tool::recvTranFinishPduOK, this, [this, index, tool](std::shared_ptr<TranFinishPdu> pdu) {
+        handleRangeFinish(index, tool, pdu);
+    });
+
+    boost::system::error_code ec;
+    tool->connect(ec);
+    if (ec) {
+        emit error("DownTool::openRange(): Connect error: " + QString::fromLocal8Bit(ec.message()));
+        return false;
+    }
+    // 区间下载请求：sended_size 为区间起始位置，file_size 为区间长度
+    TranPdu pdu = file_ctx_.pdu;
+    pdu.tran_pdu_code = Code::GETS_RANGE;
+    pdu.sended_size = range.offset;
+    pdu.file_size = range.length;
+    auto buf = Serializer::serialize(pdu);
+    tool->send(buf.get(), Serializer::encodedLen(pdu), ec);
+    if (ec) {
+        emit error("DownTool::openRange(): Send PDU error: " + QString::fromLocal8Bit(ec.message()));
+        return false;
+    }
+
+    // 每个连接只使用一个线程运行异步任务
+    tool->asyncRecvProtocol(true);
+    tool->SR_run();
+    return true;
+}
+
+void DownTool::handleRangeRespond(size_t index, SR_Tool* tool, std::shared_ptr<PDURespond> pdu) {
+    if (index >= ranges_.size() || ranges_[index].tool.get() != tool) {   // 已经被替换的连接
+        return;
+    }
+    RangeContext& range = ranges_[index];
+
+    if (Code::GETS_RANGE == pdu->code) {
+        if (Status::SUCCESS != pdu->status || pdu->msg.size() < sizeof(uint64_t)) {
+            removeFile();
+            emit error("download file error: range request error");
+            return;
+        }
+        // 保存文件哈希码，用于所有区间完成后验证整个文件
+        file_ctx_.file_hash = QByteArray(pdu->msg.data() + sizeof(uint64_t));
+
+        // 告诉服务器开始发送区间数据
+        TranDataPdu request_pdu;
+        request_pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+        request_pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN;
+        request_pdu.code = Code::GETS_DATA;
+
+        auto buf = Serializer::serialize(request_pdu);
+        boost::system::error_code ec;
+        tool->send(buf.get(), PROTOCOLHEADER_LEN + request_pdu.header.body_len, ec);
+        if (ec) {
+            removeFile();
+            emit error("download file error: request range data failed: " + QString::fromLocal8Bit(ec.message()));
+        }
+    }
+    else if (Code::GETS_FINISH == pdu->code && Status::SUCCESS == pdu->status) {
+        range.finished = true;
+        for (auto& other : ranges_) {
+            if (!other.finished) {
+                return;
+            }
+        }
+        // 所有区间都已完成，验证整个文件
+        if (verifySHA256()) {
+            qDebug() << "download file verify success";
+            reportCompression();
+            emit workFinished();
+        }
+        else {
+            removeFile();
+            emit error("download file error: verify failed");
+        }
+    }
+}
+
+void DownTool::handleRangeData(size_t index, SR_Tool* tool, std::shared_ptr<TranDataPdu> pdu) {
+    if (index >= ranges_.size() || ranges_[index].tool.get() != tool) {
+        return;
+    }
+    RangeContext& range = ranges_[index];
+    if (GETS_DATA != pdu->code || !file_ctx_.file.isOpen()) {
+        return;
+    }
+    // 校验和错误，重新下载该区间
+    if (pdu->chunk_size > pdu->data.size() || Crc32c::compute(pdu->data.data(), pdu->chunk_size) != pdu->check_sum) {
+        retryRange(index);
+        return;
+    }
+    // 每个连接按顺序接收自己的区间，检查是否漏了数据或超出区间
+    if (pdu->file_offset != range.offset + range.recv_bytes || !unpackData(pdu, range.length - range.recv_bytes) ||
+        pdu->chunk_size > range.length - range.recv_bytes) {
+        removeFile();
+        emit error("download file: recv range data error: missing data");
+        return;
+    }
+    file_ctx_.file.seek(pdu->file_offset);
+    file_ctx_.file.write(pdu->data.data(), pdu->chunk_size);
+    EVP_DigestUpdate(range.hash.get(), pdu->data.data(), pdu->chunk_size);
+    range.recv_bytes += pdu->chunk_size;
+    file_ctx_.recv_bytes += pdu->chunk_size;
+
+    emit sendProgress(file_ctx_.recv_bytes, file_ctx_.pdu.file_size);
+}
+
+void DownTool::handleRangeFinish(size_t index, SR_Tool* tool, std::shared_ptr<TranFinishPdu> pdu) {
+    if (index >= ranges_.size() || ranges_[index].tool.get() != tool || Code::GETS_RANGE != pdu->code) {
+        return;
+    }
+    RangeContext& range = ranges_[index];
+
+    // 比较接收到的数据的哈希与服务端发送的区间哈希
+    unsigned char result[SHA256_DIGEST_LENGTH];
+    unsigned int result_len = 0;
+    bool verified = false;
+    if (range.recv_bytes == range.length && pdu->file_size == range.length &&
+        EVP_DigestFinal_ex(range.hash.get(), result, &result_len) == 1) {
+        QByteArray range_hash = QByteArray(reinterpret_cast<char*>(result), result_len).toHex();
+        verified = (range_hash == QByteArray(pdu->file_md5));
+    }
+
+    // 发送确认，1 表示验证成功，0 表示验证失败
+    TranFinishPdu ack_pdu;
+    ack_pdu.header.type = ProtocolType::TRANFINISHPDU_TYPE;
+    ack_pdu.header.body_len = TRANFINISHPDU_BODY_LEN;
+    ack_pdu.code = Code::GETS_FINISH;
+    ack_pdu.file_size = verified ? 1 : 0;
+    auto buf = Serializer::serialize(ack_pdu);
+    boost::system::error_code ec;
+    tool->send(buf.get(), PROTOCOLHEADER_LEN + ack_pdu.header.body_len, ec);
+
+    if (verified) {
+        if (ec) {
+            removeFile();
+            emit error("download file error: send range finish pdu failed");
+        }
+        return;
+    }
+    // 区间验证失败，只重新下载该区间
+    retryRange(index);
+}
+
 void DownTool::initSignals() {
     connect(sr_tool_.get(), &SR_Tool::recvPDURespondOK,
             this, &DownTool::handleRecvPDURespond);
@@ -7,6 +7,8 @@
 #include <QObject>
 #include <QFile>
 #include <QString>
+#include <vector>
+#include <openssl/evp.h>
 #include "SR_Tool.h"
 #include "protocol.h"
 
@@ -16,6 +18,24 @@ struct DownContext {
     QByteArray file_hash;       // 文件哈希码（用于验证）
     QFile file;
 
+    uint64_t raw_bytes{ 0 };    // 压缩统计：解压后的字节数
+    uint64_t wire_bytes{ 0 };   // 压缩统计：实际接收的字节数
+
+    // 校验和错误的分片不写入，记录所在区间 [偏移, 长度)，其余数据接收完后使用区间下载单独重新下载
+    std::vector<std::pair<uint64_t, uint64_t>> bad_ranges;
+    bool bad_pending{ false };  // 上一个分片校验和错误，它的长度由下一个分片的偏移确定
+
+};
+
+// 多连接并行下载时，每个连接负责的区间
+struct RangeContext {
+    std::shared_ptr<SR_Tool> tool{ nullptr };   // 下载该区间的连接
+    uint64_t offset{ 0 };                       // 区间起始位置
+    uint64_t length{ 0 };                       // 区间长度
+    uint64_t recv_bytes{ 0 };                   // 已接收字节数
+    std::shared_ptr<EVP_MD_CTX> hash{ nullptr };  // 区间哈希，边接收边计算，与服务端发送的区间哈希比较
+    uint32_t retry{ 0 };                        // 已重新下载的次数
+    bool finished{ false };                     // 区间下载完成并通过验证
 };
 
 // 处理下载的类
@@ -26,10 +46,14 @@ public:
     DownTool(const QString &ip, const std::uint32_t port, const TranPdu &pdu, const QString &file_path, QObject *parent = nullptr);
     ~DownTool();
 
+    // 设置密码，请求使用的会话令牌被服务端拒绝时改用密码重新请求
+    void setAuthPwd(const char *pwd);
+
 signals:
     void sendProgress(qint64 bytes, qint64 total);      // 发送进度信号
     void workFinished();                                // 任务完成信号
     void error(QString message);                        // 错误信号
+    void tokenRejected();                               // 会话令牌被服务端拒绝，已改用密码重新请求
 
 public slots:
     void doingDown();   // 执行下载操作
@@ -42,6 +66,10 @@ private:
     bool sendTranPdu();         // 发送TranPdu
     bool verifySHA256();        // 哈希检查
     bool removeFile();          // 移除文件
+    bool sendControlPdu(uint32_t action);   // 发送传输控制，多连接下载时发送给所有连接
+    // 压缩的分片就地解压，之后 data/chunk_size 为原始数据，解压后超过 max_len 返回false
+    bool unpackData(std::shared_ptr<TranDataPdu> pdu, uint64_t max_len);
+    void reportCompression();   // 输出本次下载的压缩统计
 
 private slots:
     void handleRecvPDURespond(std::shared_ptr<PDURespond> pdu);
@@ -51,12 +79,32 @@ private:
     void handleGetsRespond(std::shared_ptr<PDURespond> pdu);
     void handleGetsFinishRespond(std::shared_ptr<PDURespond> pdu);
 
+    // 多连接并行下载：文件较大时将文件分成多个区间，每个连接使用 GETS_RANGE 下载一个区间，写入本地文件的对应位置
+    bool startRanges();                     // 开始并行下载，文件较小时返回false，使用单连接下载
+    void startRepair();                     // 单连接下载完成后，重新下载校验和错误的分片所在的区间
+    bool retryRange(size_t index);          // 区间验证失败，重新下载该区间，超过重试次数返回false
+    bool openRange(size_t index);           // 为区间建立连接并发送区间下载请求（重新下载时也使用）
+    // 并行连接的回复，tool 用于忽略已经被替换的连接的回复
+    void handleRangeRespond(size_t index, SR_Tool* tool, std::shared_ptr<PDURespond> pdu);
+    void handleRangeData(size_t index, SR_Tool* tool, std::shared_ptr<TranDataPdu> pdu);
+    void handleRangeFinish(size_t index, SR_Tool* tool, std::shared_ptr<TranFinishPdu> pdu);  // 服务端发送的区间哈希
+
 private:
     void initSignals();
 
 private:
     std::shared_ptr<SR_Tool> sr_tool_;  // 发送接收工具
     DownContext file_ctx_;              // 文件上下文
+    std::string auth_pwd_;              // 令牌被拒绝时使用的密码
+
+    QString ip_;
+    std::uint32_t port_{ 0 };
+    std::vector<RangeContext> ranges_;                      // 并行下载的区间，为空时使用单连接下载
+    std::vector<std::shared_ptr<SR_Tool>> retired_tools_;   // 重新下载区间时被替换的连接，析构时关闭
+    const uint32_t max_connections_{ 4 };                   // 最大连接数
+    const uint64_t bytes_per_connection_{ 64 * 1024 * 1024 };   // 文件每达到该大小增加一个连接
+    const uint32_t max_range_retry_{ 2 };                   // 区间验证失败后最多重新下载的次数
+    const size_t max_repair_ranges_{ 16 };                  // 校验和错误的区间超过该数量时下载失败
 
     boost::system::error_code ec_;      // 错误码
 };
@@ -0,0 +1,410 @@
+﻿#include "MultiDownTool.h"
+#include "Compressor.h"
+#include "Crc32c.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+#include <algorithm>
+
+MultiDownTool::MultiDownTool(const QString &ip, const uint32_t port, const TranPdu &pdu, const std::vector<uint64_t> &ids,
+                             const QString &dir_path, QObject *parent)
+    : QObject{parent}, sr_tool_(std::make_shared<SR_Tool>(ip.toStdString(), port, nullptr)), pdu_(pdu), ids_(ids),
+      dir_path_(QDir(dir_path).absolutePath())
+{
+    initSignals();  // 初始化信号
+
+    pdu_.tran_pdu_code = Code::GETS_MULTI;
+    pdu_.compress = Compressor::makeOffer();    // 请求压缩传输，由服务端决定是否开启
+}
+
+MultiDownTool::~MultiDownTool() {
+    sr_tool_->SR_stop();    // 关闭异步任务
+
+    // 打开的文件都还没有验证，删除
+    closeFile(true);
+
+    // 关闭连接
+    boost::system::error_code ec;
+    sr_tool_->getSSL()->shutdown(ec);
+    if (ec && ec != boost::asio::ssl::error::stream_truncated) {
+        qWarning() << "SSL 关闭错误：" << QString::fromLocal8Bit(ec.message());
+    }
+    // 无论SSL是否关闭，都关闭底层socket
+    sr_tool_->getSSL()->lowest_layer().close(ec);
+}
+
+void MultiDownTool::initSignals() {
+    connect(sr_tool_.get(), &SR_Tool::recvPDURespondOK,
+            this, &MultiDownTool::handleRecvPDURespond);
+    connect(sr_tool_.get(), &SR_Tool::recvTranDataPduOK,
+            this, &MultiDownTool::handleRecvTranDataPdu);
+    connect(sr_tool_.get(), &SR_Tool::recvTranFinishPduOK,
+            this, &MultiDownTool::handleRecvTranFinishPdu);
+}
+
+// 设置令牌被拒绝时使用的密码
+void MultiDownTool::setAuthPwd(const char *pwd) {
+    auth_pwd_.assign(pwd, strnlen(pwd, sizeof(TranPdu::pwd)));
+}
+
+void MultiDownTool::doingDown() {
+    if (ids_.empty() || ids_.size() > MAX_MULTI_IDS) {
+        emit error("multi download error: invalid file count");
+        return;
+    }
+    // 连接到服务器
+    boost::system::error_code ec;
+    sr_tool_->connect(ec);
+    if (ec) {
+        emit error("MultiDownTool::doingDown(): Connect error: " + QString::fromLocal8Bit(ec.message()));
+        return;
+    }
+
+    // 发送下载请求
+    if (!sendTranPdu()) {
+        return;
+    }
+
+    // 发送请求成功后，接收回复
+    sr_tool_->asyncRecvProtocol(true);  // 持续注册接收回复的异步事件
+    sr_tool_->SR_run(); // 在其它线程启动异步事件
+}
+
+// 发送多文件下载请求到服务端
+bool MultiDownTool::sendTranPdu() {
+    auto buf = Serializer::serialize(pdu_);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), Serializer::encodedLen(pdu_), ec);
+    if (ec) {
+        emit error("MultiDownTool::sendTranPdu(): Send PDU error: " + QString::fromLocal8Bit(ec.message()));
+        return false;
+    }
+    return true;
+}
+
+void MultiDownTool::sendPauseRequest() {
+    if (!sendControlPdu(ControlAction::PAUSE)) {
+        emit error("multi download error: send control pause failed");
+    }
+}
+
+void MultiDownTool::sendResumeRequest() {
+    if (!sendControlPdu(ControlAction::RESUME)) {
+        emit error("multi download error: send control resume failed");
+    }
+}
+
+void MultiDownTool::sendCancelRequest() {
+    // 删除未下载完的文件，已经验证的文件保留
+    closeFile(true);
+    finished_ = true;
+
+    if (!sendControlPdu(ControlAction::CANCEL)) {
+        emit error("multi download error: send cancel failed");
+    }
+    emit workFinished();    // 取消后，发送完成信号，关闭连接和线程
+    qDebug() << "multi download: send cancel request";
+}
+
+bool MultiDownTool::sendControlPdu(uint32_t action) {
+    TranControlPdu pdu;
+    pdu.header.type = ProtocolType::TRANCONTROLPDU_TYPE;
+    pdu.header.body_len = TRANCONTROL_BODY_BASE_LEN;
+    pdu.code = Code::GETS_CONTROL;
+    pdu.action = action;
+
+    auto buf = Serializer::serialize(pdu);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+    return !ec;
+}
+
+// 发送要下载的文件或文件夹ID，每个ID为uint64
+bool MultiDownTool::sendIds() {
+    TranDataPdu pdu;
+    pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+    pdu.code = Code::GETS_MULTI_LIST;
+    for (uint64_t id : ids_) {
+        uint64_t net_id = htonll(id);
+        pdu.data.append((char*)&net_id, sizeof(net_id));
+    }
+    pdu.chunk_size = pdu.data.size();
+    pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+
+    auto buf = Serializer::serialize(pdu);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+    if (ec) {
+        emit error("multi download error: send file list failed: " + QString::fromLocal8Bit(ec.message()));
+        return false;
+    }
+    return true;
+}
+
+// 清单页：页序号(uint32) + 文件总数(uint32) + 若干条[文件ID(uint64), 文件长度(uint64), 文件哈希, 路径长度(uint16), 相对路径]
+bool MultiDownTool::addListPage(const PDURespond &pdu) {
+    const size_t head_len = 2 * sizeof(uint32_t);
+    if (pdu.msg.size() < head_len) {
+        return false;
+    }
+    uint32_t page = 0;
+    uint32_t total = 0;
+    memcpy((char*)&page, pdu.msg.data(), sizeof(page));
+    memcpy((char*)&total, pdu.msg.data() + sizeof(page), sizeof(total));
+    page = ntohl(page);
+    total = ntohl(total);
+    // 清单按顺序发送，每页的文件数随路径长度变化（按编码后的长度分页）
+    if (page != list_pages_ || total == 0 || total > MAX_MULTI_FILES || (list_pages_ > 0 && total != total_files_) ||
+        pdu.msg.size() > MAX_MULTI_LIST_PAGE_LEN) {
+        return false;
+    }
+    total_files_ = total;
+
+    const char* ptr = pdu.msg.data() + head_len;
+    size_t left = pdu.msg.size() - head_len;
+    while (left > 0) {
+        if (left < MULTI_ENTRY_BASE_LEN || files_.size() >= total_files_) {
+            return false;
+        }
+        uint64_t size = 0;
+        uint16_t path_len = 0;
+        memcpy((char*)&size, ptr + sizeof(uint64_t), sizeof(size));
+        memcpy((char*)&path_len, ptr + 2 * sizeof(uint64_t) + MULTI_HASH_LEN, sizeof(path_len));
+        path_len = ntohs(path_len);
+        if (left - MULTI_ENTRY_BASE_LEN < path_len) {
+            return false;
+        }
+        MultiFile file;
+        file.size = ntohll(size);
+        file.hash = QByteArray(ptr + 2 * sizeof(uint64_t), MULTI_HASH_LEN);
+        file.path = makeLocalPath(QByteArray(ptr + MULTI_ENTRY_BASE_LEN, path_len));
+        if (file.path.isEmpty()) {
+            return false;
+        }
+        total_bytes_ += file.size;
+        files_.push_back(std::move(file));
+        ptr += MULTI_ENTRY_BASE_LEN + path_len;
+        left -= MULTI_ENTRY_BASE_LEN + path_len;
+    }
+    ++list_pages_;
+    return true;
+}
+
+// 服务端发送的路径不可信，只接受保存目录下的相对路径
+QString MultiDownTool::makeLocalPath(const QByteArray &path) const {
+    QString rel = QString::fromUtf8(path);
+    if (rel.isEmpty() || QDir::isAbsolutePath(rel) || rel.contains('\\') || rel.contains(':')) {
+        return QString();
+    }
+    QString local = QDir::cleanPath(dir_path_ + "/" + rel);
+    if (!local.startsWith(dir_path_ + "/")) {   // 包含 .. 等跳出保存目录的路径
+        return QString();
+    }
+    return local;
+}
+
+bool MultiDownTool::openFile(uint32_t index) {
+    const MultiFile& file = files_[index];
+    if (!QDir().mkpath(QFileInfo(file.path).absolutePath())) {
+        return false;
+    }
+    cur_file_.setFileName(file.path);
+    if (!cur_file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    cur_recv_ = 0;
+    cur_hash_.reset(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    return cur_hash_ != nullptr && EVP_DigestInit_ex(cur_hash_.get(), EVP_sha256(), nullptr) == 1;
+}
+
+void MultiDownTool::closeFile(bool remove) {
+    if (cur_file_.isOpen()) {
+        cur_file_.close();
+        if (remove) {
+            cur_file_.remove();
+        }
+    }
+    cur_hash_.reset();
+}
+
+// 比较接收到的数据的哈希与清单中的哈希和服务端的结束标记，服务端读取失败时结束标记的哈希为空
+void MultiDownTool::finishFile(uint32_t index, const QByteArray &server_hash) {
+    const MultiFile& file = files_[index];
+    bool verified = false;
+    if (!cur_corrupt_ && (cur_file_.isOpen() || openFile(index)) && cur_recv_ == file.size && server_hash == file.hash) {
+        unsigned char result[SHA256_DIGEST_LENGTH];
+        unsigned int result_len = 0;
+        if (EVP_DigestFinal_ex(cur_hash_.get(), result, &result_len) == 1) {
+            verified = (QByteArray(reinterpret_cast<char*>(result), result_len).toHex() == file.hash);
+        }
+    }
+    closeFile(!verified);
+    cur_corrupt_ = false;
+    if (!verified) {
+        ++failed_count_;
+        // 没有接收的数据也计入进度
+        recv_bytes_ += file.size - std::min(cur_recv_, file.size);
+        qDebug() << "multi download: file failed:" << file.path;
+    }
+    cur_index_ = index + 1;
+}
+
+void MultiDownTool::handleRecvPDURespond(std::shared_ptr<PDURespond> pdu) {
+    if (finished_ && Code::GETS_FINISH != pdu->code) {
+        return;
+    }
+    switch (pdu->code) {
+        case Code::GETS_MULTI: handleGetsMultiRespond(pdu); break;
+        case Code::GETS_MULTI_LIST: handleListRespond(pdu); break;
+        case Code::GETS_FINISH: handleGetsFinishRespond(pdu); break;
+    }
+}
+
+void MultiDownTool::handleGetsMultiRespond(std::shared_ptr<PDURespond> pdu) {
+    compress_ = pdu->header.reserved;  // 协商的压缩方式，0为不压缩
+    switch (pdu->status) {
+        case Status::SUCCESS: {
+            sendIds();
+            break;
+        }
+        case Status::NOT_VERIFY: {
+            // 会话令牌被拒绝，在同一个连接上改用密码重新请求
+            if (!useTranPwd(pdu_, auth_pwd_)) {
+                emit error("multi download error: not verify");
+            }
+            else if (sendTranPdu()) {
+                emit tokenRejected();
+            }
+            break;
+        }
+        case Status::FAILED: {
+            emit error("multi download error: request error");
+            break;
+        }
+        default: {
+            emit error("multi download error: request failed");
+            break;
+        }
+    }
+}
+
+void MultiDownTool::handleListRespond(std::shared_ptr<PDURespond> pdu) {
+    if (Status::SUCCESS != pdu->status) {
+        emit error("multi download error: file not exist or too many files");
+        return;
+    }
+    if (!addListPage(*pdu)) {
+        finished_ = true;
+        sendControlPdu(ControlAction::CANCEL);
+        emit error("multi download error: invalid file list");
+        return;
+    }
+    if (files_.size() == total_files_) {
+        qDebug() << "multi download: files:" << total_files_ << "bytes:" << total_bytes_;
+    }
+}
+
+// 文件数据：chunk_index 为文件序号，file_offset 为文件内的偏移，按清单顺序接收
+void MultiDownTool::handleRecvTranDataPdu(std::shared_ptr<TranDataPdu> pdu) {
+    if (finished_ || Code::GETS_MULTI_DATA != pdu->code) {
+        return;
+    }
+    // 清单接收完之后才会有数据，每个文件的数据按顺序发送
+    if (files_.size() != total_files_ || pdu->chunk_index != cur_index_ || cur_index_ >= files_.size() ||
+        (!cur_corrupt_ && pdu->file_offset != cur_recv_)) {
+        finished_ = true;
+        closeFile(true);
+        sendControlPdu(ControlAction::CANCEL);
+        emit error("multi download: recv data error: missing data");
+        return;
+    }
+    if (cur_corrupt_) {
+        return;
+    }
+    // 校验和错误的分片不写入，这个文件按失败处理
+    if (pdu->chunk_size > pdu->data.size() || Crc32c::compute(pdu->data.data(), pdu->chunk_size) != pdu->check_sum) {
+        qDebug() << "multi download: chunk checksum mismatch:" << files_[cur_index_].path;
+        cur_corrupt_ = true;
+        return;
+    }
+    const MultiFile& file = files_[cur_index_];
+    if (!cur_file_.isOpen() && !openFile(cur_index_)) {
+        finished_ = true;
+        sendControlPdu(ControlAction::CANCEL);
+        emit error("multi download error: open file failed: " + file.path);
+        return;
+    }
+    if (pdu->status != Compression::COMPRESS_NONE) {
+        std::string raw;
+        if (pdu->chunk_size > pdu->data.size() ||
+            !Compressor::decompress(pdu->status, pdu->data.data(), pdu->chunk_size, file.size - cur_recv_, raw)) {
+            finished_ = true;
+            closeFile(true);
+            sendControlPdu(ControlAction::CANCEL);
+            emit error("multi download: recv data error: decompress failed");
+            return;
+        }
+        pdu->data.swap(raw);
+        pdu->chunk_size = pdu->data.size();
+    }
+    if (pdu->chunk_size > file.size - cur_recv_) {
+        finished_ = true;
+        closeFile(true);
+        sendControlPdu(ControlAction::CANCEL);
+        emit error("multi download: recv data error: too much data");
+        return;
+    }
+    cur_file_.write(pdu->data.data(), pdu->chunk_size);
+    EVP_DigestUpdate(cur_hash_.get(), pdu->data.data(), pdu->chunk_size);
+    cur_recv_ += pdu->chunk_size;
+    recv_bytes_ += pdu->chunk_size;
+
+    // 如果达到更新条件在更新，避免一直更新卡顿UI
+    double cur_progress = total_bytes_ == 0 ? 1 : static_cast<double>(recv_bytes_) / total_bytes_;
+    if (cur_progress - last_progress_ >= progress_step_) {
+        last_progress_ = cur_progress;
+        emit sendProgress(recv_bytes_, total_bytes_);
+    }
+}
+
+// 文件结束标记：file_size 为文件序号，file_md5 为文件哈希
+void MultiDownTool::handleRecvTranFinishPdu(std::shared_ptr<TranFinishPdu> pdu) {
+    if (finished_ || Code::GETS_MULTI_DATA != pdu->code) {
+        return;
+    }
+    if (files_.size() != total_files_ || pdu->file_size != cur_index_ || cur_index_ >= files_.size()) {
+        finished_ = true;
+        closeFile(true);
+        sendControlPdu(ControlAction::CANCEL);
+        emit error("multi download: recv file end error");
+        return;
+    }
+    finishFile(cur_index_, QByteArray(pdu->file_md5, strnlen(pdu->file_md5, sizeof(pdu->file_md5))));
+    if (cur_index_ < files_.size()) {
+        return;
+    }
+
+    // 所有文件都已经结束，发送完成确认，1 表示所有文件验证成功
+    finished_ = true;
+    qDebug() << "multi download: finished, files:" << files_.size() << "failed:" << failed_count_;
+    TranFinishPdu ack_pdu;
+    ack_pdu.header.type = ProtocolType::TRANFINISHPDU_TYPE;
+    ack_pdu.header.body_len = TRANFINISHPDU_BODY_LEN;
+    ack_pdu.code = Code::GETS_FINISH;
+    ack_pdu.file_size = failed_count_ == 0 ? 1 : 0;
+    auto buf = Serializer::serialize(ack_pdu);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + ack_pdu.header.body_len, ec);
+    if (ec) {
+        emit error("multi download error: send finish pdu failed");
+    }
+}
+
+void MultiDownTool::handleGetsFinishRespond(std::shared_ptr<PDURespond> pdu) {
+    if (Status::SUCCESS == pdu->status && failed_count_ == 0) {
+        emit sendProgress(1, 1);    // 更新进度条
+        emit workFinished();
+        return;
+    }
+    emit error(QString("multi download: %1 of %2 files failed").arg(failed_count_).arg(files_.size()));
+}
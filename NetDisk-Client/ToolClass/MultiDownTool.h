@@ -0,0 +1,99 @@
+﻿#ifndef MULTIDOWNTOOL_H
+#define MULTIDOWNTOOL_H
+
+#include <QObject>
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include <vector>
+#include <memory>
+#include <openssl/evp.h>
+#include "SR_Tool.h"
+#include "protocol.h"
+
+// 多文件下载的一个文件
+struct MultiFile {
+    QString path;               // 本地保存路径
+    uint64_t size{ 0 };         // 文件长度
+    QByteArray hash;            // 文件内容的 SHA-256（十六进制）
+};
+
+// 多文件下载（文件夹下载）的类
+// 下载一个有大量小文件的文件夹时，每个文件单独建立连接、TLS握手和认证的开销远大于数据本身。
+// 多文件下载在一个连接上认证一次，服务端递归展开文件夹，先发送文件清单，再按清单顺序依次发送每个文件，
+// 每个文件结束时服务端发送结束标记，客户端边接收边计算哈希，逐个验证文件
+class MultiDownTool : public QObject {
+    Q_OBJECT
+
+public:
+    // pdu 提供用户名和密码，ids 为要下载的文件或文件夹ID，文件按相对路径保存到 dir_path 下
+    MultiDownTool(const QString &ip, const std::uint32_t port, const TranPdu &pdu, const std::vector<uint64_t> &ids,
+                  const QString &dir_path, QObject *parent = nullptr);
+    ~MultiDownTool();
+
+    // 设置密码，请求使用的会话令牌被服务端拒绝时改用密码重新请求
+    void setAuthPwd(const char *pwd);
+
+signals:
+    void sendProgress(qint64 bytes, qint64 total);      // 发送进度信号
+    void workFinished();                                // 任务完成信号
+    void error(QString message);                        // 错误信号
+    void tokenRejected();                               // 会话令牌被服务端拒绝，已改用密码重新请求
+
+public slots:
+    void doingDown();   // 执行下载操作
+
+    void sendPauseRequest();
+    void sendResumeRequest();
+    void sendCancelRequest();
+
+private:
+    bool sendTranPdu();                     // 发送多文件下载请求
+    bool sendControlPdu(uint32_t action);   // 发送传输控制
+    bool sendIds();                         // 发送要下载的文件或文件夹ID
+    bool addListPage(const PDURespond &pdu);    // 解析一页文件清单，格式错误返回false
+    QString makeLocalPath(const QByteArray &path) const;    // 相对路径转换为本地路径，不在保存目录下返回空
+    bool openFile(uint32_t index);          // 打开（创建）第 index 个文件，并初始化哈希
+    void finishFile(uint32_t index, const QByteArray &server_hash);    // 一个文件接收结束，验证哈希，失败时删除文件
+    void closeFile(bool remove);            // 关闭当前文件，remove 为 true 时删除
+
+private slots:
+    void handleRecvPDURespond(std::shared_ptr<PDURespond> pdu);
+    void handleRecvTranDataPdu(std::shared_ptr<TranDataPdu> pdu);
+    void handleRecvTranFinishPdu(std::shared_ptr<TranFinishPdu> pdu);
+
+private:
+    void handleGetsMultiRespond(std::shared_ptr<PDURespond> pdu);
+    void handleListRespond(std::shared_ptr<PDURespond> pdu);
+    void handleGetsFinishRespond(std::shared_ptr<PDURespond> pdu);
+
+private:
+    void initSignals();
+
+private:
+    std::shared_ptr<SR_Tool> sr_tool_;  // 发送接收工具
+    TranPdu pdu_{ {0} };                // 多文件下载请求
+    std::string auth_pwd_;              // 令牌被拒绝时使用的密码
+    std::vector<uint64_t> ids_;         // 要下载的文件或文件夹ID
+    QString dir_path_;                  // 保存目录
+
+    std::vector<MultiFile> files_;      // 文件清单
+    uint32_t total_files_{ 0 };         // 服务端展开后的文件总数
+    uint32_t list_pages_{ 0 };          // 已经接收的清单页数
+    uint64_t total_bytes_{ 0 };         // 所有文件的总长度
+    uint64_t recv_bytes_{ 0 };          // 已接收的字节数（所有文件）
+
+    uint32_t cur_index_{ 0 };           // 正在接收的文件序号，之前的文件都已经结束
+    QFile cur_file_;                    // 正在接收的文件
+    uint64_t cur_recv_{ 0 };            // 当前文件已接收的字节数
+    std::shared_ptr<EVP_MD_CTX> cur_hash_{ nullptr };   // 当前文件的哈希，边接收边计算
+    bool cur_corrupt_{ false };         // 当前文件有校验和错误的分片，忽略之后的数据，结束时按失败处理
+    uint32_t failed_count_{ 0 };        // 验证失败的文件数
+    uint32_t compress_{ 0 };            // 与服务端协商的压缩方式（Compression）
+    bool finished_{ false };
+
+    double last_progress_{ 0 };  // 最后一次进度
+    const double progress_step_{ 0.003 };   // 更新进度条的最小进度
+};
+
+#endif // MULTIDOWNTOOL_H
@@ -0,0 +1,192 @@
+﻿#include "MuxSession.h"
+#include "SR_Tool.h"
+#include "Serializer.h"
+#include <QDebug>
+
+namespace {
+
+// 已登记的会话，键为服务端地址和长任务端口
+std::mutex registry_mtx;
+std::map<std::pair<std::string, int>, std::weak_ptr<MuxSession>> registry;
+
+}
+
+MuxSession::MuxSession(std::shared_ptr<SR_Tool> conn, QObject *parent)
+    : QObject{parent}, conn_(conn)
+{
+    // 在接收线程中直接处理，窗口的归还不经过事件队列
+    connect(conn_.get(), &SR_Tool::recvMuxFrameOK, this, &MuxSession::handleFrame, Qt::DirectConnection);
+}
+
+MuxSession::~MuxSession() {
+    disconnect(conn_.get(), nullptr, this, nullptr);
+    // 唤醒等待窗口的发送
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto &it : streams_) {
+            it.second.closed = true;
+        }
+    }
+    cv_.notify_all();
+}
+
+void MuxSession::bind(const std::string &addr, int port, std::shared_ptr<MuxSession> session) {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    registry[{ addr, port }] = session;
+}
+
+void MuxSession::unbind(const std::string &addr, int port) {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    registry.erase({ addr, port });
+}
+
+std::shared_ptr<MuxSession> MuxSession::find(const std::string &addr, int port) {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    auto it = registry.find({ addr, port });
+    if (it == registry.end()) {
+        return nullptr;
+    }
+    return it->second.lock();
+}
+
+uint32_t MuxSession::openStream(std::shared_ptr<SR_Tool> tool) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint32_t stream_id = next_id_++;
+    if (next_id_ == 0) {
+        next_id_ = 1;
+    }
+    streams_[stream_id].tool = tool;
+    return stream_id;
+}
+
+void MuxSession::closeStream(uint32_t stream_id) {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (streams_.erase(stream_id) == 0) {
+            return;
+        }
+    }
+    cv_.notify_all();
+    sendControl(stream_id, MuxKind::MUX_CLOSE, 0);
+}
+
+void MuxSession::send(uint32_t stream_id, const char *data, size_t len, boost::system::error_code &ec) {
+    ProtocolHeader header;
+    if (!Serializer::deserialize(data, len, header)) {
+        ec = boost::asio::error::invalid_argument;
+        return;
+    }
+    // 只有文件数据占用窗口，窗口为正时发送（可以透支），控制类的协议单元不等待
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        auto window_ok = [this, stream_id] {
+            auto it = streams_.find(stream_id);
+            return it == streams_.end() || it->second.closed || it->second.send_window > 0;
+        };
+        if (header.type == ProtocolType::TRANDATAPDU_TYPE) {
+            cv_.wait(lock, window_ok);
+        }
+        auto it = streams_.find(stream_id);
+        if (it == streams_.end() || it->second.closed) {
+            ec = boost::asio::error::connection_reset;
+            return;
+        }
+        if (header.type == ProtocolType::TRANDATAPDU_TYPE) {
+            it->second.send_window -= static_cast<int64_t>(len);
+        }
+    }
+
+    MuxFrame frame;
+    frame.header.type = ProtocolType::MUXFRAME_TYPE;
+    frame.header.body_len = MUXFRAME_BODY_BASE_LEN + len;
+    frame.header.version = PROTOCOL_VERSION_V1;
+    frame.stream_id = stream_id;
+    frame.kind = MuxKind::MUX_DATA;
+    frame.data_len = len;
+    char head[MUXFRAME_HEAD_LEN];
+    size_t head_len = Serializer::serializeHead(frame, head);
+    conn_->send(head, head_len, data, len, ec);
+}
+
+void MuxSession::sendControl(uint32_t stream_id, uint32_t kind, uint32_t window) {
+    MuxFrame frame;
+    frame.header.type = ProtocolType::MUXFRAME_TYPE;
+    frame.header.body_len = MUXFRAME_BODY_BASE_LEN;
+    frame.header.version = PROTOCOL_VERSION_V1;
+    frame.stream_id = stream_id;
+    frame.kind = kind;
+    frame.window = window;
+    char head[MUXFRAME_HEAD_LEN];
+    size_t head_len = Serializer::serializeHead(frame, head);
+    boost::system::error_code ec;
+    conn_->send(head, head_len, ec);
+    if (ec) {
+        qDebug() << "MuxSession: send control frame failed:" << ec.message();
+    }
+}
+
+void MuxSession::handleFrame(std::shared_ptr<MuxFrame> frame) {
+    switch (frame->kind) {
+        case MuxKind::MUX_WINDOW: {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto it = streams_.find(frame->stream_id);
+                if (it != streams_.end()) {
+                    it->second.send_window += frame->window;
+                }
+            }
+            cv_.notify_all();
+            break;
+        }
+        case MuxKind::MUX_CLOSE: {
+            // 服务端关闭了流（拒绝或出错），通知对应的工具
+            std::shared_ptr<SR_Tool> tool;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto it = streams_.find(frame->stream_id);
+                if (it == streams_.end()) {
+                    break;
+                }
+                it->second.closed = true;
+                tool = it->second.tool.lock();
+            }
+            cv_.notify_all();
+            if (tool) {
+                emit tool->error("transfer stream closed by server");
+            }
+            break;
+        }
+        case MuxKind::MUX_DATA: {
+            std::shared_ptr<SR_Tool> tool;
+            uint32_t credit = 0;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto it = streams_.find(frame->stream_id);
+                if (it == streams_.end()) {   // 已经关闭的流，丢弃
+                    break;
+                }
+                tool = it->second.tool.lock();
+                // 交给工具后即归还窗口（工具的槽函数在自己的线程中排队处理），累计达到半个窗口时一次归还
+                ProtocolHeader header;
+                if (Serializer::deserialize(frame->data.data(), frame->data.size(), header) && header.type == ProtocolType::TRANDATAPDU_TYPE) {
+                    it->second.recv_released += frame->data.size();
+                    if (it->second.recv_released >= MUX_INITIAL_WINDOW / 2) {
+                        credit = it->second.recv_released;
+                        it->second.recv_released = 0;
+                    }
+                }
+            }
+            if (tool) {
+                tool->dispatchProtocol(frame->data.data(), frame->data.size());
+            }
+            if (credit > 0) {
+                sendControl(frame->stream_id, MuxKind::MUX_WINDOW, credit);
+            }
+            break;
+        }
+        default: {
+            qDebug() << "MuxSession: unknown mux frame kind" << frame->kind;
+            break;
+        }
+    }
+}
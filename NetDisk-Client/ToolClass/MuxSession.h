@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include <QObject>
+#include <boost/system/error_code.hpp>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <map>
+#include <string>
+#include "protocol.h"
+
+class SR_Tool;
+
+// 多路复用会话：传输任务（上传、下载）不再各自连接服务端的长任务端口，而是作为流在已登录的短任务连接上收发（见 protocol.h 的 MuxFrame）
+// 会话按服务端地址和长任务端口登记，之后为该地址创建的 SR_Tool 自动使用流，上传下载工具不需要修改；没有登记时仍然使用独立的连接
+class MuxSession : public QObject, public std::enable_shared_from_this<MuxSession>
+{
+    Q_OBJECT
+
+public:
+    // conn 为已登录并且开始接收（asyncRecvProtocol）的短任务连接
+    explicit MuxSession(std::shared_ptr<SR_Tool> conn, QObject *parent = nullptr);
+    ~MuxSession();
+
+    // 登记会话，之后为 addr:port 创建的 SR_Tool 使用该会话
+    static void bind(const std::string &addr, int port, std::shared_ptr<MuxSession> session);
+    static void unbind(const std::string &addr, int port);
+    static std::shared_ptr<MuxSession> find(const std::string &addr, int port);
+
+    uint32_t openStream(std::shared_ptr<SR_Tool> tool);     // 打开流，返回流ID（服务端收到第一个协议单元时创建流）
+    void closeStream(uint32_t stream_id);                   // 关闭流并通知服务端，可以重复调用
+    // 在流上发送一个完整的协议单元，文件数据（TranDataPdu）等待发送窗口
+    void send(uint32_t stream_id, const char *data, size_t len, boost::system::error_code &ec);
+
+private:
+    void handleFrame(std::shared_ptr<MuxFrame> frame);      // 处理短任务连接收到的多路复用帧（在短任务连接的接收线程中调用）
+    void sendControl(uint32_t stream_id, uint32_t kind, uint32_t window);   // 发送 MUX_WINDOW、MUX_CLOSE
+
+private:
+    struct Stream {
+        std::weak_ptr<SR_Tool> tool;                // 流对应的收发工具，收到的协议单元由它发出信号
+        int64_t send_window = MUX_INITIAL_WINDOW;   // 发送窗口，可以透支，为正时才能发送文件数据
+        uint32_t recv_released = 0;                 // 已经交给工具、还没有归还的字节数
+        bool closed = false;                        // 服务端已经关闭该流
+    };
+
+    std::shared_ptr<SR_Tool> conn_;     // 短任务连接
+    std::mutex mtx_;                    // 保护 streams_ 和 next_id_
+    std::condition_variable cv_;        // 等待发送窗口
+    std::unordered_map<uint32_t, Stream> streams_;
+    uint32_t next_id_ = 1;              // 下一个流ID（0 不使用）
+};
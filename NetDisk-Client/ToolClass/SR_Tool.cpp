@@ -1,8 +1,59 @@
 ﻿#include "SR_Tool.h"
 #include "Serializer.h"
 #include "BufferPool.h"
+#include "Compressor.h"
+#include "MuxSession.h"
 #include <thread>
 #include <chrono>
+#include <array>
+#include <map>
+#include <mutex>
+
+namespace {
+
+// TLS 会话缓存（进程内共享）：按服务器地址和端口保存最近收到的会话票据，之后连接同一服务器时恢复会话，只做简短握手
+std::mutex session_mtx;
+std::map<std::string, SSL_SESSION*> sessions;
+
+// 握手统计：完整握手和恢复会话的次数、总耗时（微秒）
+std::atomic<uint64_t> full_handshakes{ 0 };
+std::atomic<uint64_t> resumed_handshakes{ 0 };
+std::atomic<uint64_t> full_handshake_us{ 0 };
+std::atomic<uint64_t> resumed_handshake_us{ 0 };
+
+std::string sessionKey(const boost::asio::ip::tcp::endpoint &ep) {
+    return ep.address().to_string() + ":" + std::to_string(ep.port());
+}
+
+// 连接前设置缓存的会话，服务器不接受（票据过期、服务器重启）时自动退回完整握手
+void applySession(SSL *ssl, const std::string &key) {
+    std::lock_guard<std::mutex> lock(session_mtx);
+    auto it = sessions.find(key);
+    if (it != sessions.end()) {
+        SSL_set_session(ssl, it->second);
+    }
+}
+
+void recordHandshake(SSL *ssl, std::chrono::steady_clock::time_point start) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    bool resumed = (SSL_session_reused(ssl) == 1);
+    if (resumed) {
+        ++resumed_handshakes;
+        resumed_handshake_us += us;
+    }
+    else {
+        ++full_handshakes;
+        full_handshake_us += us;
+    }
+    uint64_t full = full_handshakes.load();
+    uint64_t resumed_count = resumed_handshakes.load();
+    qDebug() << "TLS handshake:" << (resumed ? "resumed" : "full") << us << "us, full/resumed:"
+             << full << "/" << resumed_count << ", average us:"
+             << (full == 0 ? 0 : full_handshake_us.load() / full) << "/"
+             << (resumed_count == 0 ? 0 : resumed_handshake_us.load() / resumed_count);
+}
+
+}
 
 SR_Tool::SR_Tool(const std::string &ep_addr, const int &ep_port, QObject *parent)
     : QObject(parent), ep_(boost::asio::ip::make_address(ep_addr), ep_port)
@@ -12,7 +63,13 @@ SR_Tool::SR_Tool(const std::string &ep_addr, const int &ep_port, QObject *parent
     ssl_context_ = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tlsv13_client);
     // 配置 SSL 上下文，使其使用系统默认的证书路径来验证服务器证书。这样可以确保客户端信任操作系统预安装的根证书颁发机构（CA）
     ssl_context_->set_default_verify_paths();
+    // TLS1.3 的会话票据在握手之后才到达，由回调保存到会话缓存
+    SSL_CTX_set_session_cache_mode(ssl_context_->native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_context_->native_handle(), &SR_Tool::saveSession);
     ssl_sock_ = std::make_shared<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>>(*context_.get(), *ssl_context_.get());
+    SSL_set_app_data(ssl_sock_->native_handle(), this);
+    // 对端登记了多路复用会话时使用流模式
+    mux_ = MuxSession::find(ep_addr, ep_port);
 
     run_threads_.clear();
 }
@@ -39,16 +96,53 @@ SR_Tool::~SR_Tool() {
 
 // 同步连接，完成后的连接状态保存在 ec
 void SR_Tool::connect(boost::system::error_code &ec) {
+    if (mux_) {     // 流模式不建立连接，只分配流ID
+        stream_id_ = mux_->openStream(shared_from_this());
+        ec.clear();
+        return;
+    }
     // 由于 SSL 是 TCP 之上的协议，因此要先执行 TCP 握手，在执行 SSL 握手
     ssl_sock_->lowest_layer().connect(ep_, ec);     // 底层（TCP）套接字连接
+    applySession(ssl_sock_->native_handle(), sessionKey(ep_));
+    auto start = std::chrono::steady_clock::now();
     ssl_sock_->handshake(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>::client, ec);    // ssl 握手，第一个参数指定是客户端（区别于服务端）
+    if (!ec) {
+        recordHandshake(ssl_sock_->native_handle(), start);
+    }
+}
+
+// 保存服务器发来的会话，返回1表示持有该会话的引用
+int SR_Tool::saveSession(SSL *ssl, SSL_SESSION *session) {
+    SR_Tool *self = static_cast<SR_Tool*>(SSL_get_app_data(ssl));
+    if (self == nullptr || SSL_SESSION_is_resumable(session) != 1) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(session_mtx);
+    SSL_SESSION *&cached = sessions[sessionKey(self->ep_)];
+    if (cached != nullptr) {
+        SSL_SESSION_free(cached);
+    }
+    cached = session;
+    return 1;
 }
 
-// 同步发送，完成后的连接状态保存在 ec，（有问题：不一定能全部写入）
-void SR_Tool::send(char *buf, size_t len, boost::system::error_code &ec) {
+// 同步发送，完成后的连接状态保存在 ec
+void SR_Tool::send(const char *buf, size_t len, boost::system::error_code &ec) {
+    if (mux_) {
+        mux_->send(stream_id_, buf, len, ec);
+        return;
+    }
     // asio的io操作统一了类型，该类型需要满足MutableBufferSequence
     // 但我们不需要自己实现，使用boost::asio::buffer封装要发送的资源
-    ssl_sock_->write_some(boost::asio::buffer(buf, len), ec);
+    // write_some 不一定能全部写入，使用 boost::asio::write 循环写入；多个流共享连接时加锁，一个协议单元不会被其它发送打断
+    std::lock_guard<FairMutex> lock(send_mutex_);
+    boost::asio::write(*ssl_sock_.get(), boost::asio::buffer(buf, len), ec);
+}
+
+void SR_Tool::send(const char *head, size_t head_len, const char *data, size_t len, boost::system::error_code &ec) {
+    std::array<boost::asio::const_buffer, 2> bufs = { boost::asio::buffer(head, head_len), boost::asio::buffer(data, len) };
+    std::lock_guard<FairMutex> lock(send_mutex_);
+    boost::asio::write(*ssl_sock_.get(), bufs, ec);
 }
 
 // 同步接收，完成后的连接状态保存在 ec
@@ -74,7 +168,7 @@ boost::asio::ip::tcp::endpoint SR_Tool::getEndpoint() {
 bool SR_Tool::sendPDU(const PDU &pdu) {
     auto buf = Serializer::serialize(pdu);  // 序列化
     boost::system::error_code ec;
-    send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+    send(buf.get(), Serializer::encodedLen(pdu), ec);
 
     if (ec) {  // 出错问题
         emit error(QString::fromStdString("send error " + ec.message()));
@@ -151,10 +245,13 @@ void SR_Tool::asyncConnect(std::function<void()> fun) {
                 );
 
                 // 连接成功，进行SSL握手
+                applySession(self->ssl_sock_->native_handle(), sessionKey(self->ep_));
+                auto start = std::chrono::steady_clock::now();
                 co_await self->ssl_sock_->async_handshake(
                     boost::asio::ssl::stream<boost::asio::ip::tcp::socket>::client,
                     boost::asio::use_awaitable
                 );
+                recordHandshake(self->ssl_sock_->native_handle(), start);
 
                 // 握手成功，调用处理函数
                 if (fun) {
@@ -175,6 +272,20 @@ void SR_Tool::asyncConnect(std::function<void()> fun) {
 // 异步发送数据，成功调用 fun，fun 未定义，调用 sendHandler
 void SR_Tool::asyncSend(buffer_shared_ptr buf, size_t len, std::function<void()> fun) {
     auto self = shared_from_this();
+    if (mux_) {     // 流模式通过会话同步发送
+        boost::system::error_code ec;
+        send(buf.get(), len, ec);
+        if (ec) {
+            emit error(QString::fromStdString("send error " + ec.message()));
+        }
+        else if (fun) {
+            fun();
+        }
+        else {
+            sendHandler(len);
+        }
+        return;
+    }
 
     // 启动协程
     boost::asio::co_spawn(
@@ -235,7 +346,7 @@ void SR_Tool::asyncRecv(buffer_shared_ptr buf, size_t len, std::function<void ()
     );
 }
 
-void SR_Tool::asyncSendFileData(UpContext &file_ctx) {
+void SR_Tool::asyncSendFileData(UpContext &file_ctx, std::vector<uint32_t> send_id, bool resend) {
     if (!file_ctx.file.isOpen()) {
         emit error("upload file data error: file not open");
         return;
@@ -252,8 +363,35 @@ void SR_Tool::asyncSendFileData(UpContext &file_ctx) {
 
     boost::asio::co_spawn(
         ssl_sock_->get_executor(),  // 使用套接字关联的执行器
-        [self, &file_ctx]() -> boost::asio::awaitable<void> {
-            for (uint32_t cur_chunk_id=0; cur_chunk_id<file_ctx.total_chunks; ++cur_chunk_id) {
+        [self, &file_ctx, send_id = std::move(send_id), resend]() -> boost::asio::awaitable<void> {
+            // 每个发送任务使用自己的文件对象，多个连接并行发送时不会互相影响读取位置
+            QFile file(file_ctx.file_name);
+            if (!file.open(QIODevice::ReadOnly)) {
+                emit self->error("send file data error: open file faild");
+                co_return;
+            }
+            // 按协商的压缩方式压缩每个分片，不划算的分片原样发送
+            Compressor compressor(file_ctx.compress);
+            std::string packed;
+            // 只发送需要发送的chunk（断点续传时跳过服务端已经接收的chunk），之后发送服务端要求重传的chunk
+            size_t next = 0;
+            while (true) {
+                uint32_t cur_chunk_id = 0;
+                if (next < send_id.size()) {
+                    cur_chunk_id = send_id[next++];
+                }
+                else if (resend) {
+                    std::lock_guard<std::mutex> lock(file_ctx.resend_mtx);
+                    if (file_ctx.resend_id.empty()) {
+                        file_ctx.resending = false;     // 之后的重传由新的发送任务完成
+                        break;
+                    }
+                    cur_chunk_id = file_ctx.resend_id.front();
+                    file_ctx.resend_id.pop_front();
+                }
+                else {
+                    break;
+                }
                 try {
                     // 防止一直占用cpu
                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
@@ -271,17 +409,29 @@ void SR_Tool::asyncSendFileData(UpContext &file_ctx) {
                     // pdu.check_sum = 0;
 
                     // 读取文件数据
-                    if (!file_ctx.file.isOpen()) {
+                    if (!file.isOpen()) {
                         emit self->error("send file data error: file not open");
                         co_return;
                     }
-                    file_ctx.file.seek(pdu.file_offset);
-                    QByteArray byte_chunk = file_ctx.file.read(pdu.chunk_size);
+                    file.seek(pdu.file_offset);
+                    QByteArray byte_chunk = file.read(pdu.chunk_size);
                     if (byte_chunk.size() != pdu.chunk_size) {
                         emit self->error("send file data error: read file data faild");
                         co_return;
                     }
-                    pdu.data.assign(byte_chunk.constData(), pdu.chunk_size);
+                    pdu.status = compressor.compress(byte_chunk.constData(), byte_chunk.size(), packed);
+                    // 直接引用读取的文件块或压缩缓冲区，序列化时只复制一次
+                    if (pdu.status != Compression::COMPRESS_NONE) {
+                        pdu.view = packed;
+                    }
+                    else {
+                        pdu.view = std::string_view(byte_chunk.constData(), byte_chunk.size());
+                    }
+                    // 压缩后分片大小为实际发送的数据长度
+                    pdu.chunk_size = pdu.view.size();
+                    pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+                    file_ctx.raw_bytes += byte_chunk.size();
+                    file_ctx.wire_bytes += pdu.chunk_size;
 
                     // 传输控制
                     if (file_ctx.ctrl->load() == 1) {       // 为 1 则暂停等待
@@ -296,9 +446,18 @@ void SR_Tool::asyncSendFileData(UpContext &file_ctx) {
 
                     // 发送数据
                     auto buf = Serializer::serialize(pdu);
+                    if (self->mux_) {   // 流模式等待发送窗口后通过会话发送
+                        boost::system::error_code ec;
+                        self->mux_->send(self->stream_id_, buf.get(), Serializer::encodedLen(pdu), ec);
+                        if (ec) {
+                            emit self->error(QString::fromStdString("send file data error " + ec.message()));
+                            co_return;
+                        }
+                        continue;
+                    }
                     size_t bytes_transferred = co_await boost::asio::async_write(
                         *self->ssl_sock_.get(),
-                        boost::asio::buffer(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len),
+                        boost::asio::buffer(buf.get(), Serializer::encodedLen(pdu)),
                         boost::asio::use_awaitable
                     );
 
@@ -317,6 +476,9 @@ void SR_Tool::asyncSendFileData(UpContext &file_ctx) {
 
 // 接受服务端发送过来的通信协议，keep 表示是否持续接受
 void SR_Tool::asyncRecvProtocol(bool keep, size_t header_len) {
+    if (mux_) {     // 流模式由会话接收并调用 dispatchProtocol
+        return;
+    }
     auto self = shared_from_this();
 
     boost::asio::co_spawn(
@@ -347,6 +509,17 @@ void SR_Tool::asyncRecvProtocol(bool keep, size_t header_len) {
                         emit self->error("recv Protocol failed: no body");
                         co_return;
                     }
+                    // 多路复用帧中是一个完整的协议单元，比协议单元多一个帧头
+                    if (header_len + header.body_len > (header.type == ProtocolType::MUXFRAME_TYPE ? MAX_MUXFRAME_LEN : MAX_PDU_LEN)) {
+                        emit self->error("recv Protocol failed: body too long");
+                        co_return;
+                    }
+                    // 回复体（块签名、批量上传结果等）超过单个缓冲区时，换一个足够大的缓冲区
+                    if (header_len + header.body_len > BufferPool::getInstance().getBufferSize()) {
+                        auto large_buf = BufferPool::getInstance().acquire(header_len + header.body_len);
+                        memcpy(large_buf.get(), buf.get(), header_len);
+                        buf = large_buf;
+                    }
 
                     // 读取协议体（异步）
                     bytes_transferred = co_await boost::asio::async_read(
@@ -360,69 +533,7 @@ void SR_Tool::asyncRecvProtocol(bool keep, size_t header_len) {
                         co_return;
                     }
 
-                    // 根据header类型，反序列化并发送信号
-                    switch (header.type) {
-                        case ProtocolType::PDU_TYPE: {
-                            std::shared_ptr<PDU> pdu = std::make_shared<PDU>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvPDUOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::PDURESPOND_TYPE: {
-                            std::shared_ptr<PDURespond> pdu = std::make_shared<PDURespond>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvPDURespondOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::TRANPDU_TYPE: {
-                            std::shared_ptr<TranPdu> pdu = std::make_shared<TranPdu>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvTranPduOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::TRANDATAPDU_TYPE: {
-                            std::shared_ptr<TranDataPdu> pdu = std::make_shared<TranDataPdu>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvTranDataPduOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::TRANFINISHPDU_TYPE: {
-                            std::shared_ptr<TranFinishPdu> pdu = std::make_shared<TranFinishPdu>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvTranFinishPduOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::RESPONDPACK_TYPE: {
-                            std::shared_ptr<RespondPack> pdu = std::make_shared<RespondPack>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvRespondPackOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::USERINFO_TYPE: {
-                            std::shared_ptr<UserInfo> pdu = std::make_shared<UserInfo>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvUserInfoOK(pdu);
-                            }
-                            break;
-                        }
-                        case ProtocolType::FILEINFO_TYPE: {
-                            std::shared_ptr<FileInfo> pdu = std::make_shared<FileInfo>();
-                            if (Serializer::deserialize(buf.get(), header_len+header.body_len, *pdu)) {
-                                emit self->recvFileInfoOK(pdu);
-                            }
-                            break;
-                        }
-                        default: {
-                            emit self->error("unknown ProtocolType");
-                            break;
-                        }
-                    }
+                    self->dispatchProtocol(buf.get(), header_len + header.body_len);
                 }
                 catch (const boost::system::system_error& e) {
                     emit self->error(QString::fromLocal8Bit(e.what()));
@@ -437,6 +548,84 @@ void SR_Tool::asyncRecvProtocol(bool keep, size_t header_len) {
     );
 }
 
+// 根据协议头的类型反序列化，并发送对应的信号
+void SR_Tool::dispatchProtocol(const char *buf, size_t len) {
+    ProtocolHeader header;
+    if (!Serializer::deserialize(buf, len, header)) {
+        emit error("deserialize ProtocolHeader failed");
+        return;
+    }
+    switch (header.type) {
+        case ProtocolType::PDU_TYPE: {
+            std::shared_ptr<PDU> pdu = std::make_shared<PDU>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvPDUOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::PDURESPOND_TYPE: {
+            std::shared_ptr<PDURespond> pdu = std::make_shared<PDURespond>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvPDURespondOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::TRANPDU_TYPE: {
+            std::shared_ptr<TranPdu> pdu = std::make_shared<TranPdu>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvTranPduOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::TRANDATAPDU_TYPE: {
+            std::shared_ptr<TranDataPdu> pdu = std::make_shared<TranDataPdu>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvTranDataPduOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::TRANFINISHPDU_TYPE: {
+            std::shared_ptr<TranFinishPdu> pdu = std::make_shared<TranFinishPdu>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvTranFinishPduOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::RESPONDPACK_TYPE: {
+            std::shared_ptr<RespondPack> pdu = std::make_shared<RespondPack>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvRespondPackOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::USERINFO_TYPE: {
+            std::shared_ptr<UserInfo> pdu = std::make_shared<UserInfo>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvUserInfoOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::FILEINFO_TYPE: {
+            std::shared_ptr<FileInfo> pdu = std::make_shared<FileInfo>();
+            if (Serializer::deserialize(buf, len, *pdu)) {
+                emit recvFileInfoOK(pdu);
+            }
+            break;
+        }
+        case ProtocolType::MUXFRAME_TYPE: {
+            std::shared_ptr<MuxFrame> frame = std::make_shared<MuxFrame>();
+            if (Serializer::deserialize(buf, len, *frame)) {
+                emit recvMuxFrameOK(frame);
+            }
+            break;
+        }
+        default: {
+            emit error("unknown ProtocolType");
+            break;
+        }
+    }
+}
+
 // 开始异步任务
 void SR_Tool::SR_run() {
     running_ = true;
@@ -476,6 +665,10 @@ void SR_Tool::SR_run_local() {
 
 // 结束异步任务
 void SR_Tool::SR_stop() {
+    // 流模式下结束异步任务即传输结束，关闭流
+    if (mux_ && stream_id_ != 0) {
+        mux_->closeStream(stream_id_);
+    }
     running_ = false;
     for (auto& th : run_threads_) {
         if (th.joinable()) {
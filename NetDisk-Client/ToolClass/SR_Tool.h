@@ -8,6 +8,9 @@
 #include "UdTool.h"
 #include "Serializer.h"
 #include "protocol.h"
+#include "FairMutex.h"
+
+class MuxSession;
 
 // 普通套接字共享指针
 using socket_ptr = std::shared_ptr<boost::asio::ip::tcp::socket>;
@@ -16,6 +19,7 @@ using sslsock_ptr = std::shared_ptr<boost::asio::ssl::stream<boost::asio::ip::tc
 
 
 // 用于简易处理与服务端交互的工具，网络收发使用Asio库实现.可使用同步发送和异步发送
+// 对端地址登记了多路复用会话（MuxSession）时为流模式：不建立连接，收发都通过会话的短任务连接（见 MuxSession.h）
 class SR_Tool : public QObject, public std::enable_shared_from_this<SR_Tool>
 {
     Q_OBJECT
@@ -27,7 +31,9 @@ public:
 public:
     // 同步操作，传递一个boost::system::error_code，结果放在ec
     void connect(boost::system::error_code& ec);                        // 同步连接
-    void send(char* buf, size_t len, boost::system::error_code& ec);    // 同步发送
+    void send(const char* buf, size_t len, boost::system::error_code& ec);    // 同步发送，写入全部数据
+    // 同步发送头部和数据（多路复用帧），两部分在一次加锁中写入，不会与其它发送交错
+    void send(const char* head, size_t head_len, const char* data, size_t len, boost::system::error_code& ec);
     void recv(char* buf, size_t len, boost::system::error_code& ec);    // 同步接收
     boost::asio::ssl::stream<boost::asio::ip::tcp::socket>* getSSL();   // 返回ssl指针
     boost::asio::ip::tcp::endpoint getEndpoint();                       // 返回对端对象
@@ -45,10 +51,13 @@ public:
     void asyncSend(buffer_shared_ptr buf, size_t len, std::function<void()> fun = nullptr);
     // 异步接收数据，fun 为接收成功后的回调函数，默认使用 recvHandler
     void asyncRecv(buffer_shared_ptr buf, size_t len, std::function<void()> fun = nullptr);
-    // 异步发送文件数据
-    void asyncSendFileData(UpContext& file_ctx);
+    // 异步发送文件数据，只发送 send_id 中的chunk（多连接上传时每个连接发送不同的部分）
+    // resend 为 true 时（只用于主连接），发送完 send_id 后继续发送 file_ctx.resend_id 中需要重传的chunk，直到为空
+    void asyncSendFileData(UpContext& file_ctx, std::vector<uint32_t> send_id, bool resend = false);
     // 异步接受服务端发送的通信协议，keep 表示是否持续接收
     void asyncRecvProtocol(bool keep = false, size_t header_len = PROTOCOLHEADER_LEN);
+    // 反序列化一个完整的协议单元并发出对应的信号（流模式下由多路复用会话调用）
+    void dispatchProtocol(const char* buf, size_t len);
 
 
     void SR_run();      // 在新线程开始异步任务
@@ -70,6 +79,11 @@ signals:
     void recvRespondPackOK(std::shared_ptr<RespondPack> pdu);
     void recvUserInfoOK(std::shared_ptr<UserInfo> pdu);
     void recvFileInfoOK(std::shared_ptr<FileInfo> pdu);
+    void recvMuxFrameOK(std::shared_ptr<MuxFrame> frame);
+
+private:
+    // 收到新的TLS会话（票据）时由 OpenSSL 调用，保存到会话缓存供之后的连接恢复
+    static int saveSession(SSL* ssl, SSL_SESSION* session);
 
 private:
     //异步回调函数
@@ -84,4 +98,7 @@ private:
     boost::asio::ip::tcp::endpoint ep_;     // 保存对端地址和端口信息，即服务器地址和端口
     std::vector<std::thread> run_threads_;  // 运行（执行中context_->run()）的线程
     std::atomic<bool> running_ = true;
+    FairMutex send_mutex_;                  // 同步发送锁，多个流在短任务连接上按申请顺序轮流发送
+    std::shared_ptr<MuxSession> mux_;       // 多路复用会话，为空时使用独立的连接
+    uint32_t stream_id_ = 0;                // 流模式下的流ID，连接（connect）时分配
 };
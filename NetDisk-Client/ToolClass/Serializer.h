@@ -1,98 +1,66 @@
 ﻿#ifndef SERIALIZER_H
 #define SERIALIZER_H
 
-#include <QtEndian>
 #include <memory>
+#include <stdexcept>
 #include "protocol.h"
 
 using buffer_shared_ptr = std::shared_ptr<char[]>;
 
 // 序列化工具
+// 各结构体的字段在 protocol.h 的字段表中声明一次，编解码由 WireFormat.h 在编译期生成（与服务端共用），这里负责缓冲区和错误处理
 class Serializer {
 public:
+    // 序列化协议结构体（头部+body），超过单个缓冲区大小时单独分配，检查失败抛出错误
+    template <typename T>
+    static buffer_shared_ptr serialize(const T& pdu);
+    // 序列化到调用者提供的缓冲区（容量cap），返回写入的字节数
+    template <typename T>
+    static size_t serializeInto(const T& pdu, char* out, size_t cap);
+    // 反序列化，类型错误或数据不完整返回false
+    template <typename T>
+    static bool deserialize(const char* buf, size_t len, T& pdu) {
+        return wire::deserialize(buf, len, pdu);
+    }
+    // 按 header.version 编码后的总长度（v2 的长度与 body_len 无关），发送 serialize 的结果时使用
+    template <typename T>
+    static size_t encodedLen(const T& pdu) {
+        return wire::encodedLen(pdu);
+    }
+
     // 序列化与反序列化ProtocolHeader
     static buffer_shared_ptr serialize(const ProtocolHeader& header);
     static bool deserialize(const char* buf, size_t len, ProtocolHeader& header);
 
-    // 序列化与反序列化PDU
-    static buffer_shared_ptr serialize(const PDU& pdu);
-    static bool deserialize(const char* buf, size_t len, PDU& pdu);
-
-    // 序列化与反序列化PDURespond
-    static buffer_shared_ptr serialize(const PDURespond& pdu);
-    static bool deserialize(const char* buf, size_t len, PDURespond& pdu);
-
-    // 序列化与反序列化TranPdu
-    static buffer_shared_ptr serialize(const TranPdu& pdu);
-    static bool deserialize(const char* buf, size_t len, TranPdu& pdu);
-
-    // 序列化与反序列化TranDataPdu
+    // TranDataPdu 序列化时计算数据的校验和
     static buffer_shared_ptr serialize(const TranDataPdu& pdu);
-    static bool deserialize(const char* buf, size_t len, TranDataPdu& pdu);
-
-    // 序列化与反序列化TranFinishPdu
-    static buffer_shared_ptr serialize(const TranFinishPdu& pdu);
-    static bool deserialize(const char* buf, size_t len, TranFinishPdu& pdu);
+    static size_t serializeInto(const TranDataPdu& pdu, char* out, size_t cap);
 
-    // 序列化与反序列化TranControlPdu
-    static buffer_shared_ptr serialize(const TranControlPdu& pdu);
-    static bool deserialize(const char* buf, size_t len, TranControlPdu& pdu);
-
-    // 序列化与反序列化RespondPack
-    static buffer_shared_ptr serialize(const RespondPack& pdu);
-    static bool deserialize(const char* buf, size_t len, RespondPack& pdu);
-
-    // 序列化与反序列化UserInfo
-    static buffer_shared_ptr serialize(const UserInfo& pdu);
-    static bool deserialize(const char* buf, size_t len, UserInfo& pdu);
-
-    // 序列化与反序列化FileInfo
-    static buffer_shared_ptr serialize(const FileInfo& pdu);
-    static bool deserialize(const char* buf, size_t len, FileInfo& pdu);
-
-    // 序列化与反序列化ServerInfoPack
-    static buffer_shared_ptr serialize(const ServerInfoPack& pdu);
-    static bool deserialize(const char* buf, size_t len, ServerInfoPack& pdu);
-
-    // 将data的len字节写入ptr，返回写入的字节(len)
-    static size_t writeData(char* ptr, const char* data, size_t len) {
-        memcpy(ptr, data, len);
-        return len;
-    }
+    // 只序列化MuxFrame的头部和固定字段（长度为 MUXFRAME_HEAD_LEN），流上的协议单元（data_len 字节）由调用者紧跟着发送
+    static size_t serializeHead(const MuxFrame& frame, char* out);
 
-    // 16位字节序转换函数
-    static uint16_t htons(uint16_t host32) {
-        return qToBigEndian<uint16_t>(host32);
-    }
-
-    static uint16_t ntohs(uint16_t net32) {
-        return qFromBigEndian<uint16_t>(net32);
-    }
-
-    // 32位字节序转换函数
-    static uint32_t htonl(uint32_t host32) {
-        return qToBigEndian<uint32_t>(host32);
-    }
-
-    static uint32_t ntohl(uint32_t net32) {
-        return qFromBigEndian<uint32_t>(net32);
-    }
-
-    // 64位字节序转换函数
-    static uint64_t htonll(uint64_t host64) {
-        static const int num = 42;
-        if (*reinterpret_cast<const char*>(&num) == 42) { // 小端序
-            return ((uint64_t)htonl(host64 & 0xFFFFFFFF) << 32) | htonl(host64 >> 32);
-        }
-        else { // 大端序
-            return host64;
-        }
-    }
-
-    static uint64_t ntohll(uint64_t net64) {
-        return htonll(net64); // 转换逻辑相同
-    }
+private:
+    static buffer_shared_ptr acquire(size_t total_len);     // 申请能容纳 total_len 字节的缓冲区
+    static void check(wire::Error err);                     // 检查失败时抛出错误
 };
 
+template <typename T>
+buffer_shared_ptr Serializer::serialize(const T& pdu) {
+    const wire::Measure<T> m = wire::measure(pdu);  // 总长度，头部+body长度，测量结果在编码时复用
+    auto buf = acquire(m.total_len);
+    wire::Error err = wire::Error::NONE;
+    wire::serializeInto(pdu, m, buf.get(), m.total_len, err);
+    check(err);
+    return buf; // 自动归还到池
+}
+
+template <typename T>
+size_t Serializer::serializeInto(const T& pdu, char* out, size_t cap) {
+    wire::Error err = wire::Error::NONE;
+    size_t len = wire::serializeInto(pdu, out, cap, err);
+    check(err);
+    return len;
+}
+
 
 #endif // SERIALIZER_H
@@ -2,8 +2,6 @@
 
 ShortTaskManager::ShortTaskManager(std::shared_ptr<SR_Tool> sr_tool, std::shared_ptr<TaskQue> task_queue, QObject* parent)
     : QObject(parent)
-    , file_cnt_(0)
-    , file_vet_(std::make_shared<std::vector<FileInfo>>(0))
     , sr_tool_(sr_tool)
     , task_queue_(task_queue)
 {
@@ -17,22 +15,20 @@ ShortTaskManager::~ShortTaskManager() {
 
 // 获取文件列表
 void ShortTaskManager::getFileList() {
-    {
-        std::lock_guard<std::mutex> lock(file_mutex_);
-        if (file_cnt_ != 0) {   // 不等于0说明，之前的操作没有执行完，因此拒绝执行
-            emit error("getFileList(): can't execute");
-            return;
-        }
-    }
+    // 不需要等待之前的CD执行完，每个请求的文件列表按请求ID分别接收
     bool status{false};
     // 发送请求
     PDU pdu;
     pdu.header.type = ProtocolType::PDU_TYPE;
+    pdu.header.version = PROTOCOL_VERSION_V2;
+    pdu.header.request_id = nextRequestId();
     pdu.header.body_len = PDU_BODY_BASE_LEN;
     pdu.code = Code::CD;
     // !!!!!!!!!!!!!!!!!!!! 可改为异步发送 !!!!!!!!!!!!!!!!!!!!!!!!!!
     status = sr_tool_->sendPDU(pdu);
     if (false == status) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_lists_.erase(pdu.header.request_id);   // 发送失败前可能已经收到（旧的）文件信息，一起丢弃
         emit error("getFileList(): send pdu error");
         return;
     }
@@ -45,6 +41,8 @@ void ShortTaskManager::makeDir(quint64 parent_id, QString new_dir_name) {
     // 发送请求
     PDU pdu;
     pdu.header.type = ProtocolType::PDU_TYPE;
+    pdu.header.version = PROTOCOL_VERSION_V2;
+    pdu.header.request_id = nextRequestId();
     pdu.header.body_len = PDU_BODY_BASE_LEN;
     pdu.code = Code::MAKEDIR;
 
@@ -60,7 +58,15 @@ void ShortTaskManager::makeDir(quint64 parent_id, QString new_dir_name) {
     memcpy(pdu.file_name, dir_name_bytes.data(), dir_name_bytes.size());    // 复制文件夹名到 pdu.file_name
     memcpy(pdu.msg, (char*)&pid, sizeof(pid));  // 复制父文件夹ID到 pdu.msg
 
-    sr_tool_->sendPDU(pdu); // 发送
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_[pdu.header.request_id] = new_dir_name;   // 回复可能在发送返回前到达，先记录
+    }
+    if (!sr_tool_->sendPDU(pdu)) {  // 发送
+        takePending(pdu.header.request_id);
+        emit error("makeDir(): send pdu error");
+        return;
+    }
 
     qDebug() << "send make dir request ok";
 }
@@ -69,6 +75,8 @@ void ShortTaskManager::makeDir(quint64 parent_id, QString new_dir_name) {
 void ShortTaskManager::delFile(quint64 file_id, QString file_name) {
     PDU pdu;
     pdu.header.type = ProtocolType::PDU_TYPE;
+    pdu.header.version = PROTOCOL_VERSION_V2;
+    pdu.header.request_id = nextRequestId();
     pdu.header.body_len = PDU_BODY_BASE_LEN;
     pdu.code = Code::DELETEFILE;
     pdu.msg_len = 0;
@@ -83,12 +91,102 @@ void ShortTaskManager::delFile(quint64 file_id, QString file_name) {
     memcpy(pdu.pwd, (char*)&file_id, sizeof(file_id));  // 复制文件ID到 pdu.pwd
     memcpy(pdu.file_name, file_name_bytes.data(), file_name_bytes.size());  // 复制文件名到 pdu.filename
 
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_[pdu.header.request_id] = file_name;
+    }
     // 发送 PDU 请求
-    sr_tool_->sendPDU(pdu);
+    if (!sr_tool_->sendPDU(pdu)) {
+        takePending(pdu.header.request_id);
+        emit error("delFile(): send pdu error");
+        return;
+    }
 
     qDebug() << "send delete file request ok";
 }
 
+// 批量删除
+void ShortTaskManager::batchDelete(const std::vector<quint64>& ids) {
+    for (size_t begin = 0; begin < ids.size(); begin += MAX_BATCH_OP_ITEMS) {
+        size_t end = std::min(ids.size(), begin + MAX_BATCH_OP_ITEMS);
+        std::string data;
+        data.reserve((end - begin) * sizeof(uint64_t));
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t id = htonll(ids[i]);
+            data.append((char*)&id, sizeof(id));
+        }
+        if (!sendBatch(Code::BATCH_DELETE, 0, end - begin, data, QStringList())) {
+            return;
+        }
+    }
+}
+
+// 批量创建文件夹
+void ShortTaskManager::batchMakeDir(quint64 parent_id, const QStringList& names) {
+    for (qsizetype begin = 0; begin < names.size(); begin += MAX_BATCH_OP_ITEMS) {
+        QStringList page = names.mid(begin, MAX_BATCH_OP_ITEMS);
+        std::string data;
+        for (const QString& name : page) {
+            QByteArray bytes = name.toUtf8();
+            if (bytes.isEmpty() || bytes.size() >= MAX_FILE_NAME_LEN) {
+                emit error("Directory name too long: " + name);
+                return;
+            }
+            uint16_t name_len = htons(static_cast<uint16_t>(bytes.size()));
+            data.append((char*)&name_len, sizeof(name_len));
+            data.append(bytes.data(), bytes.size());
+        }
+        if (!sendBatch(Code::BATCH_MAKEDIR, parent_id, page.size(), data, page)) {
+            return;
+        }
+    }
+}
+
+// 批量移动
+void ShortTaskManager::batchMove(const std::vector<quint64>& ids, quint64 target_dir_id) {
+    for (size_t begin = 0; begin < ids.size(); begin += MAX_BATCH_OP_ITEMS) {
+        size_t end = std::min(ids.size(), begin + MAX_BATCH_OP_ITEMS);
+        std::string data;
+        data.reserve((end - begin) * sizeof(uint64_t));
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t id = htonll(ids[i]);
+            data.append((char*)&id, sizeof(id));
+        }
+        if (!sendBatch(Code::BATCH_MOVE, target_dir_id, end - begin, data, QStringList())) {
+            return;
+        }
+    }
+}
+
+bool ShortTaskManager::sendBatch(uint32_t code, uint64_t arg, uint32_t count, const std::string& data, const QStringList& names) {
+    // TranDataPdu 只使用 v1 头部，请求ID放在 chunk_index 中，服务端在回复的 v2 头部回显
+    TranDataPdu pdu;
+    pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+    pdu.code = code;
+    pdu.chunk_index = nextRequestId();
+    pdu.total_chunks = count;
+    pdu.file_offset = arg;
+    pdu.data = data;
+    pdu.chunk_size = pdu.data.size();
+    pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batches_[pdu.chunk_index] = BatchRequest{ arg, names };  // 回复可能在发送返回前到达，先记录
+    }
+    auto buf = Serializer::serialize(pdu);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+    if (ec) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batches_.erase(pdu.chunk_index);
+        emit error("batch request: send pdu error: " + QString::fromLocal8Bit(ec.message()));
+        return false;
+    }
+    qDebug() << "send batch request ok, code:" << code << "items:" << count;
+    return true;
+}
+
 void ShortTaskManager::handleRecvPDURespond(std::shared_ptr<PDURespond> pdu) {
     // 接收PDURespond，并根据pdu->code交给其它线程处理
     // 这里多线程中使用this，因此需要确保线程执行中，this不会销毁
@@ -98,6 +196,9 @@ void ShortTaskManager::handleRecvPDURespond(std::shared_ptr<PDURespond> pdu) {
         case Code::CD:          task_queue_->addTask(std::bind(&ShortTaskManager::handleCD, this, pdu)); break;
         case Code::MAKEDIR:     task_queue_->addTask(std::bind(&ShortTaskManager::handleMakeDir, this, pdu)); break;
         case Code::DELETEFILE:  task_queue_->addTask(std::bind(&ShortTaskManager::handleDeleteFile, this, pdu)); break;
+        case Code::BATCH_DELETE:
+        case Code::BATCH_MAKEDIR:
+        case Code::BATCH_MOVE:  task_queue_->addTask(std::bind(&ShortTaskManager::handleBatch, this, pdu)); break;
     }
 }
 
@@ -107,32 +208,34 @@ void ShortTaskManager::handleRecvFileInfo(std::shared_ptr<FileInfo> pdu) {
 
 void ShortTaskManager::handleCD(std::shared_ptr<PDURespond> pdu) {
     // 如果服务端回复错误信息
-    qDebug() << "recv get file list respond ok";
+    qDebug() << "recv get file list respond ok, request id:" << pdu->header.request_id;
 
+    std::lock_guard<std::mutex> lock(mutex_);
     if (Status::NOT_VERIFY == pdu->status) {    // 未验证
+        file_lists_.erase(pdu->header.request_id);
         emit error("Clinet must need login");
         return;
     }
 
     if (Status::SUCCESS == pdu->status) {
         uint32_t cnt = 0;
-        memcpy((char*)&cnt, pdu->msg.data(), sizeof(cnt));   // 将文件数目拷贝到file_cnt_
-        file_cnt_.store(ntohl(cnt));    // 转换字节序后保存
+        memcpy((char*)&cnt, pdu->msg.data(), sizeof(cnt));   // 文件数目
+        FileList &list = file_lists_[pdu->header.request_id];
+        list.has_count = true;
+        list.count = ntohl(cnt);    // 转换字节序后保存
+        // 文件信息由工作线程处理，可能先于回复处理，此时可能已经接收完
+        finishFileList(pdu->header.request_id);
     }
     else {  // 没有文件，或错误
-        file_cnt_.store(0);
-    }
-
-    if (!file_vet_) {   // 不存在（基本不可能），则创建
-        file_vet_ = std::make_shared<std::vector<FileInfo>>(0);
+        file_lists_.erase(pdu->header.request_id);
     }
-    file_vet_->clear(); // 清空，（不清空也行，保险）
 
     // 等待接收文件，交给handleFileInfo
 }
 
 void ShortTaskManager::handleMakeDir(std::shared_ptr<PDURespond> pdu) {
     // 处理服务器的回复
+    QString name = takePending(pdu->header.request_id);
     if (Status::NOT_VERIFY == pdu->status) {    // 未验证
         emit error("Clinet must need login");
         return;
@@ -153,12 +256,13 @@ void ShortTaskManager::handleMakeDir(std::shared_ptr<PDURespond> pdu) {
         qDebug() << "recv make dir respond ok";
     }
     else {
-        emit error("Create directory error");               // 处理创建失败的情况
+        emit error("Create directory error: " + name);      // 处理创建失败的情况
     }
 }
 
 void ShortTaskManager::handleDeleteFile(std::shared_ptr<PDURespond> pdu) {
     // 判断响应码
+    QString name = takePending(pdu->header.request_id);
     if (Status::NOT_VERIFY == pdu->status) {    // 未验证
         emit error("Client must need login");
         return;
@@ -169,32 +273,94 @@ void ShortTaskManager::handleDeleteFile(std::shared_ptr<PDURespond> pdu) {
         qDebug() << "recv delete file respond ok";
     }
     else {
-        emit error("delete file error");
+        emit error("delete file error: " + name);
     }
 }
 
-void ShortTaskManager::handleFileInfo(std::shared_ptr<FileInfo> pdu) {
-    // 开始逐一接受文件信息
-    std::lock_guard<std::mutex> lock(file_mutex_);
-    if (!file_vet_) {   // 不存在file_vet_
+void ShortTaskManager::handleBatch(std::shared_ptr<PDURespond> pdu) {
+    BatchRequest request;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = batches_.find(pdu->header.request_id);
+        if (it != batches_.end()) {
+            request = std::move(it->second);
+            batches_.erase(it);
+        }
+    }
+    if (Status::NOT_VERIFY == pdu->status) {    // 未验证
+        emit error("Client must need login");
+        return;
+    }
+
+    // 结果位图：第 i 个条目成功时第 i/8 字节的第 i%8 位为1，批量创建文件夹之后为新文件夹ID
+    uint32_t count = pdu->msg_amount;
+    if (0 == count && Status::SUCCESS != pdu->status) {    // 请求格式错误，服务端没有处理任何条目
+        emit error("batch request rejected");
         return;
     }
-    if (0 == file_cnt_) {   // 没有执行CD就到来数据或数据接收完，直接过滤
+    size_t bitmap_len = (static_cast<size_t>(count) + 7) / 8;
+    bool has_ids = (pdu->code == Code::BATCH_MAKEDIR);
+    if (pdu->msg.size() < bitmap_len + (has_ids ? count * sizeof(uint64_t) : 0)) {
+        emit error("batch respond error");
         return;
     }
+    uint32_t succeeded = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if ((static_cast<unsigned char>(pdu->msg[i / 8]) >> (i % 8)) & 1) {
+            ++succeeded;
+            if (has_ids && i < static_cast<uint32_t>(request.names.size())) {
+                uint64_t new_id = 0;
+                memcpy((char*)&new_id, pdu->msg.data() + bitmap_len + i * sizeof(uint64_t), sizeof(new_id));
+                emit createDirOK(ntohll(new_id), request.arg, request.names[i]);
+            }
+        }
+    }
+    emit batchOpOK(pdu->code, succeeded, count - succeeded);
+    if (succeeded != count) {
+        emit error(QString("batch operation: %1 of %2 items failed").arg(count - succeeded).arg(count));
+    }
+    qDebug() << "recv batch respond ok, code:" << pdu->code << "succeeded:" << succeeded << "/" << count;
+}
 
-    file_cnt_ -= 1;
-    file_vet_->push_back(*pdu);
+void ShortTaskManager::handleFileInfo(std::shared_ptr<FileInfo> pdu) {
+    // 开始逐一接受文件信息，按请求ID放入对应的文件列表
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t request_id = pdu->header.request_id;
+    file_lists_[request_id].files->push_back(*pdu);
+    finishFileList(request_id);
 
-    if (0 == file_cnt_) {   // 如果此时接收的是最后一个文件
-        //将其按照文件等级从小到达排序
-        std::sort(file_vet_->begin(), file_vet_->end(), [](FileInfo& a, FileInfo& b) {return a.dir_grade < b.dir_grade; });
-        emit getFileListOK(file_vet_);  // 发送信号，更新文件视图系统
-        // 创建新的file_vet_，因为之前的file_vet_交给文件视图系统管理了
-        file_vet_ = std::make_shared<std::vector<FileInfo>>(0);
+    qDebug() << "recv file info respond ok";
+}
+
+void ShortTaskManager::finishFileList(uint32_t request_id) {
+    auto it = file_lists_.find(request_id);
+    if (it == file_lists_.end() || !it->second.has_count || it->second.files->size() < it->second.count) {
+        return;     // 还没有收到回复，或者文件没有接收完
     }
+    auto files = it->second.files;
+    file_lists_.erase(it);
+    //将其按照文件等级从小到达排序
+    std::sort(files->begin(), files->end(), [](FileInfo& a, FileInfo& b) {return a.dir_grade < b.dir_grade; });
+    emit getFileListOK(files);  // 发送信号，更新文件视图系统，files交给文件视图系统管理
+}
 
-    qDebug() << "recv file info respond ok";
+uint32_t ShortTaskManager::nextRequestId() {
+    uint32_t id = next_request_id_.fetch_add(1);
+    if (0 == id) {  // 0 表示没有请求ID（v1），回绕时跳过
+        id = next_request_id_.fetch_add(1);
+    }
+    return id;
+}
+
+QString ShortTaskManager::takePending(uint32_t request_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(request_id);
+    if (it == pending_.end()) {
+        return QString();
+    }
+    QString name = std::move(it->second);
+    pending_.erase(it);
+    return name;
 }
 
 void ShortTaskManager::initSignals() {
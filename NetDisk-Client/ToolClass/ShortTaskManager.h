@@ -2,13 +2,16 @@
 #define SHORTTASKMANAGER_H
 
 #include <QObject>
+#include <QStringList>
 #include <vector>
+#include <unordered_map>
 #include "SR_Tool.h"
 #include "TaskQue.h"
 #include "protocol.h"
 
 
 // 短任务管理器
+// 每个请求带有请求ID（v2），服务端回显该ID，请求可以连续发送而不必等待上一个回复，回复按ID匹配（服务端的工作线程可能乱序完成）
 class ShortTaskManager : public QObject {
     Q_OBJECT
 
@@ -20,11 +23,16 @@ public: // 操作请求（只发出请求，不处理接收数据与处理数据
     void getFileList();         // 获取文件列表
     void makeDir(quint64 parent_id, QString new_dir_name);  // 创建文件夹
     void delFile(quint64 file_id, QString file_name);       // 删除文件
+    // 批量操作：每个请求最多 MAX_BATCH_OP_ITEMS 个条目，更多的条目分成多个请求连续发送，不等待回复
+    void batchDelete(const std::vector<quint64>& ids);                      // 批量删除文件或文件夹
+    void batchMakeDir(quint64 parent_id, const QStringList& names);         // 批量创建文件夹
+    void batchMove(const std::vector<quint64>& ids, quint64 target_dir_id); // 批量移动到目标文件夹
 
 signals:
     void getFileListOK(std::shared_ptr<std::vector<FileInfo>> vet);
     void createDirOK(quint64 new_id,quint64 parent_id,QString new_dir_name);
     void delFileOK();
+    void batchOpOK(quint32 code, quint32 succeeded, quint32 failed);   // 一个批量操作请求完成（批量创建文件夹时每个新文件夹另外发送 createDirOK）
     void error(QString message);
 
 public slots:   // 处理SR_Tool信号的槽函数
@@ -35,17 +43,37 @@ private:    // 处理接收到信息的函数
     void handleCD(std::shared_ptr<PDURespond> pdu);
     void handleMakeDir(std::shared_ptr<PDURespond> pdu);
     void handleDeleteFile(std::shared_ptr<PDURespond> pdu);
+    void handleBatch(std::shared_ptr<PDURespond> pdu);
     void handleFileInfo(std::shared_ptr<FileInfo> pdu);
 
 private:
     void initSignals();
+    uint32_t nextRequestId();                   // 分配请求ID（不为0）
+    void finishFileList(uint32_t request_id);   // 调用前需持有 mutex_，文件列表接收完成时发送信号
+    QString takePending(uint32_t request_id);   // 取出请求对应的名称
+    // 发送一个批量操作请求，data 为条目数组（格式见 protocol.h）
+    bool sendBatch(uint32_t code, uint64_t arg, uint32_t count, const std::string& data, const QStringList& names);
 
 private:
-    // 注意声明顺序，file_mutex_，file_cnt_，file_vet_可能再task_queue_中被使用
+    // 一次CD请求的文件列表，回复（文件数量）和文件信息都带有该请求的ID
+    struct FileList {
+        bool has_count{ false };    // 是否已经收到回复
+        uint32_t count{ 0 };        // 文件数量
+        std::shared_ptr<std::vector<FileInfo>> files{ std::make_shared<std::vector<FileInfo>>() };
+    };
+
+    // 注意声明顺序，mutex_，file_lists_，pending_可能再task_queue_中被使用
     // 因此需要先销毁task_queue_，也就是最后声明task_queue_
-    std::mutex file_mutex_;                 // 保护文件操作的锁
-    std::atomic<uint32_t> file_cnt_{ 0 };   // 需要接收的文件数量，用于CD操作
-    std::shared_ptr<std::vector<FileInfo>> file_vet_;   // 保存获取的文件数据，用于CD操作
+    std::mutex mutex_;                                  // 保护 file_lists_、pending_ 和 batches_
+    std::atomic<uint32_t> next_request_id_{ 1 };        // 下一个请求ID
+    std::unordered_map<uint32_t, FileList> file_lists_; // 正在接收的文件列表，键为请求ID
+    std::unordered_map<uint32_t, QString> pending_;     // 等待回复的创建文件夹、删除文件请求的名称，键为请求ID
+    // 等待回复的批量操作：操作参数（父文件夹ID或目标文件夹ID）和批量创建的文件夹名称，键为请求ID
+    struct BatchRequest {
+        uint64_t arg{ 0 };
+        QStringList names;
+    };
+    std::unordered_map<uint32_t, BatchRequest> batches_;
 
     std::shared_ptr<SR_Tool> sr_tool_;
     std::shared_ptr<TaskQue> task_queue_;   // 任务队列
@@ -1,17 +1,26 @@
 ﻿#include "UdTool.h"
 #include "SR_Tool.h"
+#include "Compressor.h"
 #include <openssl/sha.h>
 #include <QFileInfo>
 #include <QThread>
+#include <algorithm>
 
 UdTool::UdTool(const QString& ip, const std::uint32_t& port, QObject *parent)
-    : QObject{parent}, sr_tool_(std::make_shared<SR_Tool>(ip.toStdString(), port, nullptr))
+    : QObject{parent}, sr_tool_(std::make_shared<SR_Tool>(ip.toStdString(), port, nullptr)), ip_(ip), port_(port)
 {
     initSignals();
 }
 
 UdTool::~UdTool() {
     sr_tool_->SR_stop();    // 关闭异步任务
+    // 关闭并行连接
+    for (auto& tool : join_tools_) {
+        tool->SR_stop();
+        boost::system::error_code ec;
+        tool->getSSL()->shutdown(ec);
+        tool->getSSL()->lowest_layer().close(ec);
+    }
 
     // 关闭文件
     if (file_ctx_.file.isOpen()) {
@@ -42,12 +51,15 @@ void UdTool::initSignals() {
 // 设置上传的文件
 void UdTool::setTranPdu(const TranPdu &tran_pdu) {
     // tran_pdu.file_name实际上保存的是path/name
-    if (Code::PUTS != tran_pdu.tran_pdu_code) {
+    if (Code::PUTS != tran_pdu.tran_pdu_code && Code::PUTSCONTINUE != tran_pdu.tran_pdu_code) {
         emit error("UdTool::SetTranPdu(const TranPdu&): tran_pdu_code error");
         return;
     }
 
     file_ctx_.tran_pdu = tran_pdu;
+    file_ctx_.tran_pdu.compress = Compressor::makeOffer();  // 请求压缩传输，由服务端决定是否开启
+    file_ctx_.tran_pdu.compress |= UPLOAD_CAP_QUICK_PROOF;  // 内容属于其它用户时，证明持有文件后秒传
+    file_ctx_.tran_pdu.compress |= UPLOAD_CAP_CRC32C;       // 发送的分片都带有校验和
 
     file_ctx_.file_name = QString(file_ctx_.tran_pdu.file_name);
 
@@ -69,6 +81,7 @@ void UdTool::setTranPdu(const TranPdu &tran_pdu) {
     for (uint32_t i=0; i<file_ctx_.total_chunks; ++i) {
         file_ctx_.unacked_id.insert(i);
     }
+    file_ctx_.send_id.assign(file_ctx_.unacked_id.begin(), file_ctx_.unacked_id.end());
 
     // 保存文件名（不带路径）
     QFileInfo file_info(file_ctx_.file_name);
@@ -78,6 +91,11 @@ void UdTool::setTranPdu(const TranPdu &tran_pdu) {
     file_ctx_.tran_pdu.file_name[file_suffix.size()] = '\0';
 }
 
+// 设置令牌被拒绝时使用的密码
+void UdTool::setAuthPwd(const char *pwd) {
+    auth_pwd_.assign(pwd, strnlen(pwd, sizeof(TranPdu::pwd)));
+}
+
 // 设置传输控制对象
 void UdTool::setControlAtomic(std::shared_ptr<std::atomic<std::uint32_t>> control,
                               std::shared_ptr<std::condition_variable> cv, std::shared_ptr<std::mutex> mutex)
@@ -106,23 +124,49 @@ bool UdTool::calculateSHA256() {
         return false;
     }
 
-    const int buffer_size = 4096;
-    char buffer[buffer_size];
-    int read_bytes = 0;
+    // 读取文件并更新哈希计算，大文件同时按内容分块（只读取一遍文件）
+    // 缓冲区中 [start, end) 为还没有分块的数据，分块时至少要有一个最大块的数据（文件末尾除外）
+    bool make_chunks = file_ctx_.total_bytes >= chunk_dedup_min_size_;
+    chunk_entries_.clear();
+    std::vector<char> buffer(4 * 1024 * 1024 + Chunker::kMaxSize);
+    size_t start = 0, end = 0;
+    uint64_t chunk_offset = 0;
+    bool is_eof = false;
 
-    // 读取文件并更新哈希计算
-    if (file_ctx_.file.isOpen()) {
-        file_ctx_.file.seek(0);
-        while ((read_bytes = file_ctx_.file.read(buffer, buffer_size)) > 0) {
-            if (EVP_DigestUpdate(ctx, buffer, read_bytes) != 1) {
+    if (!file_ctx_.file.isOpen()) {
+        EVP_MD_CTX_free(ctx);
+        return false;
+    }
+    file_ctx_.file.seek(0);
+    while (true) {
+        if (!is_eof && end - start < Chunker::kMaxSize) {
+            // 将剩余数据移到缓冲区开头，再读取新的数据
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            qint64 read_bytes = file_ctx_.file.read(buffer.data() + end, buffer.size() - end);
+            if (read_bytes < 0 || (read_bytes > 0 && EVP_DigestUpdate(ctx, buffer.data() + end, read_bytes) != 1)) {
                 EVP_MD_CTX_free(ctx);
                 return false;
             }
+            is_eof = (read_bytes == 0);
+            end += read_bytes;
+            continue;
         }
-    }
-    else {
-        EVP_MD_CTX_free(ctx);
-        return false;
+        if (start == end) {
+            break;
+        }
+        if (!make_chunks) {
+            start = end;
+            continue;
+        }
+        ChunkEntry entry;
+        entry.offset = chunk_offset;
+        entry.size = Chunker::nextChunk(reinterpret_cast<const unsigned char*>(buffer.data() + start), end - start);
+        SHA256(reinterpret_cast<const unsigned char*>(buffer.data() + start), entry.size, entry.hash);
+        chunk_entries_.push_back(entry);
+        chunk_offset += entry.size;
+        start += entry.size;
     }
 
     // 获取哈希计算结果
@@ -154,7 +198,7 @@ bool UdTool::sendTranPdu() {
     auto buf = Serializer::serialize(file_ctx_.tran_pdu);
 
     boost::system::error_code ec;
-    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + file_ctx_.tran_pdu.header.body_len, ec);
+    sr_tool_->send(buf.get(), Serializer::encodedLen(file_ctx_.tran_pdu), ec);
 
     if (ec) {
         emit error("UdTool::sendTranPdu(): " + QString::fromStdString(ec.what()));
@@ -163,6 +207,177 @@ bool UdTool::sendTranPdu() {
     return true;
 }
 
+// 依次尝试差量上传和块清单查询（各自收到全部回复后再次调用），都完成后发送服务端还没有的数据
+void UdTool::startTransfer() {
+    if (sendDeltaSigRequest()) {
+        return;
+    }
+    if (sendChunkQuery()) {
+        return;
+    }
+    sendFile();
+}
+
+// 请求旧版本（同目录下的同名文件）的块签名，服务端没有旧版本时回复失败
+bool UdTool::sendDeltaSigRequest() {
+    if (delta_done_ || delta_pages_ > 0 || file_ctx_.total_bytes < delta_min_size_ || file_ctx_.unacked_id.empty()) {
+        return false;
+    }
+    TranDataPdu pdu;
+    pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+    pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN;
+    pdu.code = Code::PUTS_DELTA_SIG;
+
+    auto buf = Serializer::serialize(pdu);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+    if (ec) {
+        qDebug() << "upload file: send delta request failed:" << QString::fromLocal8Bit(ec.message());
+        delta_done_ = true;
+        return false;
+    }
+    delta_pages_ = 1;   // 收到签名后改为复制指令的页数
+    return true;
+}
+
+// 发送复制指令：每页最多 MAX_DELTA_COPIES_PER_PAGE 条
+bool UdTool::sendDeltaCopies() {
+    if (delta_copies_.empty()) {
+        return false;
+    }
+    delta_pages_ = (delta_copies_.size() + MAX_DELTA_COPIES_PER_PAGE - 1) / MAX_DELTA_COPIES_PER_PAGE;
+    delta_answered_ = 0;
+    delta_ranges_.clear();
+
+    for (size_t page = 0; page < delta_pages_; ++page) {
+        size_t begin = page * MAX_DELTA_COPIES_PER_PAGE;
+        size_t end = std::min(delta_copies_.size(), begin + MAX_DELTA_COPIES_PER_PAGE);
+
+        TranDataPdu pdu;
+        pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+        pdu.code = Code::PUTS_DELTA;
+        pdu.chunk_index = page;
+        pdu.total_chunks = delta_pages_;
+        pdu.data.reserve((end - begin) * DELTA_COPY_LEN);
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t offset = htonll(delta_copies_[i].offset);
+            uint64_t base_offset = htonll(delta_copies_[i].base_offset);
+            uint32_t size = htonl(delta_copies_[i].size);
+            pdu.data.append((char*)&offset, sizeof(offset));
+            pdu.data.append((char*)&base_offset, sizeof(base_offset));
+            pdu.data.append((char*)&size, sizeof(size));
+        }
+        pdu.chunk_size = pdu.data.size();
+        pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+
+        auto buf = Serializer::serialize(pdu);
+        boost::system::error_code ec;
+        sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+        if (ec) {
+            // 发送失败不影响上传，已经发送的页仍然会收到回复，这里直接按普通上传处理
+            qDebug() << "upload file: send delta copies failed:" << QString::fromLocal8Bit(ec.message());
+            delta_copies_.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+// 秒传的持有证明：回复体为 随机数(16字节) + 区间偏移(uint64) + 区间长度(uint32)，发送 SHA-256(随机数 + 文件区间的数据)
+bool UdTool::sendQuickProof(std::shared_ptr<PDURespond> pdu) {
+    const size_t head_len = QUICK_PROOF_NONCE_LEN + sizeof(uint64_t) + sizeof(uint32_t);
+    if (pdu->msg.size() < head_len) {
+        return false;
+    }
+    uint64_t offset = 0;
+    uint32_t len = 0;
+    memcpy((char*)&offset, pdu->msg.data() + QUICK_PROOF_NONCE_LEN, sizeof(offset));
+    memcpy((char*)&len, pdu->msg.data() + QUICK_PROOF_NONCE_LEN + sizeof(offset), sizeof(len));
+    offset = ntohll(offset);
+    len = ntohl(len);
+    if (len > QUICK_PROOF_MAX_LEN || offset > file_ctx_.total_bytes || len > file_ctx_.total_bytes - offset) {
+        return false;
+    }
+    std::vector<char> data(len);
+    if (!file_ctx_.file.seek(offset) || file_ctx_.file.read(data.data(), len) != len) {
+        return false;
+    }
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    unsigned int digest_len = 0;
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    bool ok = ctx != nullptr && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1
+              && EVP_DigestUpdate(ctx, pdu->msg.data(), QUICK_PROOF_NONCE_LEN) == 1
+              && EVP_DigestUpdate(ctx, data.data(), len) == 1 && EVP_DigestFinal_ex(ctx, digest, &digest_len) == 1;
+    EVP_MD_CTX_free(ctx);
+    if (!ok || digest_len != SHA256_DIGEST_LENGTH) {
+        return false;
+    }
+
+    TranDataPdu proof;
+    proof.header.type = ProtocolType::TRANDATAPDU_TYPE;
+    proof.code = Code::PUTS_QUICK_PROOF;
+    proof.data.assign((char*)digest, sizeof(digest));
+    proof.chunk_size = proof.data.size();
+    proof.header.body_len = TRANDATAPDU_BODY_BASE_LEN + proof.chunk_size;
+
+    auto buf = Serializer::serialize(proof);
+    boost::system::error_code ec;
+    sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + proof.header.body_len, ec);
+    if (ec) {
+        qDebug() << "upload file: send quick proof failed:" << QString::fromLocal8Bit(ec.message());
+        return false;
+    }
+    file_ctx_.sended_bytes = file_ctx_.total_bytes;
+    file_ctx_.unacked_id.clear();
+    emit sendProgress(1, 1);
+    return true;
+}
+
+// 发送块清单：每页最多 MAX_CHUNKS_PER_PAGE 个块，服务端复制已有的块后回复缺失块的位图
+bool UdTool::sendChunkQuery() {
+    if (chunk_entries_.empty() || chunk_query_done_) {
+        return false;
+    }
+    chunk_pages_ = (chunk_entries_.size() + MAX_CHUNKS_PER_PAGE - 1) / MAX_CHUNKS_PER_PAGE;
+    chunk_answered_ = 0;
+    present_ranges_.clear();
+
+    for (size_t page = 0; page < chunk_pages_; ++page) {
+        size_t begin = page * MAX_CHUNKS_PER_PAGE;
+        size_t end = std::min(chunk_entries_.size(), begin + MAX_CHUNKS_PER_PAGE);
+
+        TranDataPdu pdu;
+        pdu.header.type = ProtocolType::TRANDATAPDU_TYPE;
+        pdu.code = Code::PUTS_CHUNKS;
+        pdu.file_offset = begin;
+        pdu.total_chunks = chunk_entries_.size();
+        pdu.chunk_index = page;
+        pdu.data.reserve((end - begin) * CHUNK_ENTRY_LEN);
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t offset = htonll(chunk_entries_[i].offset);
+            uint32_t size = htonl(chunk_entries_[i].size);
+            pdu.data.append((char*)&offset, sizeof(offset));
+            pdu.data.append((char*)&size, sizeof(size));
+            pdu.data.append((char*)chunk_entries_[i].hash, sizeof(chunk_entries_[i].hash));
+        }
+        pdu.chunk_size = pdu.data.size();
+        pdu.header.body_len = TRANDATAPDU_BODY_BASE_LEN + pdu.chunk_size;
+
+        auto buf = Serializer::serialize(pdu);
+        boost::system::error_code ec;
+        sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + pdu.header.body_len, ec);
+        if (ec) {
+            // 查询失败不影响上传，发送全部数据
+            qDebug() << "upload file: send chunk query failed:" << QString::fromLocal8Bit(ec.message());
+            chunk_query_done_ = true;
+            return false;
+        }
+    }
+    qDebug() << "upload file: query chunks:" << chunk_entries_.size();
+    return true;
+}
+
 // 开始发送文件
 bool UdTool::sendFile() {
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
@@ -170,29 +385,110 @@ bool UdTool::sendFile() {
     // 这里sr_tool_使用了，file_，因此在销毁UdTool前，因该确保所有异步任务完成
     // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
     qDebug() << "upload file: start send file data";
-    sr_tool_->asyncSendFileData(file_ctx_);
+    // 数据量大时开启并行连接，主连接只发送自己的部分，并行连接在加入会话成功后发送各自的部分
+    std::vector<std::vector<uint32_t>> send_ids = openJoinConnections();
+    {
+        std::lock_guard<std::mutex> lock(file_ctx_.resend_mtx);
+        file_ctx_.resending = true;
+    }
+    sr_tool_->asyncSendFileData(file_ctx_, std::move(send_ids[0]), true);
 
     sr_tool_->SR_run(); // 开启一个异步任务循环
     return true;
 }
 
+std::vector<std::vector<uint32_t>> UdTool::openJoinConnections() {
+    // 连接数由剩余数据量决定，小文件只使用主连接
+    uint64_t remain_bytes = static_cast<uint64_t>(file_ctx_.send_id.size()) * file_ctx_.chunk_size;
+    size_t count = std::min<uint64_t>(max_connections_, 1 + remain_bytes / bytes_per_connection_);
+    count = std::max<size_t>(1, std::min(count, file_ctx_.send_id.size()));
+
+    // 将需要发送的chunk按顺序分成count段，每个连接发送连续的一段，服务端写入的区间也更连续
+    std::vector<std::vector<uint32_t>> send_ids(count);
+    size_t total = file_ctx_.send_id.size();
+    for (size_t i=0; i<count; ++i) {
+        send_ids[i].assign(file_ctx_.send_id.begin() + total * i / count,
+                           file_ctx_.send_id.begin() + total * (i+1) / count);
+    }
+
+    // 并行连接发送 PUTS_JOIN 加入主连接的上传会话，连接失败的部分交给主连接发送
+    TranPdu join_pdu = file_ctx_.tran_pdu;
+    join_pdu.tran_pdu_code = Code::PUTS_JOIN;
+    auto buf = Serializer::serialize(join_pdu);
+    for (size_t i=1; i<count; ++i) {
+        auto tool = std::make_shared<SR_Tool>(ip_.toStdString(), port_, nullptr);
+        boost::system::error_code ec;
+        tool->connect(ec);
+        if (!ec) {
+            tool->send(buf.get(), Serializer::encodedLen(join_pdu), ec);
+        }
+        if (ec) {
+            qDebug() << "upload file: open join connection failed:" << QString::fromLocal8Bit(ec.message());
+            send_ids[0].insert(send_ids[0].end(), send_ids[i].begin(), send_ids[i].end());
+            continue;
+        }
+
+        size_t index = join_tools_.size();
+        SR_Tool* raw_tool = tool.get();
+        connect(raw_tool, &SR_Tool::recvPDURespondOK, this, [this, index, raw_tool](std::shared_ptr<PDURespond> pdu) {
+            if (Code::PUTS_JOIN == pdu->code) {
+                handlePutsJoinRespond(index, pdu);
+            }
+            else if (Code::PUTS_FINISH == pdu->code) {
+                handlePutsFinishRespond(pdu, raw_tool);   // 最后一个chunk可能由并行连接发送，完成回复也在该连接上
+            }
+            else {
+                handleRecvPDURespond(pdu);
+            }
+        });
+        join_tools_.push_back(tool);
+        join_send_id_.push_back(std::move(send_ids[i]));
+
+        // 每个并行连接只使用一个线程运行异步任务，接收和发送不会同时操作SSL
+        tool->asyncRecvProtocol(true);
+        tool->SR_run();
+    }
+    send_ids.resize(1);
+    qDebug() << "upload file: connections:" << join_tools_.size() + 1;
+    return send_ids;
+}
+
 void UdTool::handleRecvPDURespond(std::shared_ptr<PDURespond> pdu) {
     switch (pdu->code) {
         // !!!!!!!!!!!!!!!!!!!!!!!!!!!! 可以将任务交给线程池处理，不然可能处理速度跟不上接收数据 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
         case Code::PUTS: handlePutsRespond(pdu); break;
         case Code::PUTS_DATA: handlePutsDataRespond(pdu); break;
-        case Code::PUTS_FINISH: handlePutsFinishRespond(pdu); break;
+        case Code::PUTS_FINISH: handlePutsFinishRespond(pdu, sr_tool_.get()); break;
+        case Code::PUTS_CHUNKS: handlePutsChunksRespond(pdu); break;
+        case Code::PUTS_DELTA_SIG: handlePutsDeltaSigRespond(pdu); break;
+        case Code::PUTS_DELTA: handlePutsDeltaRespond(pdu); break;
+    }
+}
+
+void UdTool::handlePutsJoinRespond(size_t index, std::shared_ptr<PDURespond> pdu) {
+    if (index >= join_tools_.size()) {
+        return;
+    }
+    if (Status::SUCCESS == pdu->status) {
+        join_tools_[index]->asyncSendFileData(file_ctx_, std::move(join_send_id_[index]));
+    }
+    else {
+        // 主连接已经在发送自己的部分，不能再在主连接上同时发送，直接报错，之后可以断点续传
+        emit error("upload file join session error");
     }
 }
 
 void UdTool::handlePutsRespond(std::shared_ptr<PDURespond> pdu) {
+    file_ctx_.compress = pdu->header.reserved;  // 协商的压缩方式，0为不压缩
     switch (pdu->status) {
         case Status::SUCCESS: {
-            sendFile(); // 发送文件数据
+            skipReceivedChunks(pdu);    // 如果是断点续传，跳过已经上传的数据
+            startTransfer();            // 发送文件数据
             break;
         }
         case Status::PUT_CONTINUE_FAILED: {
-            // !!!!!!!!!!!!!!!!!!!! 处理端点续传失败 !!!!!!!!!!!!!!!!!!!!!!!!!
+            // 服务端没有该文件的上传记录，从头开始上传
+            startTransfer();
             break;
         }
         case Status::PUT_QUICK: {
@@ -201,6 +497,23 @@ void UdTool::handlePutsRespond(std::shared_ptr<PDURespond> pdu) {
             emit sendProgress(1, 1);
             break;
         }
+        case Status::PUT_QUICK_PROOF: {
+            // 证明通过后服务端直接发送完成回复
+            if (!sendQuickProof(pdu)) {
+                emit error("upload file error: send quick upload proof failed");
+            }
+            break;
+        }
+        case Status::NOT_VERIFY: {
+            // 会话令牌被拒绝（例如服务器重启后更换了密钥），在同一个连接上改用密码重新请求
+            if (!useTranPwd(file_ctx_.tran_pdu, auth_pwd_)) {
+                emit error("upload file request error: not verify");
+            }
+            else if (sendTranPdu()) {
+                emit tokenRejected();
+            }
+            break;
+        }
         case Status::FAILED: {
             emit error("upload file request error:");
             break;
@@ -216,6 +529,188 @@ void UdTool::handlePutsRespond(std::shared_ptr<PDURespond> pdu) {
     }
 }
 
+// 断点续传：回复体为 已接收字节数(uint64) + 上传ID(uint64) + 区间数(uint32) + 区间[begin, end)(uint64, uint64)...
+// 完全落在已接收区间内的chunk不再发送
+void UdTool::skipReceivedChunks(std::shared_ptr<PDURespond> pdu) {
+    const size_t head_len = 2 * sizeof(uint64_t) + sizeof(uint32_t);
+    if (pdu->msg.size() < head_len) {  // 不是断点续传，发送全部数据
+        return;
+    }
+    uint32_t range_count = 0;
+    memcpy((char*)&range_count, pdu->msg.data() + 2 * sizeof(uint64_t), sizeof(range_count));
+    range_count = ntohl(range_count);
+    if (range_count > MAX_RESUME_RANGES || pdu->msg.size() < head_len + range_count * 2 * sizeof(uint64_t)) {
+        return;
+    }
+
+    const char* ptr = pdu->msg.data() + head_len;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (uint32_t i=0; i<range_count; ++i) {
+        uint64_t begin = 0, end = 0;
+        memcpy((char*)&begin, ptr, sizeof(begin));
+        memcpy((char*)&end, ptr + sizeof(begin), sizeof(end));
+        ptr += 2 * sizeof(uint64_t);
+        ranges.emplace_back(ntohll(begin), ntohll(end));
+    }
+    skipRanges(std::move(ranges));
+    qDebug() << "upload file: continue, skip bytes:" << file_ctx_.sended_bytes;
+}
+
+// 完全落在服务端已有区间内的chunk不再发送，相邻的区间先合并，跨越两个区间的chunk也能跳过
+void UdTool::skipRanges(std::vector<std::pair<uint64_t, uint64_t>> ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<std::pair<uint64_t, uint64_t>> merged;
+    for (auto& range : ranges) {
+        if (range.second > file_ctx_.total_bytes || range.first >= range.second) {
+            continue;
+        }
+        if (!merged.empty() && range.first <= merged.back().second) {
+            merged.back().second = std::max(merged.back().second, range.second);
+        }
+        else {
+            merged.push_back(range);
+        }
+    }
+
+    for (auto& [begin, end] : merged) {
+        // 区间内第一个完整的chunk和最后一个完整chunk的下一个
+        uint64_t first = (begin + file_ctx_.chunk_size - 1) / file_ctx_.chunk_size;
+        uint64_t last = (end == file_ctx_.total_bytes) ? file_ctx_.total_chunks : end / file_ctx_.chunk_size;
+        for (uint64_t id=first; id<last; ++id) {
+            if (file_ctx_.unacked_id.erase(id) > 0) {
+                file_ctx_.sended_bytes += (id == file_ctx_.total_chunks-1) ? file_ctx_.last_chunk_size : file_ctx_.chunk_size;
+            }
+        }
+    }
+    file_ctx_.send_id.assign(file_ctx_.unacked_id.begin(), file_ctx_.unacked_id.end());
+    emit sendProgress(file_ctx_.sended_bytes, file_ctx_.total_bytes);
+}
+
+// 块清单查询的回复：第一个块的序号(uint64) + 块数(uint32) + 缺失位图（1为缺失）
+// 服务端已经把已有的块写入上传文件，收到所有页的回复后只发送缺失的块
+void UdTool::handlePutsChunksRespond(std::shared_ptr<PDURespond> pdu) {
+    if (chunk_query_done_) {
+        return;
+    }
+    if (Status::SUCCESS != pdu->status) {
+        // 服务端没有开启块存储，发送全部数据
+        qDebug() << "upload file: server does not support chunk store";
+        chunk_query_done_ = true;
+        present_ranges_.clear();
+        startTransfer();
+        return;
+    }
+
+    const size_t head_len = sizeof(uint64_t) + sizeof(uint32_t);
+    if (pdu->msg.size() >= head_len) {
+        uint64_t first = 0;
+        uint32_t count = 0;
+        memcpy((char*)&first, pdu->msg.data(), sizeof(first));
+        memcpy((char*)&count, pdu->msg.data() + sizeof(first), sizeof(count));
+        first = ntohll(first);
+        count = ntohl(count);
+        if (first <= chunk_entries_.size() && count <= chunk_entries_.size() - first && pdu->msg.size() >= head_len + (count + 7) / 8) {
+            const unsigned char* bitmap = reinterpret_cast<const unsigned char*>(pdu->msg.data()) + head_len;
+            for (uint32_t i=0; i<count; ++i) {
+                if ((bitmap[i / 8] & (1 << (i % 8))) == 0) {  // 服务端已有该块
+                    const ChunkEntry& entry = chunk_entries_[first + i];
+                    present_ranges_.emplace_back(entry.offset, entry.offset + entry.size);
+                }
+            }
+        }
+    }
+
+    if (++chunk_answered_ < chunk_pages_) {
+        return;
+    }
+    chunk_query_done_ = true;
+    uint64_t skip_before = file_ctx_.sended_bytes;
+    skipRanges(std::move(present_ranges_));
+    present_ranges_.clear();
+    qDebug() << "upload file: chunks reused bytes:" << file_ctx_.sended_bytes - skip_before;
+
+    // 所有数据服务端都已经有了，服务端会直接发送完成回复
+    if (file_ctx_.unacked_id.empty()) {
+        return;
+    }
+    startTransfer();
+}
+
+// 旧版本块签名的回复：没有旧版本时直接发送数据，否则计算差量并发送复制指令
+// 签名分页回复：每页为 块长度 + 总块数 + 本页第一个块的序号 + 块签名，按顺序拼接为 块长度 + 总块数 + 全部块签名，收齐后再计算复制指令
+void UdTool::handlePutsDeltaSigRespond(std::shared_ptr<PDURespond> pdu) {
+    if (delta_done_) {
+        return;
+    }
+    const size_t head_len = 3 * sizeof(uint32_t);
+    bool ok = Status::SUCCESS == pdu->status && pdu->msg.size() > head_len
+              && (pdu->msg.size() - head_len) % DELTA_SIG_ENTRY_LEN == 0;
+    if (ok) {
+        uint32_t count = 0, first = 0;
+        memcpy((char*)&count, pdu->msg.data() + sizeof(uint32_t), sizeof(count));
+        memcpy((char*)&first, pdu->msg.data() + 2 * sizeof(uint32_t), sizeof(first));
+        count = ntohl(count);
+        first = ntohl(first);
+        uint64_t page_count = (pdu->msg.size() - head_len) / DELTA_SIG_ENTRY_LEN;
+        // 页必须按顺序到达，且与第一页的块长度和总块数一致
+        ok = first == delta_sig_count_ && first + page_count <= count
+             && (first == 0 || delta_sig_.compare(0, 2 * sizeof(uint32_t), pdu->msg, 0, 2 * sizeof(uint32_t)) == 0);
+        if (ok) {
+            if (first == 0) {
+                delta_sig_.assign(pdu->msg, 0, 2 * sizeof(uint32_t));
+            }
+            delta_sig_.append(pdu->msg, head_len, std::string::npos);
+            delta_sig_count_ += page_count;
+            if (delta_sig_count_ < count) {
+                return;     // 等待后续的页
+            }
+        }
+    }
+    if (!ok || !Delta::compute(file_ctx_.file, file_ctx_.total_bytes, delta_sig_.data(), delta_sig_.size(), delta_copies_)) {
+        delta_copies_.clear();
+    }
+    delta_sig_.clear();
+    delta_sig_.shrink_to_fit();
+    qDebug() << "upload file: delta copies:" << delta_copies_.size();
+    if (!sendDeltaCopies()) {
+        delta_done_ = true;
+        startTransfer();
+    }
+}
+
+// 复制指令的回复：回复体为页序号，执行失败的页中的数据改为正常发送
+void UdTool::handlePutsDeltaRespond(std::shared_ptr<PDURespond> pdu) {
+    if (delta_done_) {
+        return;
+    }
+    if (Status::SUCCESS == pdu->status && pdu->msg.size() >= sizeof(uint32_t)) {
+        uint32_t page = 0;
+        memcpy((char*)&page, pdu->msg.data(), sizeof(page));
+        page = ntohl(page);
+        size_t begin = (size_t)page * MAX_DELTA_COPIES_PER_PAGE;
+        size_t end = std::min(delta_copies_.size(), begin + MAX_DELTA_COPIES_PER_PAGE);
+        for (size_t i = begin; i < end; ++i) {
+            delta_ranges_.emplace_back(delta_copies_[i].offset, delta_copies_[i].offset + delta_copies_[i].size);
+        }
+    }
+
+    if (++delta_answered_ < delta_pages_) {
+        return;
+    }
+    delta_done_ = true;
+    uint64_t skip_before = file_ctx_.sended_bytes;
+    skipRanges(std::move(delta_ranges_));
+    delta_ranges_.clear();
+    delta_copies_.clear();
+    qDebug() << "upload file: delta reused bytes:" << file_ctx_.sended_bytes - skip_before;
+
+    // 所有数据都可以从旧版本复制，服务端会直接发送完成回复
+    if (file_ctx_.unacked_id.empty()) {
+        return;
+    }
+    startTransfer();
+}
+
 void UdTool::handlePutsDataRespond(std::shared_ptr<PDURespond> pdu) {
     if (Status::SUCCESS == pdu->status) {
         uint32_t chunk_id = 0;
@@ -232,10 +727,35 @@ void UdTool::handlePutsDataRespond(std::shared_ptr<PDURespond> pdu) {
             emit sendProgress(file_ctx_.sended_bytes, file_ctx_.total_bytes);
         }
     }
-
+    else if (Status::FAILED == pdu->status && pdu->msg.size() >= sizeof(uint32_t)) {
+        // 服务端收到的chunk校验和错误，只重传这个chunk
+        uint32_t chunk_id = 0;
+        memcpy((char*)&chunk_id, pdu->msg.data(), sizeof(chunk_id));
+        chunk_id = ntohl(chunk_id);
+        if (file_ctx_.unacked_id.count(chunk_id) == 0) {
+            return;
+        }
+        if (++chunk_retry_[chunk_id] > max_chunk_retry_) {
+            emit error("upload file error: chunk checksum mismatch");
+            return;
+        }
+        qDebug() << "upload file: resend chunk" << chunk_id;
+        bool start = false;
+        {
+            std::lock_guard<std::mutex> lock(file_ctx_.resend_mtx);
+            file_ctx_.resend_id.push_back(chunk_id);
+            if (!file_ctx_.resending) {     // 主连接的发送任务已经结束，重新开始一个发送任务
+                file_ctx_.resending = true;
+                start = true;
+            }
+        }
+        if (start) {
+            sr_tool_->asyncSendFileData(file_ctx_, {}, true);
+        }
+    }
 }
 
-void UdTool::handlePutsFinishRespond(std::shared_ptr<PDURespond> pdu) {
+void UdTool::handlePutsFinishRespond(std::shared_ptr<PDURespond> pdu, SR_Tool* tool) {
     if (Status::SUCCESS == pdu->status) {
         // 获取file_id
         uint64_t file_id = 0;
@@ -254,12 +774,18 @@ void UdTool::handlePutsFinishRespond(std::shared_ptr<PDURespond> pdu) {
         auto buf = Serializer::serialize(ack_pdu);
 
         boost::system::error_code ec;
-        sr_tool_->send(buf.get(), PROTOCOLHEADER_LEN + ack_pdu.header.body_len, ec);
+        tool->send(buf.get(), PROTOCOLHEADER_LEN + ack_pdu.header.body_len, ec);    // 在收到完成回复的连接上确认
         if (ec) {
             // !!!!!!!!!!!!!!!!!!!!! 处理发送错误的情况 !!!!!!!!!!!!!!!!!!!!!!!!
             emit error("upload finish send error:" + QString::fromStdString(ec.what()));
         }
         else {
+            uint64_t raw_bytes = file_ctx_.raw_bytes.load();
+            if (raw_bytes > 0 && file_ctx_.compress != Compression::COMPRESS_NONE) {
+                uint64_t wire_bytes = file_ctx_.wire_bytes.load();
+                qDebug() << "upload file: sent" << raw_bytes << "bytes," << wire_bytes << "bytes on wire"
+                         << QString("(%1%)").arg(100.0 * wire_bytes / raw_bytes, 0, 'f', 1);
+            }
             emit sendProgress(1, 1);    // 更新进度条
             emit workFinished();        // 完成任务
         }
@@ -5,9 +5,14 @@
 #include <QFile>
 #include <QString>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <map>
 // include "SR_Tool.h"
 #include "protocol.h"
+#include "Chunker.h"
+#include "Delta.h"
 
 class SR_Tool;
 
@@ -23,6 +28,15 @@ struct UpContext {
     const uint32_t chunk_size{ 2048 };  // 每次发送块的大小
     uint32_t last_chunk_size{ 0 };      // 最后一个chunk的大小
     std::set<uint32_t> unacked_id;      // 未确认的chunk id
+    std::vector<uint32_t> send_id;      // 需要发送的chunk id（断点续传时只发送服务端缺失的chunk），多连接上传时分给各个连接
+    // 服务端校验和错误的chunk，由主连接重传
+    std::mutex resend_mtx;
+    std::deque<uint32_t> resend_id;     // 需要重传的chunk id
+    bool resending{ false };            // 主连接的发送任务是否正在运行（运行时由它发送 resend_id）
+
+    uint32_t compress{ 0 };                     // 与服务端协商的压缩方式（Compression）
+    std::atomic<uint64_t> raw_bytes{ 0 };       // 压缩统计：发送的原始字节数（各个连接累加）
+    std::atomic<uint64_t> wire_bytes{ 0 };      // 压缩统计：实际发送的字节数
 
     // 工作控制，0为继续，1为暂停，2为结束
     std::shared_ptr<std::atomic<std::uint32_t>> ctrl{ nullptr };
@@ -44,6 +58,8 @@ private:
 public:
     // 设置要上传和下载的文件
     void setTranPdu(const TranPdu& tran_pdu);
+    // 设置密码，请求使用的会话令牌被服务端拒绝时改用密码重新请求
+    void setAuthPwd(const char *pwd);
     // 设置传输控制变量
     void setControlAtomic(std::shared_ptr<std::atomic<std::uint32_t>> control,
                           std::shared_ptr<std::condition_variable> cv, std::shared_ptr<std::mutex> mutex);
@@ -53,6 +69,7 @@ signals:
     void workFinished();                                // 任务完成信号
     void sendItemData(TranPdu data, uint64_t file_id);  // 发送添加文件视图信号
     void error(QString message);                        // 错误信号
+    void tokenRejected();                               // 会话令牌被服务端拒绝，已改用密码重新请求
 
 public slots:
     void doingUp();     // 执行上传操作
@@ -60,9 +77,16 @@ public slots:
     void sendCancelRequest();
 
 private:
-    bool calculateSHA256();     // 计算文件哈希值
+    bool calculateSHA256();     // 计算文件哈希值（大文件同时分块，计算每个块的哈希）
     bool sendTranPdu();         // 发送TranPdu
     bool sendFile();            // 发送文件
+    bool sendChunkQuery();      // 发送块清单，查询服务端缺失的块，没有块清单返回false
+    bool sendDeltaSigRequest(); // 差量上传：请求旧版本的块签名，不需要差量上传返回false
+    bool sendDeltaCopies();     // 差量上传：发送复制指令，没有可以复制的数据返回false
+    bool sendQuickProof(std::shared_ptr<PDURespond> pdu);   // 秒传的持有证明：发送服务端指定区间的哈希
+    void startTransfer();       // 依次进行差量上传、块清单查询，最后发送剩余的文件数据
+    // 根据剩余数据量开启并行连接加入服务端的上传会话，返回各个连接（下标0为主连接）需要发送的chunk id
+    std::vector<std::vector<uint32_t>> openJoinConnections();
 
 private slots:
     void handleRecvPDURespond(std::shared_ptr<PDURespond> pdu);
@@ -70,11 +94,47 @@ private slots:
 private:
     void handlePutsRespond(std::shared_ptr<PDURespond> pdu);
     void handlePutsDataRespond(std::shared_ptr<PDURespond> pdu);
-    void handlePutsFinishRespond(std::shared_ptr<PDURespond> pdu);
+    void handlePutsFinishRespond(std::shared_ptr<PDURespond> pdu, SR_Tool* tool);   // tool 为收到完成回复的连接
+    void handlePutsJoinRespond(size_t index, std::shared_ptr<PDURespond> pdu);      // 并行连接加入会话的回复
+    void handlePutsChunksRespond(std::shared_ptr<PDURespond> pdu);  // 块清单查询的回复
+    void handlePutsDeltaSigRespond(std::shared_ptr<PDURespond> pdu);    // 旧版本块签名的回复
+    void handlePutsDeltaRespond(std::shared_ptr<PDURespond> pdu);       // 复制指令的回复
+    void skipReceivedChunks(std::shared_ptr<PDURespond> pdu);   // 断点续传，跳过服务端已接收的chunk
+    void skipRanges(std::vector<std::pair<uint64_t, uint64_t>> ranges);     // 跳过完全落在区间[begin, end)内的chunk
 
 private:
     std::shared_ptr<SR_Tool> sr_tool_;  // 发送接收工具
     UpContext file_ctx_;
+    std::string auth_pwd_;              // 令牌被拒绝时使用的密码
+
+    // 多连接并行上传：并行连接与主连接共享服务端的同一个上传会话，各自发送不相交的chunk
+    QString ip_;
+    std::uint32_t port_{ 0 };
+    std::vector<std::shared_ptr<SR_Tool>> join_tools_;      // 并行连接
+    std::vector<std::vector<uint32_t>> join_send_id_;       // 各个并行连接需要发送的chunk id
+    const uint32_t max_connections_{ 4 };                   // 最大连接数（包括主连接）
+    const uint64_t bytes_per_connection_{ 64 * 1024 * 1024 };   // 剩余数据每达到该大小增加一个连接
+
+    // 块存储模式：上传前发送文件的块清单，服务端已有的块（自己的其它文件或旧版本中相同的块）不再上传
+    std::vector<ChunkEntry> chunk_entries_;                 // 文件的块清单
+    std::vector<std::pair<uint64_t, uint64_t>> present_ranges_; // 服务端已有的块所在的区间
+    size_t chunk_pages_{ 0 };                               // 块清单的页数
+    size_t chunk_answered_{ 0 };                            // 已经收到回复的页数
+    bool chunk_query_done_{ false };
+    const uint64_t chunk_dedup_min_size_{ 8 * 1024 * 1024 };    // 达到该大小的文件才分块
+
+    // 差量上传：服务端发送同目录下同名文件（旧版本）的块签名，与旧版本相同的数据只发送复制指令
+    std::string delta_sig_;                                 // 已经收到的签名（块长度 + 总块数 + 块签名）
+    uint32_t delta_sig_count_{ 0 };                         // 已经收到签名的块数
+    std::vector<DeltaCopy> delta_copies_;                   // 复制指令
+    std::vector<std::pair<uint64_t, uint64_t>> delta_ranges_;   // 服务端已经复制的区间
+    size_t delta_pages_{ 0 };                               // 复制指令的页数
+    size_t delta_answered_{ 0 };                            // 已经收到回复的页数
+    bool delta_done_{ false };
+    const uint64_t delta_min_size_{ 1024 * 1024 };          // 达到该大小的文件才进行差量上传
+
+    std::map<uint32_t, uint32_t> chunk_retry_;  // 每个chunk已经重传的次数
+    const uint32_t max_chunk_retry_{ 3 };       // 校验和错误时每个chunk最多重传的次数
 
     double last_progress_{ 0 };  // 最后一次进度
     const double progress_step_{ 0.003 };   // 更新进度条的最小进度
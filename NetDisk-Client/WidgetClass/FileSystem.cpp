@@ -1,5 +1,6 @@
 ﻿#include "FileSystem.h"
 #include <QDateTime>
+#include <QSet>
 
 
 FileSystem::FileSystem(QWidget *parent)
@@ -202,6 +203,7 @@ void FileSystem::initUI() {
     list_view_->setContextMenuPolicy(Qt::CustomContextMenu);	// 设置自定义内容菜单
     list_view_->setMouseTracking(true);						// 设置鼠标跟踪
     list_view_->setDragEnabled(false);                        // 禁用列表项拖拽
+    list_view_->setSelectionMode(QAbstractItemView::ExtendedSelection);   // 支持 Ctrl/Shift 多选，删除和移动使用批量操作
 
     // 创建视图切换栈
     view_stack_ = new QStackedWidget(this);
@@ -252,6 +254,8 @@ void FileSystem::initSignals() {
             this, &FileSystem::handleDownloadActTriggered);
     connect(delete_file_act_, &QAction::triggered,
             this, &FileSystem::handleDeleteFileActTriggered);
+    connect(move_file_act_, &QAction::triggered,
+            this, &FileSystem::handleMoveFileActTriggered);
     connect(back_act_, &QAction::triggered,
             this, &FileSystem::handleBackActTriggered);
     connect(refresh_act_, &QAction::triggered,
@@ -280,6 +284,12 @@ void FileSystem::initActions() {
     delete_file_act_->setText("删除文件");
     delete_file_act_->setMenuRole(QAction::NoRole);
 
+    // 移动文件动作
+    move_file_act_ = new QAction(this);
+    move_file_act_->setIcon(QIcon(":/icon/icon/dirIcon.svg"));
+    move_file_act_->setText("移动到");
+    move_file_act_->setMenuRole(QAction::NoRole);
+
     // 返回动作
     back_act_ = new QAction(this);
     back_act_->setIcon(QIcon(":/icon/icon/bcakIcon.svg"));
@@ -311,6 +321,7 @@ void FileSystem::initToolBar() {
     tool_tb_->addAction(upload_act_);
     tool_tb_->addAction(download_act_);
     tool_tb_->addAction(delete_file_act_);
+    tool_tb_->addAction(move_file_act_);
     tool_tb_->addSeparator();   // 添加分割线
     tool_tb_->addAction(back_act_);
     tool_tb_->addAction(refresh_act_);
@@ -385,13 +396,7 @@ void FileSystem::handleItemClicked(const QModelIndex& proxy_index) {
         return;
     }
 
-    ItemDate data = item->data(Qt::UserRole).value<ItemDate>();
-    if (data.file_type == "d") {    // 如果是文件夹
-        download_act_->setEnabled(false);   // 文件夹不能下载，禁用
-    }
-    else {
-        download_act_->setEnabled(true);    // 其它文件可下载
-    }
+    download_act_->setEnabled(true);    // 文件和文件夹都可下载（文件夹使用多文件下载）
     cur_item_ = item;   // 改变当前选中的item
 }
 
@@ -425,6 +430,34 @@ void FileSystem::handleItemDoubleClicked(const QModelIndex& proxy_index) {
     }
 }
 
+// 选中的文件项ID：多选时为所有选中的项，没有选中项时（如右键的项没有被选中）为当前项
+std::vector<std::uint64_t> FileSystem::selectedIds() {
+    std::vector<std::uint64_t> ids;
+    const QModelIndexList indexes = list_view_->selectionModel()->selectedIndexes();
+    for (const QModelIndex& proxy_index : indexes) {
+        QStandardItem* item = file_model_->itemFromIndex(proxy_model_->mapToSource(proxy_index));
+        if (item != nullptr) {
+            ids.push_back(item->data(Qt::UserRole).value<ItemDate>().id);
+        }
+    }
+    if (ids.empty() && cur_item_ != nullptr) {
+        ids.push_back(cur_item_->data(Qt::UserRole).value<ItemDate>().id);
+    }
+    return ids;
+}
+
+// 文件夹的完整路径，0为根目录
+QString FileSystem::dirPath(std::uint64_t dir_id) {
+    QString path;
+    QStandardItem* item = dir_map_.value(dir_id, nullptr);
+    while (item != nullptr) {
+        ItemDate data = item->data(Qt::UserRole).value<ItemDate>();
+        path = "/" + data.file_name + path;
+        item = dir_map_.value(data.parent_id, nullptr);
+    }
+    return path.isEmpty() ? "/" : path;
+}
+
 // 处理右键信号的槽函数
 void FileSystem::handleCreateMenu(const QPoint &pos) {
     // 将鼠标位置转换为模型索引
@@ -462,15 +495,15 @@ void FileSystem::handleCreateMenu(const QPoint &pos) {
     if (item != nullptr) {  // pos位于文件项上
         data = item->data(Qt::UserRole).value<ItemDate>();
 
-        if (data.file_type == "d") {    // 文件夹
-            menu.addAction(delete_file_act_);
-        }
-        else {  // 其它文件
-            menu.addAction(delete_file_act_);
-            menu.addAction(download_act_);
-        }
+        menu.addAction(delete_file_act_);
+        menu.addAction(move_file_act_);
+        menu.addAction(download_act_);  // 文件夹使用多文件下载
 
         cur_item_ = item;
+        // 右键的项不在选择中时只选中该项，删除和移动作用于右键的项
+        if (!list_view_->selectionModel()->isSelected(proxy_index)) {
+            list_view_->selectionModel()->select(proxy_index, QItemSelectionModel::ClearAndSelect);
+        }
     }
 
     // 在当前位置显示菜单
@@ -491,32 +524,65 @@ void FileSystem::handleDownloadActTriggered() {
     }
     // 获取当前选中文件项的数据
     ItemDate data = cur_item_->data(Qt::UserRole).value<ItemDate>();
-    if (data.file_type != "d") {    // 只能下载普通文件
-        emit download(data);    // 发送下载信号
-    }
+    emit download(data);    // 发送下载信号，文件夹由 DiskClient 使用多文件下载
 
     cur_item_ = nullptr;    // 清除选择文件
 }
 
 // 处理删除动作触发的槽函数
 void FileSystem::handleDeleteFileActTriggered() {
-    if (cur_item_ == nullptr) {
+    // 选中的文件和文件夹一起删除（批量删除，服务端按ID区分文件和文件夹）
+    std::vector<std::uint64_t> ids = selectedIds();
+    if (ids.empty()) {
         return;
     }
-    // 获取要删除文件的 id 和文件名（主要是后缀名）
-    ItemDate data = cur_item_->data(Qt::UserRole).value<ItemDate>();
+    emit deleteFiles(ids);  // 发送删除信号
 
-    std::uint64_t file_id = data.id;
-    QString file_name = data.file_name;
-    if (data.file_type == "d") {
-        file_name = "dir.d";    //服务端删除文件不需要文件名，只需要ID和后缀名。所以只需要传递后缀名可以
+    cur_item_ = nullptr;    // 清除选择的文件
+    list_view_->clearSelection();
+}
+
+// 处理移动动作触发的槽函数
+void FileSystem::handleMoveFileActTriggered() {
+    std::vector<std::uint64_t> ids = selectedIds();
+    if (ids.empty()) {
+        return;
     }
-    else {
-        file_name = "file.other";
+    // 可选的目标文件夹：根目录和其它文件夹，不包括当前目录、选中的文件夹和它们的子文件夹（服务端也会拒绝）
+    QSet<std::uint64_t> moving(ids.begin(), ids.end());
+    QStringList paths;
+    QList<std::uint64_t> targets;
+    if (cur_dir_id != 0) {
+        paths.append(dirPath(0));
+        targets.append(0);
+    }
+    for (auto it = dir_map_.cbegin(); it != dir_map_.cend(); ++it) {
+        bool inside = (it.key() == cur_dir_id);
+        for (std::uint64_t id = it.key(); !inside && dir_map_.contains(id); ) {
+            inside = moving.contains(id);
+            id = dir_map_.value(id)->data(Qt::UserRole).value<ItemDate>().parent_id;
+        }
+        if (!inside) {
+            QString path = dirPath(it.key());
+            if (paths.contains(path)) {     // 同名文件夹的路径相同，附加ID区分
+                path += QString(" (%1)").arg(it.key());
+            }
+            paths.append(path);
+            targets.append(it.key());
+        }
+    }
+    if (targets.isEmpty()) {
+        return;
+    }
+    bool ok = false;
+    QString path = QInputDialog::getItem(this, "移动到", "目标文件夹：", paths, 0, false, &ok);
+    if (!ok) {
+        return;
     }
-    emit deleteFile(file_id, file_name);  // 发送删除信号
+    emit moveFiles(ids, targets.value(paths.indexOf(path)));   // 发送移动信号
 
     cur_item_ = nullptr;    // 清除选择的文件
+    list_view_->clearSelection();
 }
 
 // 处理返回动作触发的槽函数
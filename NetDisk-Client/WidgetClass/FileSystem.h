@@ -15,6 +15,7 @@
 #include <QStandardItemModel>
 #include <QVBoxLayout>
 #include <QInputDialog>
+#include <vector>
 
 // 代理模型，用于文件排序
 class FileSortProxy : public QSortFilterProxyModel {
@@ -74,6 +75,8 @@ private:
 
     void initIcon(QStandardItem* item, QString file_type);
     std::uint64_t initDirByteSize(QStandardItem* item);   // 递归更新文件夹空间信息
+    std::vector<std::uint64_t> selectedIds();   // 选中的文件项ID（支持多选），没有选中时为当前项
+    QString dirPath(std::uint64_t dir_id);      // 文件夹的完整路径，用于选择移动的目标文件夹
 
 private slots:
     // // 鼠标操作槽函数
@@ -85,6 +88,7 @@ private slots:
     void handleUploadActTriggered();        // 上传按钮按下
     void handleDownloadActTriggered();      // 下载按钮按下
     void handleDeleteFileActTriggered();    // 删除按钮按下
+    void handleMoveFileActTriggered();      // 移动按钮按下
     void handleBackActTriggered();          // 返回行为被按下
     void handleRefreshActTriggered();       // 刷新按键按下
     void handleCreateDirActTriggered();     // 创建文件夹按钮
@@ -94,7 +98,8 @@ signals:
     void download(ItemDate data);   // 下载信号
     void upload();                  // 上传信号
     void createDir(std::uint64_t parent_id, QString new_dir_name);   // 创建文件夹信号
-    void deleteFile(std::uint64_t file_id, QString file_name);      // 删除文件夹信号
+    void deleteFiles(std::vector<std::uint64_t> file_ids);          // 删除文件或文件夹信号（可以多选）
+    void moveFiles(std::vector<std::uint64_t> file_ids, std::uint64_t target_dir_id);   // 移动文件或文件夹信号（可以多选）
 
 
 private:
@@ -116,6 +121,7 @@ private:
     QAction *upload_act_{ nullptr };        // 上传文件
     QAction *download_act_{ nullptr };      // 下载文件
     QAction *delete_file_act_{ nullptr };   // 删除文件
+    QAction *move_file_act_{ nullptr };     // 移动文件
     QAction *back_act_{ nullptr };          // 返回
     QAction *refresh_act_{ nullptr };       // 刷新视图
     QAction *create_dir_act_{ nullptr };    // 创建文件夹
@@ -2,6 +2,7 @@
 #include "Serializer.h"
 #include "BufferPool.h"
 #include <QDebug>
+#include <QDateTime>
 
 
 Login::Login(std::shared_ptr<SR_Tool> sr_tool, UserInfo *info, QWidget *parent)
@@ -112,6 +113,7 @@ void Login::initSignals() {
 void Login::signin() {
     PDU pdu;
     pdu.header.type = ProtocolType::PDU_TYPE;
+    pdu.header.version = PROTOCOL_VERSION_V2;
     pdu.header.body_len = PDU_BODY_BASE_LEN;
     pdu.code = Code::SIGNIN;
     memcpy(pdu.user, user_byte_.data(), user_byte_.size());
@@ -122,7 +124,7 @@ void Login::signin() {
     auto buf = Serializer::serialize(pdu);
     qDebug() << "serialize success";
     // 发送请求
-    sr_tool_->asyncSend(buf, PROTOCOLHEADER_LEN + pdu.header.body_len);
+    sr_tool_->asyncSend(buf, Serializer::encodedLen(pdu));
     qDebug() << "asyncSend signup success";
 }
 
@@ -130,6 +132,7 @@ void Login::signin() {
 void Login::signup() {
     PDU pdu;
     pdu.header.type = ProtocolType::PDU_TYPE;
+    pdu.header.version = PROTOCOL_VERSION_V2;
     pdu.header.body_len = PDU_BODY_BASE_LEN;
     pdu.code = Code::SIGNUP;
     memcpy(pdu.user, user_byte_.data(), user_byte_.size());
@@ -139,7 +142,7 @@ void Login::signup() {
     // 序列化pdu
     auto buf = Serializer::serialize(pdu);
     // 发送请求
-    sr_tool_->asyncSend(buf, PROTOCOLHEADER_LEN + pdu.header.body_len);
+    sr_tool_->asyncSend(buf, Serializer::encodedLen(pdu));
 }
 
 // 连接服务器
@@ -210,6 +213,15 @@ void Login::handleRecvPDURespond(std::shared_ptr<PDURespond> pdu) {
             memcpy(info_->salt,          ptr + offset, USERSCOLMAXSIZE);
             offset += USERSCOLMAXSIZE;
             memcpy(info_->vip_date,      ptr + offset, USERSCOLMAXSIZE);
+            offset += USERSCOLMAXSIZE;
+            // 用户信息之后的会话令牌，旧版本服务端没有令牌时传输请求使用密码认证
+            if (pdu->msg.size() >= offset + SESSION_TOKEN_LEN) {
+                memcpy(info_->token, ptr + offset, SESSION_TOKEN_LEN);
+                info_->token_expire = QDateTime::currentSecsSinceEpoch() + SESSION_TOKEN_TTL;
+            }
+            else {
+                info_->token_expire = 0;
+            }
 
             QDialog::accept();      // 返回 QDialog::Accepted
         }
@@ -4,12 +4,15 @@
 #include <QListWidget>
 #include <QDataStream>
 #include <QVariant>
+#include <string_view>
+#include "WireFormat.h"
 
 #define MainServerIP "127.0.0.1"    // 主服务器ip（负载均衡器）
 #define MainServerPort 9091         // 主服务器端口（负载均衡器）
 #define DefaultServerIP "127.0.0.1" // 默认服务器，负载均衡器无法连接时使用
 #define DefaultServerSPort 8080
 #define DefaultServerLPort 8081
+#define UseMuxTransfer 1            // 传输任务作为流在已登录的短任务连接上多路复用，0 使用双端口模式（每个传输任务连接长任务端口）
 
 
 #define USERSCOLLEN 8             // 数据库用户信息表列数
@@ -29,6 +32,7 @@ enum ProtocolType {
     FILEINFO_TYPE,            // FileInfo
     SERVERINFOPACK_TYPE,      // ServerInfoPack
     SERVERSTATE_TYPE,         // ServerState
+    MUXFRAME_TYPE,            // MuxFrame
 };
 
 // 操作码
@@ -56,6 +60,22 @@ enum Code {
     PUTSCONTINUE,       // 断点上传
 
     GETCONTINUENO,      // 断点下载失败
+
+    PUTS_JOIN,          // 加入已有的上传会话（多连接并行上传同一个文件）
+    GETS_RANGE,         // 区间下载（多连接并行下载同一个文件），sended_size为区间起始位置，file_size为区间长度
+    PUTS_CHUNKS,        // 上传前发送文件的块清单，服务端回复缺失的块（块存储模式）
+    PUTS_DELTA_SIG,     // 差量上传：请求同目录下同名文件（旧版本）的块签名
+    PUTS_DELTA,         // 差量上传：发送复制指令，服务端从旧版本复制数据
+    PUTS_BATCH,         // 批量上传小文件：在一个连接上认证一次，file_size为所有文件的总长度（一次检查空间），sended_size为文件数
+    PUTS_BATCH_LIST,    // 批量上传：发送文件清单，服务端回复需要发送数据的文件（内容已经存在的文件直接秒传）
+    PUTS_BATCH_DATA,    // 批量上传：发送一个完整的小文件，服务端分组入库后回复每个文件的结果
+    GETS_MULTI,         // 多文件下载：在一个连接上认证一次，依次下载多个文件（文件夹在服务端递归展开）
+    GETS_MULTI_LIST,    // 多文件下载：客户端发送文件或文件夹ID，服务端回复文件清单后依次发送所有文件
+    GETS_MULTI_DATA,    // 多文件下载：服务端发送文件数据，每个文件结束时发送该文件的结束标记
+    BATCH_DELETE,       // 批量删除文件或文件夹（一个请求、一个数据库事务）
+    BATCH_MAKEDIR,      // 批量创建文件夹
+    BATCH_MOVE,         // 批量移动文件或文件夹到另一个文件夹
+    PUTS_QUICK_PROOF,   // 秒传的持有证明：客户端发送服务端指定区间的哈希
 };
 
 
@@ -73,6 +93,7 @@ enum Status {
     GET_CONTINUE_FAILED,  // 端点下载失败
 
     FILE_NOT_EXIST,       // 文件不存在
+    PUT_QUICK_PROOF,      // 内容已经存在但不属于该用户，证明持有文件后才能秒传
 };
 
 // 控制操作
@@ -83,27 +104,72 @@ enum ControlAction {
     CANCEL,               // 取消
 };
 
+// 数据压缩方式，TranPdu 的 compress 字段协商，TranDataPdu 的 status 字段标记每个分片的压缩方式
+enum Compression {
+    COMPRESS_NONE = 0,    // 不压缩（原样发送）
+    COMPRESS_DEFLATE,     // zlib，即 qCompress 的格式：原始长度(uint32) + zlib 数据
+};
+
 
 // 协议头部结构体
 #define PROTOCOLHEADER_LEN (2*sizeof(uint8_t) + sizeof(uint16_t) + sizeof(uint32_t))
+#define MAX_PDU_LEN (16*1024*1024)  // 单个PDU最大长度，与服务端相同，超出视为非法数据
 struct ProtocolHeader {
     uint16_t type{ 0 };       // 类型标识
     uint32_t body_len{ 0 };   // Body的长度（字节数）
     uint8_t version{ 0 };     // 协议版本（可选，用于兼容未来扩展）
-    uint8_t reserved{ 0 };    // 预留字段（可选，用于对齐或未来扩展）
+    uint8_t reserved{ 0 };    // 预留字段（可选，用于对齐或未来扩展）；上传/下载请求的回复中为协商的压缩方式，上传/下载请求中为认证方式（AUTH_SESSION_TOKEN）
+    uint32_t request_id{ 0 }; // 请求ID：不属于定长的头部，v2 编码在 body 的开头，回复回显请求的ID（v1 中为0）
 };
+// 每个结构体的编解码字段表（按网络顺序排列的定长字段和变长部分），见 WireFormat.h
+namespace wire {
+template <>
+struct Layout<ProtocolHeader> : NoTail {
+    // 定长的头部（8字节），request_id 不在其中
+    using Body = Fields<&ProtocolHeader::type, &ProtocolHeader::body_len, &ProtocolHeader::version, &ProtocolHeader::reserved>;
+};
+}
+static_assert(wire::Layout<ProtocolHeader>::Body::kSize == PROTOCOLHEADER_LEN, "ProtocolHeader 的字段表与 PROTOCOLHEADER_LEN 不一致");
+
+// 协议版本（ProtocolHeader::version），选择 body 的编码方式，见 WireFormat.h；客户端的短任务和上传/下载请求使用 v2，
+// 服务端按请求的版本回复，其它回复仍为 v1，接收时按头部的版本解码
+#define PROTOCOL_VERSION_V1 0     // 定长编码
+#define PROTOCOL_VERSION_V2 2     // 紧凑编码：整数为变长整数，字符数组只发送实际内容
+static_assert(PROTOCOL_VERSION_V1 == wire::kVersionV1 && PROTOCOL_VERSION_V2 == wire::kVersionV2, "协议版本与 WireFormat.h 不一致");
+#define MAX_FILE_NAME_LEN 256     // 文件名数组的长度，最长255字节，与服务端相同
+#define V1_FILE_NAME_LEN 100      // v1 中文件名字段的宽度，v1 的文件名最长99字节
 
 // 与服务端进行短任务交互的协议单元：如进行登陆、注册、删除、创建文件夹等功能
-#define PDU_BODY_BASE_LEN (3*sizeof(uint32_t) + 140)
+#define PDU_BODY_BASE_LEN (2*sizeof(uint32_t) + 140)
 struct PDU {
     ProtocolHeader header;      // 头部（type=1）
     std::uint32_t code{ 0 };    // 状态码
     char user[20] = { 0 };      // 用户名，默认最长20，非中文
     char pwd[20] = { 0 };       // 密码，默认最长20，非中文
-    char file_name[100] = { 0 };// 可用,可不用。如删除文件，就使用。最长100字节
+    char file_name[MAX_FILE_NAME_LEN] = { 0 };  // 可用,可不用。如删除文件，就使用。最长255字节
     std::uint32_t msg_len = 0;  // 备用空间长度，如有特别要求则使用，最长200字节
     char msg[200] = { 0 };      // 备用空间
 };
+namespace wire {
+template <>
+struct Field<&PDU::file_name> : ClippedField<&PDU::file_name, V1_FILE_NAME_LEN> {};
+template <>
+struct Layout<PDU> {
+    static constexpr uint16_t kType = ProtocolType::PDU_TYPE;
+    using Body = Fields<&PDU::code, &PDU::user, &PDU::pwd, &PDU::file_name, &PDU::msg_len>;
+    static constexpr bool kHasTail = true;
+    static size_t tailLen(const PDU &pdu) { return pdu.msg_len; }
+    static std::string_view tail(const PDU &pdu) { return std::string_view(pdu.msg, sizeof(pdu.msg)); }
+    static bool setTail(PDU &pdu, const char *data, size_t len) {
+        if (len > sizeof(pdu.msg)) {   // 超出备用空间
+            return false;
+        }
+        memcpy(pdu.msg, data, len);
+        return true;
+    }
+};
+}
+static_assert(wire::Layout<PDU>::Body::kSize == PDU_BODY_BASE_LEN, "PDU 的字段表与 PDU_BODY_BASE_LEN 不一致");
 
 // 用于对客户端请求的回复
 #define PDURESPOND_BODY_BASE_LEN (4*sizeof(uint32_t))
@@ -115,34 +181,155 @@ struct PDURespond {
     uint32_t msg_len{ 0 };      // 信息长度（用于发送额外信息，该长度为总长度）
     std::string msg;            // 额外信息
 };
+namespace wire {
+template <>
+struct Layout<PDURespond> {
+    static constexpr uint16_t kType = ProtocolType::PDURESPOND_TYPE;
+    using Body = Fields<&PDURespond::code, &PDURespond::status, &PDURespond::msg_amount, &PDURespond::msg_len>;
+    static constexpr bool kHasTail = true;
+    static size_t tailLen(const PDURespond &pdu) { return pdu.msg_len; }
+    static std::string_view tail(const PDURespond &pdu) { return pdu.msg; }
+    static bool setTail(PDURespond &pdu, const char *data, size_t len) {
+        pdu.msg.assign(data, len);
+        return true;
+    }
+};
+}
+static_assert(wire::Layout<PDURespond>::Body::kSize == PDURESPOND_BODY_BASE_LEN, "PDURespond 的字段表与 PDURESPOND_BODY_BASE_LEN 不一致");
+#define MAX_RESUME_RANGES 256     // 断点续传回复（PUTSCONTINUE）中最多携带的已接收区间数
+// 块清单查询（PUTS_CHUNKS）：TranDataPdu 的 file_offset 为本页第一个块的序号，total_chunks 为块总数，
+// data 为若干个块[偏移(uint64), 长度(uint32), SHA-256(32字节)]；回复体为 第一个块的序号(uint64) + 块数(uint32) + 缺失位图（1为缺失），
+// 服务端只复用该用户自己的文件已经引用的块，其它用户的块也回复为缺失
+#define CHUNK_ENTRY_LEN (sizeof(uint64_t) + sizeof(uint32_t) + 32)
+#define MAX_CHUNKS_PER_PAGE 1024  // 每页最多的块数
+// 差量上传（PUTS_DELTA_SIG）：签名分页回复，每页回复体为 块长度(uint32) + 总块数(uint32) + 本页第一个块的序号(uint32) +
+// 块签名[弱校验和(uint32), SHA-256前16字节]...，失败时只回复一次（回复体为空）
+// 复制指令（PUTS_DELTA）：TranDataPdu 的 chunk_index 为页序号，data 为若干条[新文件偏移(uint64), 旧版本偏移(uint64), 长度(uint32)]；
+// 回复体为页序号(uint32)，status 表示该页的复制指令是否全部执行成功
+#define DELTA_STRONG_LEN 16
+#define DELTA_SIG_ENTRY_LEN (sizeof(uint32_t) + DELTA_STRONG_LEN)
+#define MAX_DELTA_SIGS_PER_PAGE 256     // 签名每页最多的块数，一页回复不超过默认缓冲区（8KB）
+#define DELTA_COPY_LEN (2*sizeof(uint64_t) + sizeof(uint32_t))
+#define MAX_DELTA_COPIES_PER_PAGE 4096  // 每页最多的复制指令数
+// 批量上传文件清单（PUTS_BATCH_LIST）：TranDataPdu 的 file_offset 为本页第一个文件的序号，chunk_index 为页序号，
+// data 为若干条[文件长度(uint64), 文件哈希(64字节十六进制), 文件名长度(uint16), 文件名]；回复体为 页序号(uint32) + 需要发送数据的文件序号(uint32)...
+// 批量上传文件数据（PUTS_BATCH_DATA）：chunk_index 为文件序号，status 为压缩方式，data 为整个文件；
+// 回复（同样使用 PUTS_BATCH_DATA）体为若干条[文件序号(uint32), 文件ID(uint64)]，文件ID为0表示该文件上传失败，每个文件只回复一次
+#define BATCH_HASH_LEN 64
+#define BATCH_ENTRY_BASE_LEN (sizeof(uint64_t) + BATCH_HASH_LEN + sizeof(uint16_t))
+#define BATCH_RESULT_LEN (sizeof(uint32_t) + sizeof(uint64_t))
+#define MAX_BATCH_FILE_SIZE (4*1024*1024)   // 批量上传的单个文件最大长度，更大的文件使用普通上传
+#define MAX_BATCH_FILES 65536               // 一次批量上传最多的文件数
+#define MAX_BATCH_LIST_PER_PAGE 1024        // 文件清单每页最多的文件数
+#define MAX_BATCH_RESULTS_PER_REPLY 512     // 每个回复最多的文件结果数，一个回复不超过默认缓冲区（8KB）
+// 多文件下载请求（GETS_MULTI_LIST）：TranDataPdu 的 data 为若干个文件或文件夹ID(uint64)；回复为若干页清单（code 同为 GETS_MULTI_LIST），
+// 回复体为 页序号(uint32) + 文件总数(uint32) + 若干条[文件ID(uint64), 文件长度(uint64), 文件哈希(64字节十六进制), 路径长度(uint16), 相对路径]；
+// 之后按清单顺序发送文件数据（GETS_MULTI_DATA）：chunk_index 为文件序号，file_offset 为文件内的偏移，status 为压缩方式；
+// 每个文件结束时发送 TranFinishPdu（code 为 GETS_MULTI_DATA）：file_size 为文件序号，file_md5 为文件哈希，为空表示服务端读取该文件失败
+#define MULTI_HASH_LEN 64
+#define MULTI_ENTRY_BASE_LEN (2*sizeof(uint64_t) + MULTI_HASH_LEN + sizeof(uint16_t))
+#define MAX_MULTI_IDS 4096              // 一次请求最多的文件/文件夹ID数
+#define MAX_MULTI_FILES 65536           // 一次多文件下载最多的文件数
+#define MAX_MULTI_LIST_PAGE_LEN (6*1024) // 清单每页回复体的最大长度（按编码后的字节数分页），一个回复不超过默认缓冲区（8KB）
+#define MAX_MULTI_PATH_LEN 1024         // 相对路径的最大长度
+
+// 批量操作（BATCH_DELETE、BATCH_MAKEDIR、BATCH_MOVE，在登录后的短任务连接上发送）：TranDataPdu 的 chunk_index 为请求ID（回复的 v2 头部回显该ID），
+// total_chunks 为条目数；BATCH_DELETE 的 data 为若干个文件或文件夹ID(uint64)，文件夹递归删除；BATCH_MAKEDIR 的 file_offset 为父文件夹ID，
+// data 为若干条[名称长度(uint16), 名称]；BATCH_MOVE 的 file_offset 为目标文件夹ID（0为根目录），data 为若干个文件或文件夹ID(uint64)。
+// 所有条目在一个数据库事务中完成，回复为 PDURespond（code 与请求相同）：全部成功 status 为 SUCCESS，否则为 FAILED，msg_amount 为条目数，
+// msg 为结果位图（(条目数+7)/8 字节，第 i 个条目成功时第 i/8 字节的第 i%8 位为1），BATCH_MAKEDIR 在位图之后为每个条目的新文件夹ID(uint64，失败为0)
+#define MAX_BATCH_OP_ITEMS 512          // 一个批量操作请求最多的条目数，更多的条目由客户端分成多个请求；BATCH_MAKEDIR 的回复（位图 + 每个条目8字节）不超过默认缓冲区（8KB）
+static_assert(PROTOCOLHEADER_LEN + sizeof(uint32_t) + PDURESPOND_BODY_BASE_LEN + (MAX_BATCH_OP_ITEMS + 7) / 8 + MAX_BATCH_OP_ITEMS * sizeof(uint64_t) <= 8 * 1024,
+              "BATCH_MAKEDIR 的回复必须放得下默认缓冲区");
 
 // 用于文件上传和下载的通信协议
-#define TRANPDU_BODY_LEN (sizeof(uint32_t) + 3*sizeof(uint64_t) + 240)
+#define TRANPDU_BODY_LEN (2*sizeof(uint32_t) + 3*sizeof(uint64_t) + 240)
 struct TranPdu {
     ProtocolHeader header;              // 头部（type=2）
     std::uint32_t tran_pdu_code = 0;    // 操作码
     char user[20] = { 0 };              // 用户名
     char pwd[20] = { 0 };               // 密码
-    char file_name[100] = { 0 };        // 文件名
+    char file_name[MAX_FILE_NAME_LEN] = { 0 };  // 文件名，最长255字节
     char file_md5[100] = { 0 };         // 文件MD5码
     std::uint64_t file_size = 0;        // 文件长度
     std::uint64_t sended_size = 0;      // 实现断点续传的长度
     std::uint64_t parent_dir_id = 0;    // 保存在哪个目录下的ID，为0则保存在根目录下
+    std::uint32_t compress = 0;         // 压缩协商：低8位为支持的压缩方式（1 << Compression），8~15位为希望的压缩级别，0为不压缩；16位以上为客户端能力位
+};
+namespace wire {
+template <>
+struct Field<&TranPdu::file_name> : ClippedField<&TranPdu::file_name, V1_FILE_NAME_LEN> {};
+template <>
+struct Layout<TranPdu> : NoTail {
+    static constexpr uint16_t kType = ProtocolType::TRANPDU_TYPE;
+    using Body = Fields<&TranPdu::tran_pdu_code, &TranPdu::user, &TranPdu::pwd, &TranPdu::file_name, &TranPdu::file_md5, &TranPdu::file_size, &TranPdu::sended_size, &TranPdu::parent_dir_id, &TranPdu::compress>;
 };
+}
+static_assert(wire::Layout<TranPdu>::Body::kSize == TRANPDU_BODY_LEN, "TranPdu 的字段表与 TRANPDU_BODY_LEN 不一致");
+
+// 秒传的持有证明：内容已经存在但不属于该用户时，只知道哈希不能秒传，否则任何人都可以用哈希取得其它用户的文件。
+// TranPdu 的 compress 带有 UPLOAD_CAP_QUICK_PROOF 时，服务端回复 PUT_QUICK_PROOF，回复体为 随机数(16字节) + 区间偏移(uint64) + 区间长度(uint32)；
+// 客户端发送 TranDataPdu（code 为 PUTS_QUICK_PROOF），data 为 SHA-256(随机数 + 文件区间的数据)，校验通过后服务端按秒传入库并发送完成回复（PUTS_FINISH）
+#define UPLOAD_CAP_QUICK_PROOF (1u << 16)
+#define QUICK_PROOF_NONCE_LEN 16
+#define QUICK_PROOF_MAX_LEN (64*1024)   // 证明区间的最大长度
+
+// 分片校验和：TranPdu 的 compress 带有 UPLOAD_CAP_CRC32C 时，客户端发送的分片（PUTS_DATA、PUTS_BATCH_LIST、PUTS_BATCH_DATA）都填写了 check_sum，
+// 服务端检查后才使用；旧客户端不填写校验和（为0），也不带该能力位，服务端不检查。下载的分片总是带有校验和
+#define UPLOAD_CAP_CRC32C (1u << 17)
+
+// 会话令牌：登录和注册成功的回复在用户信息之后附带令牌（msg 的最后 SESSION_TOKEN_LEN 字节），由服务端签名并带有过期时间；
+// 上传/下载请求（TranPdu）的头部 reserved 为 AUTH_SESSION_TOKEN 时，pwd 中为会话令牌而不是密码，服务端在内存中校验，不查询数据库；
+// 令牌无效或已过期时回复状态为 NOT_VERIFY 且连接保持可用，客户端在同一个连接上改用密码重新发送请求（只重试一次）
+#define SESSION_TOKEN_LEN 20
+#define AUTH_SESSION_TOKEN 1
+#define SESSION_TOKEN_TTL (24*3600)    // 令牌的有效期（秒），客户端在到期前改用密码认证
+static_assert(SESSION_TOKEN_LEN == sizeof(TranPdu::pwd), "会话令牌必须放得下 TranPdu 的 pwd");
+
+// 令牌被服务端拒绝后，请求改用密码认证；请求没有使用令牌（已经重试过）或没有密码时返回false
+inline bool useTranPwd(TranPdu &pdu, const std::string &pwd) {
+    if (pdu.header.reserved != AUTH_SESSION_TOKEN || pwd.empty()) {
+        return false;
+    }
+    memset(pdu.pwd, 0, sizeof(pdu.pwd));
+    memcpy(pdu.pwd, pwd.data(), std::min(pwd.size(), sizeof(pdu.pwd)));
+    pdu.header.reserved = 0;
+    return true;
+}
 
 // 用于文件上传和下载文件数据的通信协议
 #define TRANDATAPDU_BODY_BASE_LEN (6*sizeof(uint32_t) + sizeof(uint64_t))
 struct TranDataPdu {
     ProtocolHeader header;
     uint32_t code{ 0 };             // 操作码
-    uint32_t status{ 0 };           // 状态码，（暂不使用，由type代替）
+    uint32_t status{ 0 };           // 状态码，PUTS_DATA/GETS_DATA 中为本分片数据的压缩方式（Compression）
     uint64_t file_offset{ 0 };      // 本次数据在文件中的偏移量
     uint32_t chunk_size{ 0 };       // 本次分片大小
     uint32_t total_chunks{ 0 };     // 总分片数（用于进度计算），（暂不使用）
     uint32_t chunk_index{ 0 };      // 当前分片索引（从0开始），（暂不使用）
-    uint32_t check_sum{ 0 };        // 本次分片数据的校验和，（暂不使用）
-    std::string data;               // 文件数据
+    uint32_t check_sum{ 0 };        // 本次分片数据的校验和（CRC32C），序列化时计算
+    std::string data;               // 文件数据（接收时使用）
+    // 发送时的数据视图，不拥有数据（指向读取的文件块、压缩缓冲区等），不为空时代替 data 发送，省去拷贝到 data 的一次复制。
+    // 序列化完成之前，视图指向的数据必须保持有效
+    std::string_view view{};
+
+    std::string_view payload() const { return view.data() != nullptr ? view : std::string_view(data); }
 };
+namespace wire {
+template <>
+struct Layout<TranDataPdu> {
+    static constexpr uint16_t kType = ProtocolType::TRANDATAPDU_TYPE;
+    using Body = Fields<&TranDataPdu::code, &TranDataPdu::status, &TranDataPdu::file_offset, &TranDataPdu::chunk_size, &TranDataPdu::total_chunks, &TranDataPdu::chunk_index, &TranDataPdu::check_sum>;
+    static constexpr bool kHasTail = true;
+    static size_t tailLen(const TranDataPdu &pdu) { return pdu.chunk_size; }
+    static std::string_view tail(const TranDataPdu &pdu) { return pdu.payload(); }
+    static bool setTail(TranDataPdu &pdu, const char *data, size_t len) {
+        pdu.data.assign(data, len);
+        return true;
+    }
+};
+}
+static_assert(wire::Layout<TranDataPdu>::Body::kSize == TRANDATAPDU_BODY_BASE_LEN, "TranDataPdu 的字段表与 TRANDATAPDU_BODY_BASE_LEN 不一致");
 
 // 用于通知文件上传和下载完成的通信协议
 #define TRANFINISHPDU_BODY_LEN (sizeof(uint32_t) + sizeof(uint64_t) + 100)
@@ -152,6 +339,14 @@ struct TranFinishPdu {
     uint64_t file_size{ 0 };    // 文件大小（用于二次校验）
     char file_md5[100]{ 0 };    // 文件MD5码
 };
+namespace wire {
+template <>
+struct Layout<TranFinishPdu> : NoTail {
+    static constexpr uint16_t kType = ProtocolType::TRANFINISHPDU_TYPE;
+    using Body = Fields<&TranFinishPdu::code, &TranFinishPdu::file_size, &TranFinishPdu::file_md5>;
+};
+}
+static_assert(wire::Layout<TranFinishPdu>::Body::kSize == TRANFINISHPDU_BODY_LEN, "TranFinishPdu 的字段表与 TRANFINISHPDU_BODY_LEN 不一致");
 
 // 用于控制传输文件状态（主要是下载）的通信协议
 #define TRANCONTROL_BODY_BASE_LEN (3*sizeof(uint32_t))
@@ -162,6 +357,61 @@ struct TranControlPdu {
     uint32_t msg_len{ 0 };    // 控制信息长度
     std::string msg;          // 控制信息
 };
+namespace wire {
+template <>
+struct Layout<TranControlPdu> {
+    static constexpr uint16_t kType = ProtocolType::TRANCONTROLPDU_TYPE;
+    using Body = Fields<&TranControlPdu::code, &TranControlPdu::action, &TranControlPdu::msg_len>;
+    static constexpr bool kHasTail = true;
+    static size_t tailLen(const TranControlPdu &pdu) { return pdu.msg_len; }
+    static std::string_view tail(const TranControlPdu &pdu) { return pdu.msg; }
+    static bool setTail(TranControlPdu &pdu, const char *data, size_t len) {
+        pdu.msg.assign(data, len);
+        return true;
+    }
+};
+}
+static_assert(wire::Layout<TranControlPdu>::Body::kSize == TRANCONTROL_BODY_BASE_LEN, "TranControlPdu 的字段表与 TRANCONTROL_BODY_BASE_LEN 不一致");
+
+// 多路复用帧：在已登录的短任务连接上承载多个传输流，一个流相当于双端口模式下的一个传输连接（上传、下载），
+// 流上的协议单元（TranPdu、TranDataPdu、TranFinishPdu、TranControlPdu 以及服务端的回复）原样序列化后放在 data 中，一帧一个。
+// 流ID由客户端分配，服务端收到未知流的 MUX_DATA 时创建流，任意一方发送 MUX_CLOSE 关闭流。
+// 流量控制：每个流两个方向的初始窗口都是 MUX_INITIAL_WINDOW，只有文件数据（TranDataPdu）占用窗口，接收方处理完后用 MUX_WINDOW 归还；
+// 窗口为正时才能发送，一个数据包可能大于剩余的窗口（不拆分数据包），发送后窗口可以为负，接收方只拒绝窗口已经用完之后到达的数据包
+#define MUXFRAME_BODY_BASE_LEN (4*sizeof(uint32_t))
+#define MUXFRAME_HEAD_LEN (PROTOCOLHEADER_LEN + MUXFRAME_BODY_BASE_LEN)  // data 之前的部分
+#define MAX_MUXFRAME_LEN (MAX_PDU_LEN + MUXFRAME_HEAD_LEN)                // 一帧最大长度，data 为一个协议单元
+#define MUX_INITIAL_WINDOW (256*1024)   // 每个流的初始窗口（字节）
+#define MUX_MAX_STREAMS 128             // 一个连接上同时打开的最多流数
+// 帧类型
+enum MuxKind {
+      MUX_DATA = 0,   // 流上的一个协议单元
+      MUX_WINDOW,     // 归还窗口，window 为归还的字节数
+      MUX_CLOSE,      // 关闭流
+};
+struct MuxFrame {
+    ProtocolHeader header;
+    uint32_t stream_id{ 0 };    // 流ID（不为0）
+    uint32_t kind{ 0 };         // 帧类型（MuxKind）
+    uint32_t window{ 0 };       // MUX_WINDOW 归还的窗口（字节）
+    uint32_t data_len{ 0 };     // data 的长度
+    std::string data{ "" };     // 流上的协议单元（接收时使用）；发送时协议单元由发送方紧跟在定长部分之后写入，不复制到 data
+};
+namespace wire {
+template <>
+struct Layout<MuxFrame> {
+    static constexpr uint16_t kType = ProtocolType::MUXFRAME_TYPE;
+    using Body = Fields<&MuxFrame::stream_id, &MuxFrame::kind, &MuxFrame::window, &MuxFrame::data_len>;
+    static constexpr bool kHasTail = true;
+    static size_t tailLen(const MuxFrame &frame) { return frame.data_len; }
+    static std::string_view tail(const MuxFrame &frame) { return frame.data; }
+    static bool setTail(MuxFrame &frame, const char *data, size_t len) {
+        frame.data.assign(data, len);
+        return true;
+    }
+};
+}
+static_assert(wire::Layout<MuxFrame>::Body::kSize == MUXFRAME_BODY_BASE_LEN, "MuxFrame 的字段表与 MUXFRAME_BODY_BASE_LEN 不一致");
 
 // 服务器简版回复客户端包体，不用每次携带大量数据
 #define RESPONDPACK_BODY_BASE_LEN (2 * sizeof(uint32_t))
@@ -171,6 +421,24 @@ struct RespondPack {
     std::uint32_t len = 0;      // 备用空间存有数据量长度
     char reserve[200] = { 0 };  // 备用空间
 };
+namespace wire {
+template <>
+struct Layout<RespondPack> {
+    static constexpr uint16_t kType = ProtocolType::RESPONDPACK_TYPE;
+    using Body = Fields<&RespondPack::code, &RespondPack::len>;
+    static constexpr bool kHasTail = true;
+    static size_t tailLen(const RespondPack &pdu) { return pdu.len; }
+    static std::string_view tail(const RespondPack &pdu) { return std::string_view(pdu.reserve, sizeof(pdu.reserve)); }
+    static bool setTail(RespondPack &pdu, const char *data, size_t len) {
+        if (len > sizeof(pdu.reserve)) {   // 超出备用空间
+            return false;
+        }
+        memcpy(pdu.reserve, data, len);
+        return true;
+    }
+};
+}
+static_assert(wire::Layout<RespondPack>::Body::kSize == RESPONDPACK_BODY_BASE_LEN, "RespondPack 的字段表与 RESPONDPACK_BODY_BASE_LEN 不一致");
 
 // 客户端信息结构体，用来保存从服务器接收的用户信息
 #define USERINFO_BODY_LEN (USERSCOLLEN * USERSCOLMAXSIZE)
@@ -184,14 +452,25 @@ struct UserInfo {
     char used_capacity[USERSCOLMAXSIZE] = { 0 };// 云盘已用空间大小
     char salt[USERSCOLMAXSIZE] = { 0 };         // 可用使用来提供多重认证
     char vip_date[USERSCOLMAXSIZE] = { 0 };     // 会员到期时间
+    // 以下不在字段表中，不随 UserInfo 发送：客户端保存登录时得到的会话令牌，以及按本地时钟计算的过期时间（秒）
+    char token[SESSION_TOKEN_LEN] = { 0 };
+    int64_t token_expire{ 0 };
+};
+namespace wire {
+template <>
+struct Layout<UserInfo> : NoTail {
+    static constexpr uint16_t kType = ProtocolType::USERINFO_TYPE;
+    using Body = Fields<&UserInfo::user, &UserInfo::pwd, &UserInfo::cipher, &UserInfo::is_vip, &UserInfo::capacity_sum, &UserInfo::used_capacity, &UserInfo::salt, &UserInfo::vip_date>;
 };
+}
+static_assert(wire::Layout<UserInfo>::Body::kSize == USERINFO_BODY_LEN, "UserInfo 的字段表与 USERINFO_BODY_LEN 不一致");
 
 // 文件信息体，即保存在数据库中的文件和文件夹
 #define FILEINFO_BODY_LEN (sizeof(uint32_t) + 3*sizeof(uint64_t) + 210)
 struct FileInfo {
     ProtocolHeader header;          // 头部（type=5）
     std::uint64_t file_id{ 0 };     // 文件在数据库的id
-    char file_name[100] = { 0 };    // 文件名，最长100字节
+    char file_name[MAX_FILE_NAME_LEN] = { 0 };  // 文件名，最长255字节
     std::uint32_t dir_grade{ 0 };   // 目录等级，距离根目录距离，用来构建文件给客户端界面系统
     char file_type[10] = { 0 };     // 文件类型，如d为目录，f为文件，也可以拓展MP3等
     std::uint64_t file_size{ 0 };   // 文件大小
@@ -209,6 +488,16 @@ struct FileInfo {
         strncpy(file_date, date, sizeof(file_date) - 1);
     }
 };
+namespace wire {
+template <>
+struct Field<&FileInfo::file_name> : ClippedField<&FileInfo::file_name, V1_FILE_NAME_LEN> {};
+template <>
+struct Layout<FileInfo> : NoTail {
+    static constexpr uint16_t kType = ProtocolType::FILEINFO_TYPE;
+    using Body = Fields<&FileInfo::file_id, &FileInfo::file_name, &FileInfo::dir_grade, &FileInfo::file_type, &FileInfo::file_size, &FileInfo::parent_dir, &FileInfo::file_date>;
+};
+}
+static_assert(wire::Layout<FileInfo>::Body::kSize == FILEINFO_BODY_LEN, "FileInfo 的字段表与 FILEINFO_BODY_LEN 不一致");
 
 // 服务器信息包
 #define SERVERINFOPACK_BODY_LEN (2*sizeof(uint32_t) + sizeof(uint64_t) + 52)
@@ -220,6 +509,14 @@ struct ServerInfoPack {
     std::uint32_t lport{ 0 };
     std::uint64_t cur_con_count{ 0 };
 };
+namespace wire {
+template <>
+struct Layout<ServerInfoPack> : NoTail {
+    static constexpr uint16_t kType = ProtocolType::SERVERINFOPACK_TYPE;
+    using Body = Fields<&ServerInfoPack::name, &ServerInfoPack::ip, &ServerInfoPack::sport, &ServerInfoPack::lport, &ServerInfoPack::cur_con_count>;
+};
+}
+static_assert(wire::Layout<ServerInfoPack>::Body::kSize == SERVERINFOPACK_BODY_LEN, "ServerInfoPack 的字段表与 SERVERINFOPACK_BODY_LEN 不一致");
 
 
 inline QString formatFileSize(std::uint64_t size) {
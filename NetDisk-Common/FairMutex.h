@@ -0,0 +1,54 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <unordered_map>
+
+// 公平锁（排队锁）：按申请的先后顺序获得锁，服务端和客户端共用
+// 多路复用时同一个连接上的多个流竞争发送锁，每个流每次只发送一个数据包，std::mutex 不保证顺序，刚释放锁的流可能立即再次获得锁，
+// 其它流长时间得不到发送机会；排队锁使刚发送完的流排到队尾，多个流的数据包在连接上轮流发送
+class FairMutex {
+ public:
+  FairMutex() = default;
+  FairMutex(const FairMutex &other) = delete;
+  FairMutex& operator=(const FairMutex &other) = delete;
+
+  void lock() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    const uint64_t ticket = next_++;
+    if (serving_ == ticket) {
+      return;
+    }
+    // 每个等待者使用自己的条件变量，释放锁时只唤醒下一个号码，避免所有等待者同时醒来争抢 mtx_（惊群）
+    std::condition_variable cv;
+    waiters_.emplace(ticket, &cv);
+    cv.wait(lock, [this, ticket] { return serving_ == ticket; });
+    waiters_.erase(ticket);
+  }
+
+  bool try_lock() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (serving_ != next_) {  // 有人持有锁或者正在排队
+      return false;
+    }
+    ++next_;
+    return true;
+  }
+
+  void unlock() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    ++serving_;
+    // 在 mtx_ 内通知：等待者醒来后才从 waiters_ 中删除自己，条件变量在通知期间有效
+    auto it = waiters_.find(serving_);
+    if (it != waiters_.end()) {
+      it->second->notify_one();
+    }
+  }
+
+ private:
+  std::mutex mtx_;
+  std::unordered_map<uint64_t, std::condition_variable*> waiters_;   // 正在等待的号码与它的条件变量（位于等待者的栈上）
+  uint64_t next_{ 0 };      // 下一个申请者的号码
+  uint64_t serving_{ 0 };   // 当前持有锁的号码
+};
@@ -0,0 +1,652 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+// 协议结构体的编解码，服务端、负载均衡器和客户端共用这一份实现（各自的 makefile / .pro 把本目录加入头文件路径）
+// 每个结构体在各自的 protocol.h 中特化一次 wire::Layout：kType 为协议类型，Body 按网络顺序列出定长字段的成员指针，
+// 有变长部分（msg、文件数据）的结构体再提供 tailLen / tail / setTail。编码和解码由字段表在编译期展开，每个字段的长度和偏移都是常量，
+// 整数统一转换为大端序（网络字节序），字符数组原样复制。定长部分的长度在 protocol.h 中与 *_BODY_LEN 宏静态比较，
+// 结构体、字段表和宏只改了其中一处时无法编译。
+// 协议头部的 version 选择 body 的编码方式：v1（0，旧版本客户端不设置 version）按上面的定长格式编码；
+// v2（紧凑编码）的字段顺序不变，整数编码为变长整数（LEB128，每字节7位，最高位表示后面还有字节），
+// 字符数组编码为 长度（变长整数）+ 内容，不发送尾部的0（接收时补0，字符串和保存二进制数据的数组都不会丢失内容），
+// 变长部分与 v1 相同；头部始终是定长的，body_len 为 v2 编码后的实际长度。解码后的结构体与 v1 相同（body_len 换算为 v1 的长度）。
+// v2 的 body 以请求ID（header.request_id，变长整数）开头，回复回显请求的ID，客户端可以连续发送多个请求、按ID匹配乱序到达的回复；
+// v1 不携带请求ID（解码后为0）
+namespace wire {
+
+constexpr uint8_t kVersionV1 = 0;
+constexpr uint8_t kVersionV2 = 2;
+
+// 0和1按 v1 解码，更新的版本无法解码
+inline bool isCompact(uint8_t version) {
+  return version == kVersionV2;
+}
+inline bool isKnownVersion(uint8_t version) {
+  return version <= kVersionV2;
+}
+
+#if defined(_MSC_VER)
+constexpr bool kLittleEndian = true;    // MSVC 支持的平台都是小端序
+#else
+constexpr bool kLittleEndian = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+#endif
+
+// 字节交换，编译为单条 bswap/rev 指令
+template <typename T>
+inline T byteSwap(T v) {
+  static_assert(std::is_integral_v<T>, "byteSwap 只用于整数");
+  if constexpr (sizeof(T) == 1) {
+    return v;
+  }
+#if defined(_MSC_VER)
+  else if constexpr (sizeof(T) == 2) {
+    return static_cast<T>(_byteswap_ushort(static_cast<uint16_t>(v)));
+  }
+  else if constexpr (sizeof(T) == 4) {
+    return static_cast<T>(_byteswap_ulong(static_cast<uint32_t>(v)));
+  }
+  else {
+    return static_cast<T>(_byteswap_uint64(static_cast<uint64_t>(v)));
+  }
+#else
+  else if constexpr (sizeof(T) == 2) {
+    return static_cast<T>(__builtin_bswap16(static_cast<uint16_t>(v)));
+  }
+  else if constexpr (sizeof(T) == 4) {
+    return static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(v)));
+  }
+  else {
+    return static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(v)));
+  }
+#endif
+}
+
+// 主机字节序与网络字节序互相转换（两个方向的转换相同）
+template <typename T>
+inline T toNet(T v) {
+  if constexpr (kLittleEndian) {
+    return byteSwap(v);
+  }
+  else {
+    return v;
+  }
+}
+
+// 变长整数的编码长度
+constexpr size_t varintLen(uint64_t v) {
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+inline size_t putVarint(char *out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = static_cast<char>((v & 0x7F) | 0x80);
+    v >>= 7;
+  }
+  out[n++] = static_cast<char>(v);
+  return n;
+}
+
+// 解码变长整数，返回读取的字节数；数据不足或超过 max_bits 位返回0
+inline size_t getVarint(const char *in, size_t len, uint64_t &v, unsigned max_bits) {
+  v = 0;
+  for (size_t i = 0; i < len && i < varintLen(UINT64_MAX); ++i) {
+    const uint64_t byte = static_cast<unsigned char>(in[i]);
+    const unsigned shift = 7 * i;
+    if ((byte & 0x7F) != 0 && (shift >= max_bits || (max_bits - shift < 7 && ((byte & 0x7F) >> (max_bits - shift)) != 0))) {
+      return 0;   // 超出字段的范围
+    }
+    v |= (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// 单个字段的编解码：v1 中整数按网络字节序，字符数组原样复制；v2 中整数为变长整数，字符数组为长度+内容
+template <typename M>
+struct Codec {
+  static_assert(std::is_integral_v<M>, "协议字段只能是整数或字符数组");
+  static constexpr size_t kSize = sizeof(M);
+  static constexpr size_t kMaxCompactSize = varintLen(static_cast<std::make_unsigned_t<M>>(~0ULL));
+  // 按值读写，结构体使用 #pragma pack 时也不会引用未对齐的成员
+  static void store(char *out, M v) {
+    v = toNet(v);
+    memcpy(out, &v, sizeof(v));
+  }
+  static M load(const char *in) {
+    M v;
+    memcpy(&v, in, sizeof(v));
+    return toNet(v);
+  }
+
+  static_assert(std::is_unsigned_v<M>, "v2 只编码无符号整数");
+  static size_t compactSize(M v) {
+    return varintLen(v);
+  }
+  static size_t putCompact(char *out, M v) {
+    return putVarint(out, v);
+  }
+  static size_t getCompact(const char *in, size_t len, M &v) {
+    uint64_t value = 0;
+    size_t n = getVarint(in, len, value, sizeof(M) * 8);
+    v = static_cast<M>(value);
+    return n;
+  }
+};
+
+template <size_t N>
+struct Codec<char[N]> {
+  static constexpr size_t kSize = N;
+  static constexpr size_t kMaxCompactSize = varintLen(N) + N;
+
+  // 去掉尾部的0之后的长度：数组通常只用了开头的一小部分，先按8字节一组从后向前跳过0，最后一组再逐字节查找
+  static size_t usedLen(const char (&s)[N]) {
+    size_t n = N;
+    while (n >= sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, s + n - sizeof(word), sizeof(word));
+      if (word != 0) {
+        break;
+      }
+      n -= sizeof(word);
+    }
+    while (n > 0 && s[n - 1] == 0) {
+      --n;
+    }
+    return n;
+  }
+  // used 为 usedLen 的结果，由调用者计算一次后传入
+  static size_t compactSize(size_t used) {
+    return varintLen(used) + used;
+  }
+  static size_t putCompact(char *out, const char (&s)[N], size_t used) {
+    size_t pos = putVarint(out, used);
+    memcpy(out + pos, s, used);
+    return pos + used;
+  }
+  // 长度超过数组或数据不足返回0
+  static size_t getCompact(const char *in, size_t len, char (&s)[N]) {
+    uint64_t n = 0;
+    size_t pos = getVarint(in, len, n, 64);
+    if (pos == 0 || n > N || len - pos < n) {
+      return 0;
+    }
+    memcpy(s, in + pos, n);
+    memset(s + n, 0, N - n);
+    return pos + n;
+  }
+};
+
+template <auto Member>
+struct Field;
+
+template <typename S, typename M, M S::*Member>
+struct Field<Member> {
+  static constexpr size_t kSize = Codec<M>::kSize;
+  static constexpr size_t kMaxCompactSize = Codec<M>::kMaxCompactSize;
+  static void write(const S &s, char *out) {
+    if constexpr (std::is_array_v<M>) {
+      memcpy(out, s.*Member, kSize);
+    }
+    else {
+      Codec<M>::store(out, get(s));
+    }
+  }
+  static void read(const char *in, S &s) {
+    if constexpr (std::is_array_v<M>) {
+      memcpy(s.*Member, in, kSize);
+    }
+    else {
+      set(s, Codec<M>::load(in));
+    }
+  }
+
+  // 测量 v2 编码的长度，used 记录字符数组的有效长度，写入时传回（整数不需要）
+  static size_t measureCompact(const S &s, size_t &used) {
+    if constexpr (std::is_array_v<M>) {
+      used = Codec<M>::usedLen(s.*Member);
+      return Codec<M>::compactSize(used);
+    }
+    else {
+      used = 0;
+      return Codec<M>::compactSize(get(s));
+    }
+  }
+  static size_t writeCompact(const S &s, char *out, size_t used) {
+    if constexpr (std::is_array_v<M>) {
+      return Codec<M>::putCompact(out, s.*Member, used);
+    }
+    else {
+      (void)used;
+      return Codec<M>::putCompact(out, get(s));
+    }
+  }
+  // 返回读取的字节数，出错返回0
+  static size_t readCompact(const char *in, size_t len, S &s) {
+    if constexpr (std::is_array_v<M>) {
+      return Codec<M>::getCompact(in, len, s.*Member);
+    }
+    else {
+      M v{};
+      size_t n = Codec<M>::getCompact(in, len, v);
+      set(s, v);
+      return n;
+    }
+  }
+
+ private:
+  // 整数成员按字节复制，结构体使用 #pragma pack 时成员可能没有对齐
+  template <typename V = M>
+  static V get(const S &s) {
+    V v;
+    memcpy(&v, &(s.*Member), sizeof(v));
+    return v;
+  }
+  template <typename V = M>
+  static void set(S &s, V v) {
+    memcpy(&(s.*Member), &v, sizeof(v));
+  }
+};
+
+// v1 中宽度固定为 Width 的字符数组：结构体中的数组加长后（如文件名），v1 仍按原来的宽度编码，
+// 发送时超出的部分截断（保留结尾的0），接收时其余部分补0；v2 按数组的实际内容编码，不受 Width 限制。
+// 在 protocol.h 中特化 Field 使用：template <> struct Field<&X::name> : ClippedField<&X::name, 100> {};
+template <auto Member, size_t Width>
+struct ClippedField;
+
+template <typename S, size_t N, char (S::*Member)[N], size_t Width>
+struct ClippedField<Member, Width> {
+  static_assert(Width > 0 && Width <= N, "v1 宽度不能超过数组长度");
+  static constexpr size_t kSize = Width;
+  static constexpr size_t kMaxCompactSize = Codec<char[N]>::kMaxCompactSize;
+  static void write(const S &s, char *out) {
+    size_t n = strnlen(s.*Member, Width - 1);
+    memcpy(out, s.*Member, n);
+    memset(out + n, 0, Width - n);
+  }
+  static void read(const char *in, S &s) {
+    memcpy(s.*Member, in, Width);
+    memset(s.*Member + Width, 0, N - Width);
+  }
+
+  static size_t measureCompact(const S &s, size_t &used) {
+    used = Codec<char[N]>::usedLen(s.*Member);
+    return Codec<char[N]>::compactSize(used);
+  }
+  static size_t writeCompact(const S &s, char *out, size_t used) {
+    return Codec<char[N]>::putCompact(out, s.*Member, used);
+  }
+  static size_t readCompact(const char *in, size_t len, S &s) {
+    return Codec<char[N]>::getCompact(in, len, s.*Member);
+  }
+};
+
+// 两个成员指针是否指向同一个字段（类型不同的成员指针不能直接比较）
+template <auto A, auto B>
+constexpr bool sameMember() {
+  if constexpr (std::is_same_v<decltype(A), decltype(B)>) {
+    return A == B;
+  }
+  else {
+    return false;
+  }
+}
+
+// 定长字段表，按网络顺序排列
+template <auto... Members>
+struct Fields {
+  static constexpr size_t kCount = sizeof...(Members);
+  static constexpr size_t kSize = (Field<Members>::kSize + ... + 0);
+  static constexpr size_t kMaxCompactSize = (Field<Members>::kMaxCompactSize + ... + 0);   // v2 编码的最大长度
+
+  template <typename S>
+  static void write(const S &s, char *out) {
+    ((Field<Members>::write(s, out), out += Field<Members>::kSize), ...);
+  }
+  template <typename S>
+  static void read(const char *in, S &s) {
+    ((Field<Members>::read(in, s), in += Field<Members>::kSize), ...);
+  }
+  // 字段在定长部分中的偏移（编译期常量）
+  template <auto Target>
+  static constexpr size_t offsetOf() {
+    static_assert((sameMember<Members, Target>() || ...), "字段不在字段表中");
+    size_t offset = 0;
+    bool found = false;
+    ((found = found || sameMember<Members, Target>(), offset += (found ? 0 : Field<Members>::kSize)), ...);
+    return offset;
+  }
+
+  // 测量 v2 编码的长度，used 按字段顺序记录每个字段的测量结果（kCount 个），writeCompact 使用同一份结果，不再重新扫描字符数组
+  template <typename S>
+  static size_t measureCompact(const S &s, size_t *used) {
+    size_t len = 0;
+    ((len += Field<Members>::measureCompact(s, *used), ++used), ...);
+    return len;
+  }
+  template <typename S>
+  static size_t writeCompact(const S &s, char *out, const size_t *used) {
+    size_t pos = 0;
+    ((pos += Field<Members>::writeCompact(s, out + pos, *used), ++used), ...);
+    return pos;
+  }
+  // 返回读取的字节数，任意字段出错返回0
+  template <typename S>
+  static size_t readCompact(const char *in, size_t len, S &s) {
+    size_t pos = 0;
+    bool ok = (readCompactOne<Members>(in, len, pos, s) && ...);
+    return ok ? pos : 0;
+  }
+
+ private:
+  template <auto Member, typename S>
+  static bool readCompactOne(const char *in, size_t len, size_t &pos, S &s) {
+    size_t n = Field<Member>::readCompact(in + pos, len - pos, s);
+    pos += n;
+    return n != 0;
+  }
+};
+
+// 在 protocol.h 中特化
+template <typename T>
+struct Layout;
+
+// 没有变长部分的结构体（Layout 可以继承它）
+struct NoTail {
+  static constexpr bool kHasTail = false;
+};
+
+enum class Error {
+  NONE = 0,
+  BAD_TYPE,       // header.type 不是该结构体的类型
+  BAD_LENGTH,     // header.body_len 与定长部分加变长部分的长度不一致，或者变长部分的数据不足
+  NO_SPACE,       // 输出缓冲区容量不足
+  BAD_VERSION,    // header.version 无法编码（未知版本，或者只支持定长编码的接口收到 v2）
+};
+
+template <typename H>
+constexpr size_t headerLen() {
+  return Layout<H>::Body::kSize;
+}
+
+// body 的实际长度：定长部分 + 变长部分声明的长度
+template <typename T>
+size_t bodyLen(const T &pdu) {
+  if constexpr (Layout<T>::kHasTail) {
+    return Layout<T>::Body::kSize + Layout<T>::tailLen(pdu);
+  }
+  else {
+    return Layout<T>::Body::kSize;
+  }
+}
+
+// 编码前的测量结果：v2 中每个字段的有效长度只计算一次，申请缓冲区（encodedLen）和写入（serializeInto）共用
+template <typename T>
+struct Measure {
+  size_t used[Layout<T>::Body::kCount > 0 ? Layout<T>::Body::kCount : 1]{};
+  size_t total_len{ 0 };    // 按 header.version 编码后的总长度（头部 + body）
+};
+
+template <typename T>
+Measure<T> measure(const T &pdu) {
+  using H = std::decay_t<decltype(pdu.header)>;
+  Measure<T> m;
+  if (!isCompact(pdu.header.version)) {
+    m.total_len = headerLen<H>() + pdu.header.body_len;
+    return m;
+  }
+  // v2 的 body：请求ID + 字段 + 变长部分
+  m.total_len = headerLen<H>() + varintLen(pdu.header.request_id) + Layout<T>::Body::measureCompact(pdu, m.used);
+  if constexpr (Layout<T>::kHasTail) {
+    m.total_len += Layout<T>::tailLen(pdu);
+  }
+  return m;
+}
+
+// 按 header.version 编码后的总长度（头部 + body），调用者按这个长度申请缓冲区和发送；
+// 随后还要编码时使用 measure，把结果传给 serializeInto，避免重复测量
+template <typename T>
+size_t encodedLen(const T &pdu) {
+  return measure(pdu).total_len;
+}
+
+// 没有变长部分的结构体以任意版本编码的最大长度（用于栈上的缓冲区）
+template <typename T>
+constexpr size_t maxEncodedLen() {
+  static_assert(!Layout<T>::kHasTail, "有变长部分的结构体没有固定的最大长度");
+  using H = std::decay_t<decltype(T::header)>;
+  constexpr size_t v1 = Layout<T>::Body::kSize;
+  constexpr size_t v2 = Codec<decltype(H::request_id)>::kMaxCompactSize + Layout<T>::Body::kMaxCompactSize;
+  return headerLen<H>() + (v1 > v2 ? v1 : v2);
+}
+
+// 检查类型、版本和长度（body_len 为 v1 的长度，与变长部分声明的长度一致）
+template <typename T>
+Error check(const T &pdu) {
+  using L = Layout<T>;
+  if (pdu.header.type != L::kType) {
+    return Error::BAD_TYPE;
+  }
+  if (!isKnownVersion(pdu.header.version)) {
+    return Error::BAD_VERSION;
+  }
+  if (pdu.header.body_len != bodyLen(pdu)) {
+    return Error::BAD_LENGTH;
+  }
+  if constexpr (L::kHasTail) {
+    if (L::tail(pdu).size() < L::tailLen(pdu)) {
+      return Error::BAD_LENGTH;
+    }
+  }
+  return Error::NONE;
+}
+
+// 检查类型和长度后以 v1 编码头部和定长部分，返回写入的长度，变长部分由调用者写入或发送；检查失败返回0
+// 调用者依赖定长部分的长度和偏移（如直接发送文件数据、回填校验和），只支持 v1
+template <typename T>
+size_t serializeHead(const T &pdu, char *out, size_t cap, Error &err) {
+  using L = Layout<T>;
+  using H = std::decay_t<decltype(pdu.header)>;
+  constexpr size_t head_len = headerLen<H>() + L::Body::kSize;
+  err = check(pdu);
+  if (err != Error::NONE) {
+    return 0;
+  }
+  if (isCompact(pdu.header.version)) {
+    err = Error::BAD_VERSION;
+    return 0;
+  }
+  if (cap < head_len) {
+    err = Error::NO_SPACE;
+    return 0;
+  }
+  Layout<H>::Body::write(pdu.header, out);
+  L::Body::write(pdu, out + headerLen<H>());
+  return head_len;
+}
+
+// 以 v2 编码整个结构体，头部的 body_len 替换为编码后的长度，m 为 measure(pdu) 的结果
+template <typename T>
+size_t serializeCompact(const T &pdu, const Measure<T> &m, char *out, size_t cap, Error &err) {
+  using L = Layout<T>;
+  using H = std::decay_t<decltype(pdu.header)>;
+  err = check(pdu);
+  if (err != Error::NONE) {
+    return 0;
+  }
+  if (cap < m.total_len) {
+    err = Error::NO_SPACE;
+    return 0;
+  }
+  H header = pdu.header;
+  header.body_len = static_cast<decltype(header.body_len)>(m.total_len - headerLen<H>());
+  Layout<H>::Body::write(header, out);
+  size_t len = headerLen<H>();
+  len += putVarint(out + len, pdu.header.request_id);
+  len += L::Body::writeCompact(pdu, out + len, m.used);
+  if constexpr (L::kHasTail) {
+    if (L::tailLen(pdu) > 0) {
+      memcpy(out + len, L::tail(pdu).data(), L::tailLen(pdu));
+      len += L::tailLen(pdu);
+    }
+  }
+  return len;
+}
+
+// 按 header.version 编码整个结构体到 out（容量 cap），返回写入的长度；检查失败返回0，m 为 measure(pdu) 的结果
+template <typename T>
+size_t serializeInto(const T &pdu, const Measure<T> &m, char *out, size_t cap, Error &err) {
+  if (isCompact(pdu.header.version)) {
+    return serializeCompact(pdu, m, out, cap, err);
+  }
+  using H = std::decay_t<decltype(pdu.header)>;
+  const size_t total_len = headerLen<H>() + pdu.header.body_len;
+  if (cap < total_len) {
+    err = Error::NO_SPACE;
+    return 0;
+  }
+  size_t len = serializeHead(pdu, out, cap, err);
+  if constexpr (Layout<T>::kHasTail) {
+    if (len > 0 && Layout<T>::tailLen(pdu) > 0) {
+      memcpy(out + len, Layout<T>::tail(pdu).data(), Layout<T>::tailLen(pdu));
+      len += Layout<T>::tailLen(pdu);
+    }
+  }
+  return len;
+}
+
+// 调用者没有测量结果时（如编码到栈上的缓冲区）
+template <typename T>
+size_t serializeInto(const T &pdu, char *out, size_t cap, Error &err) {
+  return serializeInto(pdu, measure(pdu), out, cap, err);
+}
+
+// 解码 v1 的头部和定长部分，检查类型和长度，tail 指向 buf 中变长部分的起始位置（不复制）；v2 的数据返回false
+template <typename T>
+bool deserializeHead(const char *buf, size_t len, T &pdu, const char *&tail) {
+  using L = Layout<T>;
+  using H = std::decay_t<decltype(pdu.header)>;
+  if (len < headerLen<H>()) {
+    return false;
+  }
+  Layout<H>::Body::read(buf, pdu.header);
+  if (pdu.header.type != L::kType) {  // 验证类型
+    return false;
+  }
+  if (isCompact(pdu.header.version) || !isKnownVersion(pdu.header.version)) {
+    return false;
+  }
+  // 判断Body是否完整
+  if (pdu.header.body_len < L::Body::kSize || len - headerLen<H>() < pdu.header.body_len) {
+    return false;
+  }
+  L::Body::read(buf + headerLen<H>(), pdu);
+  if constexpr (L::kHasTail) {
+    // 有变长部分时 body_len 必须与声明的长度一致
+    if (pdu.header.body_len != bodyLen(pdu)) {
+      return false;
+    }
+  }
+  tail = buf + headerLen<H>() + L::Body::kSize;
+  return true;
+}
+
+// 解码 v2 的结构体，变长部分复制到结构体中，body_len 换算为 v1 的长度
+template <typename T>
+bool deserializeCompact(const char *buf, size_t len, T &pdu) {
+  using L = Layout<T>;
+  using H = std::decay_t<decltype(pdu.header)>;
+  if (len < headerLen<H>()) {
+    return false;
+  }
+  Layout<H>::Body::read(buf, pdu.header);
+  if (pdu.header.type != L::kType || !isCompact(pdu.header.version)) {
+    return false;
+  }
+  const size_t body_len = pdu.header.body_len;
+  if (len - headerLen<H>() < body_len) {
+    return false;
+  }
+  const char *body = buf + headerLen<H>();
+  decltype(H::request_id) request_id = 0;   // 按值读取，结构体使用 #pragma pack 时不能引用其中的成员
+  size_t used = Codec<decltype(H::request_id)>::getCompact(body, body_len, request_id);
+  if (used == 0) {
+    return false;
+  }
+  pdu.header.request_id = request_id;
+  size_t fields_len = L::Body::readCompact(body + used, body_len - used, pdu);
+  if (fields_len == 0) {
+    return false;
+  }
+  used += fields_len;
+  if constexpr (L::kHasTail) {
+    // 剩余的数据就是变长部分，长度必须与声明的长度一致
+    if (body_len - used != L::tailLen(pdu) || !L::setTail(pdu, body + used, body_len - used)) {
+      return false;
+    }
+  }
+  else {
+    if (used != body_len) {
+      return false;
+    }
+  }
+  pdu.header.body_len = static_cast<decltype(pdu.header.body_len)>(bodyLen(pdu));
+  return true;
+}
+
+// 按 header.version 解码整个结构体，变长部分复制到结构体中
+template <typename T>
+bool deserialize(const char *buf, size_t len, T &pdu) {
+  using H = std::decay_t<decltype(pdu.header)>;
+  if (len < headerLen<H>()) {
+    return false;
+  }
+  H header;
+  Layout<H>::Body::read(buf, header);
+  if (isCompact(header.version)) {
+    return deserializeCompact(buf, len, pdu);
+  }
+  const char *tail = nullptr;
+  if (!deserializeHead(buf, len, pdu, tail)) {
+    return false;
+  }
+  if constexpr (Layout<T>::kHasTail) {
+    return Layout<T>::setTail(pdu, tail, Layout<T>::tailLen(pdu));
+  }
+  else {
+    return true;
+  }
+}
+
+// 只有字段表、没有类型的结构体（协议头部）
+template <typename T>
+size_t writePlain(const T &value, char *out) {
+  Layout<T>::Body::write(value, out);
+  return Layout<T>::Body::kSize;
+}
+
+template <typename T>
+bool readPlain(const char *buf, size_t len, T &value) {
+  if (len < Layout<T>::Body::kSize) {
+    return false;
+  }
+  Layout<T>::Body::read(buf, value);
+  return true;
+}
+
+}
@@ -2,26 +2,45 @@
 
 #include <memory>
 #include <vector>
-#include <unordered_map>
+#include <array>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <cstdint>
 
 using buffer_shared_ptr = std::shared_ptr<char[]>;
 
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! 后续使用自定义高性能Buffer，不使用原始char数组 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 // 缓冲区池（线程安全）
+// 缓冲区按2的幂分为多个大小级别（256B ~ 4MB），同一级别的缓冲区从连续的大块内存（slab，可以使用大页）中切分，
+// 超过最大级别的缓冲区单独分配，用完直接释放。
+// 每个线程为每个级别缓存一个弹匣（magazine），申请和归还只访问本线程的弹匣，不加锁；弹匣空了或满了时才加锁，
+// 与该级别的共享仓库（depot）一次交换一批缓冲区。一个线程的缓存只服务一个缓冲区池（第一个在该线程使用的池，即单例），
+// 其它池直接使用共享仓库。
+// 线程只在申请或归还时检查清除轮次（trim_epoch_），之后不再使用缓冲区池的线程（如没有任务的工作线程）会一直持有缓存的缓冲区，
+// 这些缓冲区所在的 slab 不能释放；每个线程每个级别最多缓存 2 * kMagazineRounds 个、不超过 2 * kMagazineBytes 字节，
+// 线程退出时全部归还，长时间空闲的线程可以调用 releaseThreadCache 提前归还
 class BufferPool {
  public:
+  static const uint32_t kMinClassShift = 8;     // 最小级别 256B
+  static const uint32_t kMaxClassShift = 22;    // 最大级别 4MB
+  static const uint32_t kClassCount = kMaxClassShift - kMinClassShift + 1;
+  static const size_t kSlabSize = 2 * 1024 * 1024;  // slab 大小（与大页相同），更大的级别每个 slab 只有一个缓冲区
+  static const uint32_t kMagazineRounds = 32;       // 线程缓存与共享仓库一次交换的最大缓冲区数，弹匣容量为它的两倍
+  static const size_t kMagazineBytes = 256 * 1024;  // 一次交换的最大字节数，更大的级别交换的数量更少，超过它的级别不使用线程缓存
+  static const size_t kMaxFreeBytes = 8 * kSlabSize;  // 一个级别共享仓库中空闲缓冲区的总长度上限，超过时清除线程释放完全空闲的 slab
+
   // 删除器，调用BufferPool::release
   struct BufferDeleter {
     BufferPool* pool{ nullptr };
+    uint32_t size_class{ 0 };   // 缓冲区所属的级别，归还时不需要查找
     BufferDeleter() = default;
-    BufferDeleter(BufferPool* p = nullptr); // 绑定到对应缓冲区池
+    BufferDeleter(BufferPool* p, uint32_t c = 0); // 绑定到对应缓冲区池
 
     // 定义拷贝和移动语句
-    BufferDeleter(const BufferDeleter&) = default;  // 使用默认，因为该类只有一个指针类，直接拷贝即可
+    BufferDeleter(const BufferDeleter&) = default;  // 使用默认，因为该类只有指针和级别，直接拷贝即可
     BufferDeleter& operator=(const BufferDeleter&) = default;
     BufferDeleter(BufferDeleter&&) = default;
     BufferDeleter& operator=(BufferDeleter&&) = default;
@@ -29,30 +48,91 @@ class BufferPool {
     void operator()(char* buf) const;       // 当shared_ptr销毁时，会被调用
   };
 
+  // 一个级别的统计信息
+  struct ClassStats {
+    size_t buffer_size{ 0 };  // 缓冲区大小
+    uint64_t hits{ 0 };       // 申请次数（线程缓存中的次数在与共享仓库交换时计入）
+    uint64_t misses{ 0 };     // 共享仓库为空、切分新 slab 的次数
+    size_t in_use{ 0 };       // 不在共享仓库中的缓冲区数（包括线程缓存中的缓冲区）
+    size_t high_water{ 0 };   // in_use 的最大值
+    size_t capacity{ 0 };     // 已经切分的缓冲区总数
+  };
+
  public:
   BufferPool(size_t buffer_size = 8192, size_t initial_count = 100);
   ~BufferPool();
 
   static BufferPool& getInstance();
+  // 读取配置后、第一次使用缓冲区池之前调用：slab 使用大页（没有预留大页时使用透明大页）
+  static void setHugePages(bool enable);
+  // 默认缓冲区大小（acquire() 返回的缓冲区大小）
   size_t getBufferSize();
-  // 申请缓冲区（返回智能指针，自动归还）
+  // 申请默认大小的缓冲区（返回智能指针，自动归还）
   std::shared_ptr<char[]> acquire();
+  // 申请至少 len 字节的缓冲区，超过最大级别时单独分配（不归还到池中，用完直接释放）
+  std::shared_ptr<char[]> acquire(size_t len);
   // 归还缓冲区（由智能指针的删除器调用）
-  void release(char* buf);
+  void release(char* buf, uint32_t size_class);
+  // 每个级别的统计信息
+  std::vector<ClassStats> getStats();
+  // 把调用线程缓存的缓冲区全部还给共享仓库，线程即将长时间不使用缓冲区池时调用
+  void releaseThreadCache();
 
  private:
-  // 创建新缓冲区
-  char* createBuffer();
+  // 一块连续内存，切分为同一级别的多个缓冲区
+  struct Slab {
+    char* addr{ nullptr };
+    size_t len{ 0 };
+  };
+  // 一个大小级别的共享仓库，单独占用缓存行，不同级别的锁互不影响
+  struct alignas(64) SizeClass {
+    std::mutex mutex;
+    std::vector<char*> free_list;   // 空闲缓冲区，后进先出，最近使用的缓冲区还在缓存中
+    std::vector<Slab> slabs;
+    ClassStats stats;
+    bool used{ false };             // 上次检查后是否从共享仓库申请过
+    int idle_checks{ 0 };           // 连续没有使用的检查次数
+  };
+  struct ThreadCache;     // 一个线程的弹匣，定义在 BufferPool.cpp
+
+  // 能容纳 len 字节的级别，超过最大级别时返回 kClassCount
+  static uint32_t classOf(size_t len);
+  static size_t classSize(uint32_t size_class);
+  // 每次与共享仓库交换的缓冲区数，0 表示不使用线程缓存
+  static uint32_t magazineRounds(uint32_t size_class);
+  static ThreadCache& threadCache();
+  // 线程缓存属于本池时返回true；清除线程开始新一轮检查后，先把线程缓存全部还给共享仓库
+  bool bindCache(ThreadCache& cache);
+  // 共享仓库的操作，都会加该级别的锁
+  char* acquireFromDepot(uint32_t size_class);                      // 申请一个缓冲区
+  void releaseToDepot(char* buf, uint32_t size_class);              // 归还一个缓冲区
+  void refill(ThreadCache& cache, uint32_t size_class);             // 取一批缓冲区放入空的弹匣
+  void flush(ThreadCache& cache, uint32_t size_class, uint32_t count);  // 把弹匣底部（最早放入）的 count 个缓冲区放回共享仓库
+  void flushAll(ThreadCache& cache);                                // 归还线程缓存中的全部缓冲区
+  // 切分一个新的 slab 到空闲链表（调用前需持有 cls.mutex）
+  bool grow(SizeClass& cls, uint32_t size_class);
+  // 记录 in_use 的最大值（调用前需持有 cls.mutex）
+  static void updateHighWater(SizeClass& cls);
+  static bool allocSlab(size_t len, Slab& slab);
+  static void freeSlab(const Slab& slab);
   // 启动超时清除线程，定期清除长时间未使用的缓冲区
   void startCleanerThread();
-  // 清除过期缓冲区
+  // 清除过期缓冲区：一个级别长时间没有从共享仓库申请、并且缓冲区全部在共享仓库中时释放它的 slab，
+  // 否则空闲缓冲区超过 kMaxFreeBytes 时释放其中完全空闲的 slab；之后增加 trim_epoch_，各线程在下一次申请或归还时把线程缓存还给共享仓库
   void cleanExpiredBuffers();
+  // 释放完全空闲（所有缓冲区都在共享仓库中）的 slab，直到空闲缓冲区的总长度不超过 kMaxFreeBytes（调用前需持有 cls.mutex）
+  void trimFreeSlabs(SizeClass& cls, uint32_t size_class);
+  // 输出使用过的级别的统计信息，清除线程每次检查时调用
+  void logStats();
 
  private:
-  size_t buffer_size_{ 0 };     // 单个缓冲区大小
-  std::vector<char*> pool_;     // 缓冲区池
-  std::unordered_map<char*, std::chrono::steady_clock::time_point> last_used_;  // 记录缓冲区最后使用时间
-  std::mutex mutex_;
+  const uint64_t id_;             // 缓冲区池ID，线程缓存用它判断所属的池
+  uint32_t default_class_{ 0 };   // 默认缓冲区的级别
+  alignas(64) std::atomic<uint64_t> trim_epoch_{ 0 };  // 清除线程的检查轮次，每次申请和归还都会读取，单独占用缓存行
+  std::array<SizeClass, kClassCount> classes_;
   std::thread cleaner_thread_;  // 超时清除线程
   std::atomic<bool> stop_cleaner_{ false };   // 停止清除线程的标志
+  std::mutex cleaner_mutex_;
+  std::condition_variable cleaner_cv_;        // 停止时唤醒清除线程，不需要等到下一次检查
+  static std::atomic<bool> huge_pages_;       // slab 是否使用大页
 };
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstring>
 #include <arpa/inet.h>
+#include "WireFormat.h"
 
 // 协议类型
 enum ProtocolType {
@@ -19,6 +20,7 @@ enum ProtocolType {
   FILEINFO_TYPE,            // FileInfo
   SERVERINFOPACK_TYPE,      // ServerInfoPack
   SERVERSTATE_TYPE,         // ServerState
+  MUXFRAME_TYPE,            // MuxFrame
 };
 
 // 协议头部结构体
@@ -28,7 +30,17 @@ struct ProtocolHeader {
   uint32_t body_len{ 0 };   // Body的长度（字节数）
   uint8_t version{ 0 };     // 协议版本（可选，用于兼容未来扩展）
   uint8_t reserved{ 0 };    // 预留字段（可选，用于对齐或未来扩展）
+  uint32_t request_id{ 0 }; // 请求ID：不属于定长的头部，v2 编码在 body 的开头，回复回显请求的ID（v1 中为0）
 };
+// 每个结构体的编解码字段表（按网络顺序排列的定长字段和变长部分），见 WireFormat.h
+namespace wire {
+template <>
+struct Layout<ProtocolHeader> : NoTail {
+  // 定长的头部（8字节），request_id 不在其中
+  using Body = Fields<&ProtocolHeader::type, &ProtocolHeader::body_len, &ProtocolHeader::version, &ProtocolHeader::reserved>;
+};
+}
+static_assert(wire::Layout<ProtocolHeader>::Body::kSize == PROTOCOLHEADER_LEN, "ProtocolHeader 的字段表与 PROTOCOLHEADER_LEN 不一致");
 
 // 服务器信息包
 #define SERVERINFOPACK_BODY_LEN (2*sizeof(uint32_t) + sizeof(uint64_t) + 52)
@@ -54,6 +66,14 @@ struct ServerInfoPack {
   }
   ServerInfoPack() = default;
 };
+namespace wire {
+template <>
+struct Layout<ServerInfoPack> : NoTail {
+  static constexpr uint16_t kType = ProtocolType::SERVERINFOPACK_TYPE;
+  using Body = Fields<&ServerInfoPack::name, &ServerInfoPack::ip, &ServerInfoPack::sport, &ServerInfoPack::lport, &ServerInfoPack::cur_con_count>;
+};
+}
+static_assert(wire::Layout<ServerInfoPack>::Body::kSize == SERVERINFOPACK_BODY_LEN, "ServerInfoPack 的字段表与 SERVERINFOPACK_BODY_LEN 不一致");
 
 #pragma pack(push, 1)
 #define SERVERSTATE_BODY_LEN (sizeof(uint32_t) + sizeof(uint64_t))
@@ -62,4 +82,12 @@ struct ServerState {
   std::uint32_t code = 0;             // 状态码，0为正常，1为关闭
   std::uint64_t cur_con_count = 0;    // 当前连接数
 };
-#pragma pack(pop)   //禁用内存对齐，方便网络传输
\ No newline at end of file
+#pragma pack(pop)   //禁用内存对齐，方便网络传输
+namespace wire {
+template <>
+struct Layout<ServerState> : NoTail {
+  static constexpr uint16_t kType = ProtocolType::SERVERSTATE_TYPE;
+  using Body = Fields<&ServerState::code, &ServerState::cur_con_count>;
+};
+}
+static_assert(wire::Layout<ServerState>::Body::kSize == SERVERSTATE_BODY_LEN, "ServerState 的字段表与 SERVERSTATE_BODY_LEN 不一致");
\ No newline at end of file
@@ -1,42 +1,49 @@
 #pragma once
 
 #include <memory>
+#include <stdexcept>
 #include "BufferPool.h"
 #include "protocol.h"
 
 // 序列化工具
+// 各结构体的字段在 protocol.h 的字段表中声明一次，编解码由 WireFormat.h 在编译期生成，这里负责缓冲区和错误处理
 class Serializer {
  public:
+  // 序列化协议结构体（头部+body）到缓冲池的缓冲区，检查失败抛出错误
+  template <typename T>
+  static buffer_shared_ptr serialize(const T& pdu);
+  // 序列化到调用者提供的缓冲区（容量cap），返回写入的字节数
+  template <typename T>
+  static size_t serializeInto(const T& pdu, char* out, size_t cap);
+  // 反序列化，类型错误或数据不完整返回false
+  template <typename T>
+  static bool deserialize(const char* buf, size_t len, T& pdu) {
+    return wire::deserialize(buf, len, pdu);
+  }
+
   // 序列化与反序列化ProtocolHeader
   static buffer_shared_ptr serialize(const ProtocolHeader& header);
   static bool deserialize(const char* buf, size_t len, ProtocolHeader& header);
 
-  // 序列化与反序列化ServerInfoPack
-  static buffer_shared_ptr serialize(const ServerInfoPack& pdu);
-  static bool deserialize(const char* buf, size_t len, ServerInfoPack& pdu);
-
-  // 序列化与反序列化ServerState
-  static buffer_shared_ptr serialize(const ServerState& pdu);
-  static bool deserialize(const char* buf, size_t len, ServerState& pdu);
-
-  // 将data的len字节写入ptr，返回写入的字节(len)
-  static size_t writeData(char* ptr, const char* data, size_t len) {
-    memcpy(ptr, data, len);
-    return len;
-  }
+ private:
+  static void check(wire::Error err);   // 检查失败时抛出错误
+};
 
-  // 64位字节序转换函数
-  static uint64_t htonll(uint64_t host64) {
-    static const int num = 42;
-    if (*reinterpret_cast<const char*>(&num) == 42) { // 小端序
-      return ((uint64_t)htonl(host64 & 0xFFFFFFFF) << 32) | htonl(host64 >> 32);
-    }
-    else { // 大端序
-      return host64;
-    }
-  }
+template <typename T>
+buffer_shared_ptr Serializer::serialize(const T& pdu) {
+  // 按编码后的长度从对应的大小级别获取缓冲区，测量结果在编码时复用
+  const wire::Measure<T> m = wire::measure(pdu);
+  auto buf = BufferPool::getInstance().acquire(m.total_len);
+  wire::Error err = wire::Error::NONE;
+  wire::serializeInto(pdu, m, buf.get(), m.total_len, err);
+  check(err);
+  return buf; // 自动归还到池
+}
 
-  static uint64_t ntohll(uint64_t net64) {
-    return htonll(net64); // 转换逻辑相同
-  }
-};
+template <typename T>
+size_t Serializer::serializeInto(const T& pdu, char* out, size_t cap) {
+  wire::Error err = wire::Error::NONE;
+  size_t len = wire::serializeInto(pdu, out, cap, err);
+  check(err);
+  return len;
+}
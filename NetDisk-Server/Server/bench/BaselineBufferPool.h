@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+// 改为分级、线程缓存的缓冲区池之前的实现（一把互斥锁 + 空闲列表 + 记录最后使用时间的哈希表），只用于 bench_bufferpool 对比
+// 申请和归还的路径与原来相同；原来的清除线程每十分钟才醒来一次，不影响申请和归还的耗时，这里去掉，测试程序退出时不必等待它
+class BaselineBufferPool {
+ public:
+  // 删除器，调用BaselineBufferPool::release
+  struct BufferDeleter {
+    BaselineBufferPool* pool{ nullptr };
+    void operator()(char* buf) const {
+      if (pool && buf) {  // 绑定了，调用release归还
+        pool->release(buf);
+      }
+      else if (buf) { // 未绑定，直接释放
+        delete[] buf;
+      }
+    }
+  };
+
+ public:
+  explicit BaselineBufferPool(size_t buffer_size = 8192, size_t initial_count = 100)
+    : buffer_size_(buffer_size)
+  {
+    // 创建初始缓冲区
+    for (size_t i=0; i<initial_count; ++i) {
+      char* buf = createBuffer();
+      pool_.push_back(buf); // 添加到池
+      last_used_[buf] = std::chrono::steady_clock::now(); // 设置初始时间
+    }
+  }
+  ~BaselineBufferPool() {
+    // 释放所有缓冲区
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (char* buf : pool_) {
+      delete[] buf;
+    }
+    pool_.clear();
+    last_used_.clear();
+  }
+
+  size_t getBufferSize() {
+    return buffer_size_;
+  }
+  // 申请缓冲区（返回智能指针，自动归还）
+  std::shared_ptr<char[]> acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 池为空，动态创建新缓冲区
+    if (pool_.empty()) {
+      return std::shared_ptr<char[]>(createBuffer(), BufferDeleter{ this });
+    }
+    // 池不为空，从池中获取一个缓冲区
+    char* buf = pool_.back();
+    pool_.pop_back();
+
+    return std::shared_ptr<char[]>(buf, BufferDeleter{ this });
+  }
+  // 归还缓冲区（由智能指针的删除器调用）
+  void release(char* buf) {
+    if (!buf) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 更新最后使用时间
+    last_used_[buf] = std::chrono::steady_clock::now();
+    pool_.push_back(buf); // 将缓冲区放回池中
+  }
+
+ private:
+  // 创建新缓冲区
+  char* createBuffer() {
+    return new char[buffer_size_];
+  }
+
+ private:
+  size_t buffer_size_{ 0 };     // 单个缓冲区大小
+  std::vector<char*> pool_;     // 缓冲区池
+  std::unordered_map<char*, std::chrono::steady_clock::time_point> last_used_;  // 记录缓冲区最后使用时间
+  std::mutex mutex_;
+};
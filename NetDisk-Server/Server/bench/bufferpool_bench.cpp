@@ -0,0 +1,182 @@
+// 缓冲区池的多线程耗时测试，不属于服务器程序，单独编译：make bench_bufferpool
+// 分别用 1、2、4…… 个线程测试两种使用方式，输出每个线程每次申请加归还的平均耗时（总耗时除以每个线程的次数），
+// 与原来的缓冲区池（一把互斥锁 + 哈希表，见 BaselineBufferPool.h）和 new/delete 对比：
+//   local：每个线程申请后在本线程归还（工作线程编码回复）
+//   cross：一半线程申请，经队列交给另一半线程归还（事件循环线程接收数据，工作线程处理后释放）
+#include "BufferPool.h"
+#include "BaselineBufferPool.h"
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+
+size_t g_ops = 1000000;         // 每个线程的申请次数
+size_t g_len = 8192;            // 缓冲区长度
+std::atomic<size_t> g_sink{ 0 };  // 避免计算被优化掉
+
+enum class Alloc {
+  POOL,       // 当前的缓冲区池
+  BASELINE,   // 原来的缓冲区池
+  NEW,        // new[]/delete[]
+};
+
+// 原来的缓冲区池只有一种大小，按测试的缓冲区长度创建
+BaselineBufferPool &baselinePool() {
+  static BaselineBufferPool pool(g_len);
+  return pool;
+}
+
+std::shared_ptr<char[]> allocate(Alloc alloc) {
+  switch (alloc) {
+    case Alloc::POOL:
+      return BufferPool::getInstance().acquire(g_len);
+    case Alloc::BASELINE:
+      return baselinePool().acquire();
+    case Alloc::NEW:
+      break;
+  }
+  return std::shared_ptr<char[]>(new char[g_len]);
+}
+
+// 同时启动 thread_count 个线程执行 body(线程序号)，返回总耗时（纳秒）
+template <typename F>
+double runThreads(size_t thread_count, F body) {
+  std::vector<std::thread> threads;
+  std::atomic<size_t> ready{ 0 };
+  std::atomic<bool> go{ false };
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back([&, i]() {
+      ++ready;
+      while (!go.load()) {
+        std::this_thread::yield();
+      }
+      body(i);
+    });
+  }
+  while (ready.load() != thread_count) {
+    std::this_thread::yield();
+  }
+  auto start = std::chrono::steady_clock::now();
+  go.store(true);
+  for (std::thread &th : threads) {
+    th.join();
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+double benchLocal(size_t thread_count, Alloc alloc) {
+  double ns = runThreads(thread_count, [alloc](size_t) {
+    size_t sum = 0;
+    for (size_t i = 0; i < g_ops; ++i) {
+      auto buf = allocate(alloc);
+      buf[0] = static_cast<char>(i);
+      sum += static_cast<unsigned char>(buf[0]);
+    }
+    g_sink += sum;
+  });
+  return ns / g_ops;
+}
+
+// 一个申请线程对应一个归还线程，队列有上限，申请线程不会无限领先
+struct Channel {
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::deque<std::shared_ptr<char[]>> que;
+  bool done{ false };
+};
+
+double benchCross(size_t thread_count, Alloc alloc) {
+  const size_t pairs = std::max<size_t>(1, thread_count / 2);
+  const size_t batch = 64;
+  std::vector<std::unique_ptr<Channel>> channels;
+  for (size_t i = 0; i < pairs; ++i) {
+    channels.emplace_back(new Channel);
+  }
+  double ns = runThreads(pairs * 2, [&](size_t index) {
+    Channel &ch = *channels[index / 2];
+    if (index % 2 == 0) {   // 申请线程，每次交出一批
+      std::vector<std::shared_ptr<char[]>> local;
+      for (size_t i = 0; i < g_ops; ++i) {
+        local.push_back(allocate(alloc));
+        if (local.size() == batch || i + 1 == g_ops) {
+          std::unique_lock<std::mutex> lock(ch.mtx);
+          ch.cv.wait(lock, [&ch, batch]() { return ch.que.size() < 16 * batch; });
+          for (auto &buf : local) {
+            ch.que.push_back(std::move(buf));
+          }
+          local.clear();
+          ch.cv.notify_all();
+        }
+      }
+      std::lock_guard<std::mutex> lock(ch.mtx);
+      ch.done = true;
+      ch.cv.notify_all();
+    }
+    else {                  // 归还线程，在本线程中释放
+      std::deque<std::shared_ptr<char[]>> local;
+      while (true) {
+        {
+          std::unique_lock<std::mutex> lock(ch.mtx);
+          ch.cv.wait(lock, [&ch]() { return ch.done || !ch.que.empty(); });
+          if (ch.que.empty() && ch.done) {
+            return;
+          }
+          local.swap(ch.que);
+          ch.cv.notify_all();
+        }
+        local.clear();
+      }
+    }
+  });
+  return ns / g_ops;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  // 参数：最大线程数（默认8）、每个线程的申请次数（默认100万）、缓冲区长度（字节，默认8192）
+  size_t max_threads = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8);
+  if (argc > 2) {
+    g_ops = std::strtoul(argv[2], nullptr, 10);
+  }
+  if (argc > 3) {
+    g_len = std::strtoul(argv[3], nullptr, 10);
+  }
+  if (max_threads == 0 || g_ops == 0 || g_len == 0) {
+    std::cerr << "usage: " << argv[0] << " [max_threads] [ops_per_thread] [buffer_bytes]" << std::endl;
+    return 1;
+  }
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    char text[256];
+    snprintf(text, sizeof(text), "%2zu threads  %6zu bytes  local: pool %6.1f ns  baseline %6.1f ns  new %6.1f ns",
+             threads, g_len, benchLocal(threads, Alloc::POOL), benchLocal(threads, Alloc::BASELINE), benchLocal(threads, Alloc::NEW));
+    std::cout << text;
+    if (threads >= 2) {
+      snprintf(text, sizeof(text), "  cross: pool %6.1f ns  baseline %6.1f ns  new %6.1f ns",
+               benchCross(threads, Alloc::POOL), benchCross(threads, Alloc::BASELINE), benchCross(threads, Alloc::NEW));
+      std::cout << text;
+    }
+    std::cout << std::endl;
+  }
+
+  // 各级别的统计（线程缓存中的申请次数在与共享仓库交换时计入）
+  for (const BufferPool::ClassStats &stats : BufferPool::getInstance().getStats()) {
+    if (stats.capacity == 0) {
+      continue;
+    }
+    std::cout << "class " << stats.buffer_size << "B: hits " << stats.hits << ", misses " << stats.misses
+              << ", high water " << stats.high_water << ", capacity " << stats.capacity << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,43 @@
+// 分片校验和（CRC32C）的耗时测试，不属于服务器程序，单独编译：make bench_crc32c
+// 按传输分片的长度计算一段数据的校验和，输出使用的实现和每GB数据的耗时
+#include "Crc32c.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+int main(int argc, char *argv[]) {
+  // 参数：数据长度（MB，默认64）、分片长度（字节，默认2048，与传输分片相同）
+  size_t total_mb = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64);
+  size_t piece = (argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2048);
+  if (total_mb == 0 || piece == 0) {
+    std::cerr << "usage: " << argv[0] << " [total_mb] [piece_bytes]" << std::endl;
+    return 1;
+  }
+
+  std::string result;
+  if (!Crc32c::selfTest(result)) {
+    std::cerr << result << std::endl;
+    return 1;
+  }
+
+  std::vector<char> buf(total_mb * 1024 * 1024);
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = (char)(i * 131 + (i >> 9));
+  }
+  auto start = std::chrono::steady_clock::now();
+  volatile uint32_t sink = 0;   // 避免计算被优化掉
+  for (size_t pos = 0; pos < buf.size(); pos += piece) {
+    sink = sink ^ Crc32c::compute(buf.data() + pos, std::min(piece, buf.size() - pos));
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  double ms_per_gb = ms * (1024.0 * 1024 * 1024) / buf.size();
+
+  char text[128];
+  snprintf(text, sizeof(text), "%s, %zu MB in %zu-byte pieces: %.1f ms/GB", result.c_str(), total_mb, piece, ms_per_gb);
+  std::cout << text << std::endl;
+  return 0;
+}
@@ -0,0 +1,177 @@
+// 协议序列化的耗时测试，不属于服务器程序，单独编译：make bench_serializer
+// 测试之前检查PDU兼容旧版本客户端的编码，失败时返回1
+// 对常用的协议结构体分别测试 v1/v2 编码到缓冲池（serialize）、编码到栈上的缓冲区（serializeInto）和解码（deserialize）的单次耗时
+#include "Serializer.h"
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+size_t g_rounds = 1000000;
+volatile size_t g_sink = 0;   // 避免计算被优化掉
+
+template <typename F>
+double nsPerOp(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < g_rounds; ++i) {
+    f();
+  }
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / g_rounds;
+}
+
+// compact 为 false 时只测试 v1（TranDataPdu 只支持 v1）
+template <typename T>
+void bench(const char *name, T pdu, bool compact = true) {
+  for (uint8_t version : { (uint8_t)PROTOCOL_VERSION_V1, (uint8_t)PROTOCOL_VERSION_V2 }) {
+    if (version == PROTOCOL_VERSION_V2 && !compact) {
+      continue;
+    }
+    pdu.header.version = version;
+    const size_t len = Serializer::encodedLen(pdu);
+    char stack_buf[16 * 1024];
+    if (len > sizeof(stack_buf)) {
+      std::cerr << name << ": encoded length " << len << " exceeds the test buffer" << std::endl;
+      continue;
+    }
+    double pooled = nsPerOp([&] {
+      auto buf = Serializer::serialize(pdu);
+      g_sink = g_sink + (unsigned char)buf[0];
+    });
+    double into = nsPerOp([&] {
+      g_sink = g_sink + Serializer::serializeInto(pdu, stack_buf, sizeof(stack_buf));
+    });
+    double decode = nsPerOp([&] {
+      T out;
+      g_sink = g_sink + Serializer::deserialize(stack_buf, len, out);
+    });
+
+    char text[256];
+    snprintf(text, sizeof(text), "%-12s v%u %5zu bytes  serialize %7.1f ns  serializeInto %7.1f ns  deserialize %7.1f ns",
+             name, version == PROTOCOL_VERSION_V1 ? 1u : 2u, len, pooled, into, decode);
+    std::cout << text << std::endl;
+  }
+}
+
+// 按旧版本客户端的方式编码PDU：body_len 为 PDU_LEGACY_BODY_BASE_LEN + msg_len，实际写入的字段之后多出4字节
+size_t encodeLegacyPdu(const PDU &pdu, char *out) {
+  char *ptr = out;
+  uint16_t type = htons(pdu.header.type);
+  uint32_t body_len = htonl(PDU_LEGACY_BODY_BASE_LEN + pdu.msg_len);
+  uint32_t code = htonl(pdu.code);
+  uint32_t msg_len = htonl(pdu.msg_len);
+  memcpy(ptr, &type, sizeof(type)); ptr += sizeof(type);
+  memcpy(ptr, &body_len, sizeof(body_len)); ptr += sizeof(body_len);
+  *ptr++ = 0;   // version
+  *ptr++ = 0;   // reserved
+  memcpy(ptr, &code, sizeof(code)); ptr += sizeof(code);
+  memcpy(ptr, pdu.user, sizeof(pdu.user)); ptr += sizeof(pdu.user);
+  memcpy(ptr, pdu.pwd, sizeof(pdu.pwd)); ptr += sizeof(pdu.pwd);
+  memcpy(ptr, pdu.file_name, V1_FILE_NAME_LEN); ptr += V1_FILE_NAME_LEN;
+  memcpy(ptr, &msg_len, sizeof(msg_len)); ptr += sizeof(msg_len);
+  memcpy(ptr, pdu.msg, pdu.msg_len); ptr += pdu.msg_len;
+  memset(ptr, 0x5a, PDU_LEGACY_BODY_BASE_LEN - PDU_BODY_BASE_LEN); // 旧版本发送的多余字节
+  return PROTOCOLHEADER_LEN + PDU_LEGACY_BODY_BASE_LEN + pdu.msg_len;
+}
+
+bool samePdu(const PDU &a, const PDU &b) {
+  return a.code == b.code && strcmp(a.user, b.user) == 0 && strcmp(a.pwd, b.pwd) == 0
+      && strcmp(a.file_name, b.file_name) == 0 && a.msg_len == b.msg_len && memcmp(a.msg, b.msg, a.msg_len) == 0;
+}
+
+// 测试之前检查PDU的往返编解码：旧版本客户端的编码、v1、v2 都要解码出相同的字段
+bool checkPduRoundTrip(const PDU &pdu) {
+  char buf[1024];
+  PDU out;
+  size_t len = encodeLegacyPdu(pdu, buf);
+  if (!Serializer::deserialize(buf, len, out) || !samePdu(pdu, out) || out.header.body_len != PDU_BODY_BASE_LEN + pdu.msg_len) {
+    std::cerr << "PDU: legacy v1 encoding does not decode" << std::endl;
+    return false;
+  }
+  for (uint8_t version : { (uint8_t)PROTOCOL_VERSION_V1, (uint8_t)PROTOCOL_VERSION_V2 }) {
+    PDU in = pdu;
+    in.header.version = version;
+    PDU decoded;
+    len = Serializer::serializeInto(in, buf, sizeof(buf));
+    if (!Serializer::deserialize(buf, len, decoded) || !samePdu(in, decoded)) {
+      std::cerr << "PDU: v" << (version == PROTOCOL_VERSION_V1 ? 1 : 2) << " round trip failed" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  // 参数：每项测试的次数（默认100万）
+  if (argc > 1) {
+    g_rounds = std::strtoul(argv[1], nullptr, 10);
+  }
+  if (g_rounds == 0) {
+    std::cerr << "usage: " << argv[0] << " [rounds]" << std::endl;
+    return 1;
+  }
+
+  PDU pdu;
+  pdu.header.type = ProtocolType::PDU_TYPE;
+  pdu.code = Code::MAKEDIR;
+  strcpy(pdu.user, "benchuser");
+  strcpy(pdu.pwd, "benchpwd");
+  strcpy(pdu.file_name, "new folder");
+  pdu.msg_len = snprintf(pdu.msg, sizeof(pdu.msg), "%d", 42);
+  pdu.header.body_len = PDU_BODY_BASE_LEN + pdu.msg_len;
+  if (!checkPduRoundTrip(pdu)) {
+    return 1;
+  }
+  bench("PDU", pdu);
+
+  TranPdu tran;
+  tran.header.type = ProtocolType::TRANPDU_TYPE;
+  tran.header.body_len = TRANPDU_BODY_LEN;
+  tran.tran_pdu_code = Code::PUTS;
+  strcpy(tran.user, "benchuser");
+  strcpy(tran.file_name, "holiday-photos-2024.zip");
+  memset(tran.file_md5, 'a', 64);
+  tran.file_size = 123456789;
+  tran.parent_dir_id = 42;
+  bench("TranPdu", tran);
+
+  FileInfo info(1001, "report-final-v3.docx", 2, "docx", 345678, 17, "2024-05-01 12:34:56");
+  info.header.type = ProtocolType::FILEINFO_TYPE;
+  info.header.body_len = FILEINFO_BODY_LEN;
+  bench("FileInfo", info);
+
+  TranFinishPdu finish;
+  finish.header.type = ProtocolType::TRANFINISHPDU_TYPE;
+  finish.header.body_len = TRANFINISHPDU_BODY_LEN;
+  finish.code = Code::PUTS_FINISH;
+  finish.file_size = 123456789;
+  memset(finish.file_md5, 'b', 64);
+  bench("TranFinish", finish);
+
+  PDURespond respond;
+  respond.header.type = ProtocolType::PDURESPOND_TYPE;
+  respond.code = Code::PUTS;
+  respond.status = Status::SUCCESS;
+  respond.msg.assign(64, 'c');
+  respond.msg_amount = 1;
+  respond.msg_len = respond.msg.size();
+  respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
+  bench("PDURespond", respond);
+
+  TranDataPdu data;
+  data.header.type = ProtocolType::TRANDATAPDU_TYPE;
+  data.code = Code::PUTS_DATA;
+  data.file_offset = 1 << 20;
+  data.chunk_index = 512;
+  data.data.assign(2048, 'd');
+  data.chunk_size = data.data.size();
+  data.header.body_len = TRANDATAPDU_BODY_BASE_LEN + data.chunk_size;
+  bench("TranDataPdu", data, false);
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include "SegBuffer.h"
+#include <algorithm>
+
+size_t SegBuffer::writeAbleBytes() const {
+  return seg_size_ - write_pos_;
+}
+
+size_t SegBuffer::readAbleBytes() const {
+  return write_pos_ - read_pos_;
+}
+
+const char* SegBuffer::beginRead() const {
+  return seg_.get() + read_pos_;
+}
+
+char* SegBuffer::beginWrite() {
+  return seg_.get() + write_pos_;
+}
+
+void SegBuffer::ensureWriteAble(size_t len) {
+  if (seg_ && writeAbleBytes() >= len) {
+    return;
+  }
+  // 段中数据已经全部读完，且没有切片在使用，直接复用
+  if (seg_ && readAbleBytes() == 0 && seg_.use_count() == 1 && seg_size_ >= len) {
+    read_pos_ = 0;
+    write_pos_ = 0;
+    return;
+  }
+  switchSegment(readAbleBytes() + len);
+}
+
+void SegBuffer::ensureFrame(size_t len) {
+  if (seg_ && seg_size_ - read_pos_ >= len) {
+    return;
+  }
+  switchSegment(len);
+}
+
+void SegBuffer::hasWritten(size_t len) {
+  assert(len <= writeAbleBytes());
+  write_pos_ += len;
+}
+
+void SegBuffer::retrieve(size_t len) {
+  assert(len <= readAbleBytes());
+  read_pos_ += len;
+}
+
+buffer_shared_ptr SegBuffer::slice(size_t len) {
+  assert(len <= readAbleBytes());
+  // 别名构造：与段共享引用计数，但指向读位置
+  buffer_shared_ptr frame(seg_, seg_.get() + read_pos_);
+  read_pos_ += len;
+  return frame;
+}
+
+void SegBuffer::switchSegment(size_t min_size) {
+  BufferPool& pool = BufferPool::getInstance();
+  size_t size = std::max(pool.getBufferSize(), min_size);
+  // 大PDU从对应的大小级别申请，超过最大级别时由缓冲区池单独分配
+  buffer_shared_ptr seg = pool.acquire(size);
+
+  size_t readable = readAbleBytes();
+  if (readable > 0) {
+    memcpy(seg.get(), beginRead(), readable);
+  }
+  seg_ = seg;
+  seg_size_ = size;
+  read_pos_ = 0;
+  write_pos_ = readable;
+}
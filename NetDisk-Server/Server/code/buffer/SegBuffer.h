@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstring>
+#include <cassert>
+#include "BufferPool.h"
+
+// 分段读缓冲区（非线程安全，只由所属的反应堆线程读写）
+// 数据保存在引用计数的段中（默认从BufferPool申请），完整的PDU可以零拷贝地切片交给工作线程，
+// 切片与段共享引用计数，所有切片释放后段才会归还给BufferPool。
+// 已经切片的区域不会再被写入，只有当前段空间不足时才切换到新段，并且只搬移未读完的数据（最多一个不完整的PDU）
+class SegBuffer {
+ public:
+  SegBuffer() = default;
+  SegBuffer(const SegBuffer &other) = delete;
+  SegBuffer& operator=(const SegBuffer &other) = delete;
+  ~SegBuffer() = default;
+
+ public:
+  size_t writeAbleBytes() const;    // 返回当前段可写的字节数
+  size_t readAbleBytes() const;     // 返回可读的字节数
+
+  const char* beginRead() const;    // 返回可读数据首地址
+  char* beginWrite();               // 返回可写数据首地址
+
+  void ensureWriteAble(size_t len); // 确保当前段还有len字节可写，不够则切换到新段
+  void ensureFrame(size_t len);     // 确保从读位置开始的len字节位于同一个段中（用于大于段的PDU）
+
+  void hasWritten(size_t len);      // 标记已经写入了len字节
+  void retrieve(size_t len);        // 标记已经读取了len字节
+  buffer_shared_ptr slice(size_t len);  // 零拷贝取出可读数据的前len字节，并标记已读取
+
+ private:
+  void switchSegment(size_t min_size);  // 切换到至少min_size字节的新段，并搬移未读数据
+
+ private:
+  buffer_shared_ptr seg_{ nullptr };  // 当前段
+  size_t seg_size_{ 0 };              // 当前段大小
+  size_t read_pos_{ 0 };
+  size_t write_pos_{ 0 };
+};
@@ -1,15 +1,65 @@
 #include "BufferPool.h"
+#include "Log.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <new>
+
+std::atomic<bool> BufferPool::huge_pages_{ false };
+
+namespace {
+// 存活的缓冲区池，线程退出时把线程缓存还给仍然存活的池，键为池ID
+std::mutex& registryMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::unordered_map<uint64_t, BufferPool*>& registry() {
+  static std::unordered_map<uint64_t, BufferPool*> pools;
+  return pools;
+}
+
+std::atomic<uint64_t> next_pool_id{ 1 };
+}
+
+// 一个线程的缓存：每个级别一个弹匣，只有本线程访问，不需要加锁
+struct BufferPool::ThreadCache {
+  struct Magazine {
+    char* bufs[2 * kMagazineRounds];
+    uint32_t count{ 0 };
+    uint64_t hits{ 0 };     // 与共享仓库交换前的申请次数
+  };
+
+  uint64_t owner{ 0 };      // 所属缓冲区池的ID，0 表示还没有使用
+  uint64_t epoch{ 0 };      // 上次看到的清除轮次
+  std::array<Magazine, kClassCount> mags;
+
+  ~ThreadCache() {
+    if (owner == 0) {
+      return;
+    }
+    // 持有注册表的锁，所属的池不会在归还过程中析构
+    std::lock_guard<std::mutex> lock(registryMutex());
+    auto it = registry().find(owner);
+    if (it != registry().end()) {
+      it->second->flushAll(*this);
+    }
+    owner = UINT64_MAX;   // 之后析构的其它线程局部对象归还的缓冲区直接放回共享仓库
+  }
+};
 
 // BufferDeleter
-BufferPool::BufferDeleter::BufferDeleter(BufferPool* p)
-  : pool(p)
+BufferPool::BufferDeleter::BufferDeleter(BufferPool* p, uint32_t c)
+  : pool(p), size_class(c)
 {
 
 }
 
 void BufferPool::BufferDeleter::operator()(char* buf) const {
   if (pool && buf) {  // 绑定了，调用release归还
-    pool->release(buf);
+    pool->release(buf, size_class);
   }
   else if (buf) { // 未绑定，直接释放
     delete[] buf;
@@ -19,31 +69,49 @@ void BufferPool::BufferDeleter::operator()(char* buf) const {
 
 // BufferPool
 BufferPool::BufferPool(size_t buffer_size, size_t initial_count)
-  : buffer_size_(buffer_size), stop_cleaner_(false)
+  : id_(next_pool_id.fetch_add(1)), default_class_(std::min(classOf(buffer_size), kClassCount - 1)), stop_cleaner_(false)
 {
   // 创建初始缓冲区
-  for (size_t i=0; i<initial_count; ++i) {
-    char* buf = createBuffer();
-    pool_.push_back(buf); // 添加到池
-    last_used_[buf] = std::chrono::steady_clock::now(); // 设置初始时间
+  {
+    SizeClass& cls = classes_[default_class_];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    while (cls.stats.capacity < initial_count && grow(cls, default_class_)) {
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry()[id_] = this;
   }
   // 启动超时清除线程
   startCleanerThread();
 }
 
 BufferPool::~BufferPool() {
-  stop_cleaner_.store(true);  // 停止清除线程
+  {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry().erase(id_);  // 之后退出的线程不再归还线程缓存
+  }
+  {
+    std::lock_guard<std::mutex> lock(cleaner_mutex_);
+    stop_cleaner_.store(true);  // 停止清除线程
+  }
+  cleaner_cv_.notify_all();
   // 等待线程结束
   if (cleaner_thread_.joinable()) {
     cleaner_thread_.join();
   }
-  // 释放所有缓冲区
-  std::lock_guard<std::mutex> lock(mutex_);
-  for (char* buf : pool_) {
-    delete[] buf;
+  // 释放所有 slab，还有缓冲区不在共享仓库中的级别不释放（进程退出时其它静态对象或线程缓存可能还持有缓冲区）
+  for (SizeClass& cls : classes_) {
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    if (cls.free_list.size() != cls.stats.capacity) {
+      continue;
+    }
+    for (const Slab& slab : cls.slabs) {
+      freeSlab(slab);
+    }
+    cls.slabs.clear();
+    cls.free_list.clear();
   }
-  pool_.clear();
-  last_used_.clear();
 }
 
 // 获取单例对象
@@ -52,48 +120,237 @@ BufferPool& BufferPool::getInstance() {
   return instance;
 }
 
+void BufferPool::setHugePages(bool enable) {
+  huge_pages_.store(enable);
+}
+
 // 获取缓冲区大小
 size_t BufferPool::getBufferSize() {
-  return buffer_size_;
+  return classSize(default_class_);
 }
 
 // 申请缓冲区（返回智能指针，自动归还）
 std::shared_ptr<char[]> BufferPool::acquire() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  // 池为空，动态创建新缓冲区
-  if (pool_.empty()) {
-    return std::shared_ptr<char[]>(createBuffer(), BufferDeleter(this));
+  return acquire(classSize(default_class_));
+}
+
+std::shared_ptr<char[]> BufferPool::acquire(size_t len) {
+  uint32_t size_class = classOf(len);
+  if (size_class >= kClassCount) {  // 超过最大级别，单独分配
+    return std::shared_ptr<char[]>(new char[len], BufferDeleter(nullptr));
   }
-  // 池不为空，从池中获取一个缓冲区
-  char* buf = pool_.back();
-  pool_.pop_back();
-  
-  return std::shared_ptr<char[]>(buf, BufferDeleter(this));
+
+  ThreadCache& cache = threadCache();
+  if (magazineRounds(size_class) == 0 || !bindCache(cache)) {
+    return std::shared_ptr<char[]>(acquireFromDepot(size_class), BufferDeleter(this, size_class));
+  }
+  // 从本线程的弹匣中获取，弹匣为空时从共享仓库取一批
+  ThreadCache::Magazine& mag = cache.mags[size_class];
+  if (mag.count == 0) {
+    refill(cache, size_class);
+  }
+  ++mag.hits;
+  return std::shared_ptr<char[]>(mag.bufs[--mag.count], BufferDeleter(this, size_class));
 }
 
 // 归还缓冲区（由智能指针的删除器调用）
-void BufferPool::release(char* buf) {
-  if (!buf) {
+void BufferPool::release(char* buf, uint32_t size_class) {
+  if (!buf || size_class >= kClassCount) {
+    return;
+  }
+
+  ThreadCache& cache = threadCache();
+  uint32_t rounds = magazineRounds(size_class);
+  if (rounds == 0 || !bindCache(cache)) {
+    releaseToDepot(buf, size_class);
     return;
   }
+  // 放回本线程的弹匣，弹匣满时把较早放入的一半放回共享仓库，最近使用的缓冲区留在本线程
+  ThreadCache::Magazine& mag = cache.mags[size_class];
+  if (mag.count == 2 * rounds) {
+    flush(cache, size_class, rounds);
+  }
+  mag.bufs[mag.count++] = buf;
+}
+
+void BufferPool::releaseThreadCache() {
+  ThreadCache& cache = threadCache();
+  if (cache.owner == id_) {
+    flushAll(cache);
+  }
+}
+
+std::vector<BufferPool::ClassStats> BufferPool::getStats() {
+  std::vector<ClassStats> stats;
+  stats.reserve(kClassCount);
+  for (SizeClass& cls : classes_) {
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    stats.push_back(cls.stats);
+    stats.back().in_use = cls.stats.capacity - cls.free_list.size();
+  }
+  return stats;
+}
+
+uint32_t BufferPool::classOf(size_t len) {
+  uint32_t shift = kMinClassShift;
+  while (shift <= kMaxClassShift && (size_t(1) << shift) < len) {
+    ++shift;
+  }
+  return shift - kMinClassShift;
+}
+
+size_t BufferPool::classSize(uint32_t size_class) {
+  return size_t(1) << (size_class + kMinClassShift);
+}
 
-  std::lock_guard<std::mutex> lock(mutex_);
-  // 更新最后使用时间
-  last_used_[buf] = std::chrono::steady_clock::now();
-  pool_.push_back(buf); // 将缓冲区放回池中
+uint32_t BufferPool::magazineRounds(uint32_t size_class) {
+  return static_cast<uint32_t>(std::min<size_t>(kMagazineRounds, kMagazineBytes / classSize(size_class)));
 }
 
-// 创建新缓冲区
-char* BufferPool::createBuffer() {
-  return new char[buffer_size_];
+BufferPool::ThreadCache& BufferPool::threadCache() {
+  static thread_local ThreadCache cache;
+  return cache;
+}
+
+bool BufferPool::bindCache(ThreadCache& cache) {
+  if (cache.owner != id_) {
+    if (cache.owner != 0) {   // 已经属于其它缓冲区池
+      return false;
+    }
+    cache.owner = id_;
+    cache.epoch = trim_epoch_.load(std::memory_order_relaxed);
+  }
+  uint64_t epoch = trim_epoch_.load(std::memory_order_relaxed);
+  if (cache.epoch != epoch) {
+    flushAll(cache);
+    cache.epoch = epoch;
+  }
+  return true;
+}
+
+char* BufferPool::acquireFromDepot(uint32_t size_class) {
+  SizeClass& cls = classes_[size_class];
+  std::lock_guard<std::mutex> lock(cls.mutex);
+  if (cls.free_list.empty()) {
+    ++cls.stats.misses;
+    if (!grow(cls, size_class)) {   // 申请 slab 失败
+      throw std::bad_alloc();
+    }
+  }
+  // 从空闲链表中获取一个缓冲区
+  char* buf = cls.free_list.back();
+  cls.free_list.pop_back();
+  ++cls.stats.hits;
+  cls.used = true;
+  updateHighWater(cls);
+  return buf;
+}
+
+void BufferPool::releaseToDepot(char* buf, uint32_t size_class) {
+  SizeClass& cls = classes_[size_class];
+  std::lock_guard<std::mutex> lock(cls.mutex);
+  cls.free_list.push_back(buf); // 将缓冲区放回空闲链表
+}
+
+void BufferPool::refill(ThreadCache& cache, uint32_t size_class) {
+  SizeClass& cls = classes_[size_class];
+  ThreadCache::Magazine& mag = cache.mags[size_class];
+  std::lock_guard<std::mutex> lock(cls.mutex);
+  if (cls.free_list.empty()) {
+    ++cls.stats.misses;
+    if (!grow(cls, size_class)) {   // 申请 slab 失败
+      throw std::bad_alloc();
+    }
+  }
+  // 从空闲链表的末尾（最近归还的）取一批
+  size_t count = std::min<size_t>(magazineRounds(size_class), cls.free_list.size());
+  memcpy(mag.bufs, cls.free_list.data() + cls.free_list.size() - count, count * sizeof(char*));
+  cls.free_list.resize(cls.free_list.size() - count);
+  mag.count = static_cast<uint32_t>(count);
+  cls.stats.hits += mag.hits;
+  mag.hits = 0;
+  cls.used = true;
+  updateHighWater(cls);
+}
+
+void BufferPool::flush(ThreadCache& cache, uint32_t size_class, uint32_t count) {
+  SizeClass& cls = classes_[size_class];
+  ThreadCache::Magazine& mag = cache.mags[size_class];
+  {
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    cls.free_list.insert(cls.free_list.end(), mag.bufs, mag.bufs + count);
+    cls.stats.hits += mag.hits;
+    mag.hits = 0;
+  }
+  memmove(mag.bufs, mag.bufs + count, (mag.count - count) * sizeof(char*));
+  mag.count -= count;
+}
+
+void BufferPool::flushAll(ThreadCache& cache) {
+  for (uint32_t i = 0; i < kClassCount; ++i) {
+    if (cache.mags[i].count > 0 || cache.mags[i].hits > 0) {
+      flush(cache, i, cache.mags[i].count);
+    }
+  }
+}
+
+bool BufferPool::grow(SizeClass& cls, uint32_t size_class) {
+  const size_t buffer_size = classSize(size_class);
+  Slab slab;
+  if (!allocSlab(std::max(buffer_size, kSlabSize), slab)) {
+    return false;
+  }
+  cls.slabs.push_back(slab);
+  // 倒序放入，先取出 slab 开头的缓冲区
+  size_t count = slab.len / buffer_size;
+  cls.free_list.reserve(cls.free_list.size() + count);
+  for (size_t i = count; i > 0; --i) {
+    cls.free_list.push_back(slab.addr + (i - 1) * buffer_size);
+  }
+  cls.stats.buffer_size = buffer_size;
+  cls.stats.capacity += count;
+  return true;
+}
+
+void BufferPool::updateHighWater(SizeClass& cls) {
+  cls.stats.high_water = std::max(cls.stats.high_water, cls.stats.capacity - cls.free_list.size());
+}
+
+bool BufferPool::allocSlab(size_t len, Slab& slab) {
+  const int prot = PROT_READ | PROT_WRITE;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void* addr = MAP_FAILED;
+  if (huge_pages_.load()) {
+    addr = mmap(nullptr, len, prot, flags | MAP_HUGETLB, -1, 0);
+    if (addr == MAP_FAILED) {   // 没有预留大页，使用透明大页
+      addr = mmap(nullptr, len, prot, flags, -1, 0);
+      if (addr != MAP_FAILED) {
+        madvise(addr, len, MADV_HUGEPAGE);
+      }
+    }
+  }
+  else {
+    addr = mmap(nullptr, len, prot, flags, -1, 0);
+  }
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  slab.addr = static_cast<char*>(addr);
+  slab.len = len;
+  return true;
+}
+
+void BufferPool::freeSlab(const Slab& slab) {
+  munmap(slab.addr, slab.len);
 }
 
 // 启动超时清除线程，定期清除长时间未使用的缓冲区
 void BufferPool::startCleanerThread() {
   cleaner_thread_ = std::thread([this]() {
-    while (!(stop_cleaner_.load())) {
-      // 每十分钟检查一次
-      std::this_thread::sleep_for(std::chrono::minutes(10));
+    std::unique_lock<std::mutex> lock(cleaner_mutex_);
+    // 每十分钟检查一次
+    while (!cleaner_cv_.wait_for(lock, std::chrono::minutes(10), [this]() { return stop_cleaner_.load(); })) {
+      logStats();
       cleanExpiredBuffers();
     }
   });
@@ -101,20 +358,79 @@ void BufferPool::startCleanerThread() {
 
 // 清除过期缓冲区
 void BufferPool::cleanExpiredBuffers() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  auto now = std::chrono::steady_clock::now();
-  for (auto it=pool_.begin(); it!=pool_.end(); ) {
-    char* buf = *it;
-    auto last_used_time = last_used_[buf];  // 最后使用时间
-    // 计算时间差（秒）
-    auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_used_time).count();
-    if (duration > 3600) {  // 超过 1 小时（3600秒）
-      last_used_.erase(buf);  // 从 last_used_中去除
-      it = pool_.erase(it);   // 从池中去除，并指向下一个缓冲区
-      delete[] buf;           // 释放空间
-    }
-    else {  // 没超时
-      ++it; // 遍历下一个缓冲区
-    }
-  }
-}
\ No newline at end of file
+  // 连续 6 次检查（1 小时）没有从共享仓库申请，并且缓冲区全部归还的级别释放所有 slab
+  for (uint32_t i = 0; i < kClassCount; ++i) {
+    SizeClass& cls = classes_[i];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    if (cls.used) {
+      cls.used = false;
+      cls.idle_checks = 0;
+    }
+    else if (!cls.slabs.empty() && cls.free_list.size() == cls.stats.capacity && ++cls.idle_checks >= 6) {
+      for (const Slab& slab : cls.slabs) {
+        freeSlab(slab);
+      }
+      cls.slabs.clear();
+      cls.free_list.clear();
+      cls.free_list.shrink_to_fit();
+      cls.stats.capacity = 0;
+      cls.idle_checks = 0;
+      continue;
+    }
+    // 仍在使用的级别在流量高峰后可能留下大量空闲缓冲区，不等待整个级别空闲，先释放超出上限的部分
+    trimFreeSlabs(cls, i);
+  }
+  // 各线程在下一次申请或归还时归还线程缓存，长时间不用的缓冲区回到共享仓库，下一次检查时才能释放
+  trim_epoch_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BufferPool::trimFreeSlabs(SizeClass& cls, uint32_t size_class) {
+  const size_t buffer_size = classSize(size_class);
+  if (cls.free_list.size() * buffer_size <= kMaxFreeBytes) {
+    return;
+  }
+  // slab 按地址排序，二分查找空闲缓冲区所属的 slab，统计每个 slab 在共享仓库中的缓冲区数
+  std::sort(cls.slabs.begin(), cls.slabs.end(), [](const Slab& a, const Slab& b) { return a.addr < b.addr; });
+  auto slabOf = [&cls](char* buf) {
+    auto it = std::upper_bound(cls.slabs.begin(), cls.slabs.end(), buf, [](char* p, const Slab& slab) { return p < slab.addr; });
+    return static_cast<size_t>(it - cls.slabs.begin()) - 1;
+  };
+  std::vector<size_t> free_count(cls.slabs.size(), 0);
+  for (char* buf : cls.free_list) {
+    ++free_count[slabOf(buf)];
+  }
+  // 选出要释放的 slab，空闲缓冲区的总长度降到上限以内为止
+  std::vector<bool> released(cls.slabs.size(), false);
+  size_t free_bytes = cls.free_list.size() * buffer_size;
+  for (size_t i = 0; i < cls.slabs.size() && free_bytes > kMaxFreeBytes; ++i) {
+    if (free_count[i] * buffer_size == cls.slabs[i].len) {
+      released[i] = true;
+      free_bytes -= cls.slabs[i].len;
+    }
+  }
+  // 从空闲链表中移除这些 slab 的缓冲区，其余缓冲区保持原来的顺序
+  cls.free_list.erase(std::remove_if(cls.free_list.begin(), cls.free_list.end(),
+                                     [&](char* buf) { return released[slabOf(buf)]; }),
+                      cls.free_list.end());
+  size_t kept = 0;
+  for (size_t i = 0; i < cls.slabs.size(); ++i) {
+    if (released[i]) {
+      cls.stats.capacity -= cls.slabs[i].len / buffer_size;
+      freeSlab(cls.slabs[i]);
+    }
+    else {
+      cls.slabs[kept++] = cls.slabs[i];
+    }
+  }
+  cls.slabs.resize(kept);
+}
+
+void BufferPool::logStats() {
+  for (const ClassStats& stats : getStats()) {
+    if (stats.capacity == 0) {  // 没有使用过或已经全部释放
+      continue;
+    }
+    LOG_INFO("BufferPool %luB: hits %lu, misses %lu, in use %lu, high water %lu, capacity %lu",
+             stats.buffer_size, stats.hits, stats.misses, stats.in_use, stats.high_water, stats.capacity);
+  }
+}
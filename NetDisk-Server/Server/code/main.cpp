@@ -1,4 +1,11 @@
 #include "Server.h"
+#include "FileWriter.h"
+#include "ChunkStore.h"
+#include "UploadSession.h"
+#include "Compressor.h"
+#include "Crc32c.h"
+#include "SessionToken.h"
+#include "BufferPool.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -24,6 +31,26 @@ int main() {
   int threadNum = std::stoi(config["Server.threadNum"]);
   int logqueSize = std::stoi(config["Server.logqueSize"]);
   int timeout = std::stoi(config["Server.timeout"]);
+  // 上传文件写入引擎，默认为mmap
+  FileWriter::Engine upload_engine = (config["Server.uploadEngine"] == "pwrite" ? FileWriter::PWRITE : FileWriter::MMAP);
+  bool upload_direct_io = (config["Server.uploadDirectIO"] == "true");
+  FileWriter::setEngine(upload_engine, upload_direct_io);
+  // 存储模式，默认整文件保存，chunk 为分块保存
+  ChunkStore::setEnable(config["Server.storageMode"] == "chunk");
+  // 未完成的上传超过保留时间（小时）没有更新时删除，默认7天，0 为不删除
+  UploadSession::setExpireHours(config["Server.uploadExpireHours"].empty() ? 168 : std::stoi(config["Server.uploadExpireHours"]));
+  // 传输压缩，默认开启，none 为关闭；compressLevel 为客户端没有指定级别时使用的压缩级别（1~9）
+  int compress_level = config["Server.compressLevel"].empty() ? 1 : std::stoi(config["Server.compressLevel"]);
+  Compressor::setConfig(config["Server.compression"] != "none", compress_level);
+  // 会话令牌的签名密钥：发布的配置文件中为空，运维需要为每个部署生成自己的随机密钥（至少32字节，多台服务器使用相同的密钥时令牌可以通用）；
+  // 为空或不符合要求时使用随机密钥，服务器重启后令牌失效，客户端改用密码重新请求
+  SessionToken::setKey(config["Server.tokenKey"]);
+  // 缓冲区池的 slab 使用大页，默认关闭
+  BufferPool::setHugePages(config["Server.bufferHugePages"] == "true");
+  // 检查分片校验和的实现（只计算测试向量），并输出使用的实现
+  std::string crc_result;
+  Crc32c::selfTest(crc_result);
+  std::cout << crc_result << std::endl;
 
   // 读取负载均衡器配置
   const char *EqualizerIP = config["Equalizer.EqualizerIP"].c_str();
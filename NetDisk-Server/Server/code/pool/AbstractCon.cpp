@@ -10,6 +10,10 @@ SSL *AbstractCon::getSSL() const {
   return client_ssl_;
 }
 
+uint32_t AbstractCon::getStreamId() const {
+  return 0;
+}
+
 int AbstractCon::getSock() const {
   return client_sock_;
 }
@@ -30,7 +34,11 @@ bool AbstractCon::getIsVerify() const {
   return is_verify_;
 }
 
-Buffer& AbstractCon::getReadBuffer() {
+const UserInfo& AbstractCon::getUserInfo() const {
+  return user_info_;
+}
+
+SegBuffer& AbstractCon::getReadBuffer() {
   return read_buffer_;
 }
 
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "protocol.h"
-#include "Buffer.h"
+#include "SegBuffer.h"
 #include <atomic>
 #include <assert.h>
 
@@ -16,13 +16,15 @@ class AbstractCon {
   virtual void close() = 0;   // 纯虚函数
 
   void setVerify(const bool &status);
-  SSL *getSSL() const;
+  virtual SSL *getSSL() const;          // 多路复用的流返回所属连接的ssl
+  virtual uint32_t getStreamId() const;  // 多路复用的流ID，独立的连接为0
   int getSock() const;
   std::string getUser() const;
   std::string getPwd() const;
   bool getIsVip() const;
   bool getIsVerify() const;
-  Buffer& getReadBuffer();
+  const UserInfo& getUserInfo() const;
+  SegBuffer& getReadBuffer();
   void closeSSL();
 
   enum ConType{
@@ -43,5 +45,5 @@ class AbstractCon {
   bool is_close_ = false;         // 客户端是否已经关闭
   bool is_vip_ = false;           // 是否vip用户
 
-  Buffer read_buffer_;            // 读缓冲区
+  SegBuffer read_buffer_;         // 读缓冲区（分段，完整PDU零拷贝交给工作线程）
 };
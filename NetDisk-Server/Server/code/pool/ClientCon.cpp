@@ -1,4 +1,5 @@
 #include "ClientCon.h"
+#include "StreamCon.h"
 
 ClientCon::ClientCon(int sockfd, SSL *ssl) {
   client_sock_ = sockfd;
@@ -19,7 +20,18 @@ void ClientCon::close() {
   if (is_close_) {
     return;
   }
-  // 关闭ssl
+  // 先关闭连接上的流，流不再使用连接的ssl
+  std::unordered_map<uint32_t, std::shared_ptr<StreamCon>> streams;
+  {
+    std::lock_guard<std::mutex> lock(stream_mtx_);
+    streams.swap(streams_);
+  }
+  for (auto &it : streams) {
+    it.second->detach();
+    it.second->close();
+  }
+  // 关闭ssl：流的发送线程在发送锁内通过 getSSL 取得ssl，释放也在发送锁内完成
+  std::lock_guard<FairMutex> send_lock(send_mutex_);
   if (client_ssl_ != nullptr) {
     int shutdown_result = SSL_shutdown(client_ssl_);
     if (shutdown_result == 0) {   // 等待客户端接收关闭ssl连接
@@ -42,6 +54,34 @@ void ClientCon::close() {
   is_close_ = true;
 }
 
-std::mutex &ClientCon::getSendMutex() {
+FairMutex &ClientCon::getSendMutex() {
   return send_mutex_;
+}
+
+std::shared_ptr<StreamCon> ClientCon::getStream(uint32_t stream_id, bool create) {
+  std::lock_guard<std::mutex> lock(stream_mtx_);
+  auto it = streams_.find(stream_id);
+  if (it != streams_.end()) {
+    return it->second;
+  }
+  if (!create || is_close_ || streams_.size() >= MUX_MAX_STREAMS) {
+    return nullptr;
+  }
+  auto stream = std::make_shared<StreamCon>(weak_from_this(), stream_id);
+  streams_.emplace(stream_id, stream);
+  return stream;
+}
+
+void ClientCon::closeStream(uint32_t stream_id) {
+  std::shared_ptr<StreamCon> stream;
+  {
+    std::lock_guard<std::mutex> lock(stream_mtx_);
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+      return;
+    }
+    stream = std::move(it->second);
+    streams_.erase(it);
+  }
+  stream->close();
 }
\ No newline at end of file
@@ -1,19 +1,32 @@
 #pragma once
 
 #include "AbstractCon.h"
+#include "FairMutex.h"
 #include <mutex>
+#include <memory>
+#include <unordered_map>
 
-class ClientCon : public AbstractCon {
+class StreamCon;
+
+// 连接对象由 shared_ptr 管理（Server::addClient），流和交给工作线程的任务通过 shared_from_this 持有所属的连接
+class ClientCon : public AbstractCon, public std::enable_shared_from_this<ClientCon> {
  public:
   ClientCon(int sockfd, SSL *ssl);
   ClientCon() = default;
   ~ClientCon() override;
 
   void init(const UserInfo &info);
-  void close() override;
+  void close() override;   // 在发送锁内释放ssl，持有发送锁的线程看到的ssl要么可用，要么为nullptr
+
+  FairMutex& getSendMutex();
 
-  std::mutex& getSendMutex();
+  // 多路复用：按流ID获取流，create 为true时不存在则创建（连接已关闭或流数量达到 MUX_MAX_STREAMS 返回空）
+  std::shared_ptr<StreamCon> getStream(uint32_t stream_id, bool create);
+  void closeStream(uint32_t stream_id);   // 关闭并移除流
 
  private:
-  std::mutex send_mutex_;
+  FairMutex send_mutex_;    // 发送锁，多路复用时各个流按申请顺序轮流发送
+
+  std::mutex stream_mtx_;   // 保护 streams_
+  std::unordered_map<uint32_t, std::shared_ptr<StreamCon>> streams_;
 };
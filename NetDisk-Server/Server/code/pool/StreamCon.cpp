@@ -0,0 +1,95 @@
+#include "StreamCon.h"
+#include "ClientCon.h"
+
+StreamCon::StreamCon(std::weak_ptr<ClientCon> parent, uint32_t stream_id) : parent_(std::move(parent)), stream_id_(stream_id) {
+  // 流计入连接总数（与双端口模式下的传输连接相同），负载均衡按连接总数分配客户端
+  ++user_count;
+  initStatusControl();
+}
+
+StreamCon::~StreamCon() {
+  close();
+}
+
+SSL *StreamCon::getSSL() const {
+  std::shared_ptr<ClientCon> parent = getParent();
+  return parent == nullptr ? nullptr : parent->getSSL();
+}
+
+uint32_t StreamCon::getStreamId() const {
+  return stream_id_;
+}
+
+FairMutex &StreamCon::getSendMutex() {
+  std::shared_ptr<ClientCon> parent = getParent();
+  // 所属连接关闭后 getSSL 返回nullptr，发送不会执行，使用自己的锁即可
+  return parent == nullptr ? UpDownCon::getSendMutex() : parent->getSendMutex();
+}
+
+bool StreamCon::waitSendWindow(size_t len) {
+  std::unique_lock<std::mutex> lock(window_mtx_);
+  window_cv_.wait(lock, [this] { return send_window_ > 0 || getStatus() == UpDownCon::CLOSE; });
+  if (getStatus() == UpDownCon::CLOSE) {
+    return false;
+  }
+  send_window_ -= static_cast<int64_t>(len);
+  return true;
+}
+
+void StreamCon::close() {
+  UpDownCon::close();
+  // 唤醒等待窗口和暂停中的发送线程，它们检查到关闭状态后退出
+  {
+    std::lock_guard<std::mutex> lock(window_mtx_);
+  }
+  window_cv_.notify_all();
+  notifyAll();
+}
+
+void StreamCon::addSendWindow(uint32_t len) {
+  {
+    std::lock_guard<std::mutex> lock(window_mtx_);
+    send_window_ += len;
+  }
+  window_cv_.notify_all();
+}
+
+bool StreamCon::consumeRecvWindow(size_t len) {
+  std::lock_guard<std::mutex> lock(window_mtx_);
+  if (recv_window_ <= 0) {
+    return false;
+  }
+  recv_window_ -= static_cast<int64_t>(len);
+  return true;
+}
+
+uint32_t StreamCon::releaseRecvWindow(size_t len) {
+  std::lock_guard<std::mutex> lock(window_mtx_);
+  recv_released_ += static_cast<uint32_t>(len);
+  if (recv_released_ < MUX_INITIAL_WINDOW / 2) {
+    return 0;
+  }
+  uint32_t credit = recv_released_;
+  recv_window_ += credit;
+  recv_released_ = 0;
+  return credit;
+}
+
+void StreamCon::detach() {
+  std::lock_guard<std::mutex> lock(parent_mtx_);
+  parent_.reset();
+}
+
+std::shared_ptr<ClientCon> StreamCon::getParent() const {
+  std::lock_guard<std::mutex> lock(parent_mtx_);
+  return parent_.lock();
+}
+
+bool StreamCon::getParentUserInfo(const std::string &user, const std::string &pwd, UserInfo &info) const {
+  std::shared_ptr<ClientCon> parent = getParent();
+  if (parent == nullptr || !parent->getIsVerify() || parent->getUser() != user || parent->getPwd() != pwd) {
+    return false;
+  }
+  info = parent->getUserInfo();
+  return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "UpDownCon.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+class ClientCon;
+
+// 多路复用的流：短任务连接上的一个传输任务（上传、下载），相当于双端口模式下的一个传输连接
+// 任务状态与 UpDownCon 相同，ssl 和发送锁使用所属的连接，SRTool 发送时加上流ID（MuxFrame）；
+// 流不持有套接字，关闭流不会关闭所属的连接
+class StreamCon : public UpDownCon {
+ public:
+  StreamCon(std::weak_ptr<ClientCon> parent, uint32_t stream_id);
+  ~StreamCon() override;
+
+  SSL *getSSL() const override;       // 所属连接已关闭返回nullptr，调用前需持有发送锁
+  uint32_t getStreamId() const override;
+  // 返回所属连接的发送锁，调用者（工作线程中的任务）需持有所属连接的 shared_ptr（getParent），保证锁在使用期间有效
+  FairMutex& getSendMutex() override;
+  bool waitSendWindow(size_t len) override;
+  void close() override;
+
+  void addSendWindow(uint32_t len);         // 对方归还窗口（MUX_WINDOW）
+  bool consumeRecvWindow(size_t len);       // 收到文件数据，窗口在收到之前已经用完返回false（对方没有遵守流量控制）
+  uint32_t releaseRecvWindow(size_t len);   // 文件数据处理完，累计达到半个窗口时返回需要归还的字节数，否则返回0
+  void detach();                            // 所属连接关闭，不再使用它的ssl和发送锁
+  std::shared_ptr<ClientCon> getParent() const;   // 所属连接，已经关闭或释放返回空
+  // 所属连接已登录且用户名和密码相同时，取得它登录时的用户信息（传输任务不再查询数据库认证）
+  bool getParentUserInfo(const std::string &user, const std::string &pwd, UserInfo &info) const;
+
+ private:
+  mutable std::mutex parent_mtx_;     // 保护 parent_
+  std::weak_ptr<ClientCon> parent_;   // 不持有所属的连接，连接持有流，避免循环引用
+  uint32_t stream_id_ = 0;
+
+  std::mutex window_mtx_;
+  std::condition_variable window_cv_;
+  int64_t send_window_ = MUX_INITIAL_WINDOW;  // 发送窗口，可以透支，为正时才能发送
+  int64_t recv_window_ = MUX_INITIAL_WINDOW;  // 接收窗口
+  uint32_t recv_released_ = 0;                // 已经处理、还没有归还的字节数
+};
@@ -53,8 +53,32 @@ void UpDownCon::copyTask(const UDtask &task) {
   task_.file_size.store(task.file_size.load());
   task_.handled_size.store(task.handled_size.load());
   task_.parent_dir_id.store(task.parent_dir_id.load());
+  task_.range_end.store(task.range_end.load());
+  task_.is_range.store(task.is_range.load());
+  task_.compress.store(task.compress.load());
+  task_.check_crc.store(task.check_crc.load());
   task_.file_fd.store(task.file_fd.load());
   task_.file_map.store(task.file_map.load());
+  {
+    std::lock_guard<std::mutex> lock(task_up_session_mtx_);
+    task_.up_session = task.up_session;
+  }
+  {
+    std::lock_guard<std::mutex> lock(task_down_reader_mtx_);
+    task_.down_reader = task.down_reader;
+  }
+  {
+    std::lock_guard<std::mutex> lock(task_batch_session_mtx_);
+    task_.batch_session = task.batch_session;
+  }
+  {
+    std::lock_guard<std::mutex> lock(task_multi_session_mtx_);
+    task_.multi_session = task.multi_session;
+  }
+  {
+    std::lock_guard<std::mutex> lock(task_quick_proof_mtx_);
+    task_.quick_proof = task.quick_proof;
+  }
 }
 
 uint32_t UpDownCon::getTaskTaskType() {
@@ -83,6 +107,22 @@ uint64_t UpDownCon::getTaskParentDirId() {
   return task_.parent_dir_id.load();
 }
 
+uint64_t UpDownCon::getTaskRangeEnd() {
+  return task_.range_end.load();
+}
+
+bool UpDownCon::getTaskIsRange() {
+  return task_.is_range.load();
+}
+
+uint32_t UpDownCon::getTaskCompress() {
+  return task_.compress.load();
+}
+
+bool UpDownCon::getTaskCheckCrc() {
+  return task_.check_crc.load();
+}
+
 int32_t UpDownCon::getTaskFileFd() {
   return task_.file_fd.load();
 }
@@ -91,6 +131,31 @@ char *UpDownCon::getTaskFileMap() {
   return task_.file_map.load();
 }
 
+std::shared_ptr<UploadSession> UpDownCon::getTaskUpSession() {
+  std::lock_guard<std::mutex> lock(task_up_session_mtx_);
+  return task_.up_session;
+}
+
+std::shared_ptr<FileReader> UpDownCon::getTaskDownReader() {
+  std::lock_guard<std::mutex> lock(task_down_reader_mtx_);
+  return task_.down_reader;
+}
+
+std::shared_ptr<BatchSession> UpDownCon::getTaskBatchSession() {
+  std::lock_guard<std::mutex> lock(task_batch_session_mtx_);
+  return task_.batch_session;
+}
+
+std::shared_ptr<MultiGetSession> UpDownCon::getTaskMultiSession() {
+  std::lock_guard<std::mutex> lock(task_multi_session_mtx_);
+  return task_.multi_session;
+}
+
+std::string UpDownCon::getTaskQuickProof() {
+  std::lock_guard<std::mutex> lock(task_quick_proof_mtx_);
+  return task_.quick_proof;
+}
+
 void UpDownCon::setTaskTaskType(uint32_t type) {
   task_.task_type.store(type);
 }
@@ -168,7 +233,8 @@ void UpDownCon::close() {
       std::cerr << "close() failed with error: " << strerror(errno) << std::endl;
     }
     
-    if (munmap(task_.file_map, task_.file_size) != 0) {
+    // 上传任务的文件由上传会话管理，下载任务的文件由下载读取器管理，这里只释放通过 setTaskFileMap 设置的映射
+    if (task_.file_map != nullptr && munmap(task_.file_map, task_.file_size) != 0) {
       std::cerr << "munmap failed: " << strerror(errno) << std::endl;
     }
     task_.file_map = nullptr;   // 防止重复释放
@@ -183,17 +249,28 @@ void UpDownCon::close() {
   --user_count;
   is_close_ = true;
 
-  // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-  // 如果不需要实现断点上传，可以将未完成的任务文件直接删除，避免服务器磁盘空间浪费。如果需要实现，这段代码需要修改，可以使用数据库记录保存客户端上传传输任务状态
-  if(task_.handled_size < task_.file_size && task_.task_type == UpDownCon::ConType::PUTTASK){   //任务未完成，且为上传任务
-    //文件名为，用户根文件夹+/+文件md5码
-    std::string filepath = std::string(ROOTFILEPATH) + "/" + std::string(user_info_.user) + "/" + task_.file_md5;
-    if(remove(filepath.c_str()) == 0) {
-      std::cout << "Remove file: " << filepath.c_str() << std::endl;
-    }
-    else {
-      std::cout << "Remove file fail: " << filepath.c_str() << std::endl;
-    }
+  // 上传任务不再删除未完成的文件，而是交给上传会话处理：
+  // 最后一个使用该会话的连接断开时，会话会将已接收区间持久化，等待客户端断点续传；如果没有接收任何数据，则删除文件
+  std::shared_ptr<UploadSession> session;
+  {
+    std::lock_guard<std::mutex> lock(task_up_session_mtx_);
+    session.swap(task_.up_session);
+  }
+  session.reset();
+
+  // 释放下载读取器，发送线程仍持有时，由发送线程结束后释放（解除窗口映射并关闭文件）
+  {
+    std::lock_guard<std::mutex> lock(task_down_reader_mtx_);
+    task_.down_reader.reset();
+  }
+  // 释放批量上传会话，还没有入库的文件的引用由会话释放
+  {
+    std::lock_guard<std::mutex> lock(task_batch_session_mtx_);
+    task_.batch_session.reset();
+  }
+  {
+    std::lock_guard<std::mutex> lock(task_multi_session_mtx_);
+    task_.multi_session.reset();
   }
   // !!!!!!!!!!!!!!!!!!!!!! 不关闭底层socket吗 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 }
@@ -238,6 +315,11 @@ bool UpDownCon::cmpExchange(int expected, int desired) {
   return status_.compare_exchange_strong(expected, desired);
 }
 
-std::mutex &UpDownCon::getSendMutex() {
+FairMutex &UpDownCon::getSendMutex() {
   return send_mutex_;
 }
+
+bool UpDownCon::waitSendWindow(size_t len) {
+  (void)len;
+  return !is_close_;
+}
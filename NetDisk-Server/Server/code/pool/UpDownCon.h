@@ -2,10 +2,16 @@
 
 
 #include "AbstractCon.h"
+#include "UploadSession.h"
+#include "BatchSession.h"
+#include "MultiGetSession.h"
+#include "FileReader.h"
+#include "FairMutex.h"
 #include <mutex>
 #include <memory>
 #include <condition_variable>
 #include <atomic>
+#include <functional>
 
 struct UDtask {
   std::atomic<uint32_t> task_type{ AbstractCon::ConType::LONGTASK };  // 任务类型，默认为长任务，后面根据需要改为下载或上传
@@ -14,8 +20,17 @@ struct UDtask {
   std::atomic<uint64_t> file_size{ 0 };     // 文件总大小（字节）
   std::atomic<uint64_t> handled_size{ 0 };  // 已处理大小（字节）
   std::atomic<uint64_t> parent_dir_id{ 0 }; // 保存在哪个文件夹下，默认为0（根目录）
+  std::atomic<uint64_t> range_end{ 0 };     // 下载区间的结束位置（不包括），普通下载为文件大小
+  std::atomic<bool> is_range{ false };      // 是否为区间下载，区间下载发送完成后会发送区间的哈希
+  std::atomic<uint32_t> compress{ 0 };      // 协商的压缩方式和级别（Compressor::negotiate 的返回值）
+  std::atomic<bool> check_crc{ false };     // 是否检查上传分片的校验和（客户端带有 UPLOAD_CAP_CRC32C）
   std::atomic<int32_t> file_fd{ -1 };       // 文件套接字
   std::atomic<char*> file_map{ nullptr };   // 文件内存映射
+  std::shared_ptr<UploadSession> up_session{ nullptr };  // 上传会话（断点续传），只有上传任务使用
+  std::shared_ptr<FileReader> down_reader{ nullptr };    // 下载文件读取（滑动映射窗口），只有下载任务使用
+  std::shared_ptr<BatchSession> batch_session{ nullptr }; // 批量上传会话，只有批量上传任务使用
+  std::shared_ptr<MultiGetSession> multi_session{ nullptr };  // 多文件下载会话，只有多文件下载任务使用
+  std::string quick_proof;                  // 秒传的持有证明的期望结果（SHA-256），为空表示不需要证明
   
   UDtask() = default;
   // 重载拷贝函数
@@ -26,8 +41,17 @@ struct UDtask {
     file_size.store(other.file_size.load());
     handled_size.store(other.handled_size.load());
     parent_dir_id.store(other.parent_dir_id.load());
+    range_end.store(other.range_end.load());
+    is_range.store(other.is_range.load());
+    compress.store(other.compress.load());
+    check_crc.store(other.check_crc.load());
     file_fd.store(other.file_fd.load());
     file_map.store(other.file_map.load());
+    up_session = other.up_session;
+    down_reader = other.down_reader;
+    batch_session = other.batch_session;
+    multi_session = other.multi_session;
+    quick_proof = other.quick_proof;
   }
   UDtask& operator=(const UDtask& other) {
     task_type.store(other.task_type.load());
@@ -36,8 +60,17 @@ struct UDtask {
     file_size.store(other.file_size.load());
     handled_size.store(other.handled_size.load());
     parent_dir_id.store(other.parent_dir_id.load());
+    range_end.store(other.range_end.load());
+    is_range.store(other.is_range.load());
+    compress.store(other.compress.load());
+    check_crc.store(other.check_crc.load());
     file_fd.store(other.file_fd.load());
     file_map.store(other.file_map.load());
+    up_session = other.up_session;
+    down_reader = other.down_reader;
+    batch_session = other.batch_session;
+    multi_session = other.multi_session;
+    quick_proof = other.quick_proof;
 
     return *this;
   }
@@ -75,8 +108,17 @@ class UpDownCon : public AbstractCon {
   uint64_t getTaskFileSize();
   uint64_t getTaskHandledSize();
   uint64_t getTaskParentDirId();
+  uint64_t getTaskRangeEnd();
+  bool getTaskIsRange();
+  uint32_t getTaskCompress();
+  bool getTaskCheckCrc();
   int32_t getTaskFileFd();
   char* getTaskFileMap();
+  std::shared_ptr<UploadSession> getTaskUpSession();
+  std::shared_ptr<FileReader> getTaskDownReader();
+  std::shared_ptr<BatchSession> getTaskBatchSession();
+  std::shared_ptr<MultiGetSession> getTaskMultiSession();
+  std::string getTaskQuickProof();
 
   void setTaskTaskType(uint32_t type);
   void setTaskFileName(std::string& name);
@@ -101,7 +143,9 @@ class UpDownCon : public AbstractCon {
   bool notifyAll();
   bool cmpExchange(int expected, int desired);
 
-  std::mutex& getSendMutex();
+  virtual FairMutex& getSendMutex();
+  // 等待发送窗口后占用 len 字节（多路复用的流量控制），连接已关闭返回false；独立的连接没有窗口，只检查是否关闭
+  virtual bool waitSendWindow(size_t len);
 
  private:
   // 控制运行状态 
@@ -114,7 +158,12 @@ class UpDownCon : public AbstractCon {
   std::mutex task_file_name_mtx_;     // 保护 task_ 的 file_name 的互斥锁
   std::mutex task_file_md5_mtx_;      // 保护 task_ 的 file_md5 的互斥锁
   std::mutex task_handled_size_mtx_;  // 保护 task_ 的 handled_size 的互斥锁
+  std::mutex task_up_session_mtx_;    // 保护 task_ 的 up_session 的互斥锁
+  std::mutex task_down_reader_mtx_;   // 保护 task_ 的 down_reader 的互斥锁
+  std::mutex task_batch_session_mtx_; // 保护 task_ 的 batch_session 的互斥锁
+  std::mutex task_multi_session_mtx_; // 保护 task_ 的 multi_session 的互斥锁
+  std::mutex task_quick_proof_mtx_;   // 保护 task_ 的 quick_proof 的互斥锁
 
-  std::mutex send_mutex_;             // 发送锁，保证发送回复的原子性
+  FairMutex send_mutex_;              // 发送锁，保证发送回复的原子性
 
 };
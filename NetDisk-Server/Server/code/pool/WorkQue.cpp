@@ -1,5 +1,7 @@
 #include "WorkQue.h"
+#include "BufferPool.h"
 #include <cassert>
+#include <chrono>
 
 WorkQue::WorkQue(size_t thread_count) : is_close_(false) {
   assert(thread_count > 0);
@@ -10,7 +12,15 @@ WorkQue::WorkQue(size_t thread_count) : is_close_(false) {
         std::function<void()> task;
         {
           std::unique_lock<std::mutex> lock(mtx_);
-          cv_.wait(lock, [this]() { return is_close_ || !task_que_.empty(); });
+          auto ready = [this]() { return is_close_ || !task_que_.empty(); };
+          // 空闲一分钟后把本线程缓存的缓冲区还给缓冲区池：没有任务的线程不再申请或归还缓冲区，看不到清除轮次，
+          // 缓存的缓冲区会使所在的 slab 不能释放
+          if (!cv_.wait_for(lock, std::chrono::minutes(1), ready)) {
+            lock.unlock();
+            BufferPool::getInstance().releaseThreadCache();
+            lock.lock();
+            cv_.wait(lock, ready);
+          }
           if (is_close_ && task_que_.empty()) {  // 线程池停止，并且所有任务都执行完
             return;
           }
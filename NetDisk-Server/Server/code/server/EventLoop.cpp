@@ -2,6 +2,7 @@
 #include "Log.h"
 #include "ShortTaskTool.h"
 #include "LongTaskTool.h"
+#include "StreamCon.h"
 #include <cassert>
 #include <sys/ioctl.h>
 
@@ -86,7 +87,7 @@ void EventLoop::handleClientData(AbstractCon *client) {
       std::cout << "client close connection" << std::endl;
       break;
     }
-    Buffer& buf = client->getReadBuffer();
+    SegBuffer& buf = client->getReadBuffer();
     
     // 循环处理数据
     // 如果缓冲区可读数据小于协议头数据（先收到协议头才能确定任务类型和后续接收字节数），直接退出
@@ -96,15 +97,27 @@ void EventLoop::handleClientData(AbstractCon *client) {
       Serializer::deserialize(buf.beginRead(), PROTOCOLHEADER_LEN, header);
       // 判断是否能获取完整PDU
       size_t pdu_len = PROTOCOLHEADER_LEN + header.body_len;  // PDU总长度
+      // 多路复用帧中是一个完整的协议单元，比协议单元多一个帧头
+      size_t max_len = (header.type == ProtocolType::MUXFRAME_TYPE) ? MAX_MUXFRAME_LEN : MAX_PDU_LEN;
+      if (!client->getIsVerify()) {   // 认证之前只接受小的PDU，长度来自未认证的数据
+        max_len = MAX_UNVERIFIED_PDU_LEN;
+      }
+      if (pdu_len > max_len) {  // 非法数据，关闭连接
+        LOG_WARN("Client[%d] pdu too large: %lu", client->getSock(), pdu_len);
+        closeCon(client);
+        return;
+      }
       if (buf.readAbleBytes() < pdu_len) {
+        buf.ensureFrame(pdu_len);   // 保证PDU能完整地保存在一个段中，后续数据直接读到该段
         break;  // 数据还未全部到达，等待下次数据
       }
-      // 保存PDU
-      assert(BufferPool::getInstance().getBufferSize() >= pdu_len);
-      auto pdu_buf = BufferPool::getInstance().acquire();
-      memcpy(pdu_buf.get(), buf.beginRead(), pdu_len);
-      buf.retrieve(pdu_len);  // 收回（标记以读取）
+      // 零拷贝取出PDU，与读缓冲区的段共享引用计数
+      auto pdu_buf = buf.slice(pdu_len);
 
+      if (header.type == ProtocolType::MUXFRAME_TYPE) {
+        handleMuxFrame(pdu_buf, pdu_len, client);
+        continue;
+      }
       // 完整PDU，分发给处理线程
       work_que_->addTask(std::bind(&EventLoop::handleClientTask, this, pdu_buf, client));
     }
@@ -162,13 +175,23 @@ void EventLoop::handleClientTask(buffer_shared_ptr buf, AbstractCon *client) {
       break;
     }
     case ProtocolType::TRANDATAPDU_TYPE: {
+      // 只解析固定字段，文件数据留在缓冲区中
       TranDataPdu pdu;
-      bool deserialize_res = Serializer::deserialize(buf.get(), pdu_len, pdu);
+      const char* data = nullptr;
+      bool deserialize_res = Serializer::deserializeHead(buf.get(), pdu_len, pdu, data);
       if (!deserialize_res) {
         std::cout << "deserialize TranDataPdu failed" << std::endl;
         break;
       }
-      std::shared_ptr<AbstractTool> tool = getTool(pdu, client);
+      std::shared_ptr<AbstractTool> tool;
+      if (pdu.code == Code::PUTS_DATA || pdu.code == Code::PUTS_BATCH_DATA) {
+        // 上传数据快速路径：不拷贝到pdu.data，由PutsDataTool直接从缓冲区写入文件
+        tool = std::make_shared<PutsDataTool>(pdu, buf, data, client);
+      }
+      else {
+        pdu.data.assign(data, pdu.chunk_size);
+        tool = getTool(pdu, client);
+      }
       // 执行任务
       if (tool) {
         tool->doingTask();
@@ -209,6 +232,82 @@ void EventLoop::handleClientTask(buffer_shared_ptr buf, AbstractCon *client) {
   }
 }
 
+// 多路复用帧：控制帧（归还窗口、关闭流）直接在事件循环线程中处理，不进入工作队列，
+// 下载的发送线程等待窗口时即使占满了工作线程，也能收到客户端归还的窗口；流上的协议单元交给工作线程，处理与独立的传输连接相同
+void EventLoop::handleMuxFrame(buffer_shared_ptr buf, size_t frame_len, AbstractCon *client) {
+  ClientCon *conn = dynamic_cast<ClientCon*>(client);
+  MuxFrame frame;
+  const char *data = nullptr;
+  // 只有登录后的短任务连接能打开流
+  if (conn == nullptr || !conn->getIsVerify() || !Serializer::deserializeHead(buf.get(), frame_len, frame, data) || frame.stream_id == 0) {
+    LOG_WARN("Client[%d] invalid mux frame", client->getSock());
+    return;
+  }
+
+  switch (frame.kind) {
+    case MuxKind::MUX_WINDOW: {
+      std::shared_ptr<StreamCon> stream = conn->getStream(frame.stream_id, false);
+      if (stream) {
+        stream->addSendWindow(frame.window);
+      }
+      break;
+    }
+    case MuxKind::MUX_CLOSE: {
+      conn->closeStream(frame.stream_id);
+      break;
+    }
+    case MuxKind::MUX_DATA: {
+      // 流上只能是传输任务的协议单元，且帧中正好是一个完整的协议单元
+      ProtocolHeader header;
+      bool valid = Serializer::deserialize(data, frame.data_len, header) && PROTOCOLHEADER_LEN + header.body_len == frame.data_len &&
+                   (header.type == ProtocolType::TRANPDU_TYPE || header.type == ProtocolType::TRANDATAPDU_TYPE ||
+                    header.type == ProtocolType::TRANFINISHPDU_TYPE || header.type == ProtocolType::TRANCONTROLPDU_TYPE);
+      std::shared_ptr<StreamCon> stream = valid ? conn->getStream(frame.stream_id, true) : nullptr;
+      if (!stream) {
+        LOG_WARN("Client[%d] reject mux stream %u", client->getSock(), frame.stream_id);
+        resetStream(client, frame.stream_id);
+        break;
+      }
+      // 文件数据占用接收窗口，客户端没有遵守流量控制时关闭该流
+      const bool is_data = (header.type == ProtocolType::TRANDATAPDU_TYPE);
+      if (is_data && !stream->consumeRecvWindow(frame.data_len)) {
+        LOG_WARN("Client[%d] mux stream %u window exceeded", client->getSock(), frame.stream_id);
+        resetStream(client, frame.stream_id);
+        break;
+      }
+      // 协议单元与帧共享缓冲区（零拷贝），任务执行期间持有流和所属的连接（流使用连接的发送锁）
+      buffer_shared_ptr pdu_buf(buf, const_cast<char*>(data));
+      const size_t pdu_len = frame.data_len;
+      std::shared_ptr<ClientCon> parent = conn->shared_from_this();
+      work_que_->addTask([this, pdu_buf, stream, parent, is_data, pdu_len]() {
+        handleClientTask(pdu_buf, stream.get());
+        if (is_data) {
+          uint32_t credit = stream->releaseRecvWindow(pdu_len);
+          if (credit > 0) {
+            std::lock_guard<FairMutex> lock(stream->getSendMutex());
+            sr_tool_.sendMuxFrame(stream.get(), stream->getStreamId(), MuxKind::MUX_WINDOW, credit);
+          }
+        }
+      });
+      break;
+    }
+    default: {
+      LOG_WARN("Client[%d] unknown mux frame kind: %u", client->getSock(), frame.kind);
+      break;
+    }
+  }
+}
+
+void EventLoop::resetStream(AbstractCon *client, uint32_t stream_id) {
+  std::shared_ptr<ClientCon> conn = static_cast<ClientCon*>(client)->shared_from_this();
+  conn->closeStream(stream_id);
+  // 发送可能等待其它流的数据包，交给工作线程；任务持有连接，执行前连接关闭时 getSSL 返回nullptr，不会发送
+  work_que_->addTask([this, conn, stream_id]() {
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendMuxFrame(conn.get(), stream_id, MuxKind::MUX_CLOSE, 0);
+  });
+}
+
 // 根据任务代码不同，生成不同的具体工厂类处理短任务
 std::shared_ptr<AbstractTool> EventLoop::getTool(PDU &pdu, AbstractCon *con) {
   assert(con);
@@ -253,10 +352,26 @@ std::shared_ptr<AbstractTool> EventLoop::getTool(TranPdu &pdu, AbstractCon *con)
       con->client_type = AbstractCon::ConType::PUTTASK; // 此时任务类型已经可以确定
       return std::make_shared<PutsTool>(pdu, con);            
     }
+    case Code::PUTS_JOIN: {
+      con->client_type = AbstractCon::ConType::PUTTASK; // 加入已有上传会话的并行连接
+      return std::make_shared<PutsTool>(pdu, con);
+    }
+    case Code::PUTS_BATCH: {
+      con->client_type = AbstractCon::ConType::PUTTASK; // 批量上传小文件
+      return std::make_shared<PutsTool>(pdu, con);
+    }
     case Code::GETS: {
       con->client_type = AbstractCon::ConType::GETTASK; // 确定为下载任务
       return std::make_shared<GetsTool>(pdu, con);
     }
+    case Code::GETS_RANGE: {
+      con->client_type = AbstractCon::ConType::GETTASK; // 区间下载也是下载任务
+      return std::make_shared<GetsTool>(pdu, con);
+    }
+    case Code::GETS_MULTI: {
+      con->client_type = AbstractCon::ConType::GETTASK; // 多文件下载
+      return std::make_shared<GetsTool>(pdu, con);
+    }
     default:
     break;
   }
@@ -270,9 +385,31 @@ std::shared_ptr<AbstractTool> EventLoop::getTool(TranDataPdu &pdu, AbstractCon *
     case Code::PUTS_DATA: {
       return std::make_shared<PutsDataTool>(pdu, con);
     }
+    case Code::PUTS_CHUNKS: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 块清单查询
+    }
+    case Code::PUTS_DELTA_SIG:
+    case Code::PUTS_DELTA: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 差量上传
+    }
+    case Code::PUTS_BATCH_LIST:
+    case Code::PUTS_BATCH_DATA: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 批量上传
+    }
+    case Code::PUTS_QUICK_PROOF: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 秒传的持有证明
+    }
     case Code::GETS_DATA: {
       return std::make_shared<GetsDataTool>(pdu, con);
     }
+    case Code::BATCH_DELETE:
+    case Code::BATCH_MAKEDIR:
+    case Code::BATCH_MOVE: {
+      return std::make_shared<BatchOpTool>(pdu, con);   // 批量操作（短任务连接）
+    }
+    case Code::GETS_MULTI_LIST: {
+      return std::make_shared<GetsDataTool>(pdu, con);  // 多文件下载
+    }
     default: {
       break;
     }
@@ -325,7 +462,7 @@ int EventLoop::getSocketPending(int sockfd) {
 // 读取ssl和底层socket所有数据，保存到client的read_buffer_中
 ssize_t EventLoop::sslReadAll(AbstractCon *client, size_t buf_size) {
   SSL* ssl = client->getSSL();
-  Buffer& buf = client->getReadBuffer();
+  SegBuffer& buf = client->getReadBuffer();
   if (!ssl || buf_size == 0) {
     std::cerr << "Invalid parameters" << std::endl;
     return -1;
@@ -335,10 +472,10 @@ ssize_t EventLoop::sslReadAll(AbstractCon *client, size_t buf_size) {
   size_t total_read = 0;        // 总共读取的字节
   int continue_reading = 1;     // 是否继续读
 
-  while (continue_reading && total_read < buf_size) {
-    buf.ensureWriteAble(buf_size - total_read); // 确保能够读取字节
-    // 尝试读取数据
-    size_t ret = SSL_read(ssl, buf.beginWrite(), buf_size - total_read);
+  buf.ensureWriteAble(1); // 确保能够读取字节
+  while (continue_reading && total_read < buf_size && buf.writeAbleBytes() > 0) {
+    // 尝试读取数据，最多读满当前段；段满时返回，先处理完整的PDU，再切换新段，这样切换时只需搬移不完整的PDU
+    int ret = SSL_read(ssl, buf.beginWrite(), std::min(buf.writeAbleBytes(), buf_size - total_read));
     
     if (ret > 0) {  // 读取成功
       buf.hasWritten(ret);  // 标记写了ret字节
@@ -25,6 +25,8 @@ class EventLoop {
   void closeCon(AbstractCon* client);
   void handleClientData(AbstractCon *client);
   void handleClientTask(buffer_shared_ptr buf, AbstractCon *client);
+  void handleMuxFrame(buffer_shared_ptr buf, size_t frame_len, AbstractCon *client);  // 多路复用帧，在事件循环线程中调用
+  void resetStream(AbstractCon *client, uint32_t stream_id);   // 关闭流并通知客户端
 
   std::shared_ptr<AbstractTool> getTool(PDU &pdu, AbstractCon *con);
   std::shared_ptr<AbstractTool> getTool(TranPdu &pdu, AbstractCon *con);
@@ -43,6 +45,7 @@ class EventLoop {
   std::shared_ptr<WorkQue> work_que_;     // 线程池，工作队列，用于添加任务
   std::shared_ptr<Timer> timer_;          // 用于处理定时器超时，断开超时无操作连接
   int timeout_ms_{ -1 };                  // 超时时间，单位毫秒
+  SRTool sr_tool_;                        // 发送多路复用的控制帧
 
   // !!!!!!!!!!!!!!!!!!!!!!!!!!!!! 后续改为AbstractCon绑定对应的EventLoop !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
   std::unordered_map<int,std::shared_ptr<AbstractCon>> client_con_;    //套接字与用户连接对象的映射
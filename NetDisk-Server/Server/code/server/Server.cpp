@@ -12,6 +12,8 @@
 #include "UpDownCon.h"
 #include "BufferPool.h"
 #include "Serializer.h"
+#include "BlobStore.h"
+#include "UploadSession.h"
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <unistd.h>
@@ -47,6 +49,15 @@ int conn_pool_count, int sql_port, int thread_count, int logque_size,int timeout
     exit(EXIT_FAILURE);
   }
   SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_NONE, NULL);
+  // TLS 会话恢复：同一个客户端为每个传输任务建立新的长任务连接，恢复会话只需简短握手，不再做证书签名和密钥交换
+  // TLS1.3 使用会话票据（服务端不保存会话，票据由服务端的密钥加密），TLS1.2 的客户端使用服务端的会话缓存
+  static const unsigned char sid_ctx[] = "NetDisk-Server";
+  SSL_CTX_set_session_id_context(ssl_ctx_, sid_ctx, sizeof(sid_ctx) - 1);
+  SSL_CTX_set_session_cache_mode(ssl_ctx_, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ssl_ctx_, 20480);
+  SSL_CTX_set_timeout(ssl_ctx_, 3600);        // 会话有效期（秒）
+  SSL_CTX_clear_options(ssl_ctx_, SSL_OP_NO_TICKET);
+  SSL_CTX_set_num_tickets(ssl_ctx_, 2);       // 每次握手后发送的票据数
   
   // 初始化主reactor（epoller）
   epoller_ = std::make_unique<Epoller>();
@@ -68,6 +79,12 @@ int conn_pool_count, int sql_port, int thread_count, int logque_size,int timeout
   // 初始化日志系统
   Log::getInstance()->init(0, LOGPATH, ".log", logque_size);
   std::cout<<"日记启动"<<std::endl;
+
+  // 将旧版本按用户保存的文件迁移到全局内容存储（需要数据库连接池和日志）
+  BlobStore::migrateLegacy();
+  // 清除客户端放弃的上传，之后在主事件循环中定期清除
+  UploadSession::cleanExpired();
+  std::cout<<"文件存储已经初始化"<<std::endl;
   
   // 初始化监听套接字
   timeout_ms_ = timeout;
@@ -131,6 +148,7 @@ void Server::start() {
     if (equalizer_used_) {  // 设置间隔10000毫秒和IO事件触发，即10秒发送一次服务器状态信息给均衡器.也可以在连接处理发送，减少性能损耗。
       timerSendServerState(10000);
     }
+    timerCleanUploads(3600000);   // 每小时清除一次过期的上传
     // 开始IO复用
     int event_cnt = epoller_->wait(time_ms);
 
@@ -252,6 +270,7 @@ void Server::handleNewConnection(int select) {
     // 进行ssl握手
     SSL *ssl = SSL_new(ssl_ctx_);
     SSL_set_fd(ssl, fd);
+    auto start = std::chrono::steady_clock::now();
     if (SSL_accept(ssl) <= 0) {
       LOG_ERROR("ssl connection fail:%d", fd);
       SSL_free(ssl);
@@ -259,10 +278,29 @@ void Server::handleNewConnection(int select) {
       close(fd);
       continue;
     }
+    recordHandshake(ssl, start);
     addClient(fd, ssl, select);
   } while (true);
 }
 
+// 统计握手类型和耗时，每 kHandshakeLogInterval 次握手输出一次
+void Server::recordHandshake(SSL *ssl, std::chrono::steady_clock::time_point start) {
+  uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  if (SSL_session_reused(ssl) == 1) {
+    ++handshake_stats_.resumed;
+    handshake_stats_.resumed_us += us;
+  }
+  else {
+    ++handshake_stats_.full;
+    handshake_stats_.full_us += us;
+  }
+  const HandshakeStats &st = handshake_stats_;
+  if ((st.full + st.resumed) % kHandshakeLogInterval == 0) {
+    LOG_INFO("TLS handshakes: full %lu (avg %lu us), resumed %lu (avg %lu us)", st.full, st.full == 0 ? 0 : st.full_us / st.full,
+             st.resumed, st.resumed == 0 ? 0 : st.resumed_us / st.resumed);
+  }
+}
+
 // 处理客户端发来的数据（只接收并分发原始数据，不做序列化和其它处理）
 void Server::handleClientData(AbstractCon *client) {
   assert(client);
@@ -284,7 +322,7 @@ void Server::handleClientData(AbstractCon *client) {
       std::cout << "client close connection" << std::endl;
       break;
     }
-    Buffer& buf = client->getReadBuffer();
+    SegBuffer& buf = client->getReadBuffer();
     
     // 循环处理数据
     // 如果缓冲区可读数据小于协议头数据（先收到协议头才能确定任务类型和后续接收字节数），直接退出
@@ -294,14 +332,19 @@ void Server::handleClientData(AbstractCon *client) {
       Serializer::deserialize(buf.beginRead(), PROTOCOLHEADER_LEN, header);
       // 判断是否能获取完整PDU
       size_t pdu_len = PROTOCOLHEADER_LEN + header.body_len;  // PDU总长度
+      // 认证之前只接受小的PDU，长度来自未认证的数据
+      size_t max_len = client->getIsVerify() ? MAX_PDU_LEN : MAX_UNVERIFIED_PDU_LEN;
+      if (pdu_len > max_len) {  // 非法数据，关闭连接
+        LOG_WARN("Client[%d] pdu too large: %lu", client->getSock(), pdu_len);
+        closeCon(client);
+        return;
+      }
       if (buf.readAbleBytes() < pdu_len) {
+        buf.ensureFrame(pdu_len);   // 保证PDU能完整地保存在一个段中，后续数据直接读到该段
         break;  // 数据还未全部到达，等待下次数据
       }
-      // 保存PDU
-      assert(BufferPool::getInstance().getBufferSize() >= pdu_len);
-      auto pdu_buf = BufferPool::getInstance().acquire();
-      memcpy(pdu_buf.get(), buf.beginRead(), pdu_len);
-      buf.retrieve(pdu_len);  // 收回（标记以读取）
+      // 零拷贝取出PDU，与读缓冲区的段共享引用计数
+      auto pdu_buf = buf.slice(pdu_len);
 
       // 完整PDU，分发给处理线程
       work_que_->addTask(std::bind(&Server::handleClientTask, this, pdu_buf, client));
@@ -451,10 +494,26 @@ std::shared_ptr<AbstractTool> Server::getTool(TranPdu &pdu, AbstractCon *con) {
       con->client_type = AbstractCon::ConType::PUTTASK; // 此时任务类型已经可以确定
       return std::make_shared<PutsTool>(pdu, con);            
     }
+    case Code::PUTS_JOIN: {
+      con->client_type = AbstractCon::ConType::PUTTASK; // 加入已有上传会话的并行连接
+      return std::make_shared<PutsTool>(pdu, con);
+    }
+    case Code::PUTS_BATCH: {
+      con->client_type = AbstractCon::ConType::PUTTASK; // 批量上传小文件
+      return std::make_shared<PutsTool>(pdu, con);
+    }
     case Code::GETS: {
       con->client_type = AbstractCon::ConType::GETTASK; // 确定为下载任务
       return std::make_shared<GetsTool>(pdu, con);
     }
+    case Code::GETS_RANGE: {
+      con->client_type = AbstractCon::ConType::GETTASK; // 区间下载也是下载任务
+      return std::make_shared<GetsTool>(pdu, con);
+    }
+    case Code::GETS_MULTI: {
+      con->client_type = AbstractCon::ConType::GETTASK; // 多文件下载
+      return std::make_shared<GetsTool>(pdu, con);
+    }
     default:
     break;
   }
@@ -468,9 +527,31 @@ std::shared_ptr<AbstractTool> Server::getTool(TranDataPdu &pdu, AbstractCon *con
     case Code::PUTS_DATA: {
       return std::make_shared<PutsDataTool>(pdu, con);
     }
+    case Code::PUTS_CHUNKS: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 块清单查询
+    }
+    case Code::PUTS_DELTA_SIG:
+    case Code::PUTS_DELTA: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 差量上传
+    }
+    case Code::PUTS_BATCH_LIST:
+    case Code::PUTS_BATCH_DATA: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 批量上传
+    }
+    case Code::PUTS_QUICK_PROOF: {
+      return std::make_shared<PutsDataTool>(pdu, con);  // 秒传的持有证明
+    }
     case Code::GETS_DATA: {
       return std::make_shared<GetsDataTool>(pdu, con);
     }
+    case Code::BATCH_DELETE:
+    case Code::BATCH_MAKEDIR:
+    case Code::BATCH_MOVE: {
+      return std::make_shared<BatchOpTool>(pdu, con);   // 批量操作（短任务连接）
+    }
+    case Code::GETS_MULTI_LIST: {
+      return std::make_shared<GetsDataTool>(pdu, con);  // 多文件下载
+    }
     default: {
       break;
     }
@@ -574,6 +655,16 @@ void Server::sendServerState(int state) {
 }
 
 // 间隔millisecond毫秒向负载均衡器发送状态信息
+// 定期清除过期的上传，扫描目录和查询数据库交给工作线程，不阻塞主事件循环
+void Server::timerCleanUploads(int millisecond) {
+  static auto last_time = std::chrono::steady_clock::now();
+  auto current_time = std::chrono::steady_clock::now();
+  if (std::chrono::duration_cast<std::chrono::milliseconds>(current_time - last_time).count() > millisecond) {
+    work_que_->addTask(&UploadSession::cleanExpired);
+    last_time = current_time;
+  }
+}
+
 void Server::timerSendServerState(int millisecond) {
   // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! 后续可使用定时器 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
   // 最后发送的时间
@@ -641,7 +732,7 @@ int Server::getSocketPending(int sockfd) {
 // 读取ssl和底层socket所有数据，保存到client的read_buffer_中
 ssize_t Server::sslReadAll(AbstractCon *client, size_t buf_size) {
   SSL* ssl = client->getSSL();
-  Buffer& buf = client->getReadBuffer();
+  SegBuffer& buf = client->getReadBuffer();
   if (!ssl || buf_size == 0) {
     std::cerr << "Invalid parameters" << std::endl;
     return -1;
@@ -651,10 +742,10 @@ ssize_t Server::sslReadAll(AbstractCon *client, size_t buf_size) {
   size_t total_read = 0;        // 总共读取的字节
   int continue_reading = 1;     // 是否继续读
 
-  while (continue_reading && total_read < buf_size) {
-    buf.ensureWriteAble(buf_size - total_read); // 确保能够读取字节
-    // 尝试读取数据
-    size_t ret = SSL_read(ssl, buf.beginWrite(), buf_size - total_read);
+  buf.ensureWriteAble(1); // 确保能够读取字节
+  while (continue_reading && total_read < buf_size && buf.writeAbleBytes() > 0) {
+    // 尝试读取数据，最多读满当前段；段满时返回，先处理完整的PDU，再切换新段，这样切换时只需搬移不完整的PDU
+    int ret = SSL_read(ssl, buf.beginWrite(), std::min(buf.writeAbleBytes(), buf_size - total_read));
     
     if (ret > 0) {  // 读取成功
       buf.hasWritten(ret);  // 标记写了ret字节
@@ -3,6 +3,7 @@
 #include <string>
 #include <unordered_map>
 #include <memory>
+#include <chrono>
 #include <openssl/ossl_typ.h>
 #include "EventLoop.h"
 #include "Serializer.h"
@@ -38,9 +39,11 @@ int conn_pool_count, int sql_port, int thread_count, int logque_size,int timeout
   bool connectEqualizer(const std::string &equalizer_ip, const int &equalizer_port, const std::string &mine_ip, const int mini_sport, const int &mini_lport, const std::string &server_name, const std::string &key);
   void sendServerState(int state);
   void timerSendServerState(int millisecond);
+  void timerCleanUploads(int millisecond);    // 定期清除客户端放弃的上传
   int setFdNonblock(int fd);
   void sendError(int fd, const char *info);
   void addClient(int client_fd, SSL *ssl, int select);
+  void recordHandshake(SSL *ssl, std::chrono::steady_clock::time_point start);  // 统计握手类型（完整/恢复会话）和耗时
   std::shared_ptr<AbstractTool> getTool(PDU &pdu, AbstractCon *con);
   std::shared_ptr<AbstractTool> getTool(TranPdu &pdu, AbstractCon *con);
   std::shared_ptr<AbstractTool> getTool(TranDataPdu &pdu, AbstractCon *con);
@@ -67,6 +70,15 @@ int conn_pool_count, int sql_port, int thread_count, int logque_size,int timeout
   static const int MAX_FD = 65536;    //最大文件描述符数
   
   SSL_CTX *ssl_ctx_ = nullptr;    //安全套接字
+  // 握手统计（只在主线程接受连接时修改）：完整握手和恢复会话的次数、总耗时（微秒）
+  struct HandshakeStats {
+    uint64_t full = 0;
+    uint64_t resumed = 0;
+    uint64_t full_us = 0;
+    uint64_t resumed_us = 0;
+  };
+  HandshakeStats handshake_stats_;
+  static const uint64_t kHandshakeLogInterval = 256;
   uint32_t listen_event_ = 0;     //监听套接字默认监控事件：EPOLLRDHUP（对端关闭） EPOLLIN(可读事件) EPOLLET（边缘触发）
   uint32_t conn_event_ = 0;       //客户端连接默认监控事件：//连接默认监控事件EPOLLONESHOT（避免多线程，下次需要从新设置监听） | EPOLLRDHUP
 
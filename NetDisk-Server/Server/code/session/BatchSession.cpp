@@ -0,0 +1,270 @@
+#include "BatchSession.h"
+#include "BlobStore.h"
+#include "ChunkStore.h"
+#include "MyDB.h"
+#include "protocol.h"
+#include "Log.h"
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cctype>
+#include <cstring>
+#include <random>
+#include <algorithm>
+#include <unordered_set>
+
+const size_t BatchSession::kInsertBatch = 128;
+
+namespace {
+
+// 文件类型，规则与 AbstractTool::getSuffix 相同
+std::string getSuffix(const std::string &file_name) {
+  size_t pos = file_name.rfind('.');
+  if (pos != std::string::npos && pos != file_name.size() - 1) {
+    return file_name.substr(pos + 1);
+  }
+  return "other";
+}
+
+bool isHexHash(const std::string &hash) {
+  return hash.size() == BATCH_HASH_LEN &&
+         std::all_of(hash.begin(), hash.end(), [](unsigned char c) { return std::isdigit(c) || (c >= 'a' && c <= 'f'); });
+}
+
+}
+
+BatchSession::BatchSession(const std::string &user, uint64_t parent_dir_id, uint32_t file_count, uint64_t total_size)
+  : user_(user), parent_dir_id_(parent_dir_id), total_size_(total_size), entries_(file_count) {
+
+}
+
+BatchSession::~BatchSession() {
+  if (pending_.empty()) {
+    return;
+  }
+  MyDB db;
+  for (uint32_t index : pending_) {
+    BlobStore::release(db, entries_[index].hash);
+  }
+  LOG_WARN("client %s batch upload closed with %lu files not inserted", user_.c_str(), pending_.size());
+}
+
+bool BatchSession::addList(MyDB &db, uint32_t first_index, const char *data, size_t len, std::vector<uint32_t> &needed) {
+  needed.clear();
+  std::vector<uint32_t> indexes;    // 合法的文件
+  std::vector<std::string> hashes;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (list_failed_) {   // 第一个错误的清单页已经结束了会话，之后的清单页不再处理
+      return false;
+    }
+    size_t pos = 0;
+    uint32_t index = first_index;
+    while (pos < len) {
+      if (len - pos < BATCH_ENTRY_BASE_LEN || index >= entries_.size() || index - first_index >= MAX_BATCH_LIST_PER_PAGE) {
+        failList(first_index, index);
+        return false;
+      }
+      uint64_t size = 0;
+      uint16_t name_len = 0;
+      memcpy(&size, data + pos, sizeof(size));
+      memcpy(&name_len, data + pos + sizeof(size) + BATCH_HASH_LEN, sizeof(name_len));
+      size = ntohll(size);
+      name_len = ntohs(name_len);
+      std::string hash(data + pos + sizeof(size), BATCH_HASH_LEN);
+      pos += BATCH_ENTRY_BASE_LEN;
+      if (len - pos < name_len) {
+        failList(first_index, index);
+        return false;
+      }
+      Entry &entry = entries_[index];
+      if (entry.state != NONE) {  // 重复的清单
+        failList(first_index, index);
+        return false;
+      }
+      entry.name.assign(data + pos, name_len);
+      entry.hash = std::move(hash);
+      entry.size = size;
+      entry.state = LISTED;
+      pos += name_len;
+
+      listed_size_ += size;
+      // 文件名长度与普通上传的限制相同，以 .d 结尾的名称保留给文件夹
+      bool valid = size <= MAX_BATCH_FILE_SIZE && listed_size_ <= total_size_ && isHexHash(entry.hash) &&
+                   !entry.name.empty() && entry.name.size() < MAX_FILE_NAME_LEN && getSuffix(entry.name) != "d";
+      if (valid) {
+        indexes.push_back(index);
+        hashes.push_back(entry.hash);
+      }
+      else {
+        resolve(index, false);
+      }
+      ++index;
+    }
+  }
+
+  // 一次查询整页文件的内容是否已经存在，该用户已经拥有的内容直接引用（秒传），否则需要客户端发送数据
+  std::unordered_set<std::string> exist;
+  if (!db.getExistBlobs(user_, hashes, exist)) {
+    exist.clear();
+  }
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    if (exist.count(hashes[i]) != 0 && BlobStore::acquire(db, hashes[i])) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      resolve(indexes[i], true);
+    }
+    else {
+      needed.push_back(indexes[i]);
+    }
+  }
+  return true;
+}
+
+void BatchSession::rejectList() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!list_failed_) {
+    failList(0, 0);
+  }
+}
+
+void BatchSession::failList(uint32_t first_index, uint32_t end_index) {
+  list_failed_ = true;
+  for (uint32_t i = first_index; i < end_index && i < entries_.size(); ++i) {
+    if (entries_[i].state == LISTED) {
+      resolve(i, false);
+    }
+  }
+  for (uint32_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].state == NONE) {
+      resolve(i, false);
+    }
+  }
+}
+
+bool BatchSession::storeFile(MyDB &db, uint32_t index, const char *data, size_t len) {
+  std::string hash;
+  uint64_t size = 0;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (index >= entries_.size() || entries_[index].state != LISTED) {
+      return false;
+    }
+    entries_[index].state = RECEIVING;
+    hash = entries_[index].hash;
+    size = entries_[index].size;
+  }
+
+  // 校验长度和哈希，与声明的哈希不一致的文件不能入库
+  bool ok = false;
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  if (len == size && EVP_Digest(data, len, digest, &digest_len, EVP_sha256(), nullptr) == 1 &&
+      ChunkStore::toHex(digest, digest_len) == hash) {
+    // 先写入用户目录下的临时文件，再移入全局存储（与普通上传相同，rename 不需要复制数据）
+    std::string dir = std::string(ROOTFILEPATH) + "/" + user_;
+    mkdir(dir.c_str(), 0755);
+    std::random_device rd;
+    std::string tmp_path = dir + "/" + hash + "." + std::to_string(rd()) + ".tmp";
+    ok = writeTemp(tmp_path, data, len) && BlobStore::commit(db, tmp_path, hash, size);
+    if (!ok) {
+      remove(tmp_path.c_str());
+    }
+  }
+  else {
+    LOG_WARN("client %s batch upload hash mismatch: %u", user_.c_str(), index);
+  }
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  resolve(index, ok);
+  return ok;
+}
+
+void BatchSession::rejectFile(uint32_t index) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (index < entries_.size() && entries_[index].state == LISTED) {
+    resolve(index, false);
+  }
+}
+
+std::vector<BatchSession::Result> BatchSession::flush(MyDB &db) {
+  std::vector<uint32_t> group;
+  std::vector<NewFileInfo> files;
+  std::vector<Result> results;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    bool all_resolved = (resolved_ == entries_.size());
+    if (pending_.size() < kInsertBatch && !all_resolved) {
+      return results;
+    }
+    // 一次最多入库一组，剩余的位置留给失败的文件（清单错误时可能一次失败大量文件），其余的结果留到下一次
+    size_t group_count = std::min(pending_.size(), kInsertBatch);
+    group.assign(pending_.begin(), pending_.begin() + group_count);
+    pending_.erase(pending_.begin(), pending_.begin() + group_count);
+    size_t fail_count = std::min(failed_.size(), (size_t)MAX_BATCH_RESULTS_PER_REPLY - group_count);
+    results.assign(failed_.end() - fail_count, failed_.end());
+    failed_.resize(failed_.size() - fail_count);
+    replied_ += group.size() + results.size();
+    files.reserve(group.size());
+    for (uint32_t index : group) {
+      const Entry &entry = entries_[index];
+      files.push_back(NewFileInfo{ entry.name, entry.hash, entry.size, getSuffix(entry.name) });
+    }
+  }
+  if (group.empty()) {
+    return results;
+  }
+
+  // 一组文件在一个事务中插入，失败时整组释放引用
+  std::vector<uint64_t> ids;
+  if (!db.insertFileBatch(user_, parent_dir_id_, files, ids)) {
+    LOG_ERROR("client %s batch upload insert %lu files failed", user_.c_str(), files.size());
+    for (auto &file : files) {
+      BlobStore::release(db, file.md5);
+    }
+    ids.assign(group.size(), 0);
+  }
+  for (size_t i = 0; i < group.size(); ++i) {
+    results.emplace_back(group[i], ids[i]);
+  }
+  return results;
+}
+
+bool BatchSession::isFinished() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return replied_ == entries_.size();
+}
+
+void BatchSession::resolve(uint32_t index, bool stored) {
+  entries_[index].state = DONE;
+  ++resolved_;
+  if (stored) {
+    pending_.push_back(index);
+  }
+  else {
+    failed_.emplace_back(index, 0);
+  }
+}
+
+bool BatchSession::writeTemp(const std::string &path, const char *data, size_t len) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    LOG_ERROR("BatchSession open %s error: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, data + done, len - done);
+    if (n <= 0) {
+      LOG_ERROR("BatchSession write %s error: %s", path.c_str(), strerror(errno));
+      close(fd);
+      return false;
+    }
+    done += n;
+  }
+  // 入库前落盘，与普通上传的 syncFile 相同
+  bool ok = (fdatasync(fd) == 0);
+  close(fd);
+  return ok;
+}
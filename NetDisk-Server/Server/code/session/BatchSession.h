@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+class MyDB;
+
+// 批量上传会话（PUTS_BATCH）
+// 上传大量小文件时，每个文件单独建立连接、TLS握手、认证、检查空间和插入数据库的开销远大于传输数据本身。
+// 批量上传在一个已认证的连接上完成：开始时按所有文件的总长度检查一次空间，客户端先发送文件清单，内容已经存在的文件直接秒传，
+// 其余文件每个作为一个数据包连续发送。校验通过的文件移入全局存储后先暂存，凑满一组（或者所有文件都有结果）再在一个事务中插入数据库
+class BatchSession {
+ public:
+  using Result = std::pair<uint32_t, uint64_t>;   // 一个文件的结果：文件序号、文件ID（0为失败）
+
+  BatchSession(const std::string &user, uint64_t parent_dir_id, uint32_t file_count, uint64_t total_size);
+  BatchSession(const BatchSession &other) = delete;
+  BatchSession& operator=(const BatchSession &other) = delete;
+  ~BatchSession();   // 连接断开时，释放已经移入全局存储但还没有入库的文件持有的引用
+
+  // 解析一页文件清单（第一个文件的序号为 first_index），内容已经存在的文件直接引用，needed 返回需要发送数据的文件序号
+  // 清单格式错误返回false（本页和所有还没有清单的文件都失败，会话仍然能够结束），之后的清单页不再接受；
+  // 单个文件不合法（过大、文件名错误、超出声明的总长度）时该文件失败
+  bool addList(MyDB &db, uint32_t first_index, const char *data, size_t len, std::vector<uint32_t> &needed);
+  void rejectList();  // 清单页无法使用（如校验和错误），与清单格式错误相同，所有还没有清单的文件都失败
+  // 保存一个文件的数据：校验长度和哈希后移入全局存储，校验失败时该文件失败；不在清单中或者已经接收过的文件忽略
+  bool storeFile(MyDB &db, uint32_t index, const char *data, size_t len);
+  void rejectFile(uint32_t index);    // 文件数据无法使用（如解压失败），该文件失败
+  // 暂存的文件凑满一组，或者所有文件都已经有结果时，插入数据库并返回这些文件（以及失败的文件）的结果，否则返回空；
+  // 一次最多返回 MAX_BATCH_RESULTS_PER_REPLY 个结果（一个回复），调用者重复调用直到返回空
+  std::vector<Result> flush(MyDB &db);
+  bool isFinished();  // 所有文件的结果都已经取出
+
+  uint32_t getFileCount() const { return entries_.size(); }
+
+ private:
+  enum State { NONE = 0, LISTED, RECEIVING, DONE };
+  struct Entry {
+    std::string name;       // 文件名
+    std::string hash;       // 文件内容的 SHA-256（十六进制）
+    uint64_t size{ 0 };
+    int state{ NONE };
+  };
+  void resolve(uint32_t index, bool stored);  // 调用前需持有 mtx_，stored 为 true 时暂存等待入库，否则失败
+  void failList(uint32_t first_index, uint32_t end_index);   // 调用前需持有 mtx_，清单格式错误时结束会话，之后的清单页都被拒绝
+  static bool writeTemp(const std::string &path, const char *data, size_t len);   // 写入临时文件并落盘
+
+ private:
+  static const size_t kInsertBatch;   // 每组插入数据库的文件数
+
+  std::string user_;
+  uint64_t parent_dir_id_{ 0 };
+  uint64_t total_size_{ 0 };      // 认证时声明（并检查过空间）的总长度，清单中的文件总长度不能超过它
+
+  std::mutex mtx_;
+  std::vector<Entry> entries_;
+  uint64_t listed_size_{ 0 };     // 清单中文件的总长度
+  std::vector<uint32_t> pending_; // 已经移入全局存储、等待插入数据库的文件
+  std::vector<Result> failed_;    // 失败的文件，与下一组一起回复
+  uint32_t resolved_{ 0 };        // 已经有结果（暂存或失败）的文件数
+  uint32_t replied_{ 0 };         // 结果已经取出的文件数
+  bool list_failed_{ false };     // 出现过错误的清单页
+};
@@ -0,0 +1,206 @@
+#include "BlobStore.h"
+#include "MyDB.h"
+#include "ChunkStore.h"
+#include "protocol.h"
+#include "Log.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <functional>
+#include <map>
+
+std::mutex BlobStore::locks_[BlobStore::kLockCount];
+
+std::string BlobStore::getBlobPath(const std::string &md5) {
+  // 按哈希前两位分目录，避免单个目录下文件过多
+  return std::string(BLOBFILEPATH) + "/" + md5.substr(0, 2) + "/" + md5;
+}
+
+std::string BlobStore::getLegacyPath(const std::string &user, const std::string &md5) {
+  return std::string(ROOTFILEPATH) + "/" + user + "/" + md5;
+}
+
+std::string BlobStore::resolvePath(const std::string &user, const std::string &md5) {
+  std::string blob_path = getBlobPath(md5);
+  if (access(blob_path.c_str(), F_OK) == 0) {
+    return blob_path;
+  }
+  return getLegacyPath(user, md5);
+}
+
+bool BlobStore::commit(MyDB &db, const std::string &file_path, const std::string &md5, uint64_t file_size) {
+  std::lock_guard<std::mutex> lock(lockFor(md5));
+  if (!moveIn(db, file_path, md5)) {
+    return false;
+  }
+  // 先保证文件已经在全局存储中，再增加引用，有引用的内容一定存在
+  if (!db.addBlobRef(md5, file_size)) {
+    LOG_ERROR("BlobStore add ref failed: %s", md5.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool BlobStore::acquire(MyDB &db, const std::string &md5) {
+  std::lock_guard<std::mutex> lock(lockFor(md5));
+  return db.acquireBlobRef(md5);
+}
+
+int BlobStore::release(MyDB &db, const std::string &md5) {
+  std::lock_guard<std::mutex> lock(lockFor(md5));
+  std::int64_t ref_count = db.releaseBlobRef(md5);
+  if (ref_count < 0) {
+    return -1;
+  }
+  if (ref_count > 0) {  // 其它文件仍然引用该内容
+    return 1;
+  }
+
+  // 最后一个引用，删除内容文件（正在下载的连接持有文件描述符，仍然可以继续读取）
+  return removeContent(db, md5) ? 1 : 0;
+}
+
+void BlobStore::releaseBatch(MyDB &db, const std::string &user, const std::vector<std::string> &hashes) {
+  std::map<std::string, uint64_t> counts;
+  for (auto &md5 : hashes) {
+    if (!md5.empty()) {
+      ++counts[md5];
+    }
+  }
+
+  uint64_t removed = 0;
+  for (auto &it : counts) {
+    const std::string &md5 = it.first;
+    // 引用数和内容文件的删除在同一把锁内，不会与同一内容的上传或秒传交错
+    std::lock_guard<std::mutex> lock(lockFor(md5));
+    std::int64_t ref_count = db.releaseBlobRef(md5, it.second);
+    if (ref_count == 0) {
+      removed += removeContent(db, md5) ? 1 : 0;
+    }
+    else if (ref_count < 0 && db.getUserFileCount(user, md5) == 0) {   // 未迁移的旧文件，用户已经没有引用该内容的文件
+      std::string file_path = getLegacyPath(user, md5);
+      if (remove(file_path.c_str()) != 0 && errno != ENOENT) {
+        LOG_ERROR("BlobStore remove %s error: %s", file_path.c_str(), strerror(errno));
+      }
+    }
+  }
+  if (removed > 0) {
+    LOG_INFO("BlobStore batch release: %lu files, %lu contents removed", hashes.size(), removed);
+  }
+}
+
+void BlobStore::migrateLegacy() {
+  DIR *root_dir = opendir(ROOTFILEPATH);
+  if (root_dir == nullptr) {
+    return;
+  }
+
+  MyDB db;
+  uint64_t moved_count = 0;
+  struct dirent *user_entry;
+  while ((user_entry = readdir(root_dir)) != nullptr) {
+    std::string user = user_entry->d_name;
+    if (user == "." || user == "..") {
+      continue;
+    }
+    std::string user_path = std::string(ROOTFILEPATH) + "/" + user;
+    DIR *user_dir = opendir(user_path.c_str());
+    if (user_dir == nullptr) {
+      continue;
+    }
+
+    struct dirent *file_entry;
+    while ((file_entry = readdir(user_dir)) != nullptr) {
+      std::string md5 = file_entry->d_name;
+      // 只处理以哈希命名的数据文件，跳过会话日志（.session）和临时文件（.tmp）
+      if (md5.size() < 2 || !std::all_of(md5.begin(), md5.end(), [](unsigned char c) { return std::isxdigit(c); })) {
+        continue;
+      }
+      std::string file_path = user_path + "/" + md5;
+      struct stat file_stat;
+      if (stat(file_path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        continue;
+      }
+      // 有会话日志的是未完成的上传，留给客户端续传
+      if (access((file_path + ".session").c_str(), F_OK) == 0) {
+        continue;
+      }
+      uint64_t count = db.getUserFileCount(user, md5);
+      if (count == 0) {   // 数据库中没有引用该文件的记录，保留原样
+        continue;
+      }
+
+      // 先写入引用再移动文件，不会出现引用不足导致内容被提前删除；
+      // 引用数直接设置为所有用户引用该内容的文件数（服务器启动时还没有上传），中途崩溃后重新迁移不会重复计数
+      std::lock_guard<std::mutex> lock(lockFor(md5));
+      if (!db.resetBlobRef(md5, file_stat.st_size)) {
+        LOG_ERROR("BlobStore migrate add ref failed: %s", file_path.c_str());
+        continue;
+      }
+      if (moveIn(db, file_path, md5)) {
+        ++moved_count;
+      }
+    }
+    closedir(user_dir);
+  }
+  closedir(root_dir);
+
+  if (moved_count > 0) {
+    LOG_INFO("BlobStore migrated %lu legacy files", moved_count);
+  }
+}
+
+std::mutex& BlobStore::lockFor(const std::string &md5) {
+  return locks_[std::hash<std::string>()(md5) % kLockCount];
+}
+
+bool BlobStore::removeContent(MyDB &db, const std::string &md5) {
+  if (access(ChunkStore::getManifestPath(md5).c_str(), F_OK) == 0) {   // 切块保存的内容，释放清单中的块
+    return ChunkStore::releaseFile(db, md5);
+  }
+  std::string blob_path = getBlobPath(md5);
+  if (remove(blob_path.c_str()) != 0 && errno != ENOENT) {
+    LOG_ERROR("BlobStore remove %s error: %s", blob_path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool BlobStore::moveIn(MyDB &db, const std::string &file_path, const std::string &md5) {
+  std::string blob_path = getBlobPath(md5);
+  // 内容已经存在（整文件或块清单），丢弃新的副本
+  if (access(blob_path.c_str(), F_OK) == 0 || access(ChunkStore::getManifestPath(md5).c_str(), F_OK) == 0) {
+    if (remove(file_path.c_str()) != 0) {
+      LOG_WARN("BlobStore remove duplicate %s error: %s", file_path.c_str(), strerror(errno));
+    }
+    return true;
+  }
+
+  // 块存储模式：切块保存后删除上传的文件
+  if (ChunkStore::getEnable()) {
+    if (!ChunkStore::storeFile(db, file_path, md5)) {
+      return false;
+    }
+    if (remove(file_path.c_str()) != 0) {
+      LOG_WARN("BlobStore remove chunked %s error: %s", file_path.c_str(), strerror(errno));
+    }
+    return true;
+  }
+
+  // 创建存储目录，已经存在时忽略
+  std::string dir = std::string(BLOBFILEPATH);
+  mkdir(dir.c_str(), 0755);
+  dir += "/" + md5.substr(0, 2);
+  mkdir(dir.c_str(), 0755);
+
+  // 上传文件与全局存储在同一个文件系统中，rename 是原子的，不需要复制数据
+  if (rename(file_path.c_str(), blob_path.c_str()) != 0) {
+    LOG_ERROR("BlobStore rename %s to %s error: %s", file_path.c_str(), blob_path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <cstdint>
+#include <vector>
+
+class MyDB;
+
+// 全局内容寻址存储
+// 文件内容按哈希保存在 blobs/<哈希前两位>/<哈希>，所有用户共享，数据库 Blobs 表记录每个内容被多少个文件引用：
+// 任何用户上传过的内容，其它用户都可以秒传；删除文件只减少引用，最后一个引用被释放时才删除内容文件。
+// 上传过程中的数据仍然写入用户目录（rootfiles/<user>/<md5>，与会话日志在一起），校验通过后再移入全局存储。
+// 同一个哈希的文件操作和引用计数修改在同一把锁内完成，避免删除最后一个引用的同时有新的上传或秒传引用该内容
+// 开启块存储（ChunkStore）时，新内容不再整文件保存，而是切块保存并只保存块清单，已经整文件保存的内容保持不变
+class BlobStore {
+ public:
+  static std::string getBlobPath(const std::string &md5);    // 全局存储中的路径
+  static std::string getLegacyPath(const std::string &user, const std::string &md5);   // 旧版本按用户保存的路径
+  // 下载时使用的路径：优先使用全局存储，不存在则使用旧路径（迁移失败的文件）
+  static std::string resolvePath(const std::string &user, const std::string &md5);
+
+  // 将校验通过的上传文件移入全局存储，并增加一个引用；内容已经存在时丢弃上传的副本
+  static bool commit(MyDB &db, const std::string &file_path, const std::string &md5, uint64_t file_size);
+  // 秒传：内容存在时增加一个引用，内容已经被删除返回false
+  static bool acquire(MyDB &db, const std::string &md5);
+  // 释放一个引用，最后一个引用被释放时删除内容文件
+  // 返回1成功，0删除文件失败，-1没有引用记录（未迁移的旧文件，由调用者按旧方式处理）
+  static int release(MyDB &db, const std::string &md5);
+  // 批量删除文件后调用：hashes 为被删除文件的内容哈希（可重复），相同内容的引用一次释放，引用全部释放的内容最后统一删除；
+  // 没有引用记录的旧文件在用户不再引用时删除用户目录下的文件
+  static void releaseBatch(MyDB &db, const std::string &user, const std::vector<std::string> &hashes);
+
+  // 服务器启动时调用：将旧版本保存在 rootfiles/<user>/<md5> 的文件迁移到全局存储，并按数据库中的文件数写入引用
+  static void migrateLegacy();
+
+ private:
+  static std::mutex& lockFor(const std::string &md5);   // 按哈希分段加锁
+  static bool moveIn(MyDB &db, const std::string &file_path, const std::string &md5);  // 调用前需持有 lockFor(md5)
+  static bool removeContent(MyDB &db, const std::string &md5);   // 删除内容文件或块清单，调用前需持有 lockFor(md5)
+
+ private:
+  static const size_t kLockCount = 64;
+  static std::mutex locks_[kLockCount];
+};
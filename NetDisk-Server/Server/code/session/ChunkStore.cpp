@@ -0,0 +1,388 @@
+#include "ChunkStore.h"
+#include "Chunker.h"
+#include "FileReader.h"
+#include "MyDB.h"
+#include "protocol.h"
+#include "Log.h"
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <unordered_set>
+#include <map>
+#include <functional>
+
+const uint32_t ChunkStore::kManifestMagic = 0x4E44434D;   // "NDCM"
+const uint32_t ChunkStore::kManifestVersion = 1;
+
+std::atomic<bool> ChunkStore::enable_{ false };
+std::mutex ChunkStore::locks_[ChunkStore::kLockCount];
+
+namespace {
+
+// 清单中块哈希以32字节二进制保存
+bool hexToBin(const std::string &hex, unsigned char *out, size_t out_len) {
+  if (hex.size() != out_len * 2) {
+    return false;
+  }
+  for (size_t i = 0; i < out_len; ++i) {
+    unsigned int value = 0;
+    if (sscanf(hex.c_str() + 2 * i, "%2x", &value) != 1) {
+      return false;
+    }
+    out[i] = value;
+  }
+  return true;
+}
+
+std::string sha256Hex(const char *data, size_t len) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  if (EVP_Digest(data, len, digest, &digest_len, EVP_sha256(), nullptr) != 1) {
+    return "";
+  }
+  return ChunkStore::toHex(digest, digest_len);
+}
+
+}
+
+void ChunkStore::setEnable(bool enable) {
+  enable_.store(enable);
+}
+
+bool ChunkStore::getEnable() {
+  return enable_.load();
+}
+
+std::string ChunkStore::getChunkPath(const std::string &hash) {
+  return std::string(CHUNKFILEPATH) + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+std::string ChunkStore::getManifestPath(const std::string &md5) {
+  return std::string(BLOBFILEPATH) + "/" + md5.substr(0, 2) + "/" + md5 + ".manifest";
+}
+
+bool ChunkStore::storeFile(MyDB &db, const std::string &file_path, const std::string &md5) {
+  struct stat file_stat;
+  if (stat(file_path.c_str(), &file_stat) != 0) {
+    LOG_ERROR("ChunkStore stat %s error: %s", file_path.c_str(), strerror(errno));
+    return false;
+  }
+  uint64_t file_size = file_stat.st_size;
+  FileReader reader;
+  if (!reader.open(file_path, file_size, 0)) {
+    return false;
+  }
+
+  // 1、切块并计算每个块的哈希
+  std::vector<ChunkEntry> entries;
+  uint64_t pos = 0;
+  while (pos < file_size) {
+    uint64_t remain = file_size - pos;
+    const char *data = reader.data(pos, std::min<uint64_t>(remain, Chunker::kMaxSize));
+    if (data == nullptr) {
+      return false;
+    }
+    ChunkEntry entry;
+    entry.offset = pos;
+    entry.size = Chunker::nextChunk((const unsigned char*)data, remain);
+    entry.hash = sha256Hex(data, entry.size);
+    if (entry.hash.empty()) {
+      return false;
+    }
+    pos += entry.size;
+    entries.push_back(std::move(entry));
+  }
+
+  // 同一个清单中重复的块只计一次引用，按块哈希所在的锁分组，每组在一把锁内完成
+  std::map<size_t, std::vector<const ChunkEntry*>> groups;
+  std::unordered_set<std::string> seen;
+  for (auto &entry : entries) {
+    if (seen.insert(entry.hash).second) {
+      groups[lockIndex(entry.hash)].push_back(&entry);
+    }
+  }
+
+  // 2、先保存块（临时文件写完后原子地改名），再增加引用：有引用的块一定完整存在。
+  // 检查已有块和增加引用在同一把锁内，期间不会被其它线程释放删除
+  uint64_t new_bytes = 0;
+  std::vector<std::string> added;   // 已经增加引用的块，失败时释放
+  bool ok = true;
+  for (auto &group : groups) {
+    std::lock_guard<std::mutex> lock(locks_[group.first]);
+    std::vector<std::pair<std::string, uint32_t>> refs;
+    refs.reserve(group.second.size());
+    for (auto entry : group.second) {
+      // 已有的块只在长度一致时复用，长度不一致（例如被截断的文件）时重新写入
+      if (!chunkIntact(entry->hash, entry->size)) {
+        const char *data = reader.data(entry->offset, entry->size);
+        if (data == nullptr || !writeChunk(entry->hash, data, entry->size)) {
+          ok = false;
+          break;
+        }
+        new_bytes += entry->size;
+      }
+      refs.emplace_back(entry->hash, entry->size);
+    }
+    if (!ok || !db.addChunkRefs(refs)) {
+      ok = false;
+      break;
+    }
+    for (auto &ref : refs) {
+      added.push_back(std::move(ref.first));
+    }
+  }
+  reader.close();
+  if (!ok) {
+    LOG_ERROR("ChunkStore store chunks failed: %s", md5.c_str());
+    releaseChunks(db, added);
+    return false;
+  }
+
+  // 3、最后写入清单，清单存在说明所有块都已经保存
+  if (!writeManifest(md5, file_size, entries)) {
+    releaseChunks(db, added);
+    return false;
+  }
+  LOG_INFO("ChunkStore stored %s: %lu chunks, %lu/%lu bytes new", md5.c_str(), entries.size(), new_bytes, file_size);
+  return true;
+}
+
+bool ChunkStore::releaseFile(MyDB &db, const std::string &md5) {
+  uint64_t file_size = 0;
+  std::vector<ChunkEntry> entries;
+  if (!loadManifest(md5, file_size, entries)) {
+    return false;
+  }
+
+  std::vector<std::string> hashes;
+  std::unordered_set<std::string> seen;
+  for (auto &entry : entries) {
+    if (seen.insert(entry.hash).second) {
+      hashes.push_back(entry.hash);
+    }
+  }
+  if (!releaseChunks(db, hashes)) {
+    LOG_ERROR("ChunkStore release chunk refs failed: %s", md5.c_str());
+    return false;
+  }
+
+  std::string manifest_path = getManifestPath(md5);
+  if (remove(manifest_path.c_str()) != 0) {
+    LOG_ERROR("ChunkStore remove %s error: %s", manifest_path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void ChunkStore::collectChunks(const std::vector<std::string> &md5s, std::unordered_set<std::string> &hashes) {
+  uint64_t file_size = 0;
+  std::vector<ChunkEntry> entries;
+  for (const std::string &md5 : md5s) {
+    if (!loadManifest(md5, file_size, entries)) {
+      continue;
+    }
+    for (auto &entry : entries) {
+      hashes.insert(std::move(entry.hash));
+    }
+  }
+}
+
+// 清单格式：魔数(uint32) + 版本(uint32) + 文件大小(uint64) + 块数(uint32) + 块[偏移(uint64), 长度(uint32), 哈希(32字节)]...
+// 多字节整数统一使用网络字节序
+bool ChunkStore::loadManifest(const std::string &md5, uint64_t &file_size, std::vector<ChunkEntry> &entries) {
+  entries.clear();
+  int fd = open(getManifestPath(md5).c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  std::string content;
+  char buf[64 * 1024];
+  ssize_t n = 0;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    content.append(buf, n);
+  }
+  close(fd);
+
+  const size_t head_len = 2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+  const size_t entry_len = sizeof(uint64_t) + sizeof(uint32_t) + 32;
+  if (n < 0 || content.size() < head_len) {
+    return false;
+  }
+  uint32_t magic = 0, version = 0, count = 0;
+  const char *ptr = content.data();
+  memcpy(&magic, ptr, sizeof(magic));
+  memcpy(&version, ptr + 4, sizeof(version));
+  memcpy(&file_size, ptr + 8, sizeof(file_size));
+  memcpy(&count, ptr + 16, sizeof(count));
+  file_size = ntohll(file_size);
+  count = ntohl(count);
+  if (ntohl(magic) != kManifestMagic || ntohl(version) != kManifestVersion || content.size() != head_len + (uint64_t)count * entry_len) {
+    LOG_ERROR("ChunkStore manifest of %s is corrupted", md5.c_str());
+    return false;
+  }
+
+  ptr += head_len;
+  entries.resize(count);
+  uint64_t expect_offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    memcpy(&offset, ptr, sizeof(offset));
+    memcpy(&size, ptr + 8, sizeof(size));
+    entries[i].offset = ntohll(offset);
+    entries[i].size = ntohl(size);
+    entries[i].hash = ChunkStore::toHex((const unsigned char*)ptr + 12, 32);
+    if (entries[i].offset != expect_offset) {
+      LOG_ERROR("ChunkStore manifest of %s is corrupted", md5.c_str());
+      return false;
+    }
+    expect_offset += entries[i].size;
+    ptr += entry_len;
+  }
+  return expect_offset == file_size;
+}
+
+bool ChunkStore::readChunk(const std::string &hash, uint32_t size, std::string &buf) {
+  int fd = open(getChunkPath(hash).c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat chunk_stat;
+  if (fstat(fd, &chunk_stat) != 0 || (uint64_t)chunk_stat.st_size != size) {
+    close(fd);
+    return false;
+  }
+  buf.resize(size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, &buf[done], size - done, done);
+    if (n <= 0) {
+      close(fd);
+      return false;
+    }
+    done += n;
+  }
+  close(fd);
+  return true;
+}
+
+bool ChunkStore::releaseChunks(MyDB &db, const std::vector<std::string> &hashes) {
+  std::map<size_t, std::vector<std::string>> groups;
+  for (auto &hash : hashes) {
+    groups[lockIndex(hash)].push_back(hash);
+  }
+  bool ok = true;
+  for (auto &group : groups) {
+    std::lock_guard<std::mutex> lock(locks_[group.first]);
+    std::vector<std::string> freed;
+    if (!db.releaseChunkRefs(group.second, freed)) {
+      ok = false;
+      continue;
+    }
+    // 不再被任何清单引用的块
+    for (auto &hash : freed) {
+      std::string chunk_path = getChunkPath(hash);
+      if (remove(chunk_path.c_str()) != 0 && errno != ENOENT) {
+        LOG_WARN("ChunkStore remove %s error: %s", chunk_path.c_str(), strerror(errno));
+      }
+    }
+  }
+  return ok;
+}
+
+bool ChunkStore::chunkIntact(const std::string &hash, uint32_t size) {
+  struct stat chunk_stat;
+  return stat(getChunkPath(hash).c_str(), &chunk_stat) == 0 && S_ISREG(chunk_stat.st_mode) && (uint64_t)chunk_stat.st_size == size;
+}
+
+size_t ChunkStore::lockIndex(const std::string &hash) {
+  return std::hash<std::string>()(hash) % kLockCount;
+}
+
+std::string ChunkStore::toHex(const unsigned char *data, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  std::string out;
+  out.reserve(len * 2);
+  for (size_t i = 0; i < len; ++i) {
+    out.push_back(hex[data[i] >> 4]);
+    out.push_back(hex[data[i] & 0x0f]);
+  }
+  return out;
+}
+
+bool ChunkStore::writeChunk(const std::string &hash, const char *data, uint32_t size) {
+  // 创建存储目录，已经存在时忽略
+  std::string dir = std::string(CHUNKFILEPATH);
+  mkdir(dir.c_str(), 0755);
+  dir += "/" + hash.substr(0, 2);
+  mkdir(dir.c_str(), 0755);
+  return writeFile(getChunkPath(hash), data, size);
+}
+
+bool ChunkStore::writeManifest(const std::string &md5, uint64_t file_size, const std::vector<ChunkEntry> &entries) {
+  std::string content;
+  uint32_t u32 = htonl(kManifestMagic);
+  content.append((char*)&u32, sizeof(u32));
+  u32 = htonl(kManifestVersion);
+  content.append((char*)&u32, sizeof(u32));
+  uint64_t u64 = htonll(file_size);
+  content.append((char*)&u64, sizeof(u64));
+  u32 = htonl(entries.size());
+  content.append((char*)&u32, sizeof(u32));
+  for (auto &entry : entries) {
+    u64 = htonll(entry.offset);
+    content.append((char*)&u64, sizeof(u64));
+    u32 = htonl(entry.size);
+    content.append((char*)&u32, sizeof(u32));
+    unsigned char hash[32];
+    if (!hexToBin(entry.hash, hash, sizeof(hash))) {
+      return false;
+    }
+    content.append((char*)hash, sizeof(hash));
+  }
+
+  std::string dir = std::string(BLOBFILEPATH);
+  mkdir(dir.c_str(), 0755);
+  dir += "/" + md5.substr(0, 2);
+  mkdir(dir.c_str(), 0755);
+  return writeFile(getManifestPath(md5), content.data(), content.size());
+}
+
+bool ChunkStore::writeFile(const std::string &path, const char *data, size_t size) {
+  // 多个上传可能同时写入同一个新块，每个写入者使用自己的临时文件
+  std::random_device rd;
+  std::string tmp_path = path + "." + std::to_string(rd()) + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    LOG_ERROR("ChunkStore open %s error: %s", tmp_path.c_str(), strerror(errno));
+    return false;
+  }
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(fd, data + done, size - done);
+    if (n <= 0) {
+      LOG_ERROR("ChunkStore write %s error: %s", tmp_path.c_str(), strerror(errno));
+      close(fd);
+      remove(tmp_path.c_str());
+      return false;
+    }
+    done += n;
+  }
+  if (fdatasync(fd) != 0) {
+    LOG_ERROR("ChunkStore sync %s error: %s", tmp_path.c_str(), strerror(errno));
+    close(fd);
+    remove(tmp_path.c_str());
+    return false;
+  }
+  close(fd);
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    LOG_ERROR("ChunkStore rename %s error: %s", tmp_path.c_str(), strerror(errno));
+    remove(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+class MyDB;
+
+// 文件清单中的一个块
+struct ChunkEntry {
+  uint64_t offset{ 0 };   // 在文件中的偏移
+  uint32_t size{ 0 };     // 块长度
+  std::string hash;       // 块内容的 SHA-256（小写十六进制）
+};
+
+// 块存储（可选的存储模式，配置 storageMode = chunk 开启）
+// 文件按内容分块（Chunker）后，每个块按哈希只保存一份（chunks/<哈希前两位>/<哈希>），文件本身只保存块清单
+// （blobs/<哈希前两位>/<文件哈希>.manifest）。虚拟机镜像、日志、反复修改的文档等只有少量不同的大文件，不同版本之间大部分块相同，
+// 只需要保存（和上传）不同的块。数据库 Chunks 表记录引用每个块的清单数（同一个清单中重复的块只计一次）。
+// 上传时客户端先发送块清单，服务端把该用户的文件已经引用的块直接复制到上传文件中，客户端只发送缺失的块，之后的校验流程与整文件上传相同
+class ChunkStore {
+ public:
+  static void setEnable(bool enable);   // 读取配置文件后调用
+  static bool getEnable();
+
+  static std::string getChunkPath(const std::string &hash);
+  static std::string getManifestPath(const std::string &md5);
+
+  // 将校验通过的文件切块保存，并写入文件清单（调用者持有该文件哈希的锁，且清单不存在）
+  static bool storeFile(MyDB &db, const std::string &file_path, const std::string &md5);
+  // 删除文件清单，并释放其中所有块的引用，不再被引用的块被删除
+  static bool releaseFile(MyDB &db, const std::string &md5);
+  // 读取文件清单
+  static bool loadManifest(const std::string &md5, uint64_t &file_size, std::vector<ChunkEntry> &entries);
+  // 收集一组文件（内容哈希）的清单中的全部块哈希，不是分块保存的文件没有清单，跳过
+  static void collectChunks(const std::vector<std::string> &md5s, std::unordered_set<std::string> &hashes);
+  // 读取一个块的数据，块不存在或长度不一致返回false
+  static bool readChunk(const std::string &hash, uint32_t size, std::string &buf);
+  static std::string toHex(const unsigned char *data, size_t len);  // 二进制哈希转换为小写十六进制
+
+ private:
+  static bool writeChunk(const std::string &hash, const char *data, uint32_t size);
+  static bool writeFile(const std::string &path, const char *data, size_t size);  // 先写临时文件再原子地替换
+  static bool writeManifest(const std::string &md5, uint64_t file_size, const std::vector<ChunkEntry> &entries);
+  // 释放一组块（不重复）的引用，不再被引用的块被删除
+  static bool releaseChunks(MyDB &db, const std::vector<std::string> &hashes);
+  // 块文件存在且长度一致（块文件先写临时文件再改名，长度一致说明写入完整），调用前需持有该块的锁
+  static bool chunkIntact(const std::string &hash, uint32_t size);
+  static size_t lockIndex(const std::string &hash);   // 块哈希对应的锁
+
+ private:
+  static const uint32_t kManifestMagic;
+  static const uint32_t kManifestVersion;
+
+  static std::atomic<bool> enable_;
+  // 按块哈希分段加锁：同一个块的检查、写入、引用计数修改和删除在同一把锁内完成
+  static const size_t kLockCount = 64;
+  static std::mutex locks_[kLockCount];
+};
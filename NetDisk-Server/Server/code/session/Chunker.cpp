@@ -0,0 +1,72 @@
+#include "Chunker.h"
+#include <algorithm>
+
+// 掩码不使用最高位，这样左移一位后的掩码检查与逐字节计算的结果完全一致
+const uint64_t Chunker::kMaskS = ((1ULL << 18) - 1) << 45;
+const uint64_t Chunker::kMaskL = ((1ULL << 14) - 1) << 49;
+uint64_t Chunker::gear_[256];
+uint64_t Chunker::gear_ls_[256];
+
+uint32_t Chunker::nextChunk(const unsigned char *data, uint64_t len) {
+  static bool inited = (initGear(), true);   // 局部静态变量的初始化是线程安全的
+  (void)inited;
+
+  if (len <= kMinSize) {
+    return len;
+  }
+  uint64_t n = std::min<uint64_t>(len, kMaxSize);
+  uint64_t normal = std::min<uint64_t>(n, kAvgSize);
+  const uint64_t mask_s_ls = kMaskS << 1;
+  const uint64_t mask_l_ls = kMaskL << 1;
+
+  uint64_t fp = 0;
+  uint64_t i = kMinSize;
+  // 期望长度之前，使用更严格的掩码
+  for (; i + 2 <= normal; i += 2) {
+    fp = (fp << 2) + gear_ls_[data[i]];
+    if ((fp & mask_s_ls) == 0) {
+      return i + 1;
+    }
+    fp += gear_[data[i + 1]];
+    if ((fp & kMaskS) == 0) {
+      return i + 2;
+    }
+  }
+  for (; i < normal; ++i) {
+    fp = (fp << 1) + gear_[data[i]];
+    if ((fp & kMaskS) == 0) {
+      return i + 1;
+    }
+  }
+  // 期望长度之后，使用更宽松的掩码
+  for (; i + 2 <= n; i += 2) {
+    fp = (fp << 2) + gear_ls_[data[i]];
+    if ((fp & mask_l_ls) == 0) {
+      return i + 1;
+    }
+    fp += gear_[data[i + 1]];
+    if ((fp & kMaskL) == 0) {
+      return i + 2;
+    }
+  }
+  for (; i < n; ++i) {
+    fp = (fp << 1) + gear_[data[i]];
+    if ((fp & kMaskL) == 0) {
+      return i + 1;
+    }
+  }
+  return n;
+}
+
+void Chunker::initGear() {
+  // 使用固定种子的 splitmix64 生成 Gear 表，客户端使用同样的方法生成
+  uint64_t state = 0x4E65744469736BULL;
+  for (int i = 0; i < 256; ++i) {
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    gear_[i] = z ^ (z >> 31);
+    gear_ls_[i] = gear_[i] << 1;
+  }
+}
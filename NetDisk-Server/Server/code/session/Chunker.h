@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// 基于内容的分块（FastCDC），客户端使用完全相同的参数和 Gear 表，同样的数据在两端切出同样的块
+// 分块边界由数据内容决定，文件中间插入或删除少量数据只影响附近的块，其它块的哈希不变，可以在服务端去重
+// 实现要点：
+// 1. 跳过最小块长度之前的数据，不计算哈希（cut-point skipping）
+// 2. 归一化分块：期望长度之前使用更严格的掩码，之后使用更宽松的掩码，块长度集中在期望长度附近
+// 3. 每次循环处理两个字节（FastCDC 2020），第一个字节使用预先左移一位的 Gear 表和掩码，减少移位和判断次数
+class Chunker {
+ public:
+  static const uint32_t kMinSize = 16 * 1024;     // 最小块长度
+  static const uint32_t kAvgSize = 64 * 1024;     // 期望块长度
+  static const uint32_t kMaxSize = 256 * 1024;    // 最大块长度
+
+  // 返回从 data 开始的下一个块的长度，len 为剩余数据长度（不足 kMaxSize 时只有文件末尾才允许）
+  static uint32_t nextChunk(const unsigned char *data, uint64_t len);
+
+ private:
+  static void initGear();
+
+ private:
+  static const uint64_t kMaskS;     // 期望长度之前的掩码（18位）
+  static const uint64_t kMaskL;     // 期望长度之后的掩码（14位）
+  static uint64_t gear_[256];
+  static uint64_t gear_ls_[256];    // gear_ 左移一位
+};
@@ -0,0 +1,122 @@
+#include "Compressor.h"
+#include "protocol.h"
+#include <cmath>
+
+const size_t Compressor::kSampleSize = 512;
+const double Compressor::kMaxEntropy = 7.2;
+const uint32_t Compressor::kMaxSkip = 64;
+
+std::atomic<bool> Compressor::enable_{ true };
+std::atomic<int> Compressor::level_{ 1 };
+
+void Compressor::setConfig(bool enable, int level) {
+  enable_.store(enable);
+  level_.store(std::min(std::max(level, 1), 9));
+}
+
+uint32_t Compressor::negotiate(uint32_t offer) {
+  if (!enable_.load() || (offer & (1u << COMPRESS_DEFLATE)) == 0) {
+    return COMPRESS_NONE;
+  }
+  int level = (offer >> 8) & 0xff;
+  level = (level == 0 ? level_.load() : std::min(std::max(level, 1), 9));
+  return ((uint32_t)level << 8) | COMPRESS_DEFLATE;
+}
+
+bool Compressor::decompress(uint32_t codec, const char *data, size_t len, size_t max_len, std::string &out) {
+  if (codec != COMPRESS_DEFLATE || len <= sizeof(uint32_t)) {
+    return false;
+  }
+  uint32_t raw_len = 0;
+  memcpy(&raw_len, data, sizeof(raw_len));
+  raw_len = ntohl(raw_len);
+  if (raw_len == 0 || raw_len > max_len) {
+    return false;
+  }
+
+  // 每个工作线程复用一个解压流，避免每个分片都重新分配
+  struct Inflater {
+    z_stream stream{};
+    bool ok{ false };
+    Inflater() { ok = (inflateInit(&stream) == Z_OK); }
+    ~Inflater() { if (ok) { inflateEnd(&stream); } }
+  };
+  thread_local Inflater inflater;
+  if (!inflater.ok || inflateReset(&inflater.stream) != Z_OK) {
+    return false;
+  }
+  out.resize(raw_len);
+  inflater.stream.next_in = (Bytef*)(data + sizeof(raw_len));
+  inflater.stream.avail_in = len - sizeof(raw_len);
+  inflater.stream.next_out = (Bytef*)&out[0];
+  inflater.stream.avail_out = raw_len;
+  return inflate(&inflater.stream, Z_FINISH) == Z_STREAM_END && inflater.stream.avail_out == 0;
+}
+
+Compressor::Compressor(uint32_t negotiated) : codec_(negotiated & 0xff), level_used_((negotiated >> 8) & 0xff) {
+  if (codec_ == COMPRESS_DEFLATE) {
+    stream_ok_ = (deflateInit(&stream_, level_used_) == Z_OK);
+  }
+}
+
+Compressor::~Compressor() {
+  if (stream_ok_) {
+    deflateEnd(&stream_);
+  }
+}
+
+uint32_t Compressor::compress(const char *data, size_t len, std::string &out) {
+  raw_bytes_ += len;
+  bool tried = false;
+  if (stream_ok_ && len > kSampleSize / 4) {
+    if (skip_left_ > 0) {
+      --skip_left_;
+    }
+    else if (entropy(data, std::min(len, kSampleSize)) <= kMaxEntropy && deflateReset(&stream_) == Z_OK) {
+      tried = true;
+      // 格式与 qCompress 相同：原始长度(uint32，网络字节序) + zlib 数据
+      out.resize(sizeof(uint32_t) + deflateBound(&stream_, len));
+      uint32_t raw_len = htonl(len);
+      memcpy(&out[0], &raw_len, sizeof(raw_len));
+      stream_.next_in = (Bytef*)data;
+      stream_.avail_in = len;
+      stream_.next_out = (Bytef*)&out[sizeof(raw_len)];
+      stream_.avail_out = out.size() - sizeof(raw_len);
+      if (deflate(&stream_, Z_FINISH) == Z_STREAM_END) {
+        out.resize(out.size() - stream_.avail_out);
+        if (out.size() <= len - len / 8) {   // 至少节省 1/8 才发送压缩数据
+          fail_count_ = 0;
+          wire_bytes_ += out.size();
+          ++compressed_chunks_;
+          return codec_;
+        }
+      }
+    }
+  }
+  // 压缩不划算，连续失败时跳过的分片数成倍增加
+  if (tried) {
+    fail_count_ = std::min<uint32_t>(fail_count_ + 1, 31);
+    skip_left_ = std::min<uint32_t>(kMaxSkip, (1u << fail_count_) - 1);
+  }
+  wire_bytes_ += len;
+  ++stored_chunks_;
+  return COMPRESS_NONE;
+}
+
+double Compressor::entropy(const char *data, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  uint32_t count[256] = { 0 };
+  for (size_t i = 0; i < len; ++i) {
+    ++count[(unsigned char)data[i]];
+  }
+  double result = 0;
+  for (uint32_t c : count) {
+    if (c > 0) {
+      double p = (double)c / len;
+      result -= p * std::log2(p);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <zlib.h>
+
+// 传输数据的分片压缩
+// 上传/下载请求（TranPdu 的 compress 字段）携带客户端支持的压缩方式和希望的级别，服务端结合配置选择一种，在请求的回复中告诉客户端。
+// 发送方对每个分片单独决定是否压缩：先抽样估计字节熵，熵很高的数据（已经压缩过的图片、视频、压缩包）直接原样发送；
+// 压缩后节省不到 1/8 也原样发送，并且连续失败时成倍地跳过后面的分片，不再尝试，避免在不可压缩的数据上浪费 CPU
+class Compressor {
+ public:
+  // 读取配置文件后调用：enable 为是否允许压缩，level 为默认压缩级别（客户端没有指定时使用）
+  static void setConfig(bool enable, int level);
+  // 根据客户端的请求选择压缩方式，返回 (级别 << 8) | 压缩方式，不压缩返回0
+  static uint32_t negotiate(uint32_t offer);
+  // 解压一个分片，原始长度超过 max_len 或者数据格式错误返回false
+  static bool decompress(uint32_t codec, const char *data, size_t len, size_t max_len, std::string &out);
+
+  explicit Compressor(uint32_t negotiated);   // negotiated 为 negotiate 的返回值
+  Compressor(const Compressor &other) = delete;
+  Compressor& operator=(const Compressor &other) = delete;
+  ~Compressor();
+
+  // 尝试压缩一个分片，返回本分片的压缩方式：COMPRESS_NONE 时按原样发送 data，否则发送 out
+  uint32_t compress(const char *data, size_t len, std::string &out);
+  // 本次传输的统计：原始字节数、实际发送的字节数、压缩的分片数、原样发送的分片数
+  uint64_t getRawBytes() const { return raw_bytes_; }
+  uint64_t getWireBytes() const { return wire_bytes_; }
+  uint64_t getCompressedChunks() const { return compressed_chunks_; }
+  uint64_t getStoredChunks() const { return stored_chunks_; }
+
+ private:
+  static double entropy(const char *data, size_t len);   // 估计字节熵（位/字节）
+
+ private:
+  static const size_t kSampleSize;        // 估计熵的抽样长度
+  static const double kMaxEntropy;        // 超过该熵的分片不尝试压缩
+  static const uint32_t kMaxSkip;         // 连续压缩失败后最多跳过的分片数
+
+  static std::atomic<bool> enable_;
+  static std::atomic<int> level_;
+
+  uint32_t codec_{ 0 };
+  int level_used_{ 0 };
+  z_stream stream_{};
+  bool stream_ok_{ false };
+
+  uint32_t fail_count_{ 0 };    // 连续压缩失败次数
+  uint32_t skip_left_{ 0 };     // 还需要跳过的分片数
+
+  uint64_t raw_bytes_{ 0 };
+  uint64_t wire_bytes_{ 0 };
+  uint64_t compressed_chunks_{ 0 };
+  uint64_t stored_chunks_{ 0 };
+};
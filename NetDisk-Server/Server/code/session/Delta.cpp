@@ -0,0 +1,64 @@
+#include "Delta.h"
+#include "FileReader.h"
+#include "BlobStore.h"
+#include "ChunkStore.h"
+#include "protocol.h"
+#include <openssl/evp.h>
+#include <cmath>
+
+uint32_t Delta::getBlockSize(uint64_t file_size) {
+  uint64_t block_size = (uint64_t)std::sqrt((double)file_size);
+  block_size = std::min<uint64_t>(std::max<uint64_t>(block_size, kMinBlockSize), kMaxBlockSize);
+  // 块数过多时增大块长度
+  block_size = std::max<uint64_t>(block_size, (file_size + kMaxBlocks - 1) / kMaxBlocks);
+  return (block_size + 1023) / 1024 * 1024;
+}
+
+uint32_t Delta::weakSum(const unsigned char *data, size_t len) {
+  uint32_t a = 0, b = 0;
+  for (size_t i = 0; i < len; ++i) {
+    a += data[i];
+    b += (len - i) * data[i];
+  }
+  return (a & 0xffff) | (b << 16);
+}
+
+bool Delta::openBase(const std::string &user, const std::string &md5, FileReader &reader, uint64_t &file_size) {
+  std::vector<ChunkEntry> entries;
+  if (ChunkStore::loadManifest(md5, file_size, entries)) {
+    return reader.openChunks(std::move(entries), file_size);
+  }
+  std::string path = BlobStore::resolvePath(user, md5);
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  file_size = file_stat.st_size;
+  return reader.open(path, file_size, 0);
+}
+
+bool Delta::makeSignature(FileReader &reader, uint64_t file_size, uint32_t block_size, std::string &out) {
+  uint64_t count = file_size / block_size;
+  // 每次读取整数个块，减少读取的次数
+  const uint64_t step = std::max<uint64_t>(1, 4 * 1024 * 1024 / block_size) * block_size;
+  out.reserve(out.size() + count * DELTA_SIG_ENTRY_LEN);
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  for (uint64_t pos = 0; pos < count * block_size; pos += step) {
+    uint64_t len = std::min<uint64_t>(step, count * block_size - pos);
+    const unsigned char *data = (const unsigned char*)reader.data(pos, len);
+    if (data == nullptr) {
+      return false;
+    }
+    for (uint64_t off = 0; off < len; off += block_size) {
+      uint32_t weak = htonl(weakSum(data + off, block_size));
+      if (EVP_Digest(data + off, block_size, digest, &digest_len, EVP_sha256(), nullptr) != 1) {
+        return false;
+      }
+      out.append((char*)&weak, sizeof(weak));
+      out.append((char*)digest, DELTA_STRONG_LEN);
+    }
+  }
+  return true;
+}
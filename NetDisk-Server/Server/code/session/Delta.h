@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+class FileReader;
+
+// rsync 风格的差量上传
+// 服务端把旧版本（同目录下最新的同名文件）按固定长度分块，每块计算弱校验和与强哈希（签名）发给客户端；
+// 客户端在新文件上逐字节滚动弱校验和，弱校验和命中后再比较强哈希，相同的块只发送复制指令（新文件偏移、旧版本偏移、长度），
+// 服务端从旧版本复制数据到上传文件中，其余数据按普通上传发送。复制的数据与客户端发送的数据一样计算哈希，
+// 最终仍然校验整个文件的哈希，签名碰撞或者旧版本在上传过程中被修改都不会导致错误的数据入库
+class Delta {
+ public:
+  static const uint32_t kMinBlockSize = 2 * 1024;       // 最小块长度
+  static const uint32_t kMaxBlockSize = 128 * 1024;     // 最大块长度（块数超过 kMaxBlocks 时除外）
+  static const uint32_t kMaxBlocks = 256 * 1024;        // 签名中最多的块数，限制回复的长度
+
+  // 块长度约为文件长度的平方根（按1KB对齐），文件越大块越大，签名长度和匹配精度之间取折中
+  static uint32_t getBlockSize(uint64_t file_size);
+  // 弱校验和（rsync 的 Adler-32 变体）：低16位为字节和，高16位为加权和，可以 O(1) 滚动
+  static uint32_t weakSum(const unsigned char *data, size_t len);
+  // 打开旧版本，块存储模式保存的内容按清单读取，file_size 返回实际长度
+  static bool openBase(const std::string &user, const std::string &md5, FileReader &reader, uint64_t &file_size);
+  // 计算所有完整块的签名 [弱校验和(uint32), SHA-256前 DELTA_STRONG_LEN 字节]，追加到 out，不足一块的尾部不计算
+  static bool makeSignature(FileReader &reader, uint64_t file_size, uint32_t block_size, std::string &out);
+};
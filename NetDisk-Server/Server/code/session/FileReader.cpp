@@ -0,0 +1,193 @@
+#include "FileReader.h"
+#include "Log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+const size_t FileReader::kWindowSize = 64 * 1024 * 1024;
+const size_t FileReader::kReadAhead = 4 * 1024 * 1024;
+const size_t FileReader::kDropBehind = 4 * 1024 * 1024;
+
+static uint64_t pageAlignDown(uint64_t offset) {
+  static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  return offset / page_size * page_size;
+}
+
+FileReader::~FileReader() {
+  close();
+}
+
+bool FileReader::open(const std::string &path, uint64_t file_size, uint64_t start_offset) {
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  if (fd_ == -1) {
+    LOG_ERROR("FileReader open %s error: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  file_size_ = file_size;
+  if (file_size_ == 0) {
+    return true;
+  }
+  // 整个文件按顺序读取，让内核加大预读窗口
+  posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  ahead_pos_ = behind_pos_ = pageAlignDown(std::min(start_offset, file_size_));
+  if (!remap(ahead_pos_)) {
+    close();
+    return false;
+  }
+  // 只对大于一个窗口的冷文件丢弃已发送的页，热文件（其他用户也在下载）和小文件保留在页缓存中
+  drop_behind_ = (file_size_ > kWindowSize && isCold(ahead_pos_));
+  advise(ahead_pos_);
+  return true;
+}
+
+bool FileReader::openChunks(std::vector<ChunkEntry> entries, uint64_t file_size) {
+  entries_ = std::move(entries);
+  file_size_ = file_size;
+  chunked_ = true;
+  chunk_index_ = 0;
+  return true;
+}
+
+const char* FileReader::data(uint64_t offset, size_t len) {
+  if (chunked_) {
+    return chunkData(offset, len);
+  }
+  if (fd_ < 0 || offset > file_size_ || len > file_size_ - offset || len > kWindowSize / 2) {
+    return nullptr;
+  }
+  // 不在当前窗口中，滑动窗口
+  if (win_ == nullptr || offset < win_offset_ || offset + len > win_offset_ + win_len_) {
+    if (!remap(offset)) {
+      return nullptr;
+    }
+  }
+  advise(offset + len);
+  return win_ + (offset - win_offset_);
+}
+
+void FileReader::close() {
+  if (chunk_fd_ >= 0) {
+    ::close(chunk_fd_);
+    chunk_fd_ = -1;
+  }
+  chunked_ = false;
+  entries_.clear();
+  if (win_ != nullptr) {
+    munmap(win_, win_len_);
+    win_ = nullptr;
+    win_len_ = 0;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool FileReader::remap(uint64_t offset) {
+  if (win_ != nullptr) {
+    munmap(win_, win_len_);
+    win_ = nullptr;
+    win_len_ = 0;
+  }
+  uint64_t win_offset = pageAlignDown(offset);
+  size_t win_len = std::min<uint64_t>(kWindowSize, file_size_ - win_offset);
+  void *pmap = mmap(NULL, win_len, PROT_READ, MAP_SHARED, fd_, win_offset);
+  if (pmap == MAP_FAILED) {
+    LOG_ERROR("FileReader mmap error: %s", strerror(errno));
+    return false;
+  }
+  madvise(pmap, win_len, MADV_SEQUENTIAL);
+  win_ = (char*)pmap;
+  win_offset_ = win_offset;
+  win_len_ = win_len;
+  return true;
+}
+
+void FileReader::advise(uint64_t cursor) {
+  // 发送位置接近已预读的位置时，继续向前预读，保证前方始终有数据在读入页缓存
+  if (ahead_pos_ < file_size_ && cursor + kReadAhead / 2 >= ahead_pos_) {
+    uint64_t begin = std::max(ahead_pos_, cursor);
+    uint64_t end = std::min<uint64_t>(file_size_, cursor + kReadAhead);
+    if (end > begin) {
+      posix_fadvise(fd_, begin, end - begin, POSIX_FADV_WILLNEED);
+      ahead_pos_ = end;
+    }
+  }
+
+  // 丢弃发送位置后方已经发送的页，页仍被映射时内核不会回收，所以先解除当前窗口中对应部分的映射
+  uint64_t drop_end = pageAlignDown(cursor);
+  if (drop_behind_ && drop_end >= behind_pos_ + kDropBehind) {
+    uint64_t begin = std::max(behind_pos_, win_offset_);
+    if (win_ != nullptr && drop_end > begin) {
+      madvise(win_ + (begin - win_offset_), drop_end - begin, MADV_DONTNEED);
+    }
+    posix_fadvise(fd_, behind_pos_, drop_end - behind_pos_, POSIX_FADV_DONTNEED);
+    behind_pos_ = drop_end;
+  }
+}
+
+bool FileReader::isCold(uint64_t offset) {
+  // 检查开始发送位置之后的一段数据有多少已经在页缓存中，不到一半认为是冷文件
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t len = std::min<uint64_t>(kReadAhead, win_offset_ + win_len_ - offset);
+  if (len == 0) {
+    return false;
+  }
+  std::vector<unsigned char> vec((len + page_size - 1) / page_size);
+  if (mincore(win_ + (offset - win_offset_), len, vec.data()) != 0) {
+    return false;
+  }
+  size_t resident = std::count_if(vec.begin(), vec.end(), [](unsigned char c) { return (c & 1) != 0; });
+  return resident * 2 < vec.size();
+}
+
+const char* FileReader::chunkData(uint64_t offset, size_t len) {
+  if (offset > file_size_ || len > file_size_ - offset || len > kWindowSize / 2) {
+    return nullptr;
+  }
+  chunk_buf_.resize(len);
+  size_t copied = 0;
+  while (copied < len) {
+    uint64_t pos = offset + copied;
+    // 顺序发送时通常还在当前块或下一个块中，否则二分查找
+    if (chunk_index_ >= entries_.size() || pos < entries_[chunk_index_].offset
+        || pos >= entries_[chunk_index_].offset + entries_[chunk_index_].size) {
+      size_t index = chunk_index_ + 1;
+      if (index >= entries_.size() || pos < entries_[index].offset || pos >= entries_[index].offset + entries_[index].size) {
+        auto it = std::upper_bound(entries_.begin(), entries_.end(), pos,
+                                   [](uint64_t value, const ChunkEntry &entry) { return value < entry.offset; });
+        index = std::prev(it) - entries_.begin();
+      }
+      if (chunk_fd_ >= 0) {
+        ::close(chunk_fd_);
+        chunk_fd_ = -1;
+      }
+      chunk_index_ = index;
+    }
+
+    const ChunkEntry &entry = entries_[chunk_index_];
+    if (chunk_fd_ < 0) {
+      std::string chunk_path = ChunkStore::getChunkPath(entry.hash);
+      chunk_fd_ = ::open(chunk_path.c_str(), O_RDONLY);
+      if (chunk_fd_ == -1) {
+        LOG_ERROR("FileReader open chunk %s error: %s", chunk_path.c_str(), strerror(errno));
+        return nullptr;
+      }
+      posix_fadvise(chunk_fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    size_t n = std::min<uint64_t>(len - copied, entry.offset + entry.size - pos);
+    ssize_t ret = pread(chunk_fd_, chunk_buf_.data() + copied, n, pos - entry.offset);
+    if (ret <= 0) {
+      LOG_ERROR("FileReader read chunk %s error", entry.hash.c_str());
+      return nullptr;
+    }
+    copied += ret;
+  }
+  return chunk_buf_.data();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "ChunkStore.h"
+
+// 下载文件读取（非线程安全，同一时间只由一个发送线程使用）
+// 不再映射整个文件，而是只映射当前发送位置所在的窗口（kWindowSize），发送位置越过窗口后滑动到下一个窗口，
+// 并发下载大量大文件时不会耗尽虚拟地址空间和页表。
+// 发送位置前方持续发出 WILLNEED 预读，避免每次读取都同步触发缺页；
+// 对于冷文件（打开时大部分不在页缓存中），丢弃发送位置后方已经发送过的页，限制对页缓存的污染
+// 块存储模式下文件由多个块文件组成，按文件清单从块文件中读取到内部缓冲区
+class FileReader {
+ public:
+  FileReader() = default;
+  FileReader(const FileReader &other) = delete;
+  FileReader& operator=(const FileReader &other) = delete;
+  ~FileReader();
+
+  bool open(const std::string &path, uint64_t file_size, uint64_t start_offset);  // start_offset为开始发送的位置（断点续传）
+  bool openChunks(std::vector<ChunkEntry> entries, uint64_t file_size);          // 按文件清单读取块存储中的文件
+  // 返回文件区间 [offset, offset+len) 的数据地址，在下一次调用data或close之前有效
+  // len 不能大于窗口大小，失败返回nullptr
+  const char* data(uint64_t offset, size_t len);
+  void close();
+
+ private:
+  bool remap(uint64_t offset);      // 将窗口滑动到包含offset的位置
+  void advise(uint64_t cursor);     // 根据发送位置发出预读和丢弃建议
+  bool isCold(uint64_t offset);     // 判断文件是否为冷文件
+  const char* chunkData(uint64_t offset, size_t len);   // 块存储模式下读取数据
+
+ private:
+  static const size_t kWindowSize;      // 映射窗口大小
+  static const size_t kReadAhead;       // 发送位置前方的预读量
+  static const size_t kDropBehind;      // 发送位置后方累计多少数据后丢弃一次
+
+  int fd_{ -1 };
+  uint64_t file_size_{ 0 };
+
+  char *win_{ nullptr };          // 当前窗口
+  uint64_t win_offset_{ 0 };      // 窗口在文件中的偏移（页对齐）
+  size_t win_len_{ 0 };
+
+  uint64_t ahead_pos_{ 0 };       // 已经发出预读的位置
+  uint64_t behind_pos_{ 0 };      // 已经丢弃的位置
+  bool drop_behind_{ false };     // 是否丢弃已发送的页（冷文件）
+
+  bool chunked_{ false };             // 是否为块存储模式
+  std::vector<ChunkEntry> entries_;   // 文件清单
+  size_t chunk_index_{ 0 };           // 当前打开的块
+  int chunk_fd_{ -1 };
+  std::vector<char> chunk_buf_;       // 块存储模式下读取的数据
+};
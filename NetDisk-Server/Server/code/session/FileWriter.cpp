@@ -0,0 +1,292 @@
+#include "FileWriter.h"
+#include "Log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+std::atomic<int> FileWriter::default_engine_{ FileWriter::MMAP };
+std::atomic<bool> FileWriter::default_direct_io_{ false };
+
+void FileWriter::setEngine(Engine engine, bool direct_io) {
+  default_engine_.store(engine);
+  default_direct_io_.store(direct_io);
+}
+
+FileWriter::Engine FileWriter::getEngine() {
+  return static_cast<Engine>(default_engine_.load());
+}
+
+std::unique_ptr<FileWriter> FileWriter::create() {
+  if (getEngine() == PWRITE) {
+    return std::make_unique<PwriteWriter>(default_direct_io_.load());
+  }
+  return std::make_unique<MmapWriter>();
+}
+
+
+//*******************************************MmapWriter*******************************************//
+MmapWriter::~MmapWriter() {
+  close();
+}
+
+bool MmapWriter::open(const std::string &path, uint64_t file_size) {
+  // 续传时文件已经存在，不能截断
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd_ == -1) {
+    LOG_ERROR("MmapWriter open %s error: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  // 预分配文件大小（稀疏文件）
+  if (ftruncate(fd_, file_size) == -1) {
+    LOG_ERROR("MmapWriter ftruncate error: %s", strerror(errno));
+    close();
+    return false;
+  }
+  file_size_ = file_size;
+  if (file_size_ == 0) {
+    return true;
+  }
+  // 将文件映射到进程的虚拟内存中，修改内存会同步到文件内容
+  void *pmap = mmap(NULL, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (pmap == MAP_FAILED) {
+    LOG_ERROR("MmapWriter mmap error: %s", strerror(errno));
+    close();
+    return false;
+  }
+  map_ = (char*)pmap;
+  return true;
+}
+
+bool MmapWriter::write(uint64_t offset, const char *data, size_t len) {
+  if (map_ == nullptr || offset > file_size_ || len > file_size_ - offset) {
+    return false;
+  }
+  memcpy(map_ + offset, data, len);
+  return true;
+}
+
+bool MmapWriter::read(uint64_t offset, char *buf, size_t len) {
+  if (map_ == nullptr || offset > file_size_ || len > file_size_ - offset) {
+    return false;
+  }
+  memcpy(buf, map_ + offset, len);
+  return true;
+}
+
+bool MmapWriter::sync() {
+  if (map_ != nullptr && msync(map_, file_size_, MS_SYNC) != 0) {
+    LOG_ERROR("MmapWriter msync error: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool MmapWriter::close() {
+  if (map_ != nullptr) {
+    munmap(map_, file_size_);
+    map_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  return true;
+}
+
+
+//*******************************************PwriteWriter*******************************************//
+const size_t PwriteWriter::kAlign = 4096;
+const size_t PwriteWriter::kStageSize = 1024 * 1024;
+
+PwriteWriter::PwriteWriter(bool direct_io) : direct_io_(direct_io) {
+
+}
+
+PwriteWriter::~PwriteWriter() {
+  close();
+}
+
+bool PwriteWriter::open(const std::string &path, uint64_t file_size) {
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd_ == -1) {
+    LOG_ERROR("PwriteWriter open %s error: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  file_size_ = file_size;
+
+  // 真正预分配磁盘空间，已有的数据不受影响（续传）
+  if (file_size_ > 0 && fallocate(fd_, 0, 0, file_size_) != 0) {
+    if (errno != EOPNOTSUPP) {   // 空间不足等错误，在创建任务时就返回失败
+      LOG_ERROR("PwriteWriter fallocate error: %s", strerror(errno));
+      close();
+      return false;
+    }
+    // 文件系统不支持 fallocate，退化为稀疏文件
+    if (ftruncate(fd_, file_size_) != 0) {
+      LOG_ERROR("PwriteWriter ftruncate error: %s", strerror(errno));
+      close();
+      return false;
+    }
+  }
+
+  if (direct_io_) {
+    direct_fd_ = ::open(path.c_str(), O_WRONLY | O_DIRECT);
+    void *stage = nullptr;
+    if (direct_fd_ == -1 || posix_memalign(&stage, kAlign, kStageSize + kAlign) != 0) {
+      // 文件系统不支持 O_DIRECT，使用普通 pwrite
+      LOG_WARN("PwriteWriter O_DIRECT unavailable, fall back to buffered io");
+      if (direct_fd_ >= 0) {
+        ::close(direct_fd_);
+        direct_fd_ = -1;
+      }
+      direct_io_ = false;
+    }
+    else {
+      stage_ = (char*)stage;
+    }
+  }
+  return true;
+}
+
+bool PwriteWriter::write(uint64_t offset, const char *data, size_t len) {
+  if (fd_ < 0 || offset > file_size_ || len > file_size_ - offset) {
+    return false;
+  }
+  if (!direct_io_) {  // pwrite 本身是线程安全的，不需要加锁
+    return pwriteAll(fd_, data, len, offset);
+  }
+
+  std::lock_guard<std::mutex> lock(stage_mtx_);
+  // 与合并缓冲区中的数据连续，且放得下，则追加
+  if (stage_len_ > 0 && offset == stage_offset_ + stage_len_ && stage_pad_ + stage_len_ + len <= kStageSize + kAlign) {
+    memcpy(stage_ + stage_pad_ + stage_len_, data, len);
+    stage_len_ += len;
+    return true;
+  }
+  if (!flushStage()) {
+    return false;
+  }
+  if (len > kStageSize) {   // 数据太大，直接写入
+    return pwriteAll(fd_, data, len, offset);
+  }
+  stage_offset_ = offset;
+  stage_pad_ = offset % kAlign;
+  stage_len_ = len;
+  memcpy(stage_ + stage_pad_, data, len);
+  return true;
+}
+
+bool PwriteWriter::read(uint64_t offset, char *buf, size_t len) {
+  if (fd_ < 0 || offset > file_size_ || len > file_size_ - offset) {
+    return false;
+  }
+  if (direct_io_) {   // 合并缓冲区中的数据还没有写入文件，先写入
+    std::lock_guard<std::mutex> lock(stage_mtx_);
+    if (!flushStage()) {
+      return false;
+    }
+  }
+  size_t readed = 0;
+  while (readed < len) {
+    ssize_t n = pread(fd_, buf + readed, len - readed, offset + readed);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG_ERROR("PwriteWriter pread error: %s", n < 0 ? strerror(errno) : "unexpected eof");
+      return false;
+    }
+    readed += n;
+  }
+  return true;
+}
+
+bool PwriteWriter::flushStage() {
+  if (stage_len_ == 0) {
+    return true;
+  }
+  uint64_t begin = stage_offset_;
+  uint64_t end = stage_offset_ + stage_len_;
+  uint64_t align_begin = (begin + kAlign - 1) / kAlign * kAlign;  // 第一个对齐位置
+  uint64_t align_end = end / kAlign * kAlign;                     // 最后一个对齐位置
+  bool ok = true;
+
+  if (align_begin >= align_end) {   // 没有完整的对齐块
+    ok = pwriteAll(fd_, stage_ + stage_pad_, stage_len_, begin);
+  }
+  else {
+    // 首尾不对齐的部分使用普通描述符，中间对齐的部分使用 O_DIRECT
+    if (align_begin > begin) {
+      ok = ok && pwriteAll(fd_, stage_ + stage_pad_, align_begin - begin, begin);
+    }
+    ok = ok && pwriteAll(direct_fd_, stage_ + stage_pad_ + (align_begin - begin), align_end - align_begin, align_begin);
+    if (end > align_end) {
+      ok = ok && pwriteAll(fd_, stage_ + stage_pad_ + (align_end - begin), end - align_end, align_end);
+    }
+  }
+  stage_len_ = 0;
+  if (!ok) {
+    stage_failed_ = true;
+  }
+  return ok;
+}
+
+bool PwriteWriter::pwriteAll(int fd, const char *data, size_t len, uint64_t offset) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t n = pwrite(fd, data + written, len - written, offset + written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("PwriteWriter pwrite error: %s", strerror(errno));
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+bool PwriteWriter::sync() {
+  if (fd_ < 0) {
+    return false;
+  }
+  if (direct_io_) {
+    std::lock_guard<std::mutex> lock(stage_mtx_);
+    if (!flushStage() || stage_failed_) {
+      return false;
+    }
+  }
+  if (fdatasync(fd_) != 0) {
+    LOG_ERROR("PwriteWriter fdatasync error: %s", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool PwriteWriter::close() {
+  bool ok = true;
+  if (direct_io_ && fd_ >= 0) {
+    std::lock_guard<std::mutex> lock(stage_mtx_);
+    ok = flushStage() && !stage_failed_;   // 合并缓冲区中的数据写入失败过，文件内容不完整
+  }
+  if (direct_fd_ >= 0) {
+    ::close(direct_fd_);
+    direct_fd_ = -1;
+  }
+  if (fd_ >= 0) {
+    if (::close(fd_) != 0) {
+      LOG_ERROR("PwriteWriter close error: %s", strerror(errno));
+      ok = false;
+    }
+    fd_ = -1;
+  }
+  if (stage_ != nullptr) {
+    free(stage_);
+    stage_ = nullptr;
+  }
+  return ok;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// 上传文件写入引擎（线程安全），由上传会话持有，共享会话的所有连接通过同一个写入引擎写文件
+// MMAP：ftruncate 后将整个文件映射到内存，写入即 memcpy（原有实现）
+// PWRITE：fallocate 真正预分配磁盘空间（空间不足在创建任务时就能发现，而不是写入时触发SIGBUS），使用 pwrite 写入，
+//         不占用虚拟地址空间，也不会因为缺页竞争进程的 mmap 锁；可选 O_DIRECT，此时连续的小块数据先合并到对齐的缓冲区再写入
+class FileWriter {
+ public:
+  enum Engine {
+    MMAP = 0,
+    PWRITE
+  };
+
+  // 设置写入引擎（读取配置文件后调用）
+  static void setEngine(Engine engine, bool direct_io);
+  static Engine getEngine();
+  // 根据配置创建写入引擎
+  static std::unique_ptr<FileWriter> create();
+
+  virtual ~FileWriter() = default;
+
+  virtual bool open(const std::string &path, uint64_t file_size) = 0;   // 打开（创建）文件并预分配空间
+  virtual bool write(uint64_t offset, const char *data, size_t len) = 0;
+  virtual bool read(uint64_t offset, char *buf, size_t len) = 0;    // 读取已经写入的数据（包括还在缓存中未写入文件的数据）
+  virtual bool sync() = 0;    // 将已经写入的数据落盘
+  virtual bool close() = 0;   // 关闭文件，缓存的数据写入失败时返回false
+
+ private:
+  static std::atomic<int> default_engine_;       // 配置的写入引擎
+  static std::atomic<bool> default_direct_io_;  // 配置是否使用 O_DIRECT
+};
+
+// 共享内存映射写入
+class MmapWriter : public FileWriter {
+ public:
+  ~MmapWriter() override;
+
+  bool open(const std::string &path, uint64_t file_size) override;
+  bool write(uint64_t offset, const char *data, size_t len) override;
+  bool read(uint64_t offset, char *buf, size_t len) override;
+  bool sync() override;
+  bool close() override;
+
+ private:
+  int fd_{ -1 };
+  char *map_{ nullptr };
+  uint64_t file_size_{ 0 };
+};
+
+// pwrite 写入，可选 O_DIRECT
+class PwriteWriter : public FileWriter {
+ public:
+  explicit PwriteWriter(bool direct_io);
+  ~PwriteWriter() override;
+
+  bool open(const std::string &path, uint64_t file_size) override;
+  bool write(uint64_t offset, const char *data, size_t len) override;
+  bool read(uint64_t offset, char *buf, size_t len) override;
+  bool sync() override;
+  bool close() override;
+
+ private:
+  bool flushStage();  // 将合并缓冲区写入文件，调用前需持有 stage_mtx_
+  static bool pwriteAll(int fd, const char *data, size_t len, uint64_t offset);
+
+ private:
+  static const size_t kAlign;       // O_DIRECT 对齐大小
+  static const size_t kStageSize;   // 合并缓冲区大小
+
+  bool direct_io_{ false };
+  int fd_{ -1 };          // 普通描述符，写入不对齐的首尾部分
+  int direct_fd_{ -1 };   // O_DIRECT 描述符，写入对齐的部分
+  uint64_t file_size_{ 0 };
+
+  // 合并缓冲区（只在 O_DIRECT 时使用），保存文件区间 [stage_offset_, stage_offset_+stage_len_)
+  // 数据从 stage_ + stage_pad_ 开始存放，stage_pad_ = stage_offset_ % kAlign，保证对齐的文件偏移对应对齐的内存地址
+  char *stage_{ nullptr };
+  uint64_t stage_offset_{ 0 };
+  size_t stage_pad_{ 0 };
+  size_t stage_len_{ 0 };
+  bool stage_failed_{ false };   // 合并缓冲区写入失败过（已经记录为接收的数据丢失），之后落盘和关闭都返回失败
+  std::mutex stage_mtx_;
+};
@@ -0,0 +1,69 @@
+#include "MultiGetSession.h"
+#include "MyDB.h"
+#include "protocol.h"
+#include <cstring>
+#include <algorithm>
+
+MultiGetSession::MultiGetSession(const std::string &user) : user_(user) {
+
+}
+
+bool MultiGetSession::start() {
+  return !started_.exchange(true);
+}
+
+bool MultiGetSession::expand(MyDB &db, const char *data, size_t len) {
+  if (len == 0 || len % sizeof(uint64_t) != 0 || len / sizeof(uint64_t) > MAX_MULTI_IDS) {
+    return false;
+  }
+  std::vector<uint64_t> ids(len / sizeof(uint64_t));
+  for (size_t i = 0; i < ids.size(); ++i) {
+    memcpy(&ids[i], data + i * sizeof(uint64_t), sizeof(uint64_t));
+    ids[i] = ntohll(ids[i]);
+  }
+  // 重复的ID只下载一次
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  if (!db.getDownloadFiles(user_, ids, MAX_MULTI_FILES, files_)) {
+    files_.clear();
+    return false;
+  }
+
+  // 按编码后的长度分页，一页至少一个文件（路径不超过 MAX_MULTI_PATH_LEN，单个文件不会超过一页的长度）
+  page_begins_.clear();
+  const size_t head_len = 2 * sizeof(uint32_t);
+  size_t page_len = MAX_MULTI_LIST_PAGE_LEN;
+  for (size_t i = 0; i < files_.size(); ++i) {
+    size_t entry_len = MULTI_ENTRY_BASE_LEN + files_[i].path.size();
+    if (page_len + entry_len > MAX_MULTI_LIST_PAGE_LEN) {
+      page_begins_.push_back(i);
+      page_len = head_len;
+    }
+    page_len += entry_len;
+  }
+  return !files_.empty();
+}
+
+// 页序号(uint32) + 文件总数(uint32) + 若干条[文件ID(uint64), 文件长度(uint64), 文件哈希, 路径长度(uint16), 相对路径]
+std::string MultiGetSession::makeListPage(uint32_t page, uint32_t &file_count) const {
+  size_t begin = page_begins_[page];
+  size_t end = (page + 1 < page_begins_.size() ? page_begins_[page + 1] : files_.size());
+  file_count = end - begin;
+  std::string msg;
+  uint32_t net_page = htonl(page);
+  uint32_t total = htonl(files_.size());
+  msg.append((char*)&net_page, sizeof(net_page));
+  msg.append((char*)&total, sizeof(total));
+  for (size_t i = begin; i < end; ++i) {
+    const DownFileInfo &file = files_[i];
+    uint64_t file_id = htonll(file.file_id);
+    uint64_t file_size = htonll(file.file_size);
+    uint16_t path_len = htons(file.path.size());
+    msg.append((char*)&file_id, sizeof(file_id));
+    msg.append((char*)&file_size, sizeof(file_size));
+    msg.append(file.md5.data(), MULTI_HASH_LEN);
+    msg.append((char*)&path_len, sizeof(path_len));
+    msg.append(file.path);
+  }
+  return msg;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+class MyDB;
+
+// 多文件下载的一个文件
+struct DownFileInfo {
+  std::uint64_t file_id{ 0 };
+  std::string path;             // 相对路径，文件夹中的文件带上文件夹名（如 photos/2024/a.jpg）
+  std::string md5;              // 文件内容的 SHA-256（十六进制）
+  std::uint64_t file_size{ 0 };
+};
+
+// 多文件下载会话（GETS_MULTI）
+// 每个文件单独下载时，每个文件都要建立连接、TLS握手和认证，下载一个有上千张照片的文件夹时这些开销远大于数据本身。
+// 多文件下载在一个已认证的连接上完成：客户端发送文件或文件夹ID，服务端递归展开文件夹，先发送文件清单（相对路径、长度、哈希），
+// 再按清单顺序依次发送每个文件的数据，每个文件结束时发送结束标记，客户端据此逐个校验文件
+class MultiGetSession {
+ public:
+  explicit MultiGetSession(const std::string &user);
+  MultiGetSession(const MultiGetSession &other) = delete;
+  MultiGetSession& operator=(const MultiGetSession &other) = delete;
+
+  bool start();   // 每个会话只能发送一次，只有第一次调用返回true
+  // 解析客户端发送的ID列表并展开为文件清单，ID不合法或者文件数超过上限返回false
+  bool expand(MyDB &db, const char *data, size_t len);
+  // 清单按编码后的长度分页（每页不超过 MAX_MULTI_LIST_PAGE_LEN 字节），路径长短不一，每页的文件数不固定
+  uint32_t getPageCount() const { return page_begins_.size(); }
+  std::string makeListPage(uint32_t page, uint32_t &file_count) const;    // 清单第 page 页的回复体，file_count 返回本页的文件数
+  const std::vector<DownFileInfo>& getFiles() const { return files_; }
+
+ private:
+  std::string user_;
+  std::atomic<bool> started_{ false };
+  std::vector<DownFileInfo> files_;
+  std::vector<size_t> page_begins_;   // 每页第一个文件的序号
+};
@@ -0,0 +1,660 @@
+#include "UploadSession.h"
+#include "protocol.h"
+#include "Log.h"
+#include "MyDB.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cctype>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+const uint32_t UploadSession::kJournalMagic = 0x4E445553;    // "NDUS"
+const uint32_t UploadSession::kJournalVersion = 1;
+const uint64_t UploadSession::kCheckpointBytes = 32 * 1024 * 1024;
+const int64_t UploadSession::kCheckpointIntervalMs = 2000;
+const uint64_t UploadSession::kHashRereadBytes = 8 * 1024 * 1024;
+
+std::atomic<int64_t> UploadSession::expire_seconds_{ 7 * 24 * 3600 };
+std::mutex UploadSession::registry_mtx_;
+std::unordered_map<std::string, std::weak_ptr<UploadSession>> UploadSession::registry_;
+std::unordered_set<std::string> UploadSession::closing_;
+std::condition_variable UploadSession::closing_cv_;
+
+// 日志文件的读写辅助函数，多字节整数统一使用网络字节序
+namespace {
+
+void appendU32(std::string &out, uint32_t value) {
+  value = htonl(value);
+  out.append((char*)&value, sizeof(value));
+}
+
+void appendU64(std::string &out, uint64_t value) {
+  value = htonll(value);
+  out.append((char*)&value, sizeof(value));
+}
+
+bool readU32(const std::string &in, size_t &pos, uint32_t &value) {
+  if (in.size() - pos < sizeof(value)) {
+    return false;
+  }
+  memcpy((char*)&value, in.data() + pos, sizeof(value));
+  value = ntohl(value);
+  pos += sizeof(value);
+  return true;
+}
+
+bool readU64(const std::string &in, size_t &pos, uint64_t &value) {
+  if (in.size() - pos < sizeof(value)) {
+    return false;
+  }
+  memcpy((char*)&value, in.data() + pos, sizeof(value));
+  value = ntohll(value);
+  pos += sizeof(value);
+  return true;
+}
+
+}
+
+UploadSession::UploadSession(const std::string &user, const std::string &md5, uint64_t file_size)
+  : key_(user + "/" + md5), md5_(md5), file_size_(file_size) {
+  std::string dir = std::string(ROOTFILEPATH) + "/" + user;
+  file_path_ = dir + "/" + md5;
+  journal_path_ = file_path_ + ".session";
+
+  std::random_device rd;
+  upload_id_ = ((uint64_t)rd() << 32) | rd();
+  last_checkpoint_ms_.store(nowMs());
+
+  // OpenSSL 会根据CPU自动选择 SHA-NI 等加速实现
+  hash_ctx_ = EVP_MD_CTX_new();
+  resetHash();
+}
+
+UploadSession::~UploadSession() {
+  if (hash_ctx_ != nullptr) {
+    EVP_MD_CTX_free(hash_ctx_);
+    hash_ctx_ = nullptr;
+  }
+  // 在活动会话表的锁内注销会话并标记为正在关闭，之后的保存和落盘在锁外进行，不阻塞其它文件的 acquire/find；
+  // 同一个文件的 acquire 等到关闭完成后才从日志恢复，不会与这里同时操作该文件
+  {
+    std::lock_guard<std::mutex> lock(registry_mtx_);
+    auto it = registry_.find(key_);
+    if (it != registry_.end()) {
+      if (!it->second.expired()) {  // 已经有新的会话接管了该文件，不再处理
+        return;
+      }
+      registry_.erase(it);
+    }
+    closing_.insert(key_);
+  }
+
+  closeFile();
+
+  {
+    std::lock_guard<std::mutex> lock(registry_mtx_);
+    closing_.erase(key_);
+  }
+  closing_cv_.notify_all();
+}
+
+void UploadSession::closeFile() {
+  if (is_finish_) {
+    // 关闭文件（写入引擎关闭时会将缓存的数据写入文件，入库前已经落盘，这里出错只记录日志）
+    if (writer_ && !writer_->close()) {
+      LOG_ERROR("upload session close file failed: %s", key_.c_str());
+    }
+    writer_.reset();
+    return;
+  }
+
+  if (getReceivedBytes() == 0) {
+    writer_.reset();  // 没有接收任何数据，直接删除，避免服务器磁盘空间浪费
+    remove(file_path_.c_str());
+    remove(journal_path_.c_str());
+    return;
+  }
+
+  // 最后一个连接断开，保存会话，等待客户端续传
+  {
+    std::lock_guard<std::mutex> cp_lock(checkpoint_mtx_);
+    doCheckpoint();
+  }
+  LOG_INFO("upload session saved: %s, received %lu/%lu", key_.c_str(), getReceivedBytes(), file_size_);
+}
+
+std::shared_ptr<UploadSession> UploadSession::acquire(const std::string &user, const std::string &md5, uint64_t file_size) {
+  // 注意：active 要在 lock 之前定义，保证先释放锁再释放会话，因为会话的析构函数也需要加锁
+  std::shared_ptr<UploadSession> active;
+  std::unique_lock<std::mutex> lock(registry_mtx_);
+
+  std::string key = user + "/" + md5;
+  // 该文件之前的会话正在保存（此时没有活动会话），等待完成后再从日志恢复
+  closing_cv_.wait(lock, [&key]() { return closing_.count(key) == 0; });
+  auto it = registry_.find(key);
+  if (it != registry_.end()) {
+    active = it->second.lock();
+  }
+  if (active) {   // 已有连接在上传该文件，共享同一个会话
+    if (active->file_size_ != file_size) {
+      return nullptr;
+    }
+    return active;
+  }
+
+  std::shared_ptr<UploadSession> session(new UploadSession(user, md5, file_size));
+  if (session->load()) {
+    LOG_INFO("upload session restored: %s, received %lu/%lu", key.c_str(), session->getReceivedBytes(), file_size);
+  }
+  registry_[key] = session;
+  return session;
+}
+
+std::shared_ptr<UploadSession> UploadSession::find(const std::string &user, const std::string &md5, uint64_t file_size) {
+  // 与 acquire 相同，active 要在 lock 之前定义
+  std::shared_ptr<UploadSession> active;
+  std::lock_guard<std::mutex> lock(registry_mtx_);
+
+  auto it = registry_.find(user + "/" + md5);
+  if (it != registry_.end()) {
+    active = it->second.lock();
+  }
+  if (active == nullptr || active->file_size_ != file_size || active->is_finish_) {
+    return nullptr;
+  }
+  return active;
+}
+
+void UploadSession::setExpireHours(int hours) {
+  expire_seconds_.store(hours > 0 ? (int64_t)hours * 3600 : 0);
+}
+
+void UploadSession::cleanExpired() {
+  int64_t expire = expire_seconds_.load();
+  DIR *root_dir = (expire > 0 ? opendir(ROOTFILEPATH) : nullptr);
+  if (root_dir == nullptr) {
+    return;
+  }
+  time_t deadline = time(nullptr) - expire;
+  auto isExpired = [deadline](const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) != 0 || (S_ISREG(st.st_mode) && st.st_mtime < deadline);
+  };
+
+  MyDB db;
+  uint64_t removed = 0;
+  struct dirent *user_entry;
+  while ((user_entry = readdir(root_dir)) != nullptr) {
+    std::string user = user_entry->d_name;
+    if (user == "." || user == "..") {
+      continue;
+    }
+    std::string user_path = std::string(ROOTFILEPATH) + "/" + user;
+    DIR *user_dir = opendir(user_path.c_str());
+    if (user_dir == nullptr) {
+      continue;
+    }
+    // 先收集文件名再删除，避免遍历目录的同时修改目录
+    std::vector<std::string> names;
+    struct dirent *file_entry;
+    while ((file_entry = readdir(user_dir)) != nullptr) {
+      names.emplace_back(file_entry->d_name);
+    }
+    closedir(user_dir);
+
+    for (const std::string &name : names) {
+      std::string path = user_path + "/" + name;
+      // 批量上传的临时文件：正常情况下入库后就会删除
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) {
+        if (isExpired(path) && remove(path.c_str()) == 0) {
+          ++removed;
+        }
+        continue;
+      }
+      std::string md5 = name;
+      bool is_journal = (name.size() > 8 && name.compare(name.size() - 8, 8, ".session") == 0);
+      if (is_journal) {
+        md5 = name.substr(0, name.size() - 8);
+      }
+      if (md5.size() < 2 || !std::all_of(md5.begin(), md5.end(), [](unsigned char c) { return std::isxdigit(c); })) {
+        continue;
+      }
+      std::string file_path = user_path + "/" + md5;
+      std::string journal_path = file_path + ".session";
+      // 有会话日志的数据文件和日志一起处理
+      if (!is_journal && access(journal_path.c_str(), F_OK) == 0) {
+        continue;
+      }
+      if (!isExpired(file_path) || !isExpired(journal_path)) {
+        continue;
+      }
+      // 没有会话日志的数据文件可能是迁移失败、仍被数据库引用的旧文件
+      if (!is_journal && db.getUserFileCount(user, md5) > 0) {
+        continue;
+      }
+      // 持有活动会话表的锁，保证删除期间不会有连接恢复该会话
+      std::lock_guard<std::mutex> lock(registry_mtx_);
+      auto it = registry_.find(user + "/" + md5);
+      if ((it != registry_.end() && !it->second.expired()) || closing_.count(user + "/" + md5) > 0) {
+        continue;
+      }
+      remove(journal_path.c_str());
+      if (remove(file_path.c_str()) == 0 || is_journal) {
+        ++removed;
+      }
+    }
+  }
+  closedir(root_dir);
+
+  if (removed > 0) {
+    LOG_INFO("upload session expired: %lu abandoned uploads removed", removed);
+  }
+}
+
+uint64_t UploadSession::getUploadId() {
+  return upload_id_;
+}
+
+uint64_t UploadSession::getFileSize() {
+  return file_size_;
+}
+
+std::string UploadSession::getFilePath() {
+  return file_path_;
+}
+
+std::string UploadSession::getJournalPath() {
+  return journal_path_;
+}
+
+bool UploadSession::openFile() {
+  std::lock_guard<std::mutex> lock(writer_mtx_);
+  if (writer_) {  // 其它连接已经打开
+    return true;
+  }
+  std::unique_ptr<FileWriter> writer = FileWriter::create();
+  if (!writer->open(file_path_, file_size_)) {
+    return false;
+  }
+  writer_ = std::move(writer);
+  return true;
+}
+
+bool UploadSession::write(uint64_t offset, const char *data, size_t len, uint64_t &added) {
+  added = 0;
+  if (!writer_ || !writer_->write(offset, data, len)) {
+    return false;
+  }
+  // 写入成功后才记录区间
+  added = addRange(offset, len);
+
+  // 同一时刻只有一个线程计算哈希，其它线程写入后直接返回，不等待哈希计算（包括从文件读回）：
+  // 正在计算的线程算完后会检查连续区间是否变长，并从文件读回这些数据；没有读回的部分由之后的写入或上传完成时计算
+  std::unique_lock<std::mutex> lock(hash_mtx_, std::try_to_lock);
+  if (lock.owns_lock()) {
+    updateHash(offset, data, len, kHashRereadBytes);
+  }
+  return true;
+}
+
+bool UploadSession::syncFile() {
+  return writer_ && writer_->sync();
+}
+
+uint64_t UploadSession::addRange(uint64_t offset, uint64_t len) {
+  if (len == 0 || offset > file_size_ || len > file_size_ - offset) {
+    return 0;
+  }
+  uint64_t begin = offset;
+  uint64_t end = offset + len;
+  uint64_t covered = 0;   // 与已接收区间重叠的字节数
+
+  std::lock_guard<std::mutex> lock(ranges_mtx_);
+  // 找到第一个可能与 [begin, end) 相交或相邻的区间
+  auto it = ranges_.upper_bound(begin);
+  if (it != ranges_.begin() && std::prev(it)->second >= begin) {
+    --it;
+  }
+  // 合并所有相交或相邻的区间
+  uint64_t new_begin = begin;
+  uint64_t new_end = end;
+  while (it != ranges_.end() && it->first <= end) {
+    uint64_t overlap_begin = std::max(begin, it->first);
+    uint64_t overlap_end = std::min(end, it->second);
+    if (overlap_end > overlap_begin) {
+      covered += overlap_end - overlap_begin;
+    }
+    new_begin = std::min(new_begin, it->first);
+    new_end = std::max(new_end, it->second);
+    it = ranges_.erase(it);
+  }
+  ranges_[new_begin] = new_end;
+
+  uint64_t added = len - covered;
+  received_bytes_ += added;
+  dirty_bytes_.fetch_add(added);
+  return added;
+}
+
+uint64_t UploadSession::getReceivedBytes() {
+  std::lock_guard<std::mutex> lock(ranges_mtx_);
+  return received_bytes_;
+}
+
+bool UploadSession::isComplete() {
+  return getReceivedBytes() == file_size_;
+}
+
+std::vector<UploadSession::Range> UploadSession::getRanges(size_t max_count) {
+  std::vector<Range> ranges;
+  std::lock_guard<std::mutex> lock(ranges_mtx_);
+  for (auto &range : ranges_) {
+    if (ranges.size() >= max_count) {
+      break;
+    }
+    ranges.emplace_back(range.first, range.second);
+  }
+  return ranges;
+}
+
+void UploadSession::reset() {
+  std::lock_guard<std::mutex> hash_lock(hash_mtx_);
+  resetHash();
+  std::lock_guard<std::mutex> lock(ranges_mtx_);
+  ranges_.clear();
+  received_bytes_ = 0;
+  dirty_bytes_.store(kCheckpointBytes);   // 下一次检查时立即持久化
+}
+
+bool UploadSession::maybeCheckpoint() {
+  if (dirty_bytes_.load() < kCheckpointBytes && nowMs() - last_checkpoint_ms_.load() < kCheckpointIntervalMs) {
+    return false;
+  }
+  // 已经有线程在持久化，直接返回，不阻塞接收数据
+  std::unique_lock<std::mutex> lock(checkpoint_mtx_, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return false;
+  }
+  return doCheckpoint();
+}
+
+bool UploadSession::checkpoint() {
+  std::lock_guard<std::mutex> lock(checkpoint_mtx_);
+  return doCheckpoint();
+}
+
+bool UploadSession::doCheckpoint() {
+  if (is_finish_) {   // 已经完成，日志文件会被删除，无需持久化
+    return true;
+  }
+  last_checkpoint_ms_.store(nowMs());
+  uint64_t dirty = dirty_bytes_.exchange(0);
+  // 先获取区间快照，再将数据落盘，快照中的区间在此之前都已经交给了写入引擎，因此落盘后一定在磁盘中
+  std::vector<Range> ranges = getRanges(SIZE_MAX);
+
+  if (writer_ && !writer_->sync()) {
+    dirty_bytes_.fetch_add(dirty);
+    return false;
+  }
+  if (!writeJournal(ranges)) {
+    dirty_bytes_.fetch_add(dirty);
+    return false;
+  }
+  return true;
+}
+
+bool UploadSession::setFinish() {
+  bool expected = false;
+  return is_finish_.compare_exchange_strong(expected, true);
+}
+
+bool UploadSession::getIsFinish() {
+  return is_finish_;
+}
+
+void UploadSession::addTransferBytes(uint64_t raw, uint64_t wire) {
+  raw_bytes_ += raw;
+  wire_bytes_ += wire;
+}
+
+void UploadSession::getTransferBytes(uint64_t &raw, uint64_t &wire) {
+  raw = raw_bytes_.load();
+  wire = wire_bytes_.load();
+}
+
+void UploadSession::setDeltaBase(const std::string &md5, uint64_t file_size) {
+  std::lock_guard<std::mutex> lock(delta_mtx_);
+  delta_base_md5_ = md5;
+  delta_base_size_ = file_size;
+}
+
+bool UploadSession::getDeltaBase(std::string &md5, uint64_t &file_size) {
+  std::lock_guard<std::mutex> lock(delta_mtx_);
+  if (delta_base_md5_.empty()) {
+    return false;
+  }
+  md5 = delta_base_md5_;
+  file_size = delta_base_size_;
+  return true;
+}
+
+void UploadSession::setOwnedChunks(std::shared_ptr<const std::unordered_set<std::string>> chunks) {
+  std::lock_guard<std::mutex> lock(owned_chunks_mtx_);
+  owned_chunks_ = std::move(chunks);
+}
+
+std::shared_ptr<const std::unordered_set<std::string>> UploadSession::getOwnedChunks() {
+  std::lock_guard<std::mutex> lock(owned_chunks_mtx_);
+  return owned_chunks_;
+}
+
+void UploadSession::removeJournal() {
+  std::lock_guard<std::mutex> lock(checkpoint_mtx_);
+  remove(journal_path_.c_str());
+}
+
+bool UploadSession::verifyHash() {
+  std::lock_guard<std::mutex> lock(hash_mtx_);
+  if (hash_ctx_ == nullptr || !updateHash(0, nullptr, 0, UINT64_MAX) || hash_pos_ != file_size_) {
+    LOG_ERROR("upload session hash incomplete: %s, hashed %lu/%lu", key_.c_str(), hash_pos_, file_size_);
+    return false;
+  }
+  unsigned char result[EVP_MAX_MD_SIZE];
+  unsigned int result_len = 0;
+  if (EVP_DigestFinal_ex(hash_ctx_, result, &result_len) != 1) {
+    return false;
+  }
+  // 与客户端一致，使用小写十六进制字符串
+  static const char hex[] = "0123456789abcdef";
+  std::string digest;
+  for (unsigned int i = 0; i < result_len; ++i) {
+    digest.push_back(hex[result[i] >> 4]);
+    digest.push_back(hex[result[i] & 0x0f]);
+  }
+  LOG_INFO("upload session hash: %s, inline %lu, reread %lu", key_.c_str(), hash_inline_bytes_, hash_reread_bytes_);
+  resetHash();  // 结果已经取出，上下文需要重新初始化才能再次使用
+  return digest == md5_;
+}
+
+void UploadSession::discard() {
+  {
+    std::lock_guard<std::mutex> lock(checkpoint_mtx_);
+    remove(journal_path_.c_str());
+  }
+  reset();
+  dirty_bytes_.store(0);
+  is_finish_.store(false);
+}
+
+uint64_t UploadSession::contiguousEnd(uint64_t pos) {
+  std::lock_guard<std::mutex> lock(ranges_mtx_);
+  auto it = ranges_.upper_bound(pos);
+  if (it == ranges_.begin()) {
+    return pos;
+  }
+  --it;
+  return (it->second > pos ? it->second : pos);
+}
+
+bool UploadSession::updateHash(uint64_t offset, const char *data, size_t len, uint64_t max_reread) {
+  if (hash_ctx_ == nullptr) {
+    return false;
+  }
+  uint64_t reread = 0;
+  uint64_t end = contiguousEnd(hash_pos_);
+  while (hash_pos_ < end) {
+    // 刚写入的数据正好接在已计算部分之后，直接使用接收缓冲区中的数据
+    if (data != nullptr && offset <= hash_pos_ && hash_pos_ < offset + len) {
+      size_t n = std::min(end, offset + len) - hash_pos_;
+      if (EVP_DigestUpdate(hash_ctx_, data + (hash_pos_ - offset), n) != 1) {
+        return false;
+      }
+      hash_pos_ += n;
+      hash_inline_bytes_ += n;
+    }
+    else {
+      // 之前乱序到达的数据，从文件读回计算
+      if (reread >= max_reread) {
+        break;
+      }
+      if (hash_buf_.empty()) {
+        hash_buf_.resize(1024 * 1024);
+      }
+      size_t n = std::min<uint64_t>({ end - hash_pos_, hash_buf_.size(), max_reread - reread });
+      if (!writer_ || !writer_->read(hash_pos_, hash_buf_.data(), n) || EVP_DigestUpdate(hash_ctx_, hash_buf_.data(), n) != 1) {
+        return false;
+      }
+      hash_pos_ += n;
+      hash_reread_bytes_ += n;
+      reread += n;
+    }
+    if (hash_pos_ == end) {   // 计算期间其它线程可能补齐了后面的数据
+      end = contiguousEnd(hash_pos_);
+    }
+  }
+  return true;
+}
+
+void UploadSession::resetHash() {
+  hash_pos_ = 0;
+  hash_inline_bytes_ = 0;
+  hash_reread_bytes_ = 0;
+  if (hash_ctx_ != nullptr) {
+    EVP_DigestInit_ex(hash_ctx_, EVP_sha256(), nullptr);
+  }
+}
+
+bool UploadSession::load() {
+  int fd = open(journal_path_.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  std::string data;
+  char buf[4096];
+  ssize_t n = 0;
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    data.append(buf, n);
+  }
+  ::close(fd);
+  if (n < 0) {
+    return false;
+  }
+
+  size_t pos = 0;
+  uint32_t magic = 0, version = 0, md5_len = 0, count = 0;
+  uint64_t upload_id = 0, file_size = 0;
+  if (!readU32(data, pos, magic) || magic != kJournalMagic ||
+      !readU32(data, pos, version) || version != kJournalVersion ||
+      !readU64(data, pos, upload_id) ||
+      !readU64(data, pos, file_size) || file_size != file_size_ ||
+      !readU32(data, pos, md5_len) || data.size() - pos < md5_len) {
+    LOG_WARN("upload session journal invalid: %s", journal_path_.c_str());
+    return false;
+  }
+  if (data.compare(pos, md5_len, md5_) != 0) {
+    LOG_WARN("upload session journal mismatch: %s", journal_path_.c_str());
+    return false;
+  }
+  pos += md5_len;
+  if (!readU32(data, pos, count)) {
+    return false;
+  }
+
+  std::vector<Range> ranges;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint64_t begin = 0, end = 0;
+    if (!readU64(data, pos, begin) || !readU64(data, pos, end) || begin >= end || end > file_size_) {
+      LOG_WARN("upload session journal broken range: %s", journal_path_.c_str());
+      return false;
+    }
+    ranges.emplace_back(begin, end);
+  }
+
+  upload_id_ = upload_id;
+  for (auto &range : ranges) {
+    addRange(range.first, range.second - range.first);
+  }
+  dirty_bytes_.store(0);
+  return true;
+}
+
+bool UploadSession::writeJournal(const std::vector<Range> &ranges) {
+  std::string data;
+  appendU32(data, kJournalMagic);
+  appendU32(data, kJournalVersion);
+  appendU64(data, upload_id_);
+  appendU64(data, file_size_);
+  appendU32(data, md5_.size());
+  data.append(md5_);
+  appendU32(data, ranges.size());
+  for (auto &range : ranges) {
+    appendU64(data, range.first);
+    appendU64(data, range.second);
+  }
+
+  // 写入临时文件，落盘后再重命名，重命名是原子的，崩溃时日志文件要么是旧的，要么是新的
+  std::string tmp_path = journal_path_ + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    LOG_ERROR("upload session open journal error: %s", strerror(errno));
+    return false;
+  }
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("upload session write journal error: %s", strerror(errno));
+      ::close(fd);
+      return false;
+    }
+    written += n;
+  }
+  if (fsync(fd) != 0) {
+    ::close(fd);
+    return false;
+  }
+  ::close(fd);
+
+  if (rename(tmp_path.c_str(), journal_path_.c_str()) != 0) {
+    LOG_ERROR("upload session rename journal error: %s", strerror(errno));
+    return false;
+  }
+  // 同步目录，保证重命名落盘
+  std::string dir = journal_path_.substr(0, journal_path_.find_last_of('/'));
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    ::close(dir_fd);
+  }
+  return true;
+}
+
+int64_t UploadSession::nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
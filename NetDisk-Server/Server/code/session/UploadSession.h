@@ -0,0 +1,151 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <openssl/evp.h>
+#include "FileWriter.h"
+
+// 上传会话（线程安全），用于实现断点续传
+// 记录一个上传任务已经写入的数据区间，并定期持久化到数据文件旁的日志文件（rootfiles/<user>/<md5>.session）
+// 服务端崩溃或客户端断线后，可以根据日志文件恢复，客户端只需补传缺失的区间
+// 同一个文件（用户 + 哈希）同一时刻只有一个会话对象，多个连接共享（断线重连，或客户端开启多个连接并行上传不相交的区间）
+// 接收数据的同时增量计算 SHA-256：按顺序到达的数据直接从接收缓冲区计算，乱序到达的数据等前面的空缺补齐后再从文件读回计算，
+// 上传完成时与客户端声明的哈希比较，不一致则拒绝入库（该哈希是快传和去重的依据）
+class UploadSession {
+ public:
+  using Range = std::pair<uint64_t, uint64_t>;  // 数据区间 [begin, end)
+
+  // 获取上传会话：如果已有活动会话直接返回；否则尝试从日志文件恢复；都没有则新建
+  static std::shared_ptr<UploadSession> acquire(const std::string &user, const std::string &md5, uint64_t file_size);
+  // 只获取活动会话（多连接并行上传时，后加入的连接使用），不存在返回nullptr
+  static std::shared_ptr<UploadSession> find(const std::string &user, const std::string &md5, uint64_t file_size);
+  // 读取配置后调用：未完成的上传超过 hours 小时没有更新即视为放弃，0 表示不清除
+  static void setExpireHours(int hours);
+  // 清除过期的上传（启动时和定期调用）：没有活动会话、超过保留时间的会话日志连同数据文件一起删除，以及批量上传遗留的临时文件；
+  // 没有会话日志的数据文件（第一次持久化之前崩溃）只在数据库中没有引用时删除，迁移失败的旧文件仍在使用
+  static void cleanExpired();
+
+  ~UploadSession();
+
+  uint64_t getUploadId();
+  uint64_t getFileSize();
+  std::string getFilePath();      // 数据文件路径
+  std::string getJournalPath();   // 日志文件路径
+
+  // 打开数据文件（共享会话的连接只会打开一次），写入引擎由配置决定
+  bool openFile();
+  // 写入 [offset, offset+len) 并记录已接收区间，added 返回新增的字节数，同时更新哈希
+  bool write(uint64_t offset, const char *data, size_t len, uint64_t &added);
+  // 将已写入的数据落盘
+  bool syncFile();
+
+  // 记录 [offset, offset+len) 已经写入，返回新增的字节数（重传的数据不会重复计数）
+  uint64_t addRange(uint64_t offset, uint64_t len);
+  uint64_t getReceivedBytes();
+  bool isComplete();
+  // 返回已接收的区间，最多 max_count 个（超出的部分客户端会重传，不影响正确性）
+  std::vector<Range> getRanges(size_t max_count);
+  // 清空已接收的区间（客户端要求从头上传）
+  void reset();
+
+  // 距离上次持久化的数据量或时间超过阈值时，持久化会话
+  bool maybeCheckpoint();
+  // 持久化会话：先将数据文件落盘，再原子地替换日志文件，保证日志记录的区间一定已经写入磁盘
+  bool checkpoint();
+
+  // 标记上传完成，只有第一个调用者返回true（多个连接共享会话时，只允许一个线程写数据库）
+  bool setFinish();
+  bool getIsFinish();
+  // 上传完成后删除日志文件
+  void removeJournal();
+
+  // 记录接收的数据量，raw 为原始字节数，wire 为实际传输的字节数（压缩后），用于统计压缩效果
+  void addTransferBytes(uint64_t raw, uint64_t wire);
+  void getTransferBytes(uint64_t &raw, uint64_t &wire);
+
+  // 差量上传的旧版本（发送签名时记录，执行复制指令时从该内容复制数据）
+  void setDeltaBase(const std::string &md5, uint64_t file_size);
+  bool getDeltaBase(std::string &md5, uint64_t &file_size);
+
+  // 用户已经引用的块（块清单查询时从用户的文件清单收集，只收集一次），没有收集时返回nullptr
+  void setOwnedChunks(std::shared_ptr<const std::unordered_set<std::string>> chunks);
+  std::shared_ptr<const std::unordered_set<std::string>> getOwnedChunks();
+
+  // 计算剩余未计算的数据，并与声明的哈希比较，一致返回true（上传完成后调用）
+  bool verifyHash();
+  // 丢弃已经接收的数据（哈希校验失败），清空区间并删除日志，最后一个连接断开时删除数据文件
+  void discard();
+
+ private:
+  UploadSession(const std::string &user, const std::string &md5, uint64_t file_size);
+
+  bool load();    // 从日志文件恢复
+  void closeFile();   // 最后一个连接断开时（析构）关闭数据文件：已完成的关闭，没有数据的删除，否则保存会话
+  bool doCheckpoint();   // 调用前需持有 checkpoint_mtx_
+  bool writeJournal(const std::vector<Range> &ranges);
+  uint64_t contiguousEnd(uint64_t pos);   // 返回从 pos 开始连续接收的数据的结束位置
+  // 将 [hash_pos_, 连续接收的结束位置) 加入哈希计算，data 为刚写入的 [offset, offset+len) 的数据
+  // max_reread 为最多从文件读回计算的字节数，调用前需持有 hash_mtx_
+  bool updateHash(uint64_t offset, const char *data, size_t len, uint64_t max_reread);
+  void resetHash();   // 调用前需持有 hash_mtx_
+  static int64_t nowMs();
+
+ private:
+  static const uint32_t kJournalMagic;
+  static const uint32_t kJournalVersion;
+  static const uint64_t kCheckpointBytes;   // 持久化的数据量阈值
+  static const int64_t kCheckpointIntervalMs;   // 持久化的时间阈值（毫秒）
+  static const uint64_t kHashRereadBytes;       // 每次写入最多从文件读回计算哈希的数据量，避免长时间阻塞工作线程
+
+  std::string key_;           // 会话键：用户名/哈希
+  std::string file_path_;
+  std::string journal_path_;
+  std::string md5_;
+  uint64_t upload_id_{ 0 };
+  uint64_t file_size_{ 0 };
+
+  std::unique_ptr<FileWriter> writer_{ nullptr };   // 数据文件写入引擎
+  std::mutex writer_mtx_;   // 保护 writer_ 的创建
+
+  std::map<uint64_t, uint64_t> ranges_;   // 已接收区间，begin -> end，区间互不相交且不相邻
+  uint64_t received_bytes_{ 0 };
+  std::mutex ranges_mtx_;
+
+  std::atomic<uint64_t> dirty_bytes_{ 0 };    // 上次持久化后新增的字节数
+  std::atomic<int64_t> last_checkpoint_ms_{ 0 };  // 上次持久化的时间（毫秒）
+  std::mutex checkpoint_mtx_;
+
+  std::atomic<bool> is_finish_{ false };
+
+  std::atomic<uint64_t> raw_bytes_{ 0 };
+  std::atomic<uint64_t> wire_bytes_{ 0 };
+
+  std::string delta_base_md5_;
+  uint64_t delta_base_size_{ 0 };
+  std::mutex delta_mtx_;
+
+  std::shared_ptr<const std::unordered_set<std::string>> owned_chunks_;
+  std::mutex owned_chunks_mtx_;
+
+  // 哈希计算，只计算从文件开头连续接收的部分 [0, hash_pos_)
+  EVP_MD_CTX *hash_ctx_{ nullptr };
+  uint64_t hash_pos_{ 0 };
+  uint64_t hash_inline_bytes_{ 0 };   // 直接从接收缓冲区计算的字节数
+  uint64_t hash_reread_bytes_{ 0 };   // 从文件读回计算的字节数
+  std::vector<char> hash_buf_;        // 从文件读回数据的缓冲区
+  std::mutex hash_mtx_;               // 持有者负责推进哈希，写入时只尝试加锁，不阻塞其它连接的写入
+
+  static std::atomic<int64_t> expire_seconds_;  // 未完成上传的保留时间（秒）
+  static std::mutex registry_mtx_;
+  static std::unordered_map<std::string, std::weak_ptr<UploadSession>> registry_;   // 活动会话表
+  // 正在析构（保存会话、删除文件）的会话键，同一个文件的 acquire 和过期清除等待它完成，其它文件不受影响
+  static std::unordered_set<std::string> closing_;
+  static std::condition_variable closing_cv_;
+};
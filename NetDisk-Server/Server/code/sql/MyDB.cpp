@@ -1,9 +1,13 @@
 #include "MyDB.h"
 #include "SqlConnPool.h"
+#include "BlobStore.h"
 #include <iostream>
 #include <cassert>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+#include <unordered_map>
+#include <iterator>
 
 // 初始化静态成员
 std::string MyDB::table_name = "Users";
@@ -113,6 +117,258 @@ std::uint64_t MyDB::insertFileData(const std::string &user, const std::string fi
   return fileid;
 }
 
+// 批量插入同一个目录下的多个文件：文件ID连续分配，所有文件在一个事务中插入，已用空间只更新一次
+// 先锁定用户记录，同一用户的并发插入依次进行，不会分配到相同的文件ID
+bool MyDB::insertFileBatch(const std::string &user, const std::uint64_t parent_dir_id, const std::vector<NewFileInfo> &files, std::vector<std::uint64_t> &ids) {
+  ids.clear();
+  if (files.empty()) {
+    return true;
+  }
+
+  auto insertAll = [&]() -> bool {
+    std::vector<std::string> ret;
+    if (executeSelect("SELECT usedCapacity FROM Users WHERE User=? FOR UPDATE", {user}, ret) <= 0) {
+      return false;
+    }
+
+    //1、检查父ID是否存在，不存在保存在根文件夹
+    int dir_grade = 0;
+    std::string sql = "select DirGrade FROM FileDir where User=? and Fileid = ? and FileType ='d'";
+    if (executeSelect(sql, {user, std::to_string(parent_dir_id)}, ret) > 0) {
+      dir_grade = stoi(ret[0]) + 1;
+    }
+
+    //2、查询文件当前最大ID
+    uint64_t fileid = 1;
+    sql = "SELECT Fileid FROM FileDir WHERE User=? ORDER BY Fileid DESC LIMIT 1";
+    if (executeSelect(sql, {user}, ret) > 0) {
+      fileid = std::stoull(ret[0]) + 1;
+    }
+
+    //3、分组插入文件信息，每条语句插入多行
+    const size_t kBatch = 256;
+    uint64_t total_size = 0;
+    for (size_t begin = 0; begin < files.size(); begin += kBatch) {
+      size_t end = std::min(files.size(), begin + kBatch);
+      sql = "INSERT INTO FileDir (Fileid,User,FileName,DirGrade,FileType,MD5,FileSize,ParentDir) VALUES "
+          + makePlaceholders(end - begin, "(?,?,?,?,?,?,?,?)");
+      std::vector<std::string> params;
+      params.reserve(8 * (end - begin));
+      for (size_t i = begin; i < end; ++i) {
+        params.push_back(std::to_string(fileid + i));
+        params.push_back(user);
+        params.push_back(files[i].file_name);
+        params.push_back(std::to_string(dir_grade));
+        params.push_back(files[i].suffix);
+        params.push_back(files[i].md5);
+        params.push_back(std::to_string(files[i].file_size));
+        params.push_back(std::to_string(parent_dir_id));
+        total_size += files[i].file_size;
+      }
+      if (executeAlter(sql, params) <= 0) {
+        return false;
+      }
+    }
+
+    //4、更新已用空间
+    if (executeAlter("UPDATE Users SET usedCapacity=usedCapacity+? where User=?", {std::to_string(total_size), user}) < 0) {
+      return false;
+    }
+    for (size_t i = 0; i < files.size(); ++i) {
+      ids.push_back(fileid + i);
+    }
+    return true;
+  };
+
+  bool ok = runTransaction(insertAll);
+  if (!ok) {
+    ids.clear();
+  }
+  return ok;
+}
+
+// 批量删除文件和文件夹：文件夹按层展开（每层一次查询，而不是每个文件夹一次），所有记录在一个事务中删除，已用空间只更新一次
+// 事务提交后由调用者释放 released 中的内容引用（每个被删除的文件一项）
+bool MyDB::deleteFileBatch(const std::string &user, const std::vector<std::uint64_t> &ids, std::vector<bool> &results, std::vector<std::string> &released) {
+  results.assign(ids.size(), false);
+  released.clear();
+  if (ids.empty()) {
+    return true;
+  }
+
+  std::vector<bool> found;
+  auto deleteAll = [&]() -> bool {
+    found.assign(ids.size(), false);
+    released.clear();
+    std::vector<std::string> ret;
+    if (executeSelect("SELECT usedCapacity FROM Users WHERE User=? FOR UPDATE", {user}, ret) <= 0) {
+      return false;
+    }
+
+    //1、查询请求删除的条目
+    std::vector<std::vector<std::string>> rows;
+    if (!selectByIds("SELECT Fileid, FileType, MD5, FileSize FROM FileDir WHERE User=? AND Fileid IN ", user, ids, rows)) {
+      return false;
+    }
+    std::unordered_set<std::uint64_t> deleted;    // 要删除的所有记录
+    std::vector<std::uint64_t> frontier;          // 待展开的文件夹
+    uint64_t total_size = 0;
+    auto addRow = [&](const std::vector<std::string> &row) {
+      uint64_t id = std::stoull(row[0]);
+      if (!deleted.insert(id).second) {
+        return;
+      }
+      if (row[1] == "d") {
+        frontier.push_back(id);
+      }
+      else {
+        released.push_back(row[2]);
+        total_size += std::stoull(row[3]);
+      }
+    };
+    for (auto &row : rows) {
+      addRow(row);
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+      found[i] = (deleted.count(ids[i]) != 0);
+    }
+
+    //2、逐层展开文件夹
+    while (!frontier.empty()) {
+      std::vector<std::uint64_t> parents;
+      parents.swap(frontier);
+      if (!selectByIds("SELECT Fileid, FileType, MD5, FileSize FROM FileDir WHERE User=? AND ParentDir IN ", user, parents, rows)) {
+        return false;
+      }
+      for (auto &row : rows) {
+        addRow(row);
+      }
+    }
+
+    //3、分组删除记录，更新已用空间
+    std::vector<std::uint64_t> all(deleted.begin(), deleted.end());
+    if (!alterByIds("DELETE FROM FileDir WHERE User=? AND Fileid IN ", {user}, all)) {
+      return false;
+    }
+    if (total_size > 0 && executeAlter("UPDATE Users SET usedCapacity=usedCapacity-? where User=?", {std::to_string(total_size), user}) < 0) {
+      return false;
+    }
+    return true;
+  };
+
+  if (!runTransaction(deleteAll)) {
+    released.clear();
+    return false;
+  }
+  results = found;
+  return true;
+}
+
+// 批量移动文件和文件夹到目标文件夹：不能移动到自身或自己的子文件夹中；被移动文件夹的子孙按层级差调整目录等级
+bool MyDB::moveFileBatch(const std::string &user, const std::vector<std::uint64_t> &ids, std::uint64_t target_dir_id, std::vector<bool> &results) {
+  results.assign(ids.size(), false);
+  if (ids.empty()) {
+    return true;
+  }
+
+  std::vector<bool> moved;
+  auto moveAll = [&]() -> bool {
+    moved.assign(ids.size(), false);
+    std::vector<std::string> ret;
+    if (executeSelect("SELECT usedCapacity FROM Users WHERE User=? FOR UPDATE", {user}, ret) <= 0) {
+      return false;
+    }
+
+    //1、目标文件夹的等级和所有祖先（包括自身），文件夹不能移动到这些文件夹中
+    int64_t new_grade = 0;
+    std::unordered_set<std::uint64_t> ancestors;
+    if (target_dir_id != 0) {
+      if (executeSelect("SELECT DirGrade FROM FileDir WHERE User=? AND Fileid=? AND FileType='d'", {user, std::to_string(target_dir_id)}, ret) <= 0) {
+        return true;    // 目标文件夹不存在，全部失败
+      }
+      new_grade = std::stoll(ret[0]) + 1;
+      for (uint64_t cur = target_dir_id; cur != 0 && ancestors.insert(cur).second; ) {
+        if (executeSelect("SELECT ParentDir FROM FileDir WHERE User=? AND Fileid=?", {user, std::to_string(cur)}, ret) <= 0) {
+          break;
+        }
+        cur = std::stoull(ret[0]);
+      }
+    }
+
+    //2、查询请求移动的条目
+    std::vector<std::vector<std::string>> rows;
+    if (!selectByIds("SELECT Fileid, FileType, DirGrade FROM FileDir WHERE User=? AND Fileid IN ", user, ids, rows)) {
+      return false;
+    }
+    std::vector<std::uint64_t> targets;                       // 可以移动的条目
+    std::unordered_map<std::uint64_t, int64_t> dir_delta;     // 被移动的文件夹的等级变化
+    for (auto &row : rows) {
+      uint64_t id = std::stoull(row[0]);
+      if (row[1] == "d") {
+        if (ancestors.count(id) != 0) {
+          continue;
+        }
+        dir_delta[id] = new_grade - std::stoll(row[2]);
+      }
+      targets.push_back(id);
+    }
+    std::unordered_set<std::uint64_t> target_set(targets.begin(), targets.end());
+
+    //3、移动条目
+    if (!alterByIds("UPDATE FileDir SET ParentDir=?, DirGrade=? WHERE User=? AND Fileid IN ", {std::to_string(target_dir_id), std::to_string(new_grade), user}, targets)) {
+      return false;
+    }
+
+    //4、逐层调整子孙的等级，按等级变化分组更新
+    std::unordered_map<std::uint64_t, int64_t> frontier;
+    std::unordered_set<std::uint64_t> visited(target_set);
+    for (auto &it : dir_delta) {
+      if (it.second != 0) {
+        frontier.insert(it);
+      }
+    }
+    while (!frontier.empty()) {
+      std::vector<std::uint64_t> parents;
+      for (auto &it : frontier) {
+        parents.push_back(it.first);
+      }
+      if (!selectByIds("SELECT Fileid, FileType, ParentDir FROM FileDir WHERE User=? AND ParentDir IN ", user, parents, rows)) {
+        return false;
+      }
+      std::unordered_map<std::uint64_t, int64_t> next;
+      std::unordered_map<int64_t, std::vector<std::uint64_t>> groups;
+      for (auto &row : rows) {
+        uint64_t id = std::stoull(row[0]);
+        if (!visited.insert(id).second) {   // 数据异常（目录成环）时不重复处理
+          continue;
+        }
+        int64_t delta = frontier[std::stoull(row[2])];
+        groups[delta].push_back(id);
+        if (row[1] == "d") {
+          next[id] = delta;
+        }
+      }
+      for (auto &group : groups) {
+        if (!alterByIds("UPDATE FileDir SET DirGrade=DirGrade+(?) WHERE User=? AND Fileid IN ", {std::to_string(group.first), user}, group.second)) {
+          return false;
+        }
+      }
+      frontier.swap(next);
+    }
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+      moved[i] = (target_set.count(ids[i]) != 0);
+    }
+    return true;
+  };
+
+  if (!runTransaction(moveAll)) {
+    return false;
+  }
+  results = moved;
+  return true;
+}
+
 // 删除单个文件
 bool MyDB::deleteOneFile(const std::string &user, std::uint64_t &file_id) {
   if (file_id == 0) {
@@ -151,9 +407,15 @@ bool MyDB::deleteOneFile(const std::string &user, std::uint64_t &file_id) {
     return 0;
   }
 
-  //如果是最后一个，则删除文件
+  // 释放全局存储中的引用，最后一个引用被释放时删除内容文件
+  int release_res = BlobStore::release(*this, md5);
+  if (release_res >= 0) {
+    return release_res > 0;
+  }
+
+  //没有引用记录（未迁移的旧文件），如果是该用户的最后一个，则删除用户目录下的文件
   if (file_count.size() == 1) {
-    std::string file_path = std::string(ROOTFILEPATH) + "/" + user + "/" + md5;
+    std::string file_path = BlobStore::getLegacyPath(user, md5);
     int fd = open(file_path.c_str(), O_RDONLY);  //尝试以独占打开文件，如果失败说明正在使用，不能删除
     if (fd != -1) {
       close(fd);
@@ -229,17 +491,16 @@ bool MyDB::getFileMd5(const std::string &user, const std::uint64_t &file_id, std
 }
 
 // 检查空间是否足够
-bool MyDB::getIsEnoughSpace(const std::string &user, const std::string &pwd, std::uint64_t file_size) {
-  // 查询用户的总容量和已使用容量
-  std::string sql = "SELECT CapacitySum, usedCapacity FROM Users WHERE User=? AND Password=?";
+bool MyDB::getIsEnoughSpace(const std::string &user, std::uint64_t file_size) {
+  // 查询用户的总容量和已使用容量，上传请求可能使用会话令牌认证，不再核对密码
+  std::string sql = "SELECT CapacitySum, usedCapacity FROM Users WHERE User=?";
 
-  std::vector<std::string> parmas(2);
+  std::vector<std::string> parmas(1);
   parmas[0] = user;
-  parmas[1] = pwd;
 
   // 存储查询结果
   std::vector<std::string> ret;
-  if (executeSelect(sql, parmas, ret) <= 0) { // 用户不存在或密码错误
+  if (executeSelect(sql, parmas, ret) <= 0) { // 用户不存在
     return false;
   }
 
@@ -274,6 +535,175 @@ bool MyDB::getFileExist(const std::string &user, const std::string &md5) {
   return executeSelect(sql, params, result) > 0;
 }
 
+// 查询全局存储中是否存在该内容，存在则用户拥有该内容或证明持有文件后可以秒传
+bool MyDB::getBlobExist(const std::string &md5) {
+  std::string sql = "SELECT RefCount FROM Blobs WHERE MD5=? AND RefCount>0";
+  std::vector<std::string> params = { md5 };
+  std::vector<std::string> result;
+  return executeSelect(sql, params, result) > 0;
+}
+
+// 批量查询全局存储中已经存在的内容，exist 返回存在的哈希
+// 批量上传不做持有证明，只返回该用户已经有文件引用的内容（只知道哈希不能取得其它用户的文件）
+bool MyDB::getExistBlobs(const std::string &user, const std::vector<std::string> &hashes, std::unordered_set<std::string> &exist) {
+  exist.clear();
+  const size_t kBatch = 256;
+  for (size_t begin = 0; begin < hashes.size(); begin += kBatch) {
+    size_t end = std::min(hashes.size(), begin + kBatch);
+    std::vector<std::string> params = { user };
+    params.insert(params.end(), hashes.begin() + begin, hashes.begin() + end);
+    std::string sql = "SELECT DISTINCT Blobs.MD5 FROM Blobs JOIN FileDir ON FileDir.MD5=Blobs.MD5 WHERE Blobs.RefCount>0 AND FileDir.User=? AND FileDir.FileType!='d' AND Blobs.MD5 IN ("
+                      + makePlaceholders(end - begin, "?") + ")";
+    std::vector<std::vector<std::string>> ret;
+    if (executeSelect(sql, params, ret) < 0) {
+      return false;
+    }
+    for (auto &row : ret) {
+      exist.insert(row[0]);
+    }
+  }
+  return true;
+}
+
+// 查询用户的文件引用的全部内容，用于把块存储的复用限制在用户自己的块
+bool MyDB::getUserBlobs(const std::string &user, std::vector<std::string> &md5s) {
+  md5s.clear();
+  std::string sql = "SELECT DISTINCT MD5 FROM FileDir WHERE User=? AND FileType!='d'";
+  std::vector<std::vector<std::string>> ret;
+  if (executeSelect(sql, { user }, ret) < 0) {
+    return false;
+  }
+  for (auto &row : ret) {
+    md5s.push_back(std::move(row[0]));
+  }
+  return true;
+}
+
+// 增加count个引用，内容第一次入库时插入记录
+bool MyDB::addBlobRef(const std::string &md5, std::uint64_t file_size, std::uint64_t count) {
+  std::string sql = "INSERT INTO Blobs (MD5, FileSize, RefCount) VALUES (?, ?, ?) ON DUPLICATE KEY UPDATE RefCount=RefCount+?";
+  std::vector<std::string> params = { md5, std::to_string(file_size), std::to_string(count), std::to_string(count) };
+  return executeAlter(sql, params) > 0;
+}
+
+// 秒传时增加一个引用，内容已经被删除（引用数为0或没有记录）返回false
+bool MyDB::acquireBlobRef(const std::string &md5) {
+  std::string sql = "UPDATE Blobs SET RefCount=RefCount+1 WHERE MD5=? AND RefCount>0";
+  std::vector<std::string> params = { md5 };
+  return executeAlter(sql, params) > 0;
+}
+
+// 减少count个引用，返回剩余的引用数；引用数减为0时删除记录；没有记录返回-1
+// 读取、修改和删除在一个事务中完成（锁定该行），引用数为0的记录不会残留，也不会与并发的秒传交错
+std::int64_t MyDB::releaseBlobRef(const std::string &md5, std::uint64_t count) {
+  std::int64_t ref_count = -1;
+  auto releaseRef = [&]() {
+    std::vector<std::string> ret;
+    if (executeSelect("SELECT RefCount FROM Blobs WHERE MD5=? AND RefCount>0 FOR UPDATE", {md5}, ret) <= 0) {
+      return false;   // 没有记录
+    }
+    std::uint64_t current = std::stoull(ret[0]);
+    ref_count = (current > count ? current - count : 0);
+    if (ref_count > 0) {
+      return executeAlter("UPDATE Blobs SET RefCount=? WHERE MD5=?", {std::to_string(ref_count), md5}) > 0;
+    }
+    return executeAlter("DELETE FROM Blobs WHERE MD5=?", {md5}) > 0;
+  };
+  if (!runTransaction(releaseRef)) {
+    return -1;
+  }
+  return ref_count;
+}
+
+// 按数据库中引用该内容的文件数（所有用户）设置引用数，不存在则插入；重复执行结果相同
+bool MyDB::resetBlobRef(const std::string &md5, std::uint64_t file_size) {
+  auto resetRef = [&]() {
+    std::vector<std::string> ret;
+    if (executeSelect("SELECT COUNT(*) FROM FileDir WHERE MD5=? AND FileType!='d'", {md5}, ret) <= 0) {
+      return false;
+    }
+    std::string count = ret[0];
+    return executeAlter("INSERT INTO Blobs (MD5, FileSize, RefCount) VALUES (?, ?, ?) ON DUPLICATE KEY UPDATE RefCount=?",
+                        {md5, std::to_string(file_size), count, count}) >= 0;
+  };
+  return runTransaction(resetRef);
+}
+
+// 查询用户引用该内容的文件数（迁移旧文件时使用）
+std::uint64_t MyDB::getUserFileCount(const std::string &user, const std::string &md5) {
+  std::string sql = "SELECT COUNT(*) FROM FileDir WHERE User=? AND MD5=? AND FileType!='d'";
+  std::vector<std::string> params = { user, md5 };
+  std::vector<std::string> ret;
+  if (executeSelect(sql, params, ret) <= 0) {
+    return 0;
+  }
+  return std::stoull(ret[0]);
+}
+
+// 查询目录下最新上传的同名文件，用作差量上传的旧版本
+bool MyDB::getSameNameFile(const std::string &user, std::uint64_t parent_dir_id, const std::string &file_name, std::string &md5, std::uint64_t &file_size) {
+  std::string sql = "SELECT MD5, FileSize FROM FileDir WHERE User=? AND ParentDir=? AND FileName=? AND FileType!='d' ORDER BY FileDate DESC, Fileid DESC LIMIT 1";
+  std::vector<std::string> params = { user, std::to_string(parent_dir_id), file_name };
+  std::vector<std::string> ret;
+  if (executeSelect(sql, params, ret) <= 0 || ret.size() < 2) {
+    return false;
+  }
+  md5 = std::move(ret[0]);
+  file_size = std::stoull(ret[1]);
+  return true;
+}
+
+// 批量增加块的引用，每条语句最多处理 kBatch 个块，减少与数据库的交互次数
+bool MyDB::addChunkRefs(const std::vector<std::pair<std::string, std::uint32_t>> &chunks) {
+  const size_t kBatch = 256;
+  for (size_t begin = 0; begin < chunks.size(); begin += kBatch) {
+    size_t end = std::min(chunks.size(), begin + kBatch);
+    std::string sql = "INSERT INTO Chunks (Hash, ChunkSize, RefCount) VALUES " + makePlaceholders(end - begin, "(?, ?, 1)")
+                    + " ON DUPLICATE KEY UPDATE RefCount=RefCount+1";
+    std::vector<std::string> params;
+    params.reserve(2 * (end - begin));
+    for (size_t i = begin; i < end; ++i) {
+      params.push_back(chunks[i].first);
+      params.push_back(std::to_string(chunks[i].second));
+    }
+    if (executeAlter(sql, params) <= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// 批量减少块的引用，引用数减为0的块从表中删除，并通过freed返回，由调用者删除块文件
+bool MyDB::releaseChunkRefs(const std::vector<std::string> &hashes, std::vector<std::string> &freed) {
+  freed.clear();
+  const size_t kBatch = 256;
+  for (size_t begin = 0; begin < hashes.size(); begin += kBatch) {
+    size_t end = std::min(hashes.size(), begin + kBatch);
+    std::vector<std::string> params(hashes.begin() + begin, hashes.begin() + end);
+    std::string in_list = "(" + makePlaceholders(end - begin, "?") + ")";
+
+    std::string sql = "UPDATE Chunks SET RefCount=RefCount-1 WHERE RefCount>0 AND Hash IN " + in_list;
+    if (executeAlter(sql, params) < 0) {
+      return false;
+    }
+
+    sql = "SELECT Hash FROM Chunks WHERE RefCount=0 AND Hash IN " + in_list;
+    std::vector<std::vector<std::string>> ret;
+    if (executeSelect(sql, params, ret) < 0) {
+      return false;
+    }
+    for (auto &row : ret) {
+      freed.push_back(row[0]);
+    }
+
+    sql = "DELETE FROM Chunks WHERE RefCount=0 AND Hash IN " + in_list;
+    if (executeAlter(sql, params) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
 //传递用户名，和保存返回结果的文件信息结构体容器，返回用户在数据库中的文件信息。
 bool MyDB::getUserAllFileInfo(const std::string &user, std::vector<FileInfo> &vet) {
   vet.clear();
@@ -301,6 +731,87 @@ bool MyDB::getUserAllFileInfo(const std::string &user, std::vector<FileInfo> &ve
   return true;
 }
 
+// 展开要下载的文件：ids 中的文件直接下载，文件夹按层递归展开，文件夹中的文件路径带上文件夹名
+// 每层的文件夹一起查询子项（每次最多 kBatch 个），文件数超过 max_files 返回false
+bool MyDB::getDownloadFiles(const std::string &user, const std::vector<std::uint64_t> &ids, size_t max_files, std::vector<DownFileInfo> &files) {
+  files.clear();
+  const size_t kBatch = 256;
+  // 一行的结果：Fileid, FileName, FileType, FileSize, MD5, ParentDir
+  std::unordered_map<std::uint64_t, std::string> dirs;    // 当前一层的文件夹：文件夹ID -> 路径前缀
+  auto addRow = [&](const std::vector<std::string> &row, const std::string &prefix,
+                    std::unordered_map<std::uint64_t, std::string> &next_dirs) {
+    std::uint64_t file_id = std::stoull(row[0]);
+    if (row[2] == "d") {
+      next_dirs.emplace(file_id, prefix + row[1] + "/");
+      return true;
+    }
+    if (files.size() >= max_files || row[4].size() != MULTI_HASH_LEN || prefix.size() + row[1].size() > MAX_MULTI_PATH_LEN) {
+      return false;
+    }
+    files.push_back(DownFileInfo{ file_id, prefix + row[1], row[4], std::stoull(row[3]) });
+    return true;
+  };
+
+  try {
+    // 第一层为请求的ID
+    for (size_t begin = 0; begin < ids.size(); begin += kBatch) {
+      size_t end = std::min(ids.size(), begin + kBatch);
+      std::string sql = "SELECT Fileid, FileName, FileType, FileSize, MD5, ParentDir FROM FileDir WHERE User=? AND Fileid IN ("
+                      + makePlaceholders(end - begin, "?") + ")";
+      std::vector<std::string> params{ user };
+      for (size_t i = begin; i < end; ++i) {
+        params.push_back(std::to_string(ids[i]));
+      }
+      std::vector<std::vector<std::string>> ret;
+      if (executeSelect(sql, params, ret) < 0) {
+        return false;
+      }
+      for (auto &row : ret) {
+        if (!addRow(row, "", dirs)) {
+          return false;
+        }
+      }
+    }
+
+    // 逐层展开文件夹
+    while (!dirs.empty()) {
+      std::vector<std::uint64_t> dir_ids;
+      dir_ids.reserve(dirs.size());
+      for (auto &dir : dirs) {
+        dir_ids.push_back(dir.first);
+      }
+      std::unordered_map<std::uint64_t, std::string> next_dirs;
+      for (size_t begin = 0; begin < dir_ids.size(); begin += kBatch) {
+        size_t end = std::min(dir_ids.size(), begin + kBatch);
+        std::string sql = "SELECT Fileid, FileName, FileType, FileSize, MD5, ParentDir FROM FileDir WHERE User=? AND ParentDir IN ("
+                        + makePlaceholders(end - begin, "?") + ")";
+        std::vector<std::string> params{ user };
+        for (size_t i = begin; i < end; ++i) {
+          params.push_back(std::to_string(dir_ids[i]));
+        }
+        std::vector<std::vector<std::string>> ret;
+        if (executeSelect(sql, params, ret) < 0) {
+          return false;
+        }
+        for (auto &row : ret) {
+          if (!addRow(row, dirs[std::stoull(row[5])], next_dirs)) {
+            return false;
+          }
+        }
+      }
+      dirs.swap(next_dirs);
+    }
+  }
+  catch (const std::exception &e) {
+    std::cerr << "MyDB::getDownloadFiles: " << e.what() << std::endl;
+    return false;
+  }
+
+  // 按路径排序，同一个文件夹中的文件连续发送
+  std::sort(files.begin(), files.end(), [](const DownFileInfo &a, const DownFileInfo &b) { return a.path < b.path; });
+  return true;
+}
+
 // 通用查询，传入sql指令和参数，结果保存在result，只保存一条数据
 int MyDB::executeSelect(const std::string &sql, const std::vector<std::string> &params, std::vector<std::string>& result) {
   try {
@@ -379,4 +890,95 @@ int MyDB::executeAlter(const std::string &sql, const std::vector<std::string> &p
     std::cerr << "SQL error: " << e.what() << std::endl;
     return -1;
   }
-}
\ No newline at end of file
+}
+
+// 生成count个item，用逗号分隔
+// 在事务中执行 work，work 返回true时提交，返回false或抛出异常时回滚
+bool MyDB::runTransaction(const std::function<bool()> &work) {
+  bool ok = false;
+  try {
+    conn_->setAutoCommit(false);
+    ok = work();
+    if (ok) {
+      conn_->commit();
+    }
+    else {
+      conn_->rollback();
+    }
+  }
+  catch (sql::SQLException& e) {
+    std::cerr << "SQL error: " << e.what() << std::endl;
+    ok = false;
+    try {
+      conn_->rollback();
+    }
+    catch (sql::SQLException&) {
+    }
+  }
+  catch (std::exception& e) {   // 结果转换失败等
+    std::cerr << "transaction error: " << e.what() << std::endl;
+    ok = false;
+    try {
+      conn_->rollback();
+    }
+    catch (sql::SQLException&) {
+    }
+  }
+  // 连接会归还到连接池，恢复自动提交
+  try {
+    conn_->setAutoCommit(true);
+  }
+  catch (sql::SQLException& e) {
+    std::cerr << "SQL error: " << e.what() << std::endl;
+  }
+  return ok;
+}
+
+// 按ID分组查询，sql_prefix 以 "IN " 结尾，第一个参数为用户名，所有分组的结果合并到 result
+bool MyDB::selectByIds(const std::string &sql_prefix, const std::string &user, const std::vector<std::uint64_t> &ids, std::vector<std::vector<std::string>> &result) {
+  result.clear();
+  const size_t kBatch = 256;
+  for (size_t begin = 0; begin < ids.size(); begin += kBatch) {
+    size_t end = std::min(ids.size(), begin + kBatch);
+    std::vector<std::string> params;
+    params.reserve(1 + end - begin);
+    params.push_back(user);
+    for (size_t i = begin; i < end; ++i) {
+      params.push_back(std::to_string(ids[i]));
+    }
+    std::vector<std::vector<std::string>> rows;
+    if (executeSelect(sql_prefix + "(" + makePlaceholders(end - begin, "?") + ")", params, rows) < 0) {
+      return false;
+    }
+    result.insert(result.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+  }
+  return true;
+}
+
+// 按ID分组执行修改语句，sql_prefix 以 "IN " 结尾，params 为ID列表之前的参数
+bool MyDB::alterByIds(const std::string &sql_prefix, const std::vector<std::string> &params, const std::vector<std::uint64_t> &ids) {
+  const size_t kBatch = 256;
+  for (size_t begin = 0; begin < ids.size(); begin += kBatch) {
+    size_t end = std::min(ids.size(), begin + kBatch);
+    std::vector<std::string> all(params);
+    for (size_t i = begin; i < end; ++i) {
+      all.push_back(std::to_string(ids[i]));
+    }
+    if (executeAlter(sql_prefix + "(" + makePlaceholders(end - begin, "?") + ")", all) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string MyDB::makePlaceholders(size_t count, const std::string &item) {
+  std::string ret;
+  ret.reserve(count * (item.size() + 1));
+  for (size_t i = 0; i != count; ++i) {
+    if (i != 0) {
+      ret += ",";
+    }
+    ret += item;
+  }
+  return ret;
+}
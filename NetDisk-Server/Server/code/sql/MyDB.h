@@ -4,10 +4,20 @@
 #include "SqlConnRAII.h"
 #include "protocol.h"
 #include "UpDownCon.h"
+#include "MultiGetSession.h"
 #include <vector>
 #include <string>
+#include <unordered_set>
+#include <functional>
 
 
+// 批量插入的文件信息
+struct NewFileInfo {
+  std::string file_name;
+  std::string md5;
+  std::uint64_t file_size{ 0 };
+  std::string suffix;
+};
 
 class MyDB {
  private:
@@ -24,18 +34,42 @@ class MyDB {
   bool getUserExist(const std::string &user);                                                       //查询用户是否存在
   bool insertUser(const std::string &user, const std::string &pwd, const std::string &cipher);      //插入用户
   bool getFileMd5(const std::string &user, const std::uint64_t &file_id, std::string &md5);         //获取文件MD5
-  bool getIsEnoughSpace(const std::string &user, const std::string &pwd, std::uint64_t file_size);  //检查空间是否足够
+  bool getIsEnoughSpace(const std::string &user, std::uint64_t file_size);  //检查空间是否足够（调用者已经认证用户）
   bool getFileExist(const std::string &user, const std::string &md5);                               //查询是否已经存在该文件，支不支持秒传
   bool getUserAllFileInfo(const std::string &user, std::vector<FileInfo> &vet);                     //获取用户在数据库中的全部文件信息
+  bool getDownloadFiles(const std::string &user, const std::vector<std::uint64_t> &ids, size_t max_files, std::vector<DownFileInfo> &files);  //展开要下载的文件，文件夹递归展开
 
   std::uint64_t insertFileData(const std::string &user, const std::string file_name, const std::string file_md5, const uint64_t file_size, const uint64_t parent_dir_id, const std::string &suffix);   //插入文件数据
+  bool insertFileBatch(const std::string &user, const std::uint64_t parent_dir_id, const std::vector<NewFileInfo> &files, std::vector<std::uint64_t> &ids);  //在一个事务中插入多个文件，ids返回文件ID
   bool deleteOneFile(const std::string &user, std::uint64_t &file_id);                              //删除单个文件
   bool deleteOneDir(const std::string &user, std::uint64_t &file_id);                               //删除文件夹
+  bool deleteFileBatch(const std::string &user, const std::vector<std::uint64_t> &ids, std::vector<bool> &results, std::vector<std::string> &released);  //在一个事务中删除多个文件和文件夹，released返回被删除文件的内容哈希
+  bool moveFileBatch(const std::string &user, const std::vector<std::uint64_t> &ids, std::uint64_t target_dir_id, std::vector<bool> &results);  //在一个事务中移动多个文件和文件夹
+
+  // 全局内容存储的引用计数（Blobs表），由 BlobStore 在持有对应哈希的锁时调用
+  bool getBlobExist(const std::string &md5);                                                        //查询内容是否已经存在，支持跨用户秒传（需要持有证明）
+  bool getExistBlobs(const std::string &user, const std::vector<std::string> &hashes, std::unordered_set<std::string> &exist);  //批量查询该用户已经拥有的内容
+  bool addBlobRef(const std::string &md5, std::uint64_t file_size, std::uint64_t count = 1);        //增加引用，不存在则插入
+  bool acquireBlobRef(const std::string &md5);                                                      //内容存在时增加一个引用
+  std::int64_t releaseBlobRef(const std::string &md5, std::uint64_t count = 1);                     //减少count个引用，返回剩余引用数，没有记录返回-1
+  bool resetBlobRef(const std::string &md5, std::uint64_t file_size);                              //按所有用户引用该内容的文件数设置引用数（迁移时使用）
+  std::uint64_t getUserFileCount(const std::string &user, const std::string &md5);                  //查询用户引用该内容的文件数
+  bool getUserBlobs(const std::string &user, std::vector<std::string> &md5s);                        //查询用户的文件引用的全部内容（不重复）
+  bool getSameNameFile(const std::string &user, std::uint64_t parent_dir_id, const std::string &file_name, std::string &md5, std::uint64_t &file_size);  //查询目录下最新的同名文件（差量上传的旧版本）
+
+  // 块存储的引用计数（Chunks表），由 ChunkStore 在持有引用计数锁时调用，hashes 中不能有重复的哈希
+  bool addChunkRefs(const std::vector<std::pair<std::string, std::uint32_t>> &chunks);             //增加块的引用，不存在则插入
+  bool releaseChunkRefs(const std::vector<std::string> &hashes, std::vector<std::string> &freed);  //减少块的引用，freed返回不再被引用的块
 
  private:
   int executeSelect(const std::string &sql, const std::vector<std::string> &params, std::vector<std::string>& result);
   int executeSelect(const std::string &sql, const std::vector<std::string> &params, std::vector<std::vector<std::string>>& result);
   int executeAlter(const std::string &sql, const std::vector<std::string> &params);
+  static std::string makePlaceholders(size_t count, const std::string &item);  // 生成批量语句的占位符，如 (?,?),(?,?)
+  bool runTransaction(const std::function<bool()> &work);                       // 在一个事务中执行，失败时回滚
+  // 按ID分组（每组最多256个）执行 IN 查询或修改，减少与数据库的交互次数
+  bool selectByIds(const std::string &sql_prefix, const std::string &user, const std::vector<std::uint64_t> &ids, std::vector<std::vector<std::string>> &result);
+  bool alterByIds(const std::string &sql_prefix, const std::vector<std::string> &params, const std::vector<std::uint64_t> &ids);
   
   private:
   std::shared_ptr<sql::Connection> conn_;
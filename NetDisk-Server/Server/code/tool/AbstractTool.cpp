@@ -1,4 +1,7 @@
 #include "AbstractTool.h"
+#include "StreamCon.h"
+#include "SessionToken.h"
+#include <cstring>
 
 
 std::string AbstractTool::getSuffix(const std::string &file_name) {
@@ -12,3 +15,27 @@ std::string AbstractTool::getSuffix(const std::string &file_name) {
   }
   return "other";
 }
+
+void AbstractTool::replyTo(const ProtocolHeader &request, ProtocolHeader &reply) {
+  if (request.version == PROTOCOL_VERSION_V2) {
+    reply.version = PROTOCOL_VERSION_V2;
+    reply.request_id = request.request_id;
+  }
+  else {
+    reply.version = PROTOCOL_VERSION_V1;
+    reply.request_id = 0;
+  }
+}
+
+bool AbstractTool::getTransferUser(MyDB &db, AbstractCon *conn, const TranPdu &pdu, UserInfo &info) {
+  std::string user(pdu.user, strnlen(pdu.user, sizeof(pdu.user)));
+  if (pdu.header.reserved == AUTH_SESSION_TOKEN) {   // pwd 中为令牌，没有密码可以查询数据库，校验失败时由调用者回复 NOT_VERIFY
+    return SessionToken::verify(user, pdu.pwd, info);
+  }
+  std::string pwd(pdu.pwd, strnlen(pdu.pwd, sizeof(pdu.pwd)));
+  StreamCon *stream = dynamic_cast<StreamCon*>(conn);
+  if (stream != nullptr && stream->getParentUserInfo(user, pwd, info)) {
+    return true;
+  }
+  return db.getUserInfo(user, pwd, info) && std::string(info.cipher) != "";
+}
@@ -14,4 +14,9 @@ class AbstractTool {
  protected:
   SRTool sr_tool_;
   std::string getSuffix(const std::string &file_name);    // 获取文件后缀名
+  // 回复使用请求的版本（旧版本客户端只会收到 v1），v2 中回显请求ID，客户端按ID匹配乱序完成的回复
+  static void replyTo(const ProtocolHeader &request, ProtocolHeader &reply);
+  // 传输任务的用户认证，通过时返回true并填写用户信息：携带会话令牌的请求在内存中校验令牌；多路复用的流使用所属连接登录时的用户信息；
+  // 都不是时才用用户名和密码查询数据库
+  static bool getTransferUser(MyDB &db, AbstractCon *conn, const TranPdu &pdu, UserInfo &info);
 };
@@ -1,5 +1,15 @@
 #include "LongTaskTool.h"
 #include "Log.h"
+#include "BlobStore.h"
+#include "ChunkStore.h"
+#include "Chunker.h"
+#include "Delta.h"
+#include "FileReader.h"
+#include "Compressor.h"
+#include "Crc32c.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
 
 //*******************************************上传任务*******************************************//
 PutsTool::PutsTool(AbstractCon *conn) : conn_parent_(conn) {
@@ -28,16 +38,21 @@ bool PutsTool::firstCheck(UpDownCon *conn) {
   PDURespond respond;
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  // 加入上传会话的并行连接使用 PUTS_JOIN 回复，客户端据此区分主连接和并行连接，批量上传使用 PUTS_BATCH 回复
   respond.code = Code::PUTS;
+  if (pdu_.tran_pdu_code == Code::PUTS_JOIN || pdu_.tran_pdu_code == Code::PUTS_BATCH) {
+    respond.code = pdu_.tran_pdu_code;
+  }
   respond.msg_amount = 0;
   respond.msg_len = 0;
   UserInfo info;
 
-  bool sql_res = db.getUserInfo(pdu_.user, pdu_.pwd, info); // 获取用户信息
+  bool sql_res = getTransferUser(db, conn, pdu_, info); // 获取用户信息
 
-  if(sql_res && std::string(info.cipher) != "") {   //客户端发送过来的用户名和密码通过认证
+  if(sql_res) {   //客户端发送过来的用户名和密码（或会话令牌）通过认证
     UDtask task = createTask(respond, db);  // 创建任务
-    if(respond.status == Status::SUCCESS || respond.status == Status::PUT_CONTINUE_FAILED || respond.status==Status::PUT_QUICK) {
+    if(respond.status == Status::SUCCESS || respond.status == Status::PUT_CONTINUE_FAILED || respond.status==Status::PUT_QUICK
+       || respond.status == Status::PUT_QUICK_PROOF) {
       conn->init(info, task);     //保存客户信息，初始化连接类
       conn->setVerify(true);      //设置客户端已经通过认证
 
@@ -51,6 +66,9 @@ bool PutsTool::firstCheck(UpDownCon *conn) {
       }
     }
   }
+  else if (pdu_.header.reserved == AUTH_SESSION_TOKEN) {   // 令牌无效或已过期（如服务器更换了密钥），客户端改用密码重新请求
+    respond.status = Status::NOT_VERIFY;
+  }
   else {  // 找不到用户，或用户没有验证身份
     respond.status = Status::FAILED;
   }
@@ -58,16 +76,28 @@ bool PutsTool::firstCheck(UpDownCon *conn) {
   // 发送回复
   {
     // 理论上不会有多个线程同时调用，但任然加锁
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendPDURespond(conn->getSSL(), respond);   //将结果发回客户端
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, respond);   //将结果发回客户端
+  }
+
+  if (respond.status == Status::SUCCESS && pdu_.tran_pdu_code == Code::PUTSCONTINUE) {  // 续传时数据可能已经全部接收
+    PutsDataTool data_tool(conn);
+    data_tool.finishIfComplete();
   }
 
   if (respond.status == Status::PUT_QUICK) {  // 秒传，直接发送完成回复
     // 插入数据库，并发送回复
     MyDB db;
     std::string suffix = getSuffix(conn->getTaskFileName());
-    // 插入数据到数据库，并修改已使用空间
-    uint64_t ret = db.insertFileData(conn->getUser(), conn->getTaskFileName(), conn->getTaskFileMd5(), conn->getTaskFileSize(), conn->getTaskParentDirId(), suffix);
+    std::string md5 = conn->getTaskFileMd5();
+    uint64_t ret = 0;
+    // 引用全局存储中的内容（检查之后内容可能已经被删除），再插入数据到数据库，并修改已使用空间
+    if (BlobStore::acquire(db, md5)) {
+      ret = db.insertFileData(conn->getUser(), conn->getTaskFileName(), md5, conn->getTaskFileSize(), conn->getTaskParentDirId(), suffix);
+      if (ret == 0) {
+        BlobStore::release(db, md5);
+      }
+    }
 
     respond.header.type = ProtocolType::PDURESPOND_TYPE;
     respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
@@ -83,12 +113,12 @@ bool PutsTool::firstCheck(UpDownCon *conn) {
     else {
       respond.status = Status::FAILED;
     }
-  }
-  // 发送回复
-  {
-    // 理论上不会有多个线程同时调用，但任然加锁
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendPDURespond(conn->getSSL(), respond);   //将结果发回客户端
+    // 发送回复（只有秒传需要发送第二个回复，否则客户端会收到两次相同的回复，重复发送文件数据）
+    {
+      // 理论上不会有多个线程同时调用，但任然加锁
+      std::lock_guard<FairMutex> lock(conn->getSendMutex());
+      sr_tool_.sendPDURespond(conn, respond);   //将结果发回客户端
+    }
   }
 
   if(respond.status == Status::FAILED || respond.status == Status::NO_CAPACITY) { //出错改成重新认证
@@ -107,6 +137,24 @@ UDtask PutsTool::createTask(PDURespond &respond, MyDB &db) {
   task.file_md5 = std::string(pdu_.file_md5);     // 文件MD5码,加上用户根文件夹，用户名就是根文件夹名，保证用户名唯一，所以文件夹唯一
   task.file_size = pdu_.file_size;                // 文件总大小
   task.parent_dir_id = pdu_.parent_dir_id;        // 父文件夹ID
+  task.compress = Compressor::negotiate(pdu_.compress);   // 协商压缩方式，通过回复的头部告诉客户端
+  respond.header.reserved = task.compress & 0xff;
+  task.check_crc = (pdu_.compress & UPLOAD_CAP_CRC32C) != 0;   // 旧客户端不填写分片校验和
+
+  // 批量上传：file_size 为所有文件的总长度，一次检查空间，sended_size 为文件数，之后在同一个连接上发送清单和文件
+  if (pdu_.tran_pdu_code == Code::PUTS_BATCH) {
+    if (pdu_.sended_size == 0 || pdu_.sended_size > MAX_BATCH_FILES) {
+      respond.status = Status::FAILED;
+      return task;
+    }
+    if (!db.getIsEnoughSpace(pdu_.user, pdu_.file_size)) {
+      respond.status = Status::NO_CAPACITY;
+      return task;
+    }
+    task.batch_session = std::make_shared<BatchSession>(pdu_.user, pdu_.parent_dir_id, pdu_.sended_size, pdu_.file_size);
+    respond.status = Status::SUCCESS;
+    return task;
+  }
 
   std::cout << "upload file info:\n" 
             << "file_name: " << task.file_name << '\n'
@@ -120,70 +168,132 @@ UDtask PutsTool::createTask(PDURespond &respond, MyDB &db) {
     return task;
   }
 
-  if(!db.getIsEnoughSpace(pdu_.user, pdu_.pwd, pdu_.file_size)) { //如果空间不足
+  // 并行连接加入主连接创建的上传会话，空间检查和秒传检查已经由主连接完成
+  if (pdu_.tran_pdu_code == Code::PUTS_JOIN) {
+    std::shared_ptr<UploadSession> session = UploadSession::find(pdu_.user, pdu_.file_md5, task.file_size);
+    if (session == nullptr || !session->openFile()) {
+      std::cout << "PutsTool::createTask(RespondPack&, MyDB&): " << "no upload session to join" << std::endl;
+      respond.status = Status::FAILED;
+      return task;
+    }
+    task.up_session = session;
+    respond.status = Status::SUCCESS;
+    return task;
+  }
+
+  if(!db.getIsEnoughSpace(pdu_.user, pdu_.file_size)) { //如果空间不足
     respond.status = Status::NO_CAPACITY;
     return task;
   }
 
-  if(db.getFileExist(pdu_.user, pdu_.file_md5)) { //如果文件已经存在，支持秒传
-    respond.status = Status::PUT_QUICK;
-    task.handled_size.store(task.file_size.load()); //修改已经处理大小为总大小，否则会导致文件被删除
-    return task;    //返回即可，后面无需操作
+  if(db.getBlobExist(pdu_.file_md5)) { //如果任意用户上传过相同内容的文件，支持秒传
+    // 用户自己已经拥有该内容时直接秒传；否则只知道哈希不能秒传，客户端需要证明持有文件
+    if (db.getUserFileCount(pdu_.user, pdu_.file_md5) > 0) {
+      respond.status = Status::PUT_QUICK;
+      task.handled_size.store(task.file_size.load()); //修改已经处理大小为总大小，否则会导致文件被删除
+      return task;    //返回即可，后面无需操作
+    }
+    if ((pdu_.compress & UPLOAD_CAP_QUICK_PROOF) != 0 && makeQuickProof(respond, task)) {
+      respond.status = Status::PUT_QUICK_PROOF;
+      return task;
+    }
+    // 不支持持有证明的客户端正常上传，入库时内容已经存在，丢弃上传的副本
   }
 
   respond.status = Status::SUCCESS;  //暂时默认为OK
-  struct stat is_exist;
-  std::string open_file_name = std::string(ROOTFILEPATH) + "/" + std::string(pdu_.user) + "/" + std::string(pdu_.file_md5);
+  // 获取上传会话，多个连接上传同一个文件时共享会话；服务端重启后从日志文件恢复已接收的区间
+  std::shared_ptr<UploadSession> session = UploadSession::acquire(pdu_.user, pdu_.file_md5, task.file_size);
+  if (session == nullptr) {
+    std::cout << "PutsTool::createTask(RespondPack&, MyDB&): " << "acquire upload session failed" << std::endl;
+    respond.status = Status::FAILED;
+    return task;
+  }
+  std::string open_file_name = session->getFilePath();
   std::cout << "PutsTool::createTask(RespondPack&, MyDB&): " << "upload file path: " << open_file_name << std::endl;
-  
+
   // 如果客户端要求断点续传
   if(pdu_.tran_pdu_code == Code::PUTSCONTINUE) {
-    if (stat(open_file_name.c_str(), &is_exist) == 0) { // 如果文件存在，则继续下载
-      // ！！！！！！！有错误，文件已经被ftruncate预分配了文件大小！！！！！！！！！！
-      // ！！！！！！！因此is_exist.st_size == task.file_size！！！！！！！！！！！！
-      task.handled_size = is_exist.st_size;     // 将断点续传位置定义为文件大小
-      respond.header.body_len = PDURESPOND_BODY_BASE_LEN + sizeof(uint64_t);
-      respond.msg_len = sizeof(uint64_t);       // 保存已经上传位置到回复体，告诉客户端从哪里开始传输
+    if (session->getReceivedBytes() > 0) { // 会话中有已接收的数据，则继续上传
+      task.handled_size = session->getReceivedBytes();
+      // 回复体：已接收字节数(uint64) + 上传ID(uint64) + 区间数(uint32) + 区间[begin, end)(uint64, uint64)...
+      // 区间数受缓冲区大小限制，没有告诉客户端的区间，客户端会重传，不影响正确性
+      std::vector<UploadSession::Range> ranges = session->getRanges(MAX_RESUME_RANGES);
       uint64_t handled_size = htonll(task.handled_size.load());
+      uint64_t upload_id = htonll(session->getUploadId());
+      uint32_t range_count = htonl(ranges.size());
       respond.msg.append((char*)&handled_size, sizeof(handled_size));
+      respond.msg.append((char*)&upload_id, sizeof(upload_id));
+      respond.msg.append((char*)&range_count, sizeof(range_count));
+      for (auto &range : ranges) {
+        uint64_t begin = htonll(range.first);
+        uint64_t end = htonll(range.second);
+        respond.msg.append((char*)&begin, sizeof(begin));
+        respond.msg.append((char*)&end, sizeof(end));
+      }
+      respond.msg_amount = 1;
+      respond.msg_len = respond.msg.size();     // 保存已经上传区间到回复体，告诉客户端需要补传哪些数据
+      respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
     }
     else {  // 否则，从零开始
       respond.status = Status::PUT_CONTINUE_FAILED; // 从零开始
       task.handled_size = 0;
     }
   }
-
-  // 打开文件
-  int file_fd = open(open_file_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);  //打开文件
-  if (file_fd == -1) {
-    perror("open file in puts error");
-    respond.status = Status::FAILED;
-    return task;
+  else if (session->getReceivedBytes() > 0) {  // 客户端要求重新上传，清空之前的记录
+    session->reset();
   }
 
-  // 预分配文件大小
-  int ret = ftruncate(file_fd, task.file_size);
-  if (ret == -1) {
-    perror("ftruncate error");
-    close(file_fd);
+  // 打开文件并预分配空间（共享会话时只打开一次），写入引擎（mmap/pwrite）由配置决定
+  if (!session->openFile()) {
+    std::cout << "PutsTool::createTask(RespondPack&, MyDB&): " << "open upload file failed" << std::endl;
     respond.status = Status::FAILED;
     return task;
   }
 
-  // 将文件映射到进程的虚拟内存中，修改内存会同步到文件内容
-  char *pmap = (char *)mmap(NULL, task.file_size, PROT_WRITE, MAP_SHARED, file_fd, 0);   //偏移量从0开始
+  task.up_session = session;
 
-  if (pmap == MAP_FAILED) {
-    perror("mmap error");
-    close(file_fd);
-    respond.status = Status::FAILED;
-    return task;
-  }
+  return task;
+}
 
-  task.file_fd = file_fd;
-  task.file_map = pmap;
 
-  return task;
+bool PutsTool::makeQuickProof(PDURespond &respond, UDtask &task) {
+  FileReader reader;
+  uint64_t size = 0;
+  if (!Delta::openBase(pdu_.user, pdu_.file_md5, reader, size) || size != task.file_size) {
+    return false;
+  }
+  unsigned char nonce[QUICK_PROOF_NONCE_LEN];
+  uint64_t offset = 0;
+  uint32_t len = std::min<uint64_t>(size, QUICK_PROOF_MAX_LEN);
+  if (RAND_bytes(nonce, sizeof(nonce)) != 1 || RAND_bytes((unsigned char*)&offset, sizeof(offset)) != 1) {
+    return false;
+  }
+  offset %= (size - len + 1);
+  const char *data = (len > 0 ? reader.data(offset, len) : "");
+  if (data == nullptr) {
+    return false;
+  }
+  // 期望的结果：SHA-256(随机数 + 区间数据)
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+  bool ok = ctx != nullptr && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 && EVP_DigestUpdate(ctx, nonce, sizeof(nonce)) == 1
+            && EVP_DigestUpdate(ctx, data, len) == 1 && EVP_DigestFinal_ex(ctx, digest, &digest_len) == 1;
+  EVP_MD_CTX_free(ctx);
+  if (!ok) {
+    return false;
+  }
+  task.quick_proof.assign((char*)digest, digest_len);
+
+  uint64_t net_offset = htonll(offset);
+  uint32_t net_len = htonl(len);
+  respond.msg.assign((char*)nonce, sizeof(nonce));
+  respond.msg.append((char*)&net_offset, sizeof(net_offset));
+  respond.msg.append((char*)&net_len, sizeof(net_len));
+  respond.msg_amount = 1;
+  respond.msg_len = respond.msg.size();
+  respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
+  return true;
 }
 
 
@@ -196,10 +306,32 @@ PutsDataTool::PutsDataTool(const TranDataPdu& pdu, AbstractCon *conn) : pdu_(pdu
   
 }
 
+PutsDataTool::PutsDataTool(const TranDataPdu &pdu, buffer_shared_ptr frame, const char *data, AbstractCon *conn)
+  : pdu_(pdu), frame_(std::move(frame)), data_(data), conn_(dynamic_cast<UpDownCon*>(conn)) {
+
+}
+
 // 上传文件数据
 int PutsDataTool::doingTask() {
   if (conn_->getStatus() == UpDownCon::DOING && conn_->getIsVerify()) {
-    recvFileData(conn_);  // 接收文件数据
+    if (pdu_.code == Code::PUTS_CHUNKS) {
+      queryChunks(conn_);   // 查询缺失的块
+    }
+    else if (pdu_.code == Code::PUTS_DELTA_SIG) {
+      sendSignature(conn_); // 发送旧版本的签名
+    }
+    else if (pdu_.code == Code::PUTS_DELTA) {
+      applyDelta(conn_);    // 执行复制指令
+    }
+    else if (pdu_.code == Code::PUTS_BATCH_LIST || pdu_.code == Code::PUTS_BATCH_DATA) {
+      recvBatch(conn_);     // 批量上传的文件清单和文件数据
+    }
+    else if (pdu_.code == Code::PUTS_QUICK_PROOF) {
+      checkQuickProof(conn_);   // 秒传的持有证明
+    }
+    else {
+      recvFileData(conn_);  // 接收文件数据
+    }
   }
 
   if(conn_->getStatus() == UpDownCon::CLOSE) {  //关闭状态
@@ -215,29 +347,79 @@ int PutsDataTool::doingTask() {
   return 0;
 }
 
+void PutsDataTool::finishIfComplete() {
+  std::shared_ptr<UploadSession> session = conn_->getTaskUpSession();
+  if (session != nullptr && session->isComplete()) {
+    LOG_INFO("client %s puts %s: all data received before resume", conn_->getUser().c_str(), conn_->getTaskFileName().c_str());
+    finishUpload(conn_, session);
+  }
+}
+
 // 接受客户端的数据
 void PutsDataTool::recvFileData(UpDownCon *conn) {
   size_t total = conn->getTaskFileSize(); // 文件总大小
   size_t offset = pdu_.file_offset;       // 偏移量
   size_t target_bytes = pdu_.chunk_size;  // 本次希望处理的字节数
-  if (pdu_.data.size() < target_bytes) {
+  // 快速路径下数据仍在接收的数据帧中（反序列化时已校验长度），否则在pdu_.data中
+  const char *data = (data_ != nullptr ? data_ : pdu_.data.data());
+  if (data_ == nullptr && pdu_.data.size() < target_bytes) {
     std::cout << "upload recv data: error: the actual data is not in line with expectations" << std::endl;
     return;
   }
-  // 如果本次传输数据 + 已接收数据 > 总数据（理论上不会出现，出现说明客户端发送数据错误，大概率是设计问题）
-  // 否则，task_.handled_size += target_bytes，该操作为原子操作
-  if (!conn->lessEqualAddTaskHandleSize(total - target_bytes, target_bytes)) {
+  // 校验和错误的分片不写入，回复失败，客户端只重传这个分片
+  if (conn->getTaskCheckCrc() && Crc32c::compute(data, target_bytes) != pdu_.check_sum) {
+    LOG_WARN("client %s upload: chunk %u checksum mismatch", conn->getUser().c_str(), pdu_.chunk_index);
+    replyChunk(conn, Status::FAILED);
+    return;
+  }
+  // 压缩的分片先解压，解压后的长度不能超出文件范围
+  thread_local std::string raw_buf;
+  if (pdu_.status != Compression::COMPRESS_NONE) {
+    size_t max_len = (offset < total ? std::min<uint64_t>(total - offset, MAX_PDU_LEN) : 0);
+    if (!Compressor::decompress(pdu_.status, data, target_bytes, max_len, raw_buf)) {
+      std::cout << "upload recv data: error: decompress data failed" << std::endl;
+      return;
+    }
+    data = raw_buf.data();
+    target_bytes = raw_buf.size();
+  }
+  // 数据超出文件范围（理论上不会出现，出现说明客户端发送数据错误，大概率是设计问题）
+  if (offset > total || target_bytes > total - offset) {
     std::cout << "upload recv data: error: the number data does not match" << std::endl;
     return;
   }
-  // 写入数据
-  memcpy(conn->getTaskFileMap() + offset, pdu_.data.data(), target_bytes);
+  std::shared_ptr<UploadSession> session = conn->getTaskUpSession();
+  if (session == nullptr) {
+    return;
+  }
+  // 写入数据，数据从接收缓冲区直接交给写入引擎，并记录已接收区间，重传的数据不会重复计数
+  uint64_t added = 0;
+  if (!session->write(offset, data, target_bytes, added)) {
+    std::cout << "upload recv data: error: write file failed" << std::endl;
+    return;
+  }
+  conn->addTaskHandleSize(added);
+  session->addTransferBytes(target_bytes, pdu_.chunk_size);
 
   // 发送回复，告诉客户端，接收了那个chunk
+  replyChunk(conn, Status::SUCCESS);
+
+  // 定期持久化会话，服务端崩溃后也能断点续传
+  session->maybeCheckpoint();
+
+  // 更新状态
+  // 根据会话中已接收的区间判断是否完成，客户端重传数据不会造成误判
+  if (session->isComplete()) {
+    finishUpload(conn, session);
+  }
+}
+
+// 回复一个chunk的接收结果：SUCCESS 为已接收，FAILED 为校验和错误需要重传
+void PutsDataTool::replyChunk(UpDownCon *conn, uint32_t status) {
   PDURespond res;
   res.header.type = ProtocolType::PDURESPOND_TYPE;
   res.code = Code::PUTS_DATA;
-  res.status = Status::SUCCESS;
+  res.status = status;
   res.msg_amount = 1;
   // 设置chunk id
   uint32_t chunk_id = htonl(pdu_.chunk_index);
@@ -245,56 +427,434 @@ void PutsDataTool::recvFileData(UpDownCon *conn) {
   res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
   res.msg.assign((char*)&chunk_id, sizeof(chunk_id));
 
-  // 发送回复通知客户端已经接收了哪个chunk
+  // 由于可能会有多个线程同时发送数据，因此加锁保护
+  std::lock_guard<FairMutex> lock(conn->getSendMutex());
+  sr_tool_.sendPDURespond(conn, res);
+}
+
+// 块清单查询：data 为若干个块[偏移(uint64), 长度(uint32), SHA-256(32字节)]
+// 用户自己的文件已经引用的块直接从块存储复制到上传文件中（与客户端发送的数据一样记录已接收区间并计算哈希），回复缺失块的位图，客户端只发送缺失的块。
+// 只复用用户已经引用的块：其它用户的块只凭哈希就复制，相当于只知道哈希就能取得内容，位图也会暴露其它用户持有哪些内容
+void PutsDataTool::queryChunks(UpDownCon *conn) {
+  PDURespond res;
+  res.header.type = ProtocolType::PDURESPOND_TYPE;
+  res.code = Code::PUTS_CHUNKS;
+  res.status = Status::FAILED;
+
+  const char *data = (data_ != nullptr ? data_ : pdu_.data.data());
+  uint32_t count = pdu_.chunk_size / CHUNK_ENTRY_LEN;
+  uint64_t total = conn->getTaskFileSize();
+  std::shared_ptr<UploadSession> session = conn->getTaskUpSession();
+  // 没有开启块存储时，服务端没有块可以复用，客户端收到失败后发送全部数据
+  if (ChunkStore::getEnable() && session != nullptr && (data_ != nullptr || pdu_.data.size() >= pdu_.chunk_size)
+      && pdu_.chunk_size % CHUNK_ENTRY_LEN == 0 && count <= MAX_CHUNKS_PER_PAGE) {
+    std::shared_ptr<const std::unordered_set<std::string>> owned = session->getOwnedChunks();
+    if (owned == nullptr) {
+      // 第一页查询时收集用户的文件清单中的块，之后的页使用会话中保存的结果
+      auto chunks = std::make_shared<std::unordered_set<std::string>>();
+      std::vector<std::string> md5s;
+      MyDB db;
+      if (db.getUserBlobs(conn->getUser(), md5s)) {
+        ChunkStore::collectChunks(md5s, *chunks);
+      }
+      owned = chunks;
+      session->setOwnedChunks(owned);
+    }
+    std::string bitmap((count + 7) / 8, '\0');
+    std::string chunk;
+    uint64_t copied_bytes = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      const char *entry = data + i * CHUNK_ENTRY_LEN;
+      uint64_t offset = 0;
+      uint32_t size = 0;
+      memcpy(&offset, entry, sizeof(offset));
+      memcpy(&size, entry + sizeof(offset), sizeof(size));
+      offset = ntohll(offset);
+      size = ntohl(size);
+      std::string hash = ChunkStore::toHex((const unsigned char*)entry + sizeof(offset) + sizeof(size), 32);
+
+      bool present = false;
+      if (size > 0 && size <= Chunker::kMaxSize && offset <= total && size <= total - offset
+          && owned->count(hash) > 0 && ChunkStore::readChunk(hash, size, chunk)) {
+        uint64_t added = 0;
+        present = session->write(offset, chunk.data(), size, added);
+        conn->addTaskHandleSize(added);
+        copied_bytes += added;
+      }
+      if (!present) {
+        bitmap[i / 8] |= (1 << (i % 8));
+      }
+    }
+    LOG_INFO("client %s puts chunks: %u chunks, %lu bytes reused", conn->getUser().c_str(), count, copied_bytes);
+
+    uint64_t first_index = htonll(pdu_.file_offset);
+    uint32_t net_count = htonl(count);
+    res.status = Status::SUCCESS;
+    res.msg.append((char*)&first_index, sizeof(first_index));
+    res.msg.append((char*)&net_count, sizeof(net_count));
+    res.msg.append(bitmap);
+  }
+  res.msg_amount = (res.msg.empty() ? 0 : 1);
+  res.msg_len = res.msg.size();
+  res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
   {
-    // 由于可能会有多个线程同时发送数据，因此加锁保护
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendPDURespond(conn->getSSL(), res);
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, res);
   }
-  // !!!!!!!!!!!!!!!!!!!!!!!!!!!!! 可以在UDTask中添加，已经接收的chunk id，这样就不需要handled_size !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
-  // 更新状态
-  // 可能会有多个线程到达此时，判断为真，但没有影响
-  // !!!!!!!!!!!!!!!!!!!!!!!!!! 这种状态转换是错误的，如果客户端重传数据，也会造成handled_size == total，后续使用chunk id 判断是否完成 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-  if (conn->getTaskHandledSize() == total) {
-    // 因为可能有多个线程同时到达此时，但我们只允许一个线程执行
-    // 如果status_是DOING，则将它变为FIN，继续执行
-    // 如果status_不是DOING，则直接结束
-    // 整个过程是原子的，因此从DOING到FIN只会修改一次，也就是只有一个线程能执行
-    if (!conn->cmpExchange(UpDownCon::UDStatus::DOING, UpDownCon::UDStatus::FIN)) {
-      return;
+  if (session == nullptr || res.status != Status::SUCCESS) {
+    return;
+  }
+  session->maybeCheckpoint();
+  // 所有块都已经存在时，文件已经拼装完成，客户端不需要再发送数据
+  if (session->isComplete()) {
+    finishUpload(conn, session);
+  }
+}
+
+// 差量上传的签名：旧版本为同目录下最新的同名文件，没有旧版本（或旧版本比一个块还小）时回复失败，客户端发送全部数据
+// 签名按页回复，每页最多 MAX_DELTA_SIGS_PER_PAGE 个块，回复不超过默认缓冲区大小
+void PutsDataTool::sendSignature(UpDownCon *conn) {
+  PDURespond res;
+  res.header.type = ProtocolType::PDURESPOND_TYPE;
+  res.code = Code::PUTS_DELTA_SIG;
+  res.status = Status::FAILED;
+
+  std::shared_ptr<UploadSession> session = conn->getTaskUpSession();
+  MyDB db;
+  std::string base_md5, sig;
+  uint64_t base_size = 0;
+  uint32_t block_size = 0, count = 0;
+  if (session != nullptr && db.getSameNameFile(conn->getUser(), conn->getTaskParentDirId(), conn->getTaskFileName(), base_md5, base_size)
+      && base_md5 != conn->getTaskFileMd5()) {
+    FileReader reader;
+    if (Delta::openBase(conn->getUser(), base_md5, reader, base_size)) {
+      block_size = Delta::getBlockSize(base_size);
+      count = base_size / block_size;
+      if (count > 0 && Delta::makeSignature(reader, base_size, block_size, sig)) {
+        session->setDeltaBase(base_md5, base_size);
+        res.status = Status::SUCCESS;
+        LOG_INFO("client %s puts delta: base %s, %u blocks of %u bytes", conn->getUser().c_str(), base_md5.c_str(), count, block_size);
+      }
     }
-    std::cout << "upload file: recv file data finish" << std::endl;
+  }
 
-    // 插入数据库，并发送回复
-    MyDB db;
-    std::string suffix = getSuffix(conn_->getTaskFileName());
-    // 插入数据到数据库，并修改已使用空间
-    uint64_t ret = db.insertFileData(conn_->getUser(), conn_->getTaskFileName(), conn_->getTaskFileMd5(), conn_->getTaskFileSize(), conn_->getTaskParentDirId(), suffix);
+  uint32_t first = 0;
+  do {
+    res.msg.clear();
+    if (res.status == Status::SUCCESS) {
+      uint32_t page_count = std::min<uint32_t>(count - first, MAX_DELTA_SIGS_PER_PAGE);
+      uint32_t net_block_size = htonl(block_size);
+      uint32_t net_count = htonl(count);
+      uint32_t net_first = htonl(first);
+      res.msg.append((char*)&net_block_size, sizeof(net_block_size));
+      res.msg.append((char*)&net_count, sizeof(net_count));
+      res.msg.append((char*)&net_first, sizeof(net_first));
+      res.msg.append(sig, (size_t)first * DELTA_SIG_ENTRY_LEN, (size_t)page_count * DELTA_SIG_ENTRY_LEN);
+      first += page_count;
+    }
+    res.msg_amount = (res.msg.empty() ? 0 : 1);
+    res.msg_len = res.msg.size();
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    if (sr_tool_.sendPDURespond(conn, res) == 0) {
+      break;
+    }
+  } while (first < count);
+}
 
+// 差量上传的复制指令：data 为若干条[新文件偏移(uint64), 旧版本偏移(uint64), 长度(uint32)]
+// 从旧版本复制的数据与客户端发送的数据一样记录已接收区间并计算哈希，旧版本已经被删除或修改时回复失败，客户端改为发送这些数据
+void PutsDataTool::applyDelta(UpDownCon *conn) {
+  PDURespond res;
+  res.header.type = ProtocolType::PDURESPOND_TYPE;
+  res.code = Code::PUTS_DELTA;
+  res.status = Status::FAILED;
+
+  const char *data = (data_ != nullptr ? data_ : pdu_.data.data());
+  uint32_t count = pdu_.chunk_size / DELTA_COPY_LEN;
+  uint64_t total = conn->getTaskFileSize();
+  std::shared_ptr<UploadSession> session = conn->getTaskUpSession();
+  std::string base_md5;
+  uint64_t base_size = 0, actual_size = 0;
+  FileReader reader;
+  if (session != nullptr && (data_ != nullptr || pdu_.data.size() >= pdu_.chunk_size)
+      && pdu_.chunk_size % DELTA_COPY_LEN == 0 && count <= MAX_DELTA_COPIES_PER_PAGE
+      && session->getDeltaBase(base_md5, base_size)
+      && Delta::openBase(conn->getUser(), base_md5, reader, actual_size) && actual_size == base_size) {
+    const uint64_t kStep = 1024 * 1024;   // 每次复制的最大长度
+    uint64_t copied_bytes = 0;
+    bool ok = true;
+    for (uint32_t i = 0; i < count && ok; ++i) {
+      const char *entry = data + i * DELTA_COPY_LEN;
+      uint64_t offset = 0, base_offset = 0;
+      uint32_t size = 0;
+      memcpy(&offset, entry, sizeof(offset));
+      memcpy(&base_offset, entry + sizeof(offset), sizeof(base_offset));
+      memcpy(&size, entry + 2 * sizeof(uint64_t), sizeof(size));
+      offset = ntohll(offset);
+      base_offset = ntohll(base_offset);
+      size = ntohl(size);
+      if (offset > total || size > total - offset || base_offset > base_size || size > base_size - base_offset) {
+        ok = false;
+        break;
+      }
+      for (uint64_t done = 0; done < size; ) {
+        uint64_t len = std::min<uint64_t>(kStep, size - done);
+        const char *src = reader.data(base_offset + done, len);
+        uint64_t added = 0;
+        if (src == nullptr || !session->write(offset + done, src, len, added)) {
+          ok = false;
+          break;
+        }
+        conn->addTaskHandleSize(added);
+        copied_bytes += added;
+        done += len;
+      }
+    }
+    res.status = (ok ? Status::SUCCESS : Status::FAILED);
+    LOG_INFO("client %s puts delta: %u copies, %lu bytes reused", conn->getUser().c_str(), count, copied_bytes);
+  }
+  uint32_t page = htonl(pdu_.chunk_index);
+  res.msg.assign((char*)&page, sizeof(page));
+  res.msg_amount = 1;
+  res.msg_len = res.msg.size();
+  res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
+  {
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, res);
+  }
+
+  if (session == nullptr) {
+    return;
+  }
+  session->maybeCheckpoint();
+  // 所有数据都可以从旧版本复制时，文件已经拼装完成，客户端不需要再发送数据
+  if (session->isComplete()) {
+    finishUpload(conn, session);
+  }
+}
+
+// 批量上传：处理文件清单或者一个文件的数据，之后把已经入库的一组文件的结果发给客户端
+void PutsDataTool::recvBatch(UpDownCon *conn) {
+  std::shared_ptr<BatchSession> session = conn->getTaskBatchSession();
+  const char *data = (data_ != nullptr ? data_ : pdu_.data.data());
+  if (session == nullptr || (data_ == nullptr && pdu_.data.size() < pdu_.chunk_size)) {
+    return;
+  }
+  MyDB db;
+  // 校验和错误的清单页和文件按失败处理
+  bool intact = (!conn->getTaskCheckCrc() || Crc32c::compute(data, pdu_.chunk_size) == pdu_.check_sum);
+
+  if (pdu_.code == Code::PUTS_BATCH_LIST) {
+    std::vector<uint32_t> needed;
     PDURespond res;
     res.header.type = ProtocolType::PDURESPOND_TYPE;
-    res.header.body_len = PDURESPOND_BODY_BASE_LEN;
-    res.code = Code::PUTS_FINISH;
-    if(ret != 0) {
-      res.status = Status::SUCCESS;
-      res.msg_amount = 1;
-      res.header.body_len = PDURESPOND_BODY_BASE_LEN + sizeof(ret);
-      res.msg_len = sizeof(ret);
-      ret = htonll(ret);
-      res.msg.assign((char*)&ret, sizeof(ret));
+    res.code = Code::PUTS_BATCH_LIST;
+    res.status = Status::SUCCESS;
+    if (!intact || pdu_.file_offset > UINT32_MAX) {
+      session->rejectList();
+      res.status = Status::FAILED;
     }
-    else {
+    else if (!session->addList(db, pdu_.file_offset, data, pdu_.chunk_size, needed)) {
       res.status = Status::FAILED;
     }
+    if (res.status == Status::FAILED) {
+      LOG_WARN("client %s batch upload: invalid file list page %u", conn->getUser().c_str(), pdu_.chunk_index);
+    }
+    // 回复体：页序号(uint32) + 需要发送数据的文件序号(uint32)...
+    uint32_t page = htonl(pdu_.chunk_index);
+    res.msg.append((char*)&page, sizeof(page));
+    for (uint32_t index : needed) {
+      index = htonl(index);
+      res.msg.append((char*)&index, sizeof(index));
+    }
+    res.msg_amount = needed.size();
+    res.msg_len = res.msg.size();
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
+    {
+      std::lock_guard<FairMutex> lock(conn->getSendMutex());
+      sr_tool_.sendPDURespond(conn, res);
+    }
+  }
+  else {
+    // 压缩的文件先解压，解压失败的文件按失败处理
+    thread_local std::string raw_buf;
+    if (!intact) {
+      LOG_WARN("client %s batch upload: file %u checksum mismatch", conn->getUser().c_str(), pdu_.chunk_index);
+      session->rejectFile(pdu_.chunk_index);
+    }
+    else if (pdu_.status == Compression::COMPRESS_NONE) {
+      session->storeFile(db, pdu_.chunk_index, data, pdu_.chunk_size);
+    }
+    else if (Compressor::decompress(pdu_.status, data, pdu_.chunk_size, MAX_BATCH_FILE_SIZE, raw_buf)) {
+      session->storeFile(db, pdu_.chunk_index, raw_buf.data(), raw_buf.size());
+    }
+    else {
+      session->rejectFile(pdu_.chunk_index);
+    }
+  }
+
+  // 暂存的文件凑满一组或者所有文件都有结果时入库，回复体：若干条[文件序号(uint32), 文件ID(uint64)]，结果较多时分成多个回复
+  std::vector<BatchSession::Result> results;
+  while (!(results = session->flush(db)).empty()) {
+    PDURespond res;
+    res.header.type = ProtocolType::PDURESPOND_TYPE;
+    res.code = Code::PUTS_BATCH_DATA;
+    res.status = Status::SUCCESS;
+    for (auto &result : results) {
+      uint32_t index = htonl(result.first);
+      uint64_t file_id = htonll(result.second);
+      res.msg.append((char*)&index, sizeof(index));
+      res.msg.append((char*)&file_id, sizeof(file_id));
+    }
+    res.msg_amount = results.size();
+    res.msg_len = res.msg.size();
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, res);
+  }
+  if (session->isFinished() && conn->cmpExchange(UpDownCon::UDStatus::DOING, UpDownCon::UDStatus::FIN)) {
+    LOG_INFO("client %s batch upload finished: %u files", conn->getUser().c_str(), session->getFileCount());
+  }
+}
+
+// 秒传的持有证明：data 为 SHA-256(随机数 + 文件区间的数据)，与创建任务时计算的结果一致才引用已有的内容
+void PutsDataTool::checkQuickProof(UpDownCon *conn) {
+  std::string expected = conn->getTaskQuickProof();
+  const char *data = (data_ != nullptr ? data_ : pdu_.data.data());
+  if (expected.empty() || conn->getTaskUpSession() != nullptr) {   // 不是等待持有证明的任务
+    return;
+  }
+  // 每个任务只接受一次证明
+  if (!conn->cmpExchange(UpDownCon::UDStatus::DOING, UpDownCon::UDStatus::FIN)) {
+    return;
+  }
+  bool proved = pdu_.chunk_size == expected.size() && (data_ != nullptr || pdu_.data.size() >= pdu_.chunk_size)
+                && CRYPTO_memcmp(data, expected.data(), expected.size()) == 0;
+
+  uint64_t ret = 0;
+  if (proved) {
+    // 引用全局存储中的内容（检查之后内容可能已经被删除），再插入数据到数据库，并修改已使用空间
+    MyDB db;
+    std::string md5 = conn->getTaskFileMd5();
+    if (BlobStore::acquire(db, md5)) {
+      ret = db.insertFileData(conn->getUser(), conn->getTaskFileName(), md5, conn->getTaskFileSize(), conn->getTaskParentDirId(), getSuffix(conn->getTaskFileName()));
+      if (ret == 0) {
+        BlobStore::release(db, md5);
+      }
+    }
+    LOG_INFO("client %s puts quick with proof: %s", conn->getUser().c_str(), conn->getTaskFileName().c_str());
+  }
+  else {
+    LOG_WARN("client %s puts quick proof mismatch: %s", conn->getUser().c_str(), conn->getTaskFileName().c_str());
+  }
+
+  PDURespond res;
+  res.header.type = ProtocolType::PDURESPOND_TYPE;
+  res.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  res.code = Code::PUTS_FINISH;
+  res.status = Status::FAILED;
+  if (ret != 0) {
+    res.status = Status::SUCCESS;
+    res.msg_amount = 1;
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN + sizeof(ret);
+    res.msg_len = sizeof(ret);
+    ret = htonll(ret);
+    res.msg.assign((char*)&ret, sizeof(ret));
+  }
+  {
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, res);
+  }
+  if (res.status != Status::SUCCESS) {
+    conn->setStatus(UpDownCon::CLOSE);
+  }
+}
 
-    // 发送回复
+// 所有数据接收完成：校验哈希，移入全局存储，插入数据库，并发送完成回复
+void PutsDataTool::finishUpload(UpDownCon *conn, const std::shared_ptr<UploadSession> &session) {
+  // 因为可能有多个线程（或共享会话的多个连接）同时到达此时，但我们只允许一个线程执行
+  // 会话只会被标记完成一次；如果status_是DOING，则将它变为FIN，继续执行
+  // 整个过程是原子的，因此只有一个线程能执行
+  if (!session->setFinish()) {
+    return;
+  }
+  if (!conn->cmpExchange(UpDownCon::UDStatus::DOING, UpDownCon::UDStatus::FIN)) {
+    return;
+  }
+  std::cout << "upload file: recv file data finish" << std::endl;
+  uint64_t raw_bytes = 0, wire_bytes = 0;
+  session->getTransferBytes(raw_bytes, wire_bytes);
+  if (raw_bytes > 0) {
+    LOG_INFO("client %s puts %s: recv %lu bytes, %lu bytes on wire (%.1f%%)", conn->getUser().c_str(), conn->getTaskFileName().c_str(),
+             raw_bytes, wire_bytes, 100.0 * wire_bytes / raw_bytes);
+  }
+
+  // 校验数据的哈希，与声明的哈希不一致的文件不能入库，否则快传和去重会把错误的数据交给其它用户
+  // 之后将数据落盘，写入失败（例如 O_DIRECT 合并缓冲区写入出错）的文件同样不能入库，客户端需要重新上传
+  bool intact = session->verifyHash();
+  if (!intact) {
+    LOG_WARN("client %s puts hash mismatch: %s", conn->getUser().c_str(), conn->getTaskFileName().c_str());
+  }
+  else if (!session->syncFile()) {
+    LOG_ERROR("client %s puts flush file failed: %s", conn->getUser().c_str(), conn->getTaskFileName().c_str());
+    intact = false;
+  }
+  if (!intact) {
+    session->discard();
+
+    PDURespond res;
+    res.header.type = ProtocolType::PDURESPOND_TYPE;
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN;
+    res.code = Code::PUTS_FINISH;
+    res.status = Status::FAILED;
+    res.msg_len = 0;
     {
-      // 理论上不会有多个线程同时调用，但任然加锁
-      std::lock_guard<std::mutex> lock(conn->getSendMutex());
-      sr_tool_.sendPDURespond(conn_->getSSL(), res);
+      std::lock_guard<FairMutex> lock(conn->getSendMutex());
+      sr_tool_.sendPDURespond(conn, res);
+    }
+    conn->setStatus(UpDownCon::CLOSE);
+    return;
+  }
+
+  // 将文件移入全局存储，插入数据库，并发送回复
+  MyDB db;
+  std::string suffix = getSuffix(conn->getTaskFileName());
+  std::string md5 = conn->getTaskFileMd5();
+  uint64_t ret = 0;
+  if (BlobStore::commit(db, session->getFilePath(), md5, conn->getTaskFileSize())) {
+    // 文件已经移入全局存储，删除会话日志
+    session->removeJournal();
+    // 插入数据到数据库，并修改已使用空间
+    ret = db.insertFileData(conn->getUser(), conn->getTaskFileName(), md5, conn->getTaskFileSize(), conn->getTaskParentDirId(), suffix);
+    if (ret == 0) {
+      BlobStore::release(db, md5);
     }
   }
+
+  PDURespond res;
+  res.header.type = ProtocolType::PDURESPOND_TYPE;
+  res.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  res.code = Code::PUTS_FINISH;
+  if(ret != 0) {
+    res.status = Status::SUCCESS;
+    res.msg_amount = 1;
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN + sizeof(ret);
+    res.msg_len = sizeof(ret);
+    ret = htonll(ret);
+    res.msg.assign((char*)&ret, sizeof(ret));
+  }
+  else {
+    res.status = Status::FAILED;
+  }
+
+  // 发送回复
+  {
+    // 理论上不会有多个线程同时调用，但任然加锁
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, res);
+  }
 }
 
 //*******************************************上传完成*******************************************//
@@ -355,28 +915,39 @@ bool GetsTool::firstCheck() {
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
   respond.code = Code::GETS;
+  if (pdu_.tran_pdu_code == Code::GETS_RANGE || pdu_.tran_pdu_code == Code::GETS_MULTI) {
+    respond.code = pdu_.tran_pdu_code;
+  }
+  uint32_t compress = Compressor::negotiate(pdu_.compress);    // 协商压缩方式，通过回复的头部告诉客户端
+  respond.header.reserved = compress & 0xff;
   respond.msg_amount = 0;
   respond.msg_len = 0;
   UserInfo info;
-  bool sql_res = db.getUserInfo(pdu_.user, pdu_.pwd, info);
+  bool sql_res = getTransferUser(db, conn_, pdu_, info);
 
-  if (sql_res && std::string(info.cipher) != "") { // 用户名密码认证通过
+  if (sql_res) { // 用户名密码（或会话令牌）认证通过
     UDtask task;
+    task.compress = compress;
     if (createTask(respond, task, db)) {
       conn_->init(info, task);    // 设置下载文件信息
       conn_->setVerify(true);     // 设置验证通过
-      // 将文件大小和md5发送回给客户端，方便客户端下载完成后进行检查，是否正常
-      uint64_t file_size = htonll(task.file_size);
-      respond.msg.clear();
-      respond.msg.append((char*)&file_size, sizeof(file_size));
-      respond.msg.append(conn_->getTaskFileMd5());
-      respond.msg_len = sizeof(uint64_t) + respond.msg.size();
-      respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
+      // 将文件大小和md5发送回给客户端，方便客户端下载完成后进行检查，是否正常（多文件下载在清单中发送每个文件的信息）
+      if (task.multi_session == nullptr) {
+        uint64_t file_size = htonll(task.file_size);
+        respond.msg.clear();
+        respond.msg.append((char*)&file_size, sizeof(file_size));
+        respond.msg.append(conn_->getTaskFileMd5());
+        respond.msg_len = sizeof(uint64_t) + respond.msg.size();
+        respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
+      }
 
       conn_->setStatus(UpDownCon::UDStatus::DOING); // 设置为进行中状态
       conn_->initStatusControl(); // 初始化状态控制（用于控制下载状态）
     }
   }
+  else if (pdu_.header.reserved == AUTH_SESSION_TOKEN) {   // 令牌无效或已过期，客户端改用密码重新请求
+    respond.status = Status::NOT_VERIFY;
+  }
   else {  // 不存在该用户或密码错误或为通过认证
     respond.status = Status::FAILED;
   }
@@ -384,10 +955,10 @@ bool GetsTool::firstCheck() {
   // 发送回复
   {
     // 理论上不会有多个线程同时调用，但任然加锁
-    std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-    sr_tool_.sendPDURespond(conn_->getSSL(), respond);  // 发送认证结果
+    std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+    sr_tool_.sendPDURespond(conn_, respond);  // 发送认证结果
   }
-  if (respond.status != Status::SUCCESS) {
+  if (respond.status != Status::SUCCESS && respond.status != Status::NOT_VERIFY) {   // 令牌被拒绝时等待客户端用密码重新请求
     conn_->setStatus(UpDownCon::UDStatus::CLOSE);
   }
 
@@ -400,6 +971,13 @@ bool GetsTool::createTask(PDURespond &respond, UDtask &task, MyDB &db) {
   task.task_type = UpDownCon::ConType::GETTASK;    // 设置为下载任务
   task.file_name = pdu_.file_name;                 // 任务文件名
 
+  // 多文件下载：认证后等待客户端发送要下载的文件或文件夹ID（GETS_MULTI_LIST）
+  if (pdu_.tran_pdu_code == Code::GETS_MULTI) {
+    task.multi_session = std::make_shared<MultiGetSession>(pdu_.user);
+    respond.status = Status::SUCCESS;
+    return true;
+  }
+
   // 查询文件是否存在，并返回MD5码
   // 查询文件MD5码，不存在返回false，parent_dir_id指的是要下载的文件ID
   // pdu_的parent_dir_id字段实际保存的是file_id
@@ -408,44 +986,53 @@ bool GetsTool::createTask(PDURespond &respond, UDtask &task, MyDB &db) {
     return false;
   }
 
-  std::string full_path = std::string(ROOTFILEPATH) + "/" + std::string(pdu_.user) + "/" + task.file_md5;  // 用户目录下的文件路径
+  // 块存储模式保存的文件按清单读取，否则读取全局存储中的整个文件
+  std::vector<ChunkEntry> entries;
+  uint64_t chunked_size = 0;
+  bool is_chunked = ChunkStore::loadManifest(task.file_md5, chunked_size, entries);
+  std::string full_path = BlobStore::resolvePath(pdu_.user, task.file_md5);  // 全局存储中的文件路径
   struct stat file_stat;
 
-  if (stat(full_path.c_str(), &file_stat) == -1) {  // 文件不存在
+  if (is_chunked) {
+    task.file_size = chunked_size;    // 文件总大小
+  }
+  else if (stat(full_path.c_str(), &file_stat) == -1) {  // 文件不存在
     respond.status = Status::FILE_NOT_EXIST;
     return false;
   }
+  else {
+    task.file_size = file_stat.st_size; // 文件总大小
+  }
 
-  task.file_size = file_stat.st_size; // 文件总大小
-
+  if (pdu_.tran_pdu_code == Code::GETS_RANGE) {
+    // 区间下载：客户端使用多个连接分别下载文件的不同区间 [sended_size, sended_size+file_size)
+    if (pdu_.file_size == 0 || pdu_.sended_size >= task.file_size || pdu_.file_size > task.file_size - pdu_.sended_size) {
+      respond.status = Status::GET_CONTINUE_FAILED;
+      return false;
+    }
+    task.handled_size = pdu_.sended_size;
+    task.range_end = pdu_.sended_size + pdu_.file_size;
+    task.is_range = true;
+  }
   // 断点续传或者从新开始
-  if(pdu_.sended_size < task.file_size) {
+  else if(pdu_.sended_size < task.file_size) {
     task.handled_size = pdu_.sended_size;       // 客户端指定的偏移量，但是不能大于文件总字节.默认为0
+    task.range_end = task.file_size.load();
   }
   else {
     respond.status = Status::GET_CONTINUE_FAILED; // 断点下载失败
     return false;
   }
 
-  // 打开文件以便读取
-  int file_fd = open(full_path.c_str(), O_RDONLY);
-  if (file_fd == -1) {
-    perror("open file in gets error");
-    respond.status = Status::FAILED;
-    return false;
-  }
-
-  // 映射文件到内存
-  char *pmap = (char *)mmap(NULL, task.file_size, PROT_READ, MAP_SHARED, file_fd, 0);  // 内存映射
-  if (pmap == MAP_FAILED) {
-    perror("mmap error");
-    close(file_fd);
+  // 打开文件以便读取，只映射发送位置所在的窗口，而不是整个文件
+  std::shared_ptr<FileReader> reader = std::make_shared<FileReader>();
+  bool open_res = is_chunked ? reader->openChunks(std::move(entries), task.file_size)
+                             : reader->open(full_path, task.file_size, task.handled_size);
+  if (!open_res) {
     respond.status = Status::FAILED;
     return false;
   }
-
-  task.file_fd = file_fd;
-  task.file_map = pmap;
+  task.down_reader = reader;
 
   respond.status = Status::SUCCESS; // 设置为OK
   return true;
@@ -463,7 +1050,12 @@ GetsDataTool::GetsDataTool(const TranDataPdu &pdu, AbstractCon *conn) : pdu_(pdu
 
 int GetsDataTool::doingTask() {
   if (conn_->getStatus() == UpDownCon::UDStatus::DOING && conn_->getIsVerify()) {
-    sendFileData();  // 发送文件数据
+    if (pdu_.code == Code::GETS_MULTI_LIST) {
+      sendMultiFiles();   // 多文件下载
+    }
+    else {
+      sendFileData();     // 发送文件数据
+    }
   }
 
   if (!conn_->getIsVerify()) {
@@ -495,62 +1087,113 @@ void GetsDataTool::sendFileData() {
   // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!! 不能确定客户端接收的数据，也就不能重传，后续可添加 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
   // 发送文件数据
   // !!!!!!!!!!!!!!!!!!!!!!!! 这里获取之前下载的文件数据量在当前无用，如果后续添加离线任务续传的功能，可以使用它 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+  // 持有读取器，保证发送过程中连接关闭时窗口映射依然有效
+  std::shared_ptr<FileReader> reader = conn_->getTaskDownReader();
+  if (reader == nullptr) {
+    conn_->setStatus(UpDownCon::CLOSE);
+    return;
+  }
+
   size_t pre_handled_bytes = conn_->getTaskHandledSize();   // 之前处理的字节
-  size_t total = conn_->getTaskFileSize() - pre_handled_bytes;  // 需要传输的总字节数
+  size_t range_end = conn_->getTaskRangeEnd();              // 发送的结束位置，区间下载时为区间的结束位置
+  size_t total = range_end - pre_handled_bytes;             // 需要传输的总字节数
   size_t chunk_size = 2048;   // 每次发送的块大小
 
   size_t total_chunks = (total-1)/chunk_size + 1; // 总chaunk数，向上取整
   size_t last_chunk_size = total - chunk_size*(total_chunks-1); // 最后一个chunk的大小
+  // 区间下载时，边发送边计算区间的哈希，发送完成后告诉客户端，客户端可以单独校验并重新下载该区间
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> range_hash(nullptr, EVP_MD_CTX_free);
+  if (conn_->getTaskIsRange()) {
+    range_hash.reset(EVP_MD_CTX_new());
+    if (range_hash == nullptr || EVP_DigestInit_ex(range_hash.get(), EVP_sha256(), nullptr) != 1) {
+      conn_->setStatus(UpDownCon::CLOSE);
+      return;
+    }
+  }
+
+  // 按协商的压缩方式压缩每个分片，不划算的分片原样发送
+  Compressor compressor(conn_->getTaskCompress());
+  std::string packed;
+
   // 创建发送数据协议
   TranDataPdu tran_data;
   tran_data.header.type = ProtocolType::TRANDATAPDU_TYPE;
   tran_data.code = Code::GETS_DATA;
   // 设置并发送文件数据
   for (uint32_t i=0; i<total_chunks; ++i) {
+    size_t raw_size = (i == total_chunks-1 ? last_chunk_size : chunk_size);
     tran_data.file_offset = (uint64_t)i * chunk_size + pre_handled_bytes;
-    tran_data.chunk_size = (i == total_chunks-1 ? last_chunk_size : chunk_size);
     tran_data.total_chunks = total_chunks;
     tran_data.chunk_index = i;
-    tran_data.data.assign(conn_->getTaskFileMap() + tran_data.file_offset, tran_data.chunk_size);
+    const char *file_data = reader->data(tran_data.file_offset, raw_size);
+    if (file_data == nullptr) {
+      LOG_ERROR("download file: read %s error", conn_->getTaskFileName().c_str());
+      break;
+    }
+    if (range_hash != nullptr) {
+      EVP_DigestUpdate(range_hash.get(), file_data, raw_size);
+    }
+    tran_data.status = compressor.compress(file_data, raw_size, packed);
+    // 发送时直接引用映射的文件数据或压缩缓冲区，不再复制到 tran_data.data
+    if (tran_data.status != Compression::COMPRESS_NONE) {
+      tran_data.view = packed;
+    }
+    else {
+      tran_data.view = std::string_view(file_data, raw_size);
+    }
+    tran_data.chunk_size = tran_data.view.size();
     // body长度为，TranDataPdu基础长度+数据长度
     tran_data.header.body_len = TRANDATAPDU_BODY_BASE_LEN + tran_data.chunk_size;
 
     // 传输控制
-    if (conn_->getStatus() == UpDownCon::UDStatus::PAUSE) { // 暂停
-      // 等待状态再次改变，且不为PAUSE
-      conn_->wait([this]() { return conn_->getStatus() != UpDownCon::UDStatus::PAUSE; });
-    }
-    if (conn_->getStatus() == UpDownCon::UDStatus::CLOSE) { // 取消
+    if (!transferControl()) { // 取消
       break;
     }
-    // 继续，则什么都不做，继续
-    
-    // 避免长时间占用cpu
-    if (conn_->getIsVip()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(5));
-    }
-    else {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // 多路复用的流等待发送窗口，独立的连接不等待
+    if (!conn_->waitSendWindow(PROTOCOLHEADER_LEN + tran_data.header.body_len)) {
+      break;
     }
 
     // 发送数据
     size_t send_bytes = 0;
     {
       // 理论上不会有多个线程同时调用，但任然加锁
-      std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-      send_bytes = sr_tool_.sendTranDataPdu(conn_->getSSL(), tran_data);
+      std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+      send_bytes = sr_tool_.sendTranDataPdu(conn_, tran_data);
     }
     if (send_bytes != PROTOCOLHEADER_LEN + tran_data.header.body_len) {
       std::cout << "download file: send data error" << std::endl;
       break;
     }
-    conn_->addTaskHandleSize(tran_data.chunk_size); // 更新处理字节数
+    conn_->addTaskHandleSize(raw_size); // 更新处理字节数
+  }
+  if (compressor.getCompressedChunks() > 0) {
+    LOG_INFO("client %s gets %s: sent %lu bytes, %lu bytes on wire (%.1f%%), %lu/%lu chunks compressed", conn_->getUser().c_str(),
+             conn_->getTaskFileName().c_str(), compressor.getRawBytes(), compressor.getWireBytes(),
+             100.0 * compressor.getWireBytes() / compressor.getRawBytes(), compressor.getCompressedChunks(),
+             compressor.getCompressedChunks() + compressor.getStoredChunks());
   }
 
   // !!!!!!!!!!!!!!!!!!!!!!!!!! 这里根据服务端发送的数据判断是否完成，实际应该根据客户端接收到的数据判断 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-  // 检查文件是否已经全部发送
-  if (conn_->getTaskHandledSize() == total) {
-    conn_->setStatus(UpDownCon::FIN);  // 文件传输完成
+  // 检查文件（区间）是否已经全部发送
+  if (conn_->getTaskHandledSize() == range_end) {
+    conn_->setStatus(UpDownCon::FIN);  // 文件传输完成（先修改状态，客户端收到区间哈希后会立即发送确认）
+    if (range_hash != nullptr) {  // 区间下载，发送区间的哈希
+      unsigned char result[EVP_MAX_MD_SIZE];
+      unsigned int result_len = 0;
+      EVP_DigestFinal_ex(range_hash.get(), result, &result_len);
+
+      TranFinishPdu range_finish;
+      range_finish.header.type = ProtocolType::TRANFINISHPDU_TYPE;
+      range_finish.header.body_len = TRANFINISHPDU_BODY_LEN;
+      range_finish.code = Code::GETS_RANGE;
+      range_finish.file_size = total;   // 区间长度
+      for (unsigned int i = 0; i < result_len; ++i) {
+        snprintf(range_finish.file_md5 + 2 * i, 3, "%02x", result[i]);
+      }
+      std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+      sr_tool_.sendTranFinishPdu(conn_, range_finish);
+    }
   }
   else{ // 没有发送所有数据，错误
     conn_->setStatus(UpDownCon::CLOSE);
@@ -558,6 +1201,139 @@ void GetsDataTool::sendFileData() {
 }
 
 
+// 多文件下载：展开客户端发送的文件和文件夹ID，发送文件清单，再按清单顺序发送每个文件，每个文件结束时发送结束标记
+void GetsDataTool::sendMultiFiles() {
+  std::shared_ptr<MultiGetSession> session = conn_->getTaskMultiSession();
+  if (session == nullptr || !session->start()) {  // 每个连接只下载一组文件
+    return;
+  }
+  MyDB db;
+  PDURespond res;
+  res.header.type = ProtocolType::PDURESPOND_TYPE;
+  res.code = Code::GETS_MULTI_LIST;
+  if (!session->expand(db, pdu_.data.data(), std::min<size_t>(pdu_.chunk_size, pdu_.data.size()))) {
+    res.status = Status::FILE_NOT_EXIST;
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN;
+    {
+      std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+      sr_tool_.sendPDURespond(conn_, res);
+    }
+    conn_->setStatus(UpDownCon::CLOSE);
+    return;
+  }
+
+  // 发送文件清单
+  const std::vector<DownFileInfo> &files = session->getFiles();
+  uint32_t pages = session->getPageCount();
+  res.status = Status::SUCCESS;
+  for (uint32_t page = 0; page < pages; ++page) {
+    uint32_t file_count = 0;
+    res.msg = session->makeListPage(page, file_count);
+    res.msg_amount = file_count;
+    res.msg_len = res.msg.size();
+    res.header.body_len = PDURESPOND_BODY_BASE_LEN + res.msg_len;
+    std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+    sr_tool_.sendPDURespond(conn_, res);
+  }
+
+  // 按清单顺序发送每个文件，一个文件读取失败时发送空哈希的结束标记，不影响后面的文件
+  Compressor compressor(conn_->getTaskCompress());
+  std::string packed;
+  const size_t chunk_size = 2048;   // 每次发送的块大小，与单文件下载相同
+  TranDataPdu tran_data;
+  tran_data.header.type = ProtocolType::TRANDATAPDU_TYPE;
+  tran_data.code = Code::GETS_MULTI_DATA;
+  tran_data.total_chunks = files.size();
+  TranFinishPdu file_end;
+  file_end.header.type = ProtocolType::TRANFINISHPDU_TYPE;
+  file_end.header.body_len = TRANFINISHPDU_BODY_LEN;
+  file_end.code = Code::GETS_MULTI_DATA;
+  uint32_t failed = 0;
+  for (uint32_t index = 0; index < files.size(); ++index) {
+    const DownFileInfo &file = files[index];
+    FileReader reader;
+    uint64_t file_size = 0;
+    bool ok = Delta::openBase(conn_->getUser(), file.md5, reader, file_size) && file_size == file.file_size;
+    tran_data.chunk_index = index;
+    for (uint64_t offset = 0; ok && offset < file_size; offset += chunk_size) {
+      size_t raw_size = std::min<uint64_t>(chunk_size, file_size - offset);
+      const char *file_data = reader.data(offset, raw_size);
+      if (file_data == nullptr) {
+        ok = false;
+        break;
+      }
+      tran_data.file_offset = offset;
+      tran_data.status = compressor.compress(file_data, raw_size, packed);
+      // 发送时直接引用映射的文件数据或压缩缓冲区，不再复制到 tran_data.data
+      if (tran_data.status != Compression::COMPRESS_NONE) {
+        tran_data.view = packed;
+      }
+      else {
+        tran_data.view = std::string_view(file_data, raw_size);
+      }
+      tran_data.chunk_size = tran_data.view.size();
+      tran_data.header.body_len = TRANDATAPDU_BODY_BASE_LEN + tran_data.chunk_size;
+
+      if (!transferControl()) {   // 取消
+        return;
+      }
+      if (!conn_->waitSendWindow(PROTOCOLHEADER_LEN + tran_data.header.body_len)) {
+        return;
+      }
+      size_t send_bytes = 0;
+      {
+        std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+        send_bytes = sr_tool_.sendTranDataPdu(conn_, tran_data);
+      }
+      if (send_bytes != PROTOCOLHEADER_LEN + tran_data.header.body_len) {
+        conn_->setStatus(UpDownCon::CLOSE);
+        return;
+      }
+    }
+    if (!ok) {
+      ++failed;
+      LOG_WARN("client %s gets multi: read %s failed", conn_->getUser().c_str(), file.path.c_str());
+    }
+
+    // 文件结束标记
+    file_end.file_size = index;
+    memset(file_end.file_md5, 0, sizeof(file_end.file_md5));
+    if (ok) {
+      memcpy(file_end.file_md5, file.md5.data(), std::min(file.md5.size(), sizeof(file_end.file_md5) - 1));
+    }
+    std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+    sr_tool_.sendTranFinishPdu(conn_, file_end);
+  }
+  if (compressor.getCompressedChunks() > 0) {
+    LOG_INFO("client %s gets multi: sent %lu bytes, %lu bytes on wire (%.1f%%)", conn_->getUser().c_str(),
+             compressor.getRawBytes(), compressor.getWireBytes(), 100.0 * compressor.getWireBytes() / compressor.getRawBytes());
+  }
+  LOG_INFO("client %s gets multi: %lu files, %u failed", conn_->getUser().c_str(), files.size(), failed);
+  conn_->setStatus(UpDownCon::FIN);   // 等待客户端的完成确认
+}
+
+// 传输控制：暂停时等待状态改变，取消时返回false；每次发送前短暂休眠，避免长时间占用cpu
+bool GetsDataTool::transferControl() {
+  if (conn_->getStatus() == UpDownCon::UDStatus::PAUSE) { // 暂停
+    // 等待状态再次改变，且不为PAUSE
+    conn_->wait([this]() { return conn_->getStatus() != UpDownCon::UDStatus::PAUSE; });
+  }
+  if (conn_->getStatus() == UpDownCon::UDStatus::CLOSE) { // 取消
+    return false;
+  }
+  // 继续，则什么都不做，继续
+
+  // 避免长时间占用cpu
+  if (conn_->getIsVip()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+
 //*******************************************下载完成*******************************************//
 GetsFinishTool::GetsFinishTool(AbstractCon *conn) : conn_(dynamic_cast<UpDownCon*>(conn)) {
 
@@ -580,8 +1356,8 @@ int GetsFinishTool::doingTask() {
       // 发送
       {
         // 理论上不会有多个线程同时调用，但任然加锁
-        std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-        sr_tool_.sendPDURespond(conn_->getSSL(), res);
+        std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+        sr_tool_.sendPDURespond(conn_, res);
       }
 
       // 关闭连接
@@ -601,8 +1377,8 @@ int GetsFinishTool::doingTask() {
       // 发送
       {
         // 理论上不会有多个线程同时调用，但任然加锁
-        std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-        sr_tool_.sendPDURespond(conn_->getSSL(), res);
+        std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+        sr_tool_.sendPDURespond(conn_, res);
       }
 
 
@@ -3,6 +3,7 @@
 
 #include "AbstractTool.h"
 #include "AbstractCon.h"
+#include "BufferPool.h"
 
 // 负责上传任务
 class PutsTool : public AbstractTool {
@@ -14,24 +15,39 @@ class PutsTool : public AbstractTool {
  private:
   bool firstCheck(UpDownCon *conn);   // 首次连接认证
   UDtask createTask(PDURespond &respond, MyDB &db);  // 生成任务结构体
+  // 秒传的持有证明：随机选择内容中的一个区间，回复体为挑战，task 中保存期望的结果；内容读取失败返回false
+  bool makeQuickProof(PDURespond &respond, UDtask &task);
 
  private:
   TranPdu pdu_{ 0 };
   AbstractCon *conn_parent_{ nullptr };
 };
 
-// 负责上传文件数据任务
+// 负责上传文件数据任务（包括块存储模式下的块清单查询、差量上传，以及批量上传的清单和文件）
 class PutsDataTool : public AbstractTool {
  public:
   PutsDataTool(AbstractCon* conn);
   PutsDataTool(const TranDataPdu &pdu, AbstractCon *conn);
+  // 快速路径：pdu只包含固定字段，文件数据直接从接收到的数据帧（frame）中读取，不再拷贝到pdu.data
+  PutsDataTool(const TranDataPdu &pdu, buffer_shared_ptr frame, const char *data, AbstractCon *conn);
   int doingTask() override;
+  // 会话中的数据已经全部接收时直接入库（续传时之前的连接在入库前断开），客户端不会再发送数据
+  void finishIfComplete();
 
  private:
   void recvFileData(UpDownCon *conn);
+  void replyChunk(UpDownCon *conn, uint32_t status);   // 回复一个chunk的接收结果，FAILED 表示需要重传
+  void queryChunks(UpDownCon *conn);    // 块清单查询：复制用户已经引用的块，回复缺失的块
+  void sendSignature(UpDownCon *conn);  // 差量上传：发送旧版本的块签名
+  void applyDelta(UpDownCon *conn);     // 差量上传：执行复制指令，从旧版本复制数据
+  void recvBatch(UpDownCon *conn);      // 批量上传：处理文件清单和文件数据，分组回复入库结果
+  void checkQuickProof(UpDownCon *conn);  // 秒传的持有证明：校验通过后按秒传入库
+  void finishUpload(UpDownCon *conn, const std::shared_ptr<UploadSession> &session);   // 接收完成后入库
 
  private:
   TranDataPdu pdu_{ {0} };
+  buffer_shared_ptr frame_{ nullptr };  // 持有数据帧，保证data_有效
+  const char *data_{ nullptr };         // 文件数据，为空时使用pdu_.data
   UpDownCon *conn_{ nullptr };
 };
 
@@ -63,7 +79,7 @@ class GetsTool : public AbstractTool {
   UpDownCon *conn_{ nullptr };
 };
 
-// 负责下载文件数据任务
+// 负责下载文件数据任务（包括多文件下载）
 class GetsDataTool : public AbstractTool {
  public:
   GetsDataTool(AbstractCon* conn);
@@ -72,6 +88,8 @@ class GetsDataTool : public AbstractTool {
 
  private:
   void sendFileData();
+  void sendMultiFiles();    // 多文件下载：发送文件清单，再按顺序发送每个文件
+  bool transferControl();   // 传输控制（暂停时等待）和限速，取消时返回false
 
  private:
   TranDataPdu pdu_{ {0} };
@@ -1,67 +1,84 @@
 #include "SRTool.h"
 #include "BufferPool.h"
 #include "Serializer.h"
+#include "AbstractCon.h"
 
 
 // 安全发送PDU，返回发送的字节数
-size_t SRTool::sendPDU(SSL *ssl, const PDU &pdu) {
-  // 序列化PDU（自动回收）
-  auto buf = Serializer::serialize(pdu);
-  // 要发送的字节为Header大小+Body大小
-  const size_t target_bytes = PROTOCOLHEADER_LEN + pdu.header.body_len;
-  size_t sended_bytes = 0;  // 已发送大小
-  // 发送header
-  while (sended_bytes < target_bytes) {
-    size_t ret = SSL_write(ssl, buf.get() + sended_bytes, target_bytes - sended_bytes);
-    if (ret <= 0) {
-      int err = SSL_get_error(ssl, ret);  // 获取错误信息
-      if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {  // 暂时无法发送，稍后重试
-        continue;
-      }
-      else {  // 其他错误，终止发送
-        perror("SSL_write failed");
-        break;
-      }
-    }
-    sended_bytes += ret;
-  } 
-  return sended_bytes;
+size_t SRTool::sendPDU(AbstractCon *conn, const PDU &pdu) {
+  // 定长的协议结构体序列化到栈上，不从缓冲池申请缓冲区
+  char buf[PROTOCOLHEADER_LEN + std::max(PDU_BODY_BASE_LEN, wire::Layout<PDU>::Body::kMaxCompactSize) + sizeof(pdu.msg)];
+  size_t len = Serializer::serializeInto(pdu, buf, sizeof(buf));
+  return writePdu(conn, buf, len);
 }
 
 // 安全发送PDU回复
-size_t SRTool::sendPDURespond(SSL *ssl, const PDURespond &pdu) {
+size_t SRTool::sendPDURespond(AbstractCon *conn, const PDURespond &pdu) {
   // 序列化PDU（自动回收）
   auto buf = Serializer::serialize(pdu);
-  // 要发送的字节为Header大小+Body大小
-  const size_t target_bytes = PROTOCOLHEADER_LEN + pdu.header.body_len;
-  size_t sended_bytes = 0;  // 已发送大小
-  // 发送header
-  while (sended_bytes < target_bytes) {
-    size_t ret = SSL_write(ssl, buf.get() + sended_bytes, target_bytes - sended_bytes);
-    if (ret <= 0) {
-      int err = SSL_get_error(ssl, ret);  // 获取错误信息
-      if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {  // 暂时无法发送，稍后重试
-        continue;
-      }
-      else {  // 其他错误，终止发送
-        perror("SSL_write failed");
-        break;
-      }
+  return writePdu(conn, buf.get(), Serializer::encodedLen(pdu));
+}
+
+// 数据包不经过缓冲池序列化：头部和固定字段序列化到栈上，数据直接从 pdu.payload() 发送，不再先复制到 pdu.data
+size_t SRTool::sendTranDataPdu(AbstractCon *conn, const TranDataPdu &pdu) {
+  char head[TRANDATAPDU_HEAD_LEN];
+  const size_t head_len = Serializer::serializeHead(pdu, head);
+  return writePdu(conn, head, head_len, pdu.payload().substr(0, pdu.chunk_size));
+}
+
+// SSL_write 只接受连续的数据，一个TLS记录（16KB）能装下的协议单元在线程局部的缓冲区中拼接后一次写入，
+// 保证头部和数据在同一个记录中，不会为了几十字节的头部单独产生一个记录；更大的协议单元分多次写入，数据不再复制
+size_t SRTool::writePdu(AbstractCon *conn, const char *head, size_t head_len, std::string_view payload) {
+  SSL *ssl = conn->getSSL();
+  if (ssl == nullptr) {   // 连接已关闭（流所属的连接关闭）
+    return 0;
+  }
+  const size_t pdu_len = head_len + payload.size();
+  char frame_head[MUXFRAME_HEAD_LEN];
+  size_t frame_len = 0;
+  if (conn->getStreamId() != 0) {
+    MuxFrame frame;
+    frame.header.type = ProtocolType::MUXFRAME_TYPE;
+    frame.header.body_len = MUXFRAME_BODY_BASE_LEN + pdu_len;
+    frame.header.version = PROTOCOL_VERSION_V1;
+    frame.stream_id = conn->getStreamId();
+    frame.kind = MUX_DATA;
+    frame.data_len = pdu_len;
+    frame_len = Serializer::serializeHead(frame, frame_head);
+  }
+  if (frame_len == 0 && payload.empty()) {  // 已经是连续的数据
+    return writeAll(ssl, head, head_len);
+  }
+
+  if (frame_len + pdu_len <= kMaxGatherLen) {
+    std::vector<char> &gather = gatherBuffer();
+    memcpy(gather.data(), frame_head, frame_len);
+    memcpy(gather.data() + frame_len, head, head_len);
+    if (!payload.empty()) {
+      memcpy(gather.data() + frame_len + head_len, payload.data(), payload.size());
     }
-    sended_bytes += ret;
+    size_t sended_bytes = writeAll(ssl, gather.data(), frame_len + pdu_len);
+    return sended_bytes < frame_len ? 0 : sended_bytes - frame_len;
   }
-  return sended_bytes;
+  if (frame_len > 0 && writeAll(ssl, frame_head, frame_len) < frame_len) {
+    return 0;
+  }
+  size_t sended_bytes = writeAll(ssl, head, head_len);
+  if (sended_bytes < head_len || payload.empty()) {
+    return sended_bytes;
+  }
+  return sended_bytes + writeAll(ssl, payload.data(), payload.size());
 }
 
-size_t SRTool::sendTranDataPdu(SSL *ssl, const TranDataPdu &pdu) {
-  // 序列化PDU（自动回收）
-  auto buf = Serializer::serialize(pdu);
-  // 要发送的字节为Header大小+Body大小
-  const size_t target_bytes = PROTOCOLHEADER_LEN + pdu.header.body_len;
+std::vector<char>& SRTool::gatherBuffer() {
+  thread_local std::vector<char> gather(kMaxGatherLen);
+  return gather;
+}
+
+size_t SRTool::writeAll(SSL *ssl, const char *data, size_t len) {
   size_t sended_bytes = 0;  // 已发送大小
-  // 发送header
-  while (sended_bytes < target_bytes) {
-    size_t ret = SSL_write(ssl, buf.get() + sended_bytes, target_bytes - sended_bytes);
+  while (sended_bytes < len) {
+    int ret = SSL_write(ssl, data + sended_bytes, len - sended_bytes);
     if (ret <= 0) {
       int err = SSL_get_error(ssl, ret);  // 获取错误信息
       if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {  // 暂时无法发送，稍后重试
@@ -73,63 +90,67 @@ size_t SRTool::sendTranDataPdu(SSL *ssl, const TranDataPdu &pdu) {
       }
     }
     sended_bytes += ret;
-  } 
+  }
   return sended_bytes;
 }
 
+size_t SRTool::sendTranFinishPdu(AbstractCon *conn, const TranFinishPdu &pdu) {
+  char buf[wire::maxEncodedLen<TranFinishPdu>()];
+  size_t len = Serializer::serializeInto(pdu, buf, sizeof(buf));
+  return writePdu(conn, buf, len);
+}
+
 // ssl发送客户端信息
-size_t SRTool::sendUserInfo(SSL *ssl, const UserInfo &info) {
-  // 序列化PDU（自动回收）
-  auto buf = Serializer::serialize(info);
-  // 要发送的字节为Header大小+Body大小
-  const size_t target_bytes = PROTOCOLHEADER_LEN + info.header.body_len;
-  size_t sended_bytes = 0;  // 已发送大小
-  // 发送header
-  while (sended_bytes < target_bytes) {
-    size_t ret = SSL_write(ssl, buf.get() + sended_bytes, target_bytes - sended_bytes);
-    if (ret <= 0) {
-      int err = SSL_get_error(ssl, ret);  // 获取错误信息
-      if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {  // 暂时无法发送，稍后重试
-        continue;
-      }
-      else {  // 其他错误，终止发送
-        perror("SSL_write failed");
-        break;
-      }
-    }
-    sended_bytes += ret;
-  } 
-  return sended_bytes; 
+size_t SRTool::sendUserInfo(AbstractCon *conn, const UserInfo &info) {
+  char buf[wire::maxEncodedLen<UserInfo>()];
+  size_t len = Serializer::serializeInto(info, buf, sizeof(buf));
+  return writePdu(conn, buf, len);
+}
+
+// 多路复用的控制帧没有协议单元，直接写入所属的连接
+size_t SRTool::sendMuxFrame(AbstractCon *conn, uint32_t stream_id, uint32_t kind, uint32_t window) {
+  SSL *ssl = conn->getSSL();
+  if (ssl == nullptr) {
+    return 0;
+  }
+  MuxFrame frame;
+  frame.header.type = ProtocolType::MUXFRAME_TYPE;
+  frame.header.body_len = MUXFRAME_BODY_BASE_LEN;
+  frame.header.version = PROTOCOL_VERSION_V1;
+  frame.stream_id = stream_id;
+  frame.kind = kind;
+  frame.window = window;
+  char buf[MUXFRAME_HEAD_LEN];
+  size_t len = Serializer::serializeHead(frame, buf);
+  return writeAll(ssl, buf, len);
 }
 
 // 将一个存在全部文件信息的向量发送回客户端
-bool SRTool::sendFileInfo(SSL *ssl, std::vector<FileInfo> &vet) {
+// 文件信息依次序列化到同一个缓冲区，凑满一个TLS记录再写入，不再每个文件信息单独申请缓冲区、单独产生一个记录
+// v2 中文件名、类型和日期只发送实际内容，一个文件信息通常只有几十字节（v1 为246字节）
+bool SRTool::sendFileInfo(AbstractCon *conn, std::vector<FileInfo> &vet, const ProtocolHeader &reply) {
+  SSL *ssl = conn->getSSL();
+  if (ssl == nullptr) {
+    return false;
+  }
+  const size_t info_len = wire::maxEncodedLen<FileInfo>();   // 一个文件信息最多占用的长度
+  std::vector<char> &gather = gatherBuffer();
+  size_t used = 0;
   // 遍历文件信息结构体的向量
   for (FileInfo &file_info : vet) {
     // 设置协议头
     file_info.header.type = ProtocolType::FILEINFO_TYPE;
     file_info.header.body_len = FILEINFO_BODY_LEN;
-    // 序列化PDU（自动回收）
-    auto buf = Serializer::serialize(file_info);
-    // 要发送的字节为Header大小+Body大小
-    const size_t target_bytes = PROTOCOLHEADER_LEN + file_info.header.body_len;
-    size_t sended_bytes = 0;  // 已发送大小
-    // 发送header
-    while (sended_bytes < target_bytes) {
-      size_t ret = SSL_write(ssl, buf.get() + sended_bytes, target_bytes - sended_bytes);
-      if (ret <= 0) {
-        int err = SSL_get_error(ssl, ret);  // 获取错误信息
-        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {  // 暂时无法发送，稍后重试
-          continue;
-        }
-        else {  // 其他错误，终止发送
-          perror("SSL_write failed");
-          return false;
-        }
+    file_info.header.version = reply.version;
+    file_info.header.request_id = reply.request_id;
+    if (used + info_len > gather.size()) {
+      if (writeAll(ssl, gather.data(), used) != used) {
+        return false;
       }
-      sended_bytes += ret;
-    } 
+      used = 0;
+    }
+    used += Serializer::serializeInto(file_info, gather.data() + used, gather.size() - used);
   }
-  
-  return true;  // 如果所有数据发送成功，返回 true
-}
\ No newline at end of file
+
+  return writeAll(ssl, gather.data(), used) == used;  // 如果所有数据发送成功，返回 true
+}
@@ -1,21 +1,34 @@
 #pragma once
 
 #include "protocol.h"
+#include <string_view>
+
+class AbstractCon;
 
 
 // !!!!!!!!!!!!!!!!!!!!!!!!!! 发送数据应该是线程安全的，后续更改 !!!!!!!!!!!!!!!!!!!!!!!!!!!
 // send和recv的包装，主要用于网络发送和接收数据
+// 发送到连接 conn：conn 是多路复用的流（getStreamId 不为0）时，协议单元放在 MuxFrame 中通过所属的连接发送，返回值不包括 MuxFrame 的头部
 class SRTool {
  public:
   
 
-  size_t sendPDU(SSL *ssl, const PDU &pdu);     // 安全套接字发送PDU
-  size_t sendPDURespond(SSL *ssl, const PDURespond &pdu);
-  size_t sendTranDataPdu(SSL *ssl, const TranDataPdu &pdu);
+  size_t sendPDU(AbstractCon *conn, const PDU &pdu);     // 安全套接字发送PDU
+  size_t sendPDURespond(AbstractCon *conn, const PDURespond &pdu);
+  size_t sendTranDataPdu(AbstractCon *conn, const TranDataPdu &pdu);
+  size_t sendTranFinishPdu(AbstractCon *conn, const TranFinishPdu &pdu);
 
-  size_t sendUserInfo(SSL *ssl, const UserInfo &info);      //使用ssl发生客户信息
+  size_t sendUserInfo(AbstractCon *conn, const UserInfo &info);      //使用ssl发生客户信息
 
-  bool sendFileInfo(SSL *ssl, std::vector<FileInfo> &vet);  //使用ssl把文件信息全部发送回客户端
+  bool sendFileInfo(AbstractCon *conn, std::vector<FileInfo> &vet, const ProtocolHeader &reply);  //使用ssl把文件信息全部发送回客户端（版本和请求ID与reply相同），只用于短任务连接
 
-  
+  // 发送多路复用的控制帧（MUX_WINDOW、MUX_CLOSE），conn 为流所属的连接或流本身（都通过所属连接的ssl发送）
+  size_t sendMuxFrame(AbstractCon *conn, uint32_t stream_id, uint32_t kind, uint32_t window);
+
+ private:
+  static constexpr size_t kMaxGatherLen = 16 * 1024;   // 一个TLS记录的最大明文长度，不超过时头部和数据拼接后一次写入
+  // 发送一个协议单元（head + payload），流上的协议单元加上 MuxFrame 的头部，返回写入的协议单元的字节数
+  size_t writePdu(AbstractCon *conn, const char *head, size_t head_len, std::string_view payload = std::string_view());
+  size_t writeAll(SSL *ssl, const char *data, size_t len);  // 写入全部数据，返回实际写入的字节数
+  static std::vector<char>& gatherBuffer();  // 线程局部的拼接缓冲区（kMaxGatherLen字节）
 };  
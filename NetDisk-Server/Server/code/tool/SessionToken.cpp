@@ -0,0 +1,88 @@
+#include "SessionToken.h"
+#include "Log.h"
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+
+const size_t SessionToken::kFieldsLen = 1 + sizeof(uint32_t);
+std::string SessionToken::key_;
+
+const size_t SessionToken::kMinKeyLen = 32;
+// 曾经随配置文件发布的示例密钥，所有人都知道，不能使用
+const char *const SessionToken::kPublishedKey = "9f3c1a7e5b2d48c6a0e4f7b1d3c5e8a2";
+
+void SessionToken::setKey(const std::string &key) {
+  if (key == kPublishedKey) {
+    LOG_ERROR("SessionToken: Server.tokenKey is the published example key, ignored, using a random key");
+  }
+  else if (!key.empty() && key.size() < kMinKeyLen) {
+    LOG_ERROR("SessionToken: Server.tokenKey is shorter than %zu bytes, ignored, using a random key", kMinKeyLen);
+  }
+  else if (!key.empty()) {
+    key_ = key;
+    return;
+  }
+  else {
+    LOG_WARN("SessionToken: Server.tokenKey is empty, using a random key, tokens become invalid after restart");
+  }
+  unsigned char random_key[32];
+  if (RAND_bytes(random_key, sizeof(random_key)) != 1) {
+    LOG_ERROR("SessionToken generate key failed, session token disabled");
+    key_.clear();
+    return;
+  }
+  key_.assign(reinterpret_cast<char*>(random_key), sizeof(random_key));
+}
+
+bool SessionToken::issue(const UserInfo &info, char *token) {
+  if (key_.empty()) {
+    return false;
+  }
+  unsigned char *out = reinterpret_cast<unsigned char*>(token);
+  out[0] = (std::string(info.is_vip) == "1") ? 1 : 0;
+  uint32_t expire = htonl(static_cast<uint32_t>(time(nullptr) + SESSION_TOKEN_TTL));
+  memcpy(out + 1, &expire, sizeof(expire));
+  sign(std::string(info.user, strnlen(info.user, sizeof(info.user))), out, out + kFieldsLen);
+  return true;
+}
+
+bool SessionToken::verify(const std::string &user, const char *token, UserInfo &info) {
+  if (key_.empty() || user.empty() || user.size() >= sizeof(info.user)) {
+    return false;
+  }
+  const unsigned char *in = reinterpret_cast<const unsigned char*>(token);
+  unsigned char mac[SESSION_TOKEN_LEN - kFieldsLen];
+  sign(user, in, mac);
+  // 比较签名的耗时与内容无关，不能逐字节猜测签名
+  if (CRYPTO_memcmp(mac, in + kFieldsLen, sizeof(mac)) != 0) {
+    return false;
+  }
+  uint32_t expire = 0;
+  memcpy(&expire, in + 1, sizeof(expire));
+  if (static_cast<int64_t>(ntohl(expire)) <= static_cast<int64_t>(time(nullptr))) {   // 已经过期
+    return false;
+  }
+
+  info = UserInfo();
+  memcpy(info.user, user.data(), user.size());
+  strcpy(info.is_vip, (in[0] & 1) ? "1" : "0");
+  return true;
+}
+
+// 签名覆盖定长的标志、过期时间和之后的用户名，不同用户名的输入不会相同
+void SessionToken::sign(const std::string &user, const unsigned char *fields, unsigned char *mac) {
+  unsigned char data[kFieldsLen + USERSCOLMAXSIZE];
+  size_t user_len = std::min(user.size(), sizeof(data) - kFieldsLen);
+  memcpy(data, fields, kFieldsLen);
+  memcpy(data + kFieldsLen, user.data(), user_len);
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  HMAC(EVP_sha256(), key_.data(), static_cast<int>(key_.size()), data, kFieldsLen + user_len, digest, &digest_len);
+  memcpy(mac, digest, SESSION_TOKEN_LEN - kFieldsLen);
+}
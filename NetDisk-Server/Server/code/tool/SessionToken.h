@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "protocol.h"
+
+// 会话令牌：登录或注册成功时签发，之后的上传/下载请求用令牌代替密码认证，服务端只在内存中校验签名和有效期，不查询数据库
+// 令牌共 SESSION_TOKEN_LEN 字节（放在 TranPdu 的 pwd 中）：标志（1字节，最低位为VIP）+ 过期时间（4字节，网络字节序，Unix时间秒）+ 签名（15字节），
+// 签名为 HMAC-SHA256(密钥, 标志 + 过期时间 + 用户名) 的前15字节，密钥只保存在服务端，客户端不能伪造或修改令牌
+class SessionToken {
+ public:
+  // 读取配置文件后调用，key 为配置文件中的 tokenKey，发布的配置文件中为空，运维需要为每个部署生成自己的随机密钥
+  // （至少 kMinKeyLen 字节，如 openssl rand -hex 32）：多台服务器配置相同的密钥时令牌可以通用，重启后令牌仍然有效；
+  // 为空、过短或是曾经发布的示例密钥时使用随机密钥并输出日志，服务器重启后之前的令牌失效，客户端收到 NOT_VERIFY 后改用密码认证
+  static void setKey(const std::string &key);
+  // 为通过认证的用户签发令牌，写入 token，没有设置密钥时返回false
+  static bool issue(const UserInfo &info, char *token);
+  // 校验用户 user 的令牌，通过时在 info 中填写用户名和VIP标志（签发时的状态）
+  static bool verify(const std::string &user, const char *token, UserInfo &info);
+
+ private:
+  static void sign(const std::string &user, const unsigned char *fields, unsigned char *mac);
+
+ private:
+  static const size_t kFieldsLen;   // 标志和过期时间的长度
+  static const size_t kMinKeyLen;   // 配置的密钥的最短长度
+  static const char *const kPublishedKey;   // 曾经发布的示例密钥
+  static std::string key_;
+};
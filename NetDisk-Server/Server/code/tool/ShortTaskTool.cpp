@@ -1,4 +1,6 @@
 #include "ShortTaskTool.h"
+#include "SessionToken.h"
+#include "BlobStore.h"
 #include "Log.h"
 #include <vector>
 
@@ -14,6 +16,7 @@ int LoginTool::doingTask() {
   PDURespond respond;
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  replyTo(pdu_.header, respond.header);
   respond.code = Code::SIGNIN;
   UserInfo info;
   MyDB db;
@@ -34,6 +37,13 @@ int LoginTool::doingTask() {
     respond.msg.append(info.used_capacity, USERSCOLMAXSIZE);
     respond.msg.append(info.salt, USERSCOLMAXSIZE);
     respond.msg.append(info.vip_date, USERSCOLMAXSIZE);
+    // 附带会话令牌，之后的上传/下载请求用令牌认证，不再查询数据库
+    char token[SESSION_TOKEN_LEN];
+    if (SessionToken::issue(info, token)) {
+      respond.msg.append(token, SESSION_TOKEN_LEN);
+      respond.msg_len += SESSION_TOKEN_LEN;
+      respond.header.body_len += SESSION_TOKEN_LEN;
+    }
 
     conn->init(info);      //保存客户信息
     conn->setVerify(true); //设置客户端已经通过认证
@@ -44,8 +54,8 @@ int LoginTool::doingTask() {
 
   // 发送回复
   {
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendPDURespond(conn->getSSL(), respond); //发送回客户端
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, respond); //发送回客户端
   }
 
   if(respond.status == Status::SUCCESS) {  // 登录成功
@@ -69,6 +79,7 @@ int SignTool::doingTask() {
   PDURespond respond;   // 回复体
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  replyTo(pdu_.header, respond.header);
   respond.code = Code::SIGNUP;
   UserInfo info;        // 客户信息
   MyDB db;              // 数据库连接
@@ -97,6 +108,13 @@ int SignTool::doingTask() {
       respond.msg.append(info.used_capacity, USERSCOLMAXSIZE);
       respond.msg.append(info.salt, USERSCOLMAXSIZE);
       respond.msg.append(info.vip_date, USERSCOLMAXSIZE);
+      // 附带会话令牌，之后的上传/下载请求用令牌认证，不再查询数据库
+      char token[SESSION_TOKEN_LEN];
+      if (SessionToken::issue(info, token)) {
+        respond.msg.append(token, SESSION_TOKEN_LEN);
+        respond.msg_len += SESSION_TOKEN_LEN;
+        respond.header.body_len += SESSION_TOKEN_LEN;
+      }
 
       conn->init(info);          //用客户信息保存在连接类中
       conn->setVerify(true);     //标志为已经通过认证客户端
@@ -111,8 +129,8 @@ int SignTool::doingTask() {
 
   // 发送回复
   {
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendPDURespond(conn->getSSL(), respond);
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, respond);
   }
   if(respond.status == Status::SUCCESS) {
     LOG_INFO("User:%s Sgin", pdu_.user);
@@ -170,16 +188,16 @@ int CdTool::doingTask() {
   PDURespond respond;
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  replyTo(pdu_.header, respond.header);   // 文件信息也按请求的版本回复
   respond.code = Code::CD;
   respond.msg_amount = 0;
   respond.msg_len = 0;
   ClientCon *conn = dynamic_cast<ClientCon*>(conn_parent_);
-  SSL *ssl = conn->getSSL();
   if(!conn->getIsVerify()) {  // 如果客户端没认证
     respond.status = Status::NOT_VERIFY;  // 返回告诉客户端先进行登陆操作
     {
-      std::lock_guard<std::mutex> lock(conn->getSendMutex());
-      sr_tool_.sendPDURespond(ssl, respond);
+      std::lock_guard<FairMutex> lock(conn->getSendMutex());
+      sr_tool_.sendPDURespond(conn, respond);
     }
     return -1;
   }
@@ -190,14 +208,14 @@ int CdTool::doingTask() {
   if(!sql_res) {  // 失败
     respond.status = Status::FAILED;  // 发送错误回去给客户端
     {
-      std::lock_guard<std::mutex> lock(conn->getSendMutex());
-      sr_tool_.sendPDURespond(ssl, respond);
+      std::lock_guard<FairMutex> lock(conn->getSendMutex());
+      sr_tool_.sendPDURespond(conn, respond);
     }
     return -1;
   }
 
   // 正常发送全部文件信息
-  // !!!!!!!!!!!!!!!!!!!!!! 这里直接发送回复后，另外发送文件信息 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+  // 回复和文件信息带有相同的请求ID，在一次加锁中发送，同一连接上其它请求的回复不会插在中间
   // 将回复体发送回客户端
   uint32_t file_cnt = file_vet.size();
   file_cnt = htonl(file_cnt);
@@ -207,16 +225,11 @@ int CdTool::doingTask() {
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
   respond.msg.append((char*)&file_cnt, sizeof(file_cnt));
 
-  // 发送回复
+  // 发送回复和文件信息
   {
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendPDURespond(ssl, respond);
-  }
-
-  // 发送文件信息
-  {
-    std::lock_guard<std::mutex> lock(conn->getSendMutex());
-    sr_tool_.sendFileInfo(ssl, file_vet);
+    std::lock_guard<FairMutex> lock(conn->getSendMutex());
+    sr_tool_.sendPDURespond(conn, respond);
+    sr_tool_.sendFileInfo(conn, file_vet, respond.header);
   }
   LOG_INFO("client %s cd",conn->getUser().c_str());
   return 0;
@@ -233,15 +246,15 @@ int CreateDirTool::doingTask() {
   PDURespond respond;
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  replyTo(pdu_.header, respond.header);
   respond.code = Code::MAKEDIR;
-  SSL *ssl = conn_->getSSL();
 
   // 如果客户端未认证
   if (!conn_->getIsVerify()) {
     respond.status = Status::NOT_VERIFY;    // 未验证
     {
-      std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-      sr_tool_.sendPDURespond(ssl, respond);
+      std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+      sr_tool_.sendPDURespond(conn_, respond);
     }
     return -1;
   }
@@ -273,8 +286,8 @@ int CreateDirTool::doingTask() {
 
   // 发送响应
   {
-    std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-    sr_tool_.sendPDURespond(ssl, respond);
+    std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+    sr_tool_.sendPDURespond(conn_, respond);
   }
 
   LOG_INFO("client %s created directory: %s", conn_->getUser().c_str(), pdu_.file_name);
@@ -292,6 +305,7 @@ int DeleteTool::doingTask() {
   PDURespond respond;
   respond.header.type = ProtocolType::PDURESPOND_TYPE;
   respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  replyTo(pdu_.header, respond.header);
   respond.code = Code::DELETEFILE;
   SSL *ssl = conn_->getSSL();
 
@@ -305,8 +319,8 @@ int DeleteTool::doingTask() {
   if (!conn_->getIsVerify()) {
     respond.status = Status::NOT_VERIFY;  // 未验证
     {
-      std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-      sr_tool_.sendPDURespond(ssl, respond);
+      std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+      sr_tool_.sendPDURespond(conn_, respond);
     }
     return -1;
   }
@@ -340,8 +354,150 @@ int DeleteTool::doingTask() {
 
   // 发送响应
   {
-    std::lock_guard<std::mutex> lock(conn_->getSendMutex());
-    sr_tool_.sendPDURespond(ssl, respond);
+    std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+    sr_tool_.sendPDURespond(conn_, respond);
+  }
+  return 0;
+}
+
+
+// 批量操作
+BatchOpTool::BatchOpTool(const TranDataPdu &pdu, AbstractCon *conn) : pdu_(pdu), conn_(dynamic_cast<ClientCon*>(conn)) {
+
+}
+
+int BatchOpTool::doingTask() {
+  std::cout << "BatchOpTool: doingTask()" << std::endl;
+  if (conn_ == nullptr) {   // 只能在短任务连接上使用
+    return -1;
+  }
+  PDURespond respond;
+  respond.header.type = ProtocolType::PDURESPOND_TYPE;
+  respond.header.body_len = PDURESPOND_BODY_BASE_LEN;
+  respond.code = pdu_.code;
+  respond.status = Status::FAILED;
+
+  if (!conn_->getIsVerify()) {
+    respond.status = Status::NOT_VERIFY;
+    sendRespond(respond);
+    return -1;
+  }
+
+  MyDB db;
+  std::vector<bool> results;
+  std::vector<uint64_t> new_ids;
+  size_t item_count = 0;
+  bool ok = false;
+  if (pdu_.code == Code::BATCH_DELETE || pdu_.code == Code::BATCH_MOVE) {
+    std::vector<uint64_t> ids;
+    if (parseIds(ids)) {
+      item_count = ids.size();
+      if (pdu_.code == Code::BATCH_DELETE) {
+        std::vector<std::string> released;
+        ok = db.deleteFileBatch(conn_->getUser(), ids, results, released);
+        if (ok) {
+          BlobStore::releaseBatch(db, conn_->getUser(), released);   // 事务提交后统一删除不再被引用的内容
+        }
+      }
+      else {
+        ok = db.moveFileBatch(conn_->getUser(), ids, pdu_.file_offset, results);
+      }
+    }
+  }
+  else if (pdu_.code == Code::BATCH_MAKEDIR) {
+    std::vector<std::string> names;
+    if (parseNames(names)) {
+      item_count = names.size();
+      // 合法的名称在一个事务中插入，ID连续分配
+      std::vector<NewFileInfo> dirs;
+      std::vector<size_t> index;
+      for (size_t i = 0; i < names.size(); ++i) {
+        if (!names[i].empty() && names[i].size() < MAX_FILE_NAME_LEN) {
+          dirs.push_back(NewFileInfo{ names[i], "", 0, "d" });
+          index.push_back(i);
+        }
+      }
+      std::vector<uint64_t> ids;
+      ok = db.insertFileBatch(conn_->getUser(), pdu_.file_offset, dirs, ids);
+      results.assign(names.size(), false);
+      new_ids.assign(names.size(), 0);
+      for (size_t i = 0; ok && i < ids.size(); ++i) {
+        results[index[i]] = true;
+        new_ids[index[i]] = ids[i];
+      }
+    }
+  }
+  if (!ok) {
+    results.assign(item_count, false);
+    new_ids.assign(pdu_.code == Code::BATCH_MAKEDIR ? item_count : 0, 0);
+  }
+
+  // 结果位图，BATCH_MAKEDIR 之后附带新文件夹的ID
+  std::string bitmap((item_count + 7) / 8, '\0');
+  size_t succeeded = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i]) {
+      bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | (1 << (i % 8)));
+      ++succeeded;
+    }
   }
+  respond.status = (ok && succeeded == item_count && item_count > 0) ? Status::SUCCESS : Status::FAILED;
+  respond.msg_amount = item_count;
+  respond.msg = std::move(bitmap);
+  for (uint64_t id : new_ids) {
+    id = htonll(id);
+    respond.msg.append((char*)&id, sizeof(id));
+  }
+  respond.msg_len = respond.msg.size();
+  respond.header.body_len = PDURESPOND_BODY_BASE_LEN + respond.msg_len;
+  sendRespond(respond);
+
+  LOG_INFO("client %s batch op %u: %lu/%lu succeeded", conn_->getUser().c_str(), pdu_.code, succeeded, item_count);
   return 0;
 }
+
+bool BatchOpTool::parseIds(std::vector<uint64_t> &ids) {
+  size_t len = pdu_.data.size();
+  if (len % sizeof(uint64_t) != 0 || len / sizeof(uint64_t) != pdu_.total_chunks || pdu_.total_chunks > MAX_BATCH_OP_ITEMS) {
+    return false;
+  }
+  ids.resize(pdu_.total_chunks);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    memcpy(&ids[i], pdu_.data.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+    ids[i] = ntohll(ids[i]);
+  }
+  return true;
+}
+
+bool BatchOpTool::parseNames(std::vector<std::string> &names) {
+  if (pdu_.total_chunks > MAX_BATCH_OP_ITEMS) {
+    return false;
+  }
+  const std::string &data = pdu_.data;
+  size_t pos = 0;
+  while (pos < data.size()) {
+    uint16_t name_len = 0;
+    if (data.size() - pos < sizeof(name_len) || names.size() >= pdu_.total_chunks) {
+      return false;
+    }
+    memcpy(&name_len, data.data() + pos, sizeof(name_len));
+    name_len = ntohs(name_len);
+    pos += sizeof(name_len);
+    if (data.size() - pos < name_len) {
+      return false;
+    }
+    names.emplace_back(data.data() + pos, name_len);
+    pos += name_len;
+  }
+  return names.size() == pdu_.total_chunks;
+}
+
+// 请求ID放在 chunk_index 中（TranDataPdu 只使用 v1 头部），回复使用 v2 回显该ID
+void BatchOpTool::sendRespond(PDURespond &respond) {
+  if (pdu_.chunk_index != 0) {
+    respond.header.version = PROTOCOL_VERSION_V2;
+    respond.header.request_id = pdu_.chunk_index;
+  }
+  std::lock_guard<FairMutex> lock(conn_->getSendMutex());
+  sr_tool_.sendPDURespond(conn_, respond);
+}
@@ -60,3 +60,19 @@ class DeleteTool:public AbstractTool{
   PDU pdu_{ 0 };
   ClientCon *conn_{ nullptr };
 };
+
+// 批量删除、批量创建文件夹、批量移动（请求和回复的格式见 protocol.h），一个请求的所有条目在一个数据库事务中完成
+class BatchOpTool : public AbstractTool {
+ public:
+  BatchOpTool(const TranDataPdu &pdu, AbstractCon *conn);
+  int doingTask() override;
+
+ private:
+  bool parseIds(std::vector<uint64_t> &ids);          // 解析ID数组，条目数与 total_chunks 不一致返回false
+  bool parseNames(std::vector<std::string> &names);   // 解析名称数组
+  void sendRespond(PDURespond &respond);
+
+ private:
+  TranDataPdu pdu_;
+  ClientCon *conn_{ nullptr };
+};